@@ -27,6 +27,7 @@
 #include "ltc2942.h"
 #include "mode.h"
 #include "ufat.h"
+#include "prof.h"
 
 // Command help
 
@@ -35,9 +36,9 @@ const char help_y[] PROGMEM ="Test sync";
 const char help_demo[] PROGMEM ="Demo mode";
 const char help_c[] PROGMEM ="Clock mode";
 const char help_w[] PROGMEM ="Swap primary and secondary interfaces";
-const char help_i[] PROGMEM ="I<period>,<#tx>: Sets USB IO parameters. IO at (period+1)/1024Hz.\n\t\tUse #tx slots for transmission before reception.";
+const char help_i[] PROGMEM ="I<period>,<#tx>: Sets USB IO parameters. IO at (period+1)/1024Hz.\n\t\tUse #tx slots for transmission before reception, 0 to adapt to the transmit backlog.";
 const char help_r[] PROGMEM ="RN-41 terminal";
-const char help_b[] PROGMEM ="B,<if>: Benchmark IO. if=0 for USB, 1 for BT";
+const char help_b[] PROGMEM ="Benchmark mode";
 const char help_l[] PROGMEM ="L,<en>: en=1 to enable LCD, 0 to disable";
 const char help_t[] PROGMEM ="T[,<hh><mm><ss>] Query or set time";
 const char help_ttest[] PROGMEM ="Time-related tests";
@@ -46,7 +47,7 @@ const char help_quit[] PROGMEM ="Exit current mode";
 const char help_h[] PROGMEM ="Help";
 const char help_a[] PROGMEM ="A,<hex>,<us>: ADC mode. hex: ADC channel bitmask in hex; us: sample period in microseconds";
 const char help_s[] PROGMEM ="S,<us>: test streaming/logging mode; us: sample period in microseconds";
-const char help_f[] PROGMEM ="F,<bin>,<pktctr>,<ts>,<bat>,<label>: bin: 1 for binary, 0 for text; for others: 1 to stream, 0 otherwise";
+const char help_f[] PROGMEM ="F,<bin>,<pktctr>,<ts>,<bat>,<label>: bin: 1 for binary, 0 for text, 2 for compressed binary (motion only); for others: 1 to stream, 0 otherwise";
 const char help_M[] PROGMEM ="M[,<mode>[,<logfile>[,<duration>]]: without parameters lists available modes, otherwise enters the specified mode.\n\t\tOptionally logs to logfile (use -1 not to log) and runs for the specified duration in seconds.";
 const char help_m[] PROGMEM ="MPU test mode";
 const char help_g[] PROGMEM ="G,<mode> enters motion recognition mode. The parameter is the sample rate/channels to acquire. Use G? to find more about modes";
@@ -64,6 +65,7 @@ const char help_battery[] PROGMEM="Short-term battery info";
 const char help_powertest[] PROGMEM="Power tests";
 const char help_callback[] PROGMEM ="Lists timer callbacks";
 const char help_clearbootctr[] PROGMEM ="Clear boot counter";
+const char help_profile[] PROGMEM ="P[,<cmd>] Profiling of the motion pipeline. Without parameter prints the statistics; cmd: 0=disable, 1=clear and enable, 2=send statistics as binary packets";
 //const char help_clear[] PROGMEM ="Lists timer callbacks";
 
 unsigned CurrentAnnotation=0;
@@ -461,15 +463,15 @@ unsigned char CommandParserIO(char *buffer,unsigned char size)
 	int period,txslot;
 	
 	rv = ParseCommaGetInt((char*)buffer,2,&period,&txslot);
-	if(rv || period<0 || txslot<=0)
+	if(rv || period<0 || txslot<0)
 		return 2;
 
 	// Check params, clamp at some reasonable value
 	if(period>999)
 		period=999;
 	
-	if(txslot>256)
-		txslot=256;
+	if(txslot>128)
+		txslot=128;
 		
 	dbg_setioparam(period,txslot);
 		
@@ -556,7 +558,8 @@ unsigned char CommandParserStreamFormat(char *buffer,unsigned char size)
 	//printf("%d %d %d %d %d\n",bin,pktctr,ts,bat,label);
 		
 	
-	bin=bin?1:0;
+	if(bin<0 || bin>2)
+		bin=1;
 	pktctr=pktctr?1:0;
 	ts=ts?1:0;
 	bat=bat?1:0;
@@ -846,6 +849,33 @@ unsigned char CommandParserClearBootCounter(char *buffer,unsigned char size)
 	fprintf_P(file_pri,PSTR("Cleared\n"));
 	return 0;
 }
+unsigned char CommandParserProfile(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int cmd;
+	
+	if(size==0)
+	{
+		prof_print(file_pri);
+		return 0;
+	}
+	rv = ParseCommaGetInt((char*)buffer,1,&cmd);
+	if(rv)
+		return 2;
+	switch(cmd)
+	{
+		case 0:
+		case 1:
+			prof_enable(cmd);
+			break;
+		case 2:
+			prof_printbin(file_pri);
+			break;
+		default:
+			return 2;
+	}
+	return 0;
+}
 void CommandChangeMode(unsigned char newmode)
 {
 	//if(system_mode!=newmode)
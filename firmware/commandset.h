@@ -38,6 +38,7 @@ extern const char help_battery[];
 extern const char help_powertest[];
 extern const char help_callback[];
 extern const char help_clearbootctr[];
+extern const char help_profile[];
 
 extern const COMMANDPARSER CommandParsersDefault[];
 extern const unsigned char CommandParsersDefaultNum;
@@ -74,6 +75,7 @@ unsigned char CommandParserBatteryInfoLong(char *buffer,unsigned char size);
 unsigned char CommandParserBatteryInfo(char *buffer,unsigned char size);
 unsigned char CommandParserCallback(char *buffer,unsigned char size);
 unsigned char CommandParserClearBootCounter(char *buffer,unsigned char size);
+unsigned char CommandParserProfile(char *buffer,unsigned char size);
 
 
 
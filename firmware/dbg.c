@@ -32,6 +32,17 @@
 		~232-279uS @ 394 KHz
 		~511-559 @ 100KHz
 	
+	*Adaptive scheduling*
+	
+	By default the number of tx slots before an inquiry of the receive level is adapted to the tx backlog: one slot 
+	per DBG_MAXPAYLOAD bytes in the tx buffer, up to DBG_TXBEFORERX_MAX. This saturates the interface when streaming
+	and keeps a fast response to received data otherwise.
+	
+	When a cycle neither transmits nor receives anything, the callback skips an increasing number of invocations
+	(1, 3, 7, ... up to DBG_IDLE_MAXSKIP) before the next inquiry, which reduces the I2C traffic when idle and leaves 
+	the bus to the other peripherals. Data placed in the tx buffer immediately ends the backoff.
+	
+	A fixed ratio can be set with dbg_setnumtxbeforerx; 0 returns to adaptive scheduling.
 	
 */
 
@@ -55,6 +66,10 @@ unsigned char _dbg_numtxbeforerx=5;			// 5: 13743 bytes/sec @1024Hz	6880 bytes/s
 //unsigned char _dbg_numtxbeforerx=1;		// 1: 8254 bytes/sec @1024Hz	4127 bytes/sec @512Hz
 //unsigned char _dbg_numtxbeforerx=10;	// 10: 14894 bytes/sec @1024Hz	7447 bytes/sec @512Hz
 unsigned char _dbg_newnumtxbeforerx=0;
+unsigned char _dbg_adaptive=1;						// Adapt _dbg_numtxbeforerx to the tx backlog and back off when idle
+volatile unsigned char _dbg_cycletx=0;				// Number of tx transactions in the current cycle
+volatile unsigned char _dbg_idleskip=0;				// Number of callbacks to skip after an idle cycle
+volatile unsigned char _dbg_idleskipctr=0;			// Callbacks remaining to skip
 
 volatile unsigned char _dbg_flag_unregister=0;	// Set to 1 for the callback to self-unregister at the end of the state machine cycle
 
@@ -88,6 +103,7 @@ void dbg_init(void)
 	
 	dbg_general_state=0;
 	dbg_general_busy=0;
+	_dbg_idleskip=_dbg_idleskipctr=0;
 	
 	dbg_clearbuffers();
 	
@@ -120,12 +136,25 @@ void dbg_clearbuffers(void)
 	buffer_clear(&_dbg_tx_state);
 	buffer_clear(&_dbg_rx_state);
 }
+/******************************************************************************
+	function: dbg_setnumtxbeforerx
+*******************************************************************************	
+	Sets the number of tx slots before an inquiry of the receive level.
+	
+	Parameters:
+		c	-	Number of tx slots (clamped to 128), or 0 for adaptive scheduling
+******************************************************************************/
 void dbg_setnumtxbeforerx(unsigned char c)
 {
-	if(c<1)
-		c=1;
+	if(c==0)
+	{
+		_dbg_adaptive=1;
+		return;
+	}
 	if(c>128)
 		c=128;
+	_dbg_adaptive=0;
+	_dbg_idleskip=_dbg_idleskipctr=0;
 	_dbg_newnumtxbeforerx=c;
 }
 int dbg_fputchar(char c, FILE*stream)
@@ -191,14 +220,9 @@ CIRCULARBUFFER *dbg_get_txbuf(void)
 ******************************************************************************/
 unsigned char dbg_putbuf(char *data,unsigned char n)
 {
-	//if(buffer_level(&_dbg_tx_state)<n)
 	// If not connected: don't fill buffer
-	if(system_isusbconnected() && buffer_level(&_dbg_tx_state)<n)
-	{
-		for(unsigned char i=0;i<n;i++)
-			buffer_put(&_dbg_tx_state,data[i]);
+	if(system_isusbconnected() && buffer_write(&_dbg_tx_state,data,n)==0)
 		return 0;
-	}
 	return 1;
 }
 
@@ -277,6 +301,17 @@ unsigned char dbg_callback(unsigned char p)
 		return 0;
 	}
 	
+	// Idle backoff: skip callbacks unless there is data to send
+	if(_dbg_idleskipctr)
+	{
+		if(buffer_level(&_dbg_tx_state)==0)
+		{
+			_dbg_idleskipctr--;
+			return 0;
+		}
+		_dbg_idleskip=_dbg_idleskipctr=0;
+	}
+	
 	//system_led_toggle(0b10);
 	//fprintf(file_bt,"s %d\n",dbg_general_state);
 	
@@ -284,13 +319,27 @@ unsigned char dbg_callback(unsigned char p)
 	if(dbg_general_state<_dbg_numtxbeforerx)
 	{
 		
+		lvl = buffer_level(&_dbg_tx_state);
 		// Update the number of tx before rx, in case this changed
-		if(dbg_general_state==0 && _dbg_newnumtxbeforerx!=0)
+		if(dbg_general_state==0)
 		{
-			_dbg_numtxbeforerx=_dbg_newnumtxbeforerx;
-			_dbg_newnumtxbeforerx=0;
+			_dbg_cycletx=0;
+			if(_dbg_adaptive)
+			{
+				// One slot per full payload in the tx buffer
+				r=(lvl+DBG_MAXPAYLOAD-1)/DBG_MAXPAYLOAD;
+				if(r<1)
+					r=1;
+				if(r>DBG_TXBEFORERX_MAX)
+					r=DBG_TXBEFORERX_MAX;
+				_dbg_numtxbeforerx=r;
+			}
+			else if(_dbg_newnumtxbeforerx!=0)
+			{
+				_dbg_numtxbeforerx=_dbg_newnumtxbeforerx;
+				_dbg_newnumtxbeforerx=0;
+			}
 		}
-		lvl = buffer_level(&_dbg_tx_state);
 		/*b[0]='l';b[1]='v';b[2]='l';b[3]=hex2chr(lvl>>4);b[4]=hex2chr(lvl&0xf);b[5]='\n';
 		uart1_fputbuf_int(b,6);*/
 		if(lvl==0)
@@ -313,9 +362,7 @@ unsigned char dbg_callback(unsigned char p)
 			lvl=DBG_MAXPAYLOAD;	
 				
 		// Setup write transaction
-		_dbg_trans_tx.dodata = lvl;
-		for(unsigned char i=0;i<lvl;i++)
-			_dbg_trans_tx.data[i]=buffer_get(&_dbg_tx_state);	
+		_dbg_trans_tx.dodata = buffer_read(&_dbg_tx_state,_dbg_trans_tx.data,lvl);
 		//uart1_fputbuf_int("strttrns\n",9);
 		r = i2c_transaction_queue(1,0,&_dbg_trans_tx);
 		if(r)
@@ -325,6 +372,7 @@ unsigned char dbg_callback(unsigned char p)
 		}	
 		//uart1_fputbuf_int("strttrns suc\n",13);
 		dbg_tot_tx+=lvl;
+		_dbg_cycletx++;
 		dbg_general_busy=1;
 		return 0;
 	}
@@ -486,6 +534,7 @@ unsigned char _dbg_query_callback2(I2C_TRANSACTION *t)
 		dbg_general_busy=0;
 		if(dbg_rxlevel!=0)
 		{
+			_dbg_idleskip=0;
 			//system_led_set(1);
 			dbg_general_state++;		
 			//char b[32];
@@ -497,6 +546,19 @@ unsigned char _dbg_query_callback2(I2C_TRANSACTION *t)
 		{
 			//system_led_set(0);
 			dbg_general_state=0;
+			// Idle cycle: double the number of callbacks skipped before the next cycle
+			if(_dbg_adaptive)
+			{
+				if(_dbg_cycletx==0)
+				{
+					_dbg_idleskip=(_dbg_idleskip<<1)|1;
+					if(_dbg_idleskip>DBG_IDLE_MAXSKIP)
+						_dbg_idleskip=DBG_IDLE_MAXSKIP;
+				}
+				else
+					_dbg_idleskip=0;
+				_dbg_idleskipctr=_dbg_idleskip;
+			}
 		}
 		#ifdef DBG_BENCH
 			_dbg_query_callback2_time=timer_us_get();
@@ -527,14 +589,16 @@ unsigned char _dbg_read_callback(I2C_TRANSACTION *t)
 	// Copy data in receive buffer
 	if(t->status==0)
 	{
-		for(unsigned char i=0;i<t->dodata;i++)
+		// The general callback is avoiding issuing a read transaction larger than the space available in the rx buffer, hence no needs to test for isfull here.
+		if(dbg_rx_callback==0)
+			buffer_write(&_dbg_rx_state,t->data,t->dodata);
+		else
 		{
-			// The general callback is avoiding issuing a read transaction larger than the space available in the rx buffer, hence no needs to test for isfull here.
-			//if(!buffer_isfull(&_dbg_rx_state))
-			//{
-				if(dbg_rx_callback==0 || (*dbg_rx_callback)(t->data[i])==1)
+			for(unsigned char i=0;i<t->dodata;i++)
+			{
+				if((*dbg_rx_callback)(t->data[i])==1)
 					buffer_put(&_dbg_rx_state,t->data[i]);
-			//}
+			}
 		}
 		dbg_general_busy=0;
 		// Check RX level
@@ -10,6 +10,10 @@
 //#define DBG_BUFFER_SIZE 1024
 #define DBG_ADDRESS 0x22
 #define DBG_MAXPAYLOAD 16
+// Adaptive scheduling (dbg_setnumtxbeforerx(0)): maximum number of tx slots before an inquiry when the tx buffer is full
+#define DBG_TXBEFORERX_MAX 15
+// Adaptive scheduling: maximum number of callbacks skipped between inquiries when idle (i.e. ~64ms at 500Hz)
+#define DBG_IDLE_MAXSKIP 31
 
 extern volatile unsigned long dbg_tot_tx,dbg_tot_rx;
 
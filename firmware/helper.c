@@ -519,7 +519,7 @@ unsigned char ParseComma(const char *str,unsigned char n,...)
 	va_start(args,n);
 	for(unsigned char i=0;i<n;i++)
 	{
-		char *p = strchr(str,',');
+		char *p = strchr((char*)str,',');
 		*p=0;
 		// Not found -> return
 		if(!p)
@@ -559,7 +559,7 @@ unsigned char ParseComma(const char *str,unsigned char n,...)
 	while(1)
 	{
 		// Search for a delimieter
-		char *p = strchr(str,',');
+		char *p = strchr((char*)str,',');
 		
 		if(!p)
 			return numtoken;
@@ -601,7 +601,7 @@ unsigned char ParseCommaGetInt(const char *str,int n,...)
 	va_start(args,n);
 	for(unsigned char i=0;i<n;i++)
 	{
-		char *p = strchr(str,',');
+		char *p = strchr((char*)str,',');
 		
 		// Comma not found -> return
 		if(!p)
@@ -664,7 +664,7 @@ unsigned char ParseCommaGetLong(const char *str,int n,...)
 	va_start(args,n);
 	for(unsigned char i=0;i<n;i++)
 	{
-		char *p = strchr(str,',');
+		char *p = strchr((char*)str,',');
 		// Not found -> return
 		if(!p)
 			return 1;
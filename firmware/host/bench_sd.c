@@ -0,0 +1,165 @@
+/*
+	file: bench_sd
+
+	Benchmarks of the storage stack on the simulated card, in simulated time:
+
+	* sd_streamcache_write: throughput and latency distribution of the writes of records with caching.
+	* ufat_log_test: throughput and record latency of logging on a uFAT formatted card.
+
+	The benchmarks fail (exit code 1) if the card reports protocol or write errors, if the data read back
+	differs from the data written, or if the worst-case latency exceeds the limit given with -l. This allows
+	catching performance regressions of the logging path before flashing.
+
+	Usage: bench_sd [options] <image>
+
+	-c <sectors>	Capacity of the card (default 2097152, i.e. 1GB)
+	-n <bytes>		Amount of data to write (default 4MB)
+	-r <bytes>		Size of the records of the sd_streamcache_write benchmark (default 32)
+	-w <us>			Busy time after a block write on an erased sector
+	-d <us>			Busy time after a block write on a sector which is not erased
+	-s <n>			Stall of the card every n blocks (0: no stall)
+	-S <us>			Duration of a stall
+	-l <us>			Maximum worst-case latency of a record write
+	-t				Prints the commands received by the card
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sd.h"
+#include "ufat.h"
+#include "test_sd.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+/******************************************************************************
+	function: bench_streamcache
+*******************************************************************************
+	Writes size bytes in records of recsize bytes with sd_streamcache_write
+	from sector startsect, then checks the data written to the card.
+
+	Returns:
+		Worst-case latency of a record write (us)
+******************************************************************************/
+unsigned long bench_streamcache(unsigned long startsect,unsigned long size,unsigned short recsize)
+{
+	char rec[256];
+	char sect[512];
+	SDLATENCY lat;
+	unsigned long t1,tus,n,err;
+	unsigned long long t0;
+
+	printf("sd_streamcache_write: %lu bytes in records of %u bytes from sector %lu\n",size,recsize,startsect);
+	sd_streamcache_clearstat();
+	sd_lat_clear(&lat);
+	hostsd_clearstat();
+	t0=host_time_ns;
+	t1=timer_ms_get();
+	sd_stream_open(startsect,0);
+	err=0;
+	for(n=0;n<size;n+=recsize)
+	{
+		for(unsigned short i=0;i<recsize;i++)
+			rec[i]=host_pattern(n+i);
+		tus=timer_us_get();
+		if(sd_streamcache_write(rec,recsize,0))
+			err++;
+		sd_lat_insert(&lat,timer_us_get()-tus);
+	}
+	if(sd_streamcache_close(0))
+		err++;
+	t1=timer_ms_get()-t1;
+	printf("Written %lu bytes in %lu ms (simulated): %lu KB/s. Write errors: %lu\n",n,t1,t1?n/t1*1000/1024:0,err);
+	sd_streamcache_printstat(file_pri);
+	printf("Record write latency:\n");
+	sd_lat_print(file_pri,&lat);
+	hostsd_printstat(file_pri);
+	HOST_CHECK(err==0);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+	HOST_CHECK(hostsd_stat.write_errors==0);
+	HOST_CHECK(host_time_ns>t0);
+
+	// Check the data written
+	for(unsigned long i=0;i<n;i++)
+	{
+		if((i&511)==0 && hostsd_readsector(startsect+i/512,sect))
+			break;
+		if(sect[i&511]!=host_pattern(i))
+		{
+			printf("Data differs at byte %lu\n",i);
+			HOST_CHECK(0);
+			break;
+		}
+	}
+	return lat.max;
+}
+/******************************************************************************
+	function: bench_ufat
+*******************************************************************************
+	Formats the card with uFAT and runs ufat_log_test on the first log (sd_bench_log).
+******************************************************************************/
+void bench_ufat(unsigned long size)
+{
+	hostsd_clearstat();
+	HOST_CHECK(ufat_format(4,64)==0);
+	HOST_CHECK(ufat_init()==0);
+	hostsd_clearstat();
+	sd_bench_log(0,size,size/4);
+	hostsd_printstat(file_pri);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+	HOST_CHECK(hostsd_stat.write_errors==0);
+	HOST_CHECK(ufat_log_getlogsize(0)>=size);
+}
+
+int main(int argc,char **argv)
+{
+	unsigned long capacity=2097152;
+	unsigned long size=4*1024*1024;
+	unsigned long maxlat=0,lat;
+	unsigned short recsize=32;
+	unsigned long sdcapacity;
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	int c;
+
+	host_init();
+	while((c=getopt(argc,argv,"c:n:r:w:d:s:S:l:t"))!=-1)
+	{
+		switch(c)
+		{
+			case 'c': capacity=strtoul(optarg,0,0); break;
+			case 'n': size=strtoul(optarg,0,0); break;
+			case 'r': recsize=strtoul(optarg,0,0); break;
+			case 'w': hostsd_param.write_busy_us=strtoul(optarg,0,0); break;
+			case 'd': hostsd_param.write_busy_dirty_us=strtoul(optarg,0,0); break;
+			case 's': hostsd_param.write_stall_every=strtoul(optarg,0,0); break;
+			case 'S': hostsd_param.write_stall_us=strtoul(optarg,0,0); break;
+			case 'l': maxlat=strtoul(optarg,0,0); break;
+			case 't': hostsd_param.trace=1; break;
+			default:
+				printf("Usage: %s [-c sectors] [-n bytes] [-r recsize] [-w us] [-d us] [-s n] [-S us] [-l us] [-t] <image>\n",argv[0]);
+				return 1;
+		}
+	}
+	if(optind>=argc || recsize==0 || recsize>256)
+	{
+		printf("Usage: %s [-c sectors] [-n bytes] [-r recsize] [-w us] [-d us] [-s n] [-S us] [-l us] [-t] <image>\n",argv[0]);
+		return 1;
+	}
+	if(host_sdinit(argv[optind],capacity))
+		return 1;
+
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&sdcapacity)==0);
+	HOST_CHECK(sdcapacity==capacity);
+	lat=bench_streamcache(capacity/2,size,recsize);
+	if(maxlat && lat>maxlat)
+	{
+		printf("Worst-case latency %lu us exceeds %lu us\n",lat,maxlat);
+		HOST_CHECK(0);
+	}
+	bench_ufat(size);
+
+	hostsd_close();
+	return host_result("bench_sd");
+}
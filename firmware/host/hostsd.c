@@ -0,0 +1,637 @@
+/*
+	file: hostsd
+
+	Simulated SD card for the host build, backed by an image file.
+
+	The card is driven byte by byte from the SPI data register (SPDR) and implements the subset of the SPI
+	mode protocol used by sd and sd_int: initialisation (CMD0, CMD8, CMD55/ACMD41, CMD58), CSD/CID/SD status,
+	single and multiple block reads and writes, pre-erase (ACMD23) and erase (CMD32/CMD33/CMD38).
+
+	The card follows a timing model (HOSTSD_PARAM) in simulated time: each SPI byte takes byte_ns, the card is
+	busy after block writes, stop tokens and erases, and the data of reads is available after read_latency_us.
+	Writes to sectors which are not erased are slower than writes to erased sectors, so that pre-erase and
+	erase-ahead show in the benchmarks. Bytes which do not follow the protocol (e.g. a data token while the
+	card is busy) are counted in protocol_errors, which the host tests check.
+
+	Erased sectors read as 0x00. The erased state of each sector is kept in a bitmap; the image is a sparse
+	file so that large cards do not use disk space.
+
+	* hostsd_defaultparam:		Timing model of a typical SDHC card.
+	* hostsd_open:				Opens or creates the image of the card.
+	* hostsd_close:				Closes the image.
+	* hostsd_spi:				Exchanges one byte with the card.
+	* hostsd_select:			Chip select of the card.
+	* hostsd_readsector:		Reads a sector of the image, e.g. to check the content written by the firmware.
+	* hostsd_writesector:		Writes a sector of the image, e.g. to prepare a test.
+	* hostsd_printstat:			Prints the statistics of the card.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "hostsd.h"
+#include "hostshim.h"
+
+HOSTSD_PARAM hostsd_param;
+HOSTSD_STAT hostsd_stat;
+
+// Card state
+#define HOSTSD_IDLE			0				// Waiting for a command
+#define HOSTSD_CMD			1				// Receiving a command
+#define HOSTSD_WRTOKEN		2				// Single block write: waiting for the start block token
+#define HOSTSD_MWRTOKEN		3				// Multiblock write: waiting for a start block or stop token
+#define HOSTSD_WRDATA		4				// Receiving the data and CRC of a block
+#define HOSTSD_READ			5				// Single block read
+#define HOSTSD_MREAD		6				// Multiblock read
+
+static int _hostsd_fd=-1;
+static unsigned long _hostsd_capacity;
+static unsigned char *_hostsd_erased;		// Bitmap of the erased sectors
+static unsigned char _hostsd_selected;
+static unsigned char _hostsd_state;
+static unsigned char _hostsd_multi;			// The block being received belongs to a multiblock write
+static unsigned char _hostsd_app;			// The next command is an application command
+static unsigned char _hostsd_idle;			// Card in idle state (not initialised)
+static unsigned long _hostsd_acmd41;
+static unsigned char _hostsd_cmd[6];
+static unsigned char _hostsd_cmdn;
+static unsigned char _hostsd_cmdstate;		// State to return to if a command is received during a read
+static unsigned long _hostsd_addr;			// Address of the current read or write
+static unsigned long _hostsd_erase1,_hostsd_erase2;
+static unsigned long long _hostsd_busyuntil;	// The card is busy until this time (ns)
+static unsigned long long _hostsd_readyat;	// Read data available at this time (ns)
+static unsigned char _hostsd_data[514];
+static unsigned short _hostsd_datan;
+// Bytes answered to the next exchanges
+static unsigned char _hostsd_out[600];
+static unsigned short _hostsd_outn,_hostsd_outrd;
+
+/******************************************************************************
+	function: hostsd_defaultparam
+*******************************************************************************
+	Timing model of a typical SDHC card on the SPI bus clocked at F_CPU/2.
+******************************************************************************/
+void hostsd_defaultparam(HOSTSD_PARAM *p)
+{
+	p->byte_ns=1450;						// 8 bits at 5.5MHz
+	p->cmd_ncr=1;
+	p->read_latency_us=300;
+	p->write_busy_us=250;
+	p->write_busy_dirty_us=900;
+	p->write_stall_every=512;
+	p->write_stall_us=40000;
+	p->stop_busy_us=500;
+	p->read_stop_busy_us=50;
+	p->erase_busy_us=20000;
+	p->erase_busy_per_mb_us=2000;
+	p->init_acmd41=2;
+	p->trace=0;
+}
+/******************************************************************************
+	function: hostsd_open
+*******************************************************************************
+	Opens the image of the card, creating it if needed, and resets the card.
+	All sectors are initially considered as not erased.
+
+	Parameters:
+		image		-	File name of the image
+		capacity	-	Capacity of the card in sectors; must be a multiple of 1024
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char hostsd_open(const char *image,unsigned long capacity)
+{
+	hostsd_close();
+	if(capacity==0 || capacity%1024)
+		return 1;
+	_hostsd_fd=open(image,O_RDWR|O_CREAT,0644);
+	if(_hostsd_fd<0)
+		return 1;
+	if(ftruncate(_hostsd_fd,(off_t)capacity*512))
+	{
+		hostsd_close();
+		return 1;
+	}
+	_hostsd_capacity=capacity;
+	_hostsd_erased=(unsigned char*)calloc(capacity/8,1);
+	_hostsd_selected=0;
+	_hostsd_state=HOSTSD_IDLE;
+	_hostsd_app=0;
+	_hostsd_idle=1;
+	_hostsd_acmd41=0;
+	_hostsd_busyuntil=0;
+	_hostsd_outn=_hostsd_outrd=0;
+	hostsd_clearstat();
+	return 0;
+}
+/******************************************************************************
+	function: hostsd_close
+*******************************************************************************
+	Closes the image of the card.
+******************************************************************************/
+void hostsd_close(void)
+{
+	if(_hostsd_fd>=0)
+		close(_hostsd_fd);
+	_hostsd_fd=-1;
+	free(_hostsd_erased);
+	_hostsd_erased=0;
+}
+/******************************************************************************
+	function: hostsd_clearstat
+*******************************************************************************
+	Clears the statistics of the card.
+******************************************************************************/
+void hostsd_clearstat(void)
+{
+	memset(&hostsd_stat,0,sizeof(hostsd_stat));
+}
+/******************************************************************************
+	function: hostsd_printstat
+*******************************************************************************
+	Prints the statistics of the card.
+******************************************************************************/
+void hostsd_printstat(FILE *f)
+{
+	fprintf(f,"Card: %llu SPI bytes, %lu commands, %lu blocks written (%lu multiblock writes), %lu blocks read\n",hostsd_stat.bytes,hostsd_stat.commands,hostsd_stat.blocks_written,hostsd_stat.multiblock_writes,hostsd_stat.blocks_read);
+	fprintf(f,"Card: %lu erases, %llu sectors erased. Busy: %llu ms, longest %llu us\n",hostsd_stat.erases,hostsd_stat.sectors_erased,hostsd_stat.busy_ns/1000000,hostsd_stat.maxbusy_ns/1000);
+	fprintf(f,"Card: %lu protocol errors, %lu write errors\n",hostsd_stat.protocol_errors,hostsd_stat.write_errors);
+}
+/******************************************************************************
+	function: hostsd_readsector
+*******************************************************************************
+	Reads a sector of the image.
+
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char hostsd_readsector(unsigned long sector,char *buffer)
+{
+	if(_hostsd_fd<0 || sector>=_hostsd_capacity)
+		return 1;
+	if(hostsd_iserased(sector))
+	{
+		memset(buffer,0,512);
+		return 0;
+	}
+	if(pread(_hostsd_fd,buffer,512,(off_t)sector*512)!=512)
+		return 1;
+	return 0;
+}
+/******************************************************************************
+	function: hostsd_writesector
+*******************************************************************************
+	Writes a sector of the image.
+
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char hostsd_writesector(unsigned long sector,const char *buffer)
+{
+	if(_hostsd_fd<0 || sector>=_hostsd_capacity)
+		return 1;
+	if(pwrite(_hostsd_fd,buffer,512,(off_t)sector*512)!=512)
+		return 1;
+	_hostsd_erased[sector>>3]&=~(1<<(sector&7));
+	return 0;
+}
+/******************************************************************************
+	function: hostsd_iserased
+*******************************************************************************
+	Returns:
+		1			-	The sector is erased
+		0			-	The sector is written or not erased
+******************************************************************************/
+unsigned char hostsd_iserased(unsigned long sector)
+{
+	if(sector>=_hostsd_capacity)
+		return 0;
+	return (_hostsd_erased[sector>>3]>>(sector&7))&1;
+}
+/******************************************************************************
+	function: _hostsd_erase
+*******************************************************************************
+	Erases the sectors from s1 to s2: the sectors are marked as erased in the
+	bitmap, and read as 0x00 until written. The space of the sectors is
+	deallocated from the sparse image when the file system of the host allows it;
+	otherwise the image keeps the old data, which is not read while the card is open.
+******************************************************************************/
+static void _hostsd_erase(unsigned long s1,unsigned long s2)
+{
+	#ifdef FALLOC_FL_PUNCH_HOLE
+	fallocate(_hostsd_fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,(off_t)s1*512,(off_t)(s2-s1+1)*512);
+	#endif
+	for(unsigned long s=s1;s<=s2;s++)
+		_hostsd_erased[s>>3]|=1<<(s&7);
+}
+/******************************************************************************
+	function: _hostsd_busy
+*******************************************************************************
+	Makes the card busy for us microseconds from now.
+******************************************************************************/
+static void _hostsd_busy(unsigned long long us)
+{
+	unsigned long long ns=us*1000;
+
+	_hostsd_busyuntil=host_time_ns+ns;
+	hostsd_stat.busy_ns+=ns;
+	if(ns>hostsd_stat.maxbusy_ns)
+		hostsd_stat.maxbusy_ns=ns;
+}
+/******************************************************************************
+	function: _hostsd_put
+*******************************************************************************
+	Queues n bytes answered to the next exchanges.
+******************************************************************************/
+static void _hostsd_put(const unsigned char *b,unsigned short n)
+{
+	memcpy(_hostsd_out+_hostsd_outn,b,n);
+	_hostsd_outn+=n;
+}
+static void _hostsd_putc(unsigned char c)
+{
+	_hostsd_out[_hostsd_outn++]=c;
+}
+/******************************************************************************
+	function: _hostsd_putr1
+*******************************************************************************
+	Queues the answer delay (Ncr) and the R1 answer.
+******************************************************************************/
+static void _hostsd_putr1(unsigned char r1)
+{
+	_hostsd_outn=_hostsd_outrd=0;
+	for(unsigned long i=0;i<hostsd_param.cmd_ncr;i++)
+		_hostsd_putc(0xFF);
+	_hostsd_putc(r1|(_hostsd_idle?0x01:0x00));
+}
+/******************************************************************************
+	function: _hostsd_putblock
+*******************************************************************************
+	Queues a data block: start block token, data and CRC-16 (polynomial 0x1021,
+	initial value 0, most significant byte first), as the card sends them.
+******************************************************************************/
+static void _hostsd_putblock(const unsigned char *b,unsigned short n)
+{
+	unsigned short crc=host_crc16(b,n);
+
+	_hostsd_putc(0xFE);
+	_hostsd_put(b,n);
+	_hostsd_putc(crc>>8);
+	_hostsd_putc(crc);
+}
+/******************************************************************************
+	function: _hostsd_readblock
+*******************************************************************************
+	Queues the sector _hostsd_addr as a data block.
+******************************************************************************/
+static void _hostsd_readblock(void)
+{
+	unsigned char b[512];
+
+	_hostsd_outn=_hostsd_outrd=0;
+	if(hostsd_readsector(_hostsd_addr,(char*)b))
+	{
+		_hostsd_putc(0x08);						// Data error token: out of range
+		_hostsd_state=HOSTSD_IDLE;
+		return;
+	}
+	_hostsd_putblock(b,512);
+	hostsd_stat.blocks_read++;
+	_hostsd_addr++;
+}
+/******************************************************************************
+	function: _hostsd_csd
+*******************************************************************************
+	Builds the CSD of a version 2.0 card (SDHC/SDXC).
+******************************************************************************/
+static void _hostsd_csd(unsigned char *csd)
+{
+	unsigned long csize=_hostsd_capacity/1024-1;
+
+	memset(csd,0,16);
+	csd[0]=0x40;								// CSD_STRUCTURE=1
+	csd[1]=0x0E;								// TAAC
+	csd[3]=0x32;								// TRAN_SPEED: 25MHz
+	csd[4]=0x5B;								// CCC
+	csd[5]=0x59;								// CCC, READ_BL_LEN=9
+	csd[7]=(csize>>16)&0x3F;					// C_SIZE
+	csd[8]=csize>>8;
+	csd[9]=csize;
+	csd[10]=0x7F;								// ERASE_BLK_EN=1, SECTOR_SIZE=0x7F
+	csd[11]=0x80;
+	csd[12]=0x0A;								// R2W_FACTOR=2, WRITE_BL_LEN=9
+	csd[13]=0x40;
+	csd[15]=0x01;
+}
+/******************************************************************************
+	function: _hostsd_command
+*******************************************************************************
+	Executes the command received in _hostsd_cmd.
+******************************************************************************/
+static void _hostsd_command(void)
+{
+	unsigned char cmd=_hostsd_cmd[0]&0x3F;
+	unsigned long arg=((unsigned long)_hostsd_cmd[1]<<24)|((unsigned long)_hostsd_cmd[2]<<16)|((unsigned long)_hostsd_cmd[3]<<8)|_hostsd_cmd[4];
+	unsigned char app=_hostsd_app;
+	unsigned char b[64];
+
+	hostsd_stat.commands++;
+	if(hostsd_param.trace)
+		printf("[%llu us] %sCMD%u %08lX\n",host_time_ns/1000,app?"A":"",cmd,arg);
+	_hostsd_app=0;
+	_hostsd_state=HOSTSD_IDLE;
+
+	if(app)
+	{
+		switch(cmd)
+		{
+			case 13:								// ACMD13: SD status
+				_hostsd_putr1(0x00);
+				_hostsd_putc(0x00);					// Second byte of R2
+				memset(b,0,64);
+				b[8]=0x04;							// SPEED_CLASS: class 10
+				b[10]=0x90;							// AU_SIZE: 4MB
+				b[11]=0x00;b[12]=0x08;				// ERASE_SIZE: 8 AU
+				b[13]=0x28;							// ERASE_TIMEOUT
+				_hostsd_putc(0xFF);
+				_hostsd_putblock(b,64);
+				return;
+			case 23:								// ACMD23: pre-erase
+				_hostsd_putr1(0x00);
+				return;
+			case 41:								// ACMD41: initialisation
+				if(++_hostsd_acmd41>hostsd_param.init_acmd41)
+					_hostsd_idle=0;
+				_hostsd_putr1(0x00);
+				return;
+		}
+	}
+	switch(cmd)
+	{
+		case 0:										// CMD0: reset
+			_hostsd_idle=1;
+			_hostsd_acmd41=0;
+			_hostsd_putr1(0x00);
+			return;
+		case 8:										// CMD8: interface condition
+			_hostsd_putr1(0x00);
+			b[0]=0;b[1]=0;b[2]=_hostsd_cmd[3]&0x0F;b[3]=_hostsd_cmd[4];
+			_hostsd_put(b,4);
+			return;
+		case 9:										// CMD9: CSD
+		case 10:									// CMD10: CID
+			_hostsd_putr1(0x00);
+			if(cmd==9)
+				_hostsd_csd(b);
+			else
+			{
+				memset(b,0,16);
+				b[0]=0x03;
+				memcpy(b+3,"HOST0",5);
+				b[15]=0x01;
+			}
+			_hostsd_putc(0xFF);
+			_hostsd_putblock(b,16);
+			return;
+		case 12:									// CMD12: stop transmission
+			_hostsd_putr1(0x00);
+			_hostsd_busy(hostsd_param.read_stop_busy_us);
+			return;
+		case 13:									// CMD13: status
+			_hostsd_putr1(0x00);
+			_hostsd_putc(0x00);
+			return;
+		case 16:									// CMD16: block length
+		case 59:									// CMD59: CRC on/off
+			_hostsd_putr1(0x00);
+			return;
+		case 17:									// CMD17: read single block
+		case 18:									// CMD18: read multiple block
+			if(arg>=_hostsd_capacity)
+			{
+				_hostsd_putr1(0x40);				// Parameter error
+				return;
+			}
+			_hostsd_putr1(0x00);
+			_hostsd_addr=arg;
+			_hostsd_state=cmd==17?HOSTSD_READ:HOSTSD_MREAD;
+			return;
+		case 24:									// CMD24: write single block
+		case 25:									// CMD25: write multiple block
+			if(arg>=_hostsd_capacity)
+			{
+				_hostsd_putr1(0x40);
+				return;
+			}
+			_hostsd_putr1(0x00);
+			_hostsd_addr=arg;
+			_hostsd_multi=cmd==25;
+			_hostsd_state=_hostsd_multi?HOSTSD_MWRTOKEN:HOSTSD_WRTOKEN;
+			if(_hostsd_multi)
+				hostsd_stat.multiblock_writes++;
+			return;
+		case 32:									// CMD32: erase start
+			_hostsd_erase1=arg;
+			_hostsd_putr1(0x00);
+			return;
+		case 33:									// CMD33: erase end
+			_hostsd_erase2=arg;
+			_hostsd_putr1(0x00);
+			return;
+		case 38:									// CMD38: erase
+			if(_hostsd_erase1>_hostsd_erase2 || _hostsd_erase2>=_hostsd_capacity)
+			{
+				_hostsd_putr1(0x10);				// Erase sequence error
+				return;
+			}
+			_hostsd_putr1(0x00);
+			_hostsd_erase(_hostsd_erase1,_hostsd_erase2);
+			hostsd_stat.erases++;
+			hostsd_stat.sectors_erased+=_hostsd_erase2-_hostsd_erase1+1;
+			_hostsd_busy(hostsd_param.erase_busy_us+(unsigned long long)hostsd_param.erase_busy_per_mb_us*(_hostsd_erase2-_hostsd_erase1+1)/2048);
+			return;
+		case 55:									// CMD55: application command follows
+			_hostsd_app=1;
+			_hostsd_putr1(0x00);
+			return;
+		case 58:									// CMD58: OCR
+			_hostsd_putr1(0x00);
+			b[0]=_hostsd_idle?0x40:0xC0;			// Power up status, CCS
+			b[1]=0xFF;b[2]=0x80;b[3]=0x00;
+			_hostsd_put(b,4);
+			return;
+	}
+	_hostsd_putr1(0x04);							// Illegal command
+}
+/******************************************************************************
+	function: _hostsd_endblock
+*******************************************************************************
+	Writes the block received in _hostsd_data and answers the data response.
+******************************************************************************/
+static void _hostsd_endblock(void)
+{
+	unsigned long us;
+
+	_hostsd_outn=_hostsd_outrd=0;
+	if(_hostsd_addr>=_hostsd_capacity)
+	{
+		hostsd_stat.write_errors++;
+		_hostsd_putc(0x0D);							// Data response: write error
+		_hostsd_state=HOSTSD_IDLE;
+		return;
+	}
+	us=hostsd_iserased(_hostsd_addr)?hostsd_param.write_busy_us:hostsd_param.write_busy_dirty_us;
+	hostsd_writesector(_hostsd_addr,(char*)_hostsd_data);
+	hostsd_stat.blocks_written++;
+	if(hostsd_param.write_stall_every && hostsd_stat.blocks_written%hostsd_param.write_stall_every==0)
+		us+=hostsd_param.write_stall_us;
+	_hostsd_addr++;
+	_hostsd_putc(0x05);								// Data response: accepted
+	_hostsd_busy(us);
+	_hostsd_state=_hostsd_multi?HOSTSD_MWRTOKEN:HOSTSD_IDLE;
+}
+/******************************************************************************
+	function: hostsd_select
+*******************************************************************************
+	Chip select of the card. Deselecting the card discards the pending answer
+	bytes; the card remains busy.
+******************************************************************************/
+void hostsd_select(unsigned char selected)
+{
+	if(!selected)
+		_hostsd_outn=_hostsd_outrd=0;
+	_hostsd_selected=selected;
+}
+/******************************************************************************
+	function: _hostsd_protocolerror
+*******************************************************************************
+	Counts a byte received which does not follow the protocol.
+******************************************************************************/
+static void _hostsd_protocolerror(const char *what)
+{
+	hostsd_stat.protocol_errors++;
+	if(hostsd_param.trace)
+		printf("[%llu us] Protocol error: %s\n",host_time_ns/1000,what);
+}
+/******************************************************************************
+	function: hostsd_spi
+*******************************************************************************
+	Exchanges one byte with the card.
+
+	Parameters:
+		mosi		-	Byte sent to the card
+	Returns:
+		Byte answered by the card
+******************************************************************************/
+unsigned char hostsd_spi(unsigned char mosi)
+{
+	unsigned char miso;
+	unsigned char busy;
+
+	host_time_advance_ns(hostsd_param.byte_ns);
+	hostsd_stat.bytes++;
+	if(!_hostsd_selected || _hostsd_fd<0)
+		return 0xFF;
+
+	busy=host_time_ns<_hostsd_busyuntil;
+
+	// Answer
+	if(_hostsd_outrd<_hostsd_outn)
+	{
+		miso=_hostsd_out[_hostsd_outrd++];
+		if(_hostsd_outrd==_hostsd_outn)
+		{
+			_hostsd_outn=_hostsd_outrd=0;
+			// The next block of a multiblock read is available after the read latency
+			_hostsd_readyat=host_time_ns+(unsigned long long)hostsd_param.read_latency_us*1000;
+		}
+	}
+	else if(busy)
+		miso=0x00;
+	else if((_hostsd_state==HOSTSD_READ || _hostsd_state==HOSTSD_MREAD) && host_time_ns>=_hostsd_readyat)
+	{
+		_hostsd_readblock();
+		if(_hostsd_state==HOSTSD_READ)
+			_hostsd_state=HOSTSD_IDLE;
+		miso=0xFF;
+	}
+	else
+		miso=0xFF;
+
+	// Reception
+	switch(_hostsd_state)
+	{
+		case HOSTSD_IDLE:
+		case HOSTSD_READ:
+		case HOSTSD_MREAD:
+			if((mosi&0xC0)==0x40)
+			{
+				if(busy && _hostsd_state==HOSTSD_IDLE)
+				{
+					_hostsd_protocolerror("command while busy");
+					break;
+				}
+				_hostsd_cmdstate=_hostsd_state;
+				_hostsd_cmd[0]=mosi;
+				_hostsd_cmdn=1;
+				_hostsd_state=HOSTSD_CMD;
+			}
+			break;
+		case HOSTSD_CMD:
+			_hostsd_cmd[_hostsd_cmdn++]=mosi;
+			if(_hostsd_cmdn==6)
+			{
+				if(_hostsd_cmdstate==HOSTSD_MREAD || _hostsd_cmdstate==HOSTSD_READ)
+				{
+					// Only CMD12 is accepted during a read; the byte following the command is a stuff byte
+					if((_hostsd_cmd[0]&0x3F)!=12)
+					{
+						_hostsd_protocolerror("command other than CMD12 during a read");
+						_hostsd_state=_hostsd_cmdstate;
+						break;
+					}
+					_hostsd_command();
+					_hostsd_outn=_hostsd_outrd=0;
+					_hostsd_putc(0xFF);
+					_hostsd_putc(0x00);
+				}
+				else
+					_hostsd_command();
+			}
+			break;
+		case HOSTSD_WRTOKEN:
+		case HOSTSD_MWRTOKEN:
+			if(mosi==0xFF)
+				break;
+			if(busy)
+			{
+				_hostsd_protocolerror("token while busy");
+				break;
+			}
+			if((_hostsd_state==HOSTSD_WRTOKEN && mosi==0xFE) || (_hostsd_state==HOSTSD_MWRTOKEN && mosi==0xFC))
+			{
+				_hostsd_datan=0;
+				_hostsd_state=HOSTSD_WRDATA;
+				break;
+			}
+			if(_hostsd_state==HOSTSD_MWRTOKEN && mosi==0xFD)
+			{
+				// Stop token: busy from the next byte
+				_hostsd_busy(hostsd_param.stop_busy_us);
+				_hostsd_state=HOSTSD_IDLE;
+				break;
+			}
+			_hostsd_protocolerror("invalid token");
+			break;
+		case HOSTSD_WRDATA:
+			_hostsd_data[_hostsd_datan++]=mosi;
+			if(_hostsd_datan==514)
+				_hostsd_endblock();
+			break;
+	}
+	return miso;
+}
@@ -0,0 +1,56 @@
+#ifndef __HOSTSD_H
+#define __HOSTSD_H
+
+/*
+	Timing model of the simulated card. All times are in microseconds of simulated time.
+*/
+typedef struct
+{
+	unsigned long byte_ns;						// Duration of one SPI byte exchange (ns)
+	unsigned long cmd_ncr;						// Number of 0xFF bytes before the answer to a command
+	unsigned long read_latency_us;				// Time from a read command, or from the end of the previous block, to the start block token
+	unsigned long write_busy_us;				// Busy time after writing a block to an erased sector
+	unsigned long write_busy_dirty_us;			// Busy time after writing a block to a sector which is not erased
+	unsigned long write_stall_every;			// Every write_stall_every blocks the card stalls (e.g. internal garbage collection); 0 to disable
+	unsigned long write_stall_us;				// Additional busy time of a stall
+	unsigned long stop_busy_us;					// Busy time after the stop token of a multiblock write
+	unsigned long read_stop_busy_us;			// Busy time after CMD12 terminating a multiblock read
+	unsigned long erase_busy_us;				// Busy time of an erase (CMD38)
+	unsigned long erase_busy_per_mb_us;			// Additional busy time of an erase per MB erased
+	unsigned long init_acmd41;					// Number of ACMD41 answered with idle before the card is initialised
+	unsigned char trace;						// Prints the commands and protocol errors
+} HOSTSD_PARAM;
+
+/*
+	Statistics of the simulated card, cleared by hostsd_open and hostsd_clearstat.
+*/
+typedef struct
+{
+	unsigned long long bytes;					// Bytes exchanged on SPI
+	unsigned long commands;						// Commands received
+	unsigned long blocks_written;				// Blocks written
+	unsigned long blocks_read;					// Blocks read
+	unsigned long erases;						// Erase commands (CMD38)
+	unsigned long long sectors_erased;			// Sectors erased
+	unsigned long multiblock_writes;			// Multiblock writes (CMD25)
+	unsigned long long busy_ns;					// Total busy time of the card (ns)
+	unsigned long long maxbusy_ns;				// Longest busy time of the card (ns)
+	unsigned long protocol_errors;				// Bytes received which do not follow the protocol (e.g. data token while busy)
+	unsigned long write_errors;					// Writes out of the capacity of the card
+} HOSTSD_STAT;
+
+extern HOSTSD_PARAM hostsd_param;
+extern HOSTSD_STAT hostsd_stat;
+
+void hostsd_defaultparam(HOSTSD_PARAM *p);
+unsigned char hostsd_open(const char *image,unsigned long capacity);
+void hostsd_close(void);
+void hostsd_clearstat(void);
+void hostsd_printstat(FILE *f);
+unsigned char hostsd_spi(unsigned char mosi);
+void hostsd_select(unsigned char selected);
+unsigned char hostsd_readsector(unsigned long sector,char *buffer);
+unsigned char hostsd_writesector(unsigned long sector,const char *buffer);
+unsigned char hostsd_iserased(unsigned long sector);
+
+#endif
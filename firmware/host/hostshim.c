@@ -0,0 +1,697 @@
+/*
+	file: hostshim
+
+	Hardware and system interface of the firmware modules compiled on the host.
+
+	* Simulated time: the time advances with the SPI transfers (see hostsd), the delays, and by 1us at each
+	call of the timer functions, which is about the duration of these calls on the AVR. The time spent in the
+	code of the firmware is not accounted: the benchmarks measure the time spent communicating with the card.
+	* SPI: writing SPDR exchanges one byte with the simulated card, PORTB bit 4 is its chip select.
+	* Streams: file_pri and the other interfaces of main write to the standard output; fputbuf and the buffer
+	level functions of serial are implemented for streams with a SERIALPARAM, such as the logs of ufat. The
+	transmit and receive levels are those of the txbuf and rxbuf of the SERIALPARAM, if any.
+	* Interrupts: host_sreg_i is the interrupt flag of the atomic blocks, sei and cli. host_irq_start runs an
+	interrupt routine periodically from a timer signal, interrupting the main code asynchronously; when the
+	interrupt flag is cleared the routine is pending and runs once the flag is set again.
+	* Queues: host_stress_read and host_stress_write pass a stream of elements between the main code and an
+	interrupt routine through a queue (HOSTQUEUE: the operations of the buffer under test with random sizes),
+	and check that the stream arrives complete and in order.
+	* Link: host_link_putbuf writes all or nothing in the transmit buffer host_link_tx, as the interrupt driven
+	interfaces do, and host_link_drain transmits it at the rate of the link in simulated time to a receiver,
+	optionally corrupting bytes. This models a slow link for the streaming and readout tests.
+	* Globals of the modules not compiled on the host (sampling modes, battery), for the modules of the motion
+	mode.
+	* Tests: HOST_CHECK counts the checks and failures, host_result prints them and returns the exit code.
+	host_fletcher16 and host_crc16 are the reference checksums of the packets and of the card, and
+	host_clock_ns the time of the host for the benchmarks of code which does not communicate with the card.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "wait.h"
+#include "spi.h"
+#include "sd.h"
+#include "serial.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+unsigned long long host_time_ns;
+unsigned long host_numtest,host_numfail;
+
+/******************************************************************************
+	Time
+******************************************************************************/
+void host_time_advance_ns(unsigned long long ns)
+{
+	host_time_ns+=ns;
+}
+unsigned long timer_ms_get_c(void)
+{
+	host_time_advance_ns(1000);
+	return host_time_ns/1000000;
+}
+unsigned long timer_us_get_c(void)
+{
+	host_time_advance_ns(1000);
+	return host_time_ns/1000;
+}
+unsigned long timer_s_get_c(void)
+{
+	host_time_advance_ns(1000);
+	return host_time_ns/1000000000;
+}
+
+/******************************************************************************
+	Interrupts
+******************************************************************************/
+volatile unsigned char host_sreg_i=1,host_irq_pending;
+volatile unsigned short host_irq_atomic;
+volatile unsigned long host_irq_num,host_irq_numdeferred,host_irq_numatomic;
+static unsigned long _host_irq_rnd=1;
+static void (* volatile _host_irq)(void);
+
+/******************************************************************************
+	function: host_irq_deliver
+*******************************************************************************
+	Runs the pending interrupt routine; called when the interrupt flag is set.
+******************************************************************************/
+void host_irq_deliver(void)
+{
+	while(host_irq_pending && host_sreg_i)
+	{
+		host_sreg_i=0;
+		host_irq_pending=0;
+		if(_host_irq)
+		{
+			host_irq_num++;
+			_host_irq();
+		}
+		host_sreg_i=1;
+	}
+}
+/******************************************************************************
+	function: host_irq_atomic_raise
+*******************************************************************************
+	Raises the interrupt with a probability of 1/host_irq_atomic; called when an
+	atomic block starts.
+******************************************************************************/
+void host_irq_atomic_raise(void)
+{
+	if(!_host_irq)
+		return;
+	_host_irq_rnd=_host_irq_rnd*1103515245+12345;
+	if((_host_irq_rnd>>16)%host_irq_atomic==0)
+	{
+		host_irq_numatomic++;
+		host_irq_pending=1;
+	}
+}
+static void _host_irq_signal(int sig)
+{
+	host_irq_pending=1;
+	if(!host_sreg_i)
+	{
+		host_irq_numdeferred++;
+		return;
+	}
+	host_irq_deliver();
+}
+/******************************************************************************
+	function: host_irq_start
+*******************************************************************************
+	Runs an interrupt routine every period microseconds of the time of the host,
+	until host_irq_stop, and within the atomic blocks if host_irq_atomic is set.
+	The routine runs with the interrupt flag cleared.
+
+	Parameters:
+		isr			-	Interrupt routine
+		period		-	Period in microseconds; the host may use a longer period
+******************************************************************************/
+void host_irq_start(void (*isr)(void),unsigned long period)
+{
+	struct sigaction sa;
+	struct itimerval it;
+
+	host_irq_num=host_irq_numdeferred=host_irq_numatomic=0;
+	host_irq_pending=0;
+	_host_irq=isr;
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=_host_irq_signal;
+	sa.sa_flags=SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGALRM,&sa,0);
+	it.it_interval.tv_sec=period/1000000;
+	it.it_interval.tv_usec=period%1000000;
+	it.it_value=it.it_interval;
+	setitimer(ITIMER_REAL,&it,0);
+}
+/******************************************************************************
+	function: host_irq_stop
+*******************************************************************************
+	Stops the interrupt routine started by host_irq_start.
+******************************************************************************/
+void host_irq_stop(void)
+{
+	struct itimerval it;
+
+	memset(&it,0,sizeof(it));
+	setitimer(ITIMER_REAL,&it,0);
+	signal(SIGALRM,SIG_IGN);
+	_host_irq=0;
+	host_irq_pending=0;
+	host_irq_atomic=0;
+}
+
+/******************************************************************************
+	Queues
+******************************************************************************/
+static const HOSTQUEUE *_host_stress_q;
+static unsigned long _host_stress_rnd;				// State of the random generator of the routine
+static volatile unsigned long _host_stress_num;		// Elements transferred by the routine
+static volatile unsigned long _host_stress_err;		// Elements out of order
+
+/******************************************************************************
+	function: host_rnd
+*******************************************************************************
+	Random generator (xorshift) with its own state, usable in the interrupt routine.
+******************************************************************************/
+unsigned long host_rnd(unsigned long *s)
+{
+	*s^=*s<<13;
+	*s^=*s>>17;
+	*s^=*s<<5;
+	return *s;
+}
+/******************************************************************************
+	function: host_work
+*******************************************************************************
+	Work of the main code between the accesses to a queue, of up to 1us, so that
+	the interrupts also fall within the accesses rather than only in the waits
+	for elements or for space. One call in 256 pauses up to 500us, so that the
+	queue fills or empties.
+******************************************************************************/
+void host_work(void)
+{
+	unsigned long long t;
+
+	t=host_clock_ns()+(rand()%256?rand()%1000:rand()%500*1000);
+	while(host_clock_ns()<t);
+}
+static void _host_stress_producer(void)
+{
+	_host_stress_num+=_host_stress_q->put(_host_stress_num,&_host_stress_rnd);
+}
+static void _host_stress_consumer(void)
+{
+	unsigned long err=0;
+
+	_host_stress_num+=_host_stress_q->get(_host_stress_num,&_host_stress_rnd,&err);
+	_host_stress_err+=err;
+}
+/******************************************************************************
+	function: host_stress_read
+*******************************************************************************
+	The main code reads the elements which the interrupt routine adds to the
+	queue, for HOST_STRESS_NUMIRQ interrupts, then the remaining elements.
+
+	Parameters:
+		q			-	Queue under test
+		name		-	Name of the queue
+******************************************************************************/
+void host_stress_read(const HOSTQUEUE *q,const char *name)
+{
+	unsigned long r=0,err=0,rnd=3;
+
+	_host_stress_q=q;
+	q->clear();
+	_host_stress_rnd=1;
+	_host_stress_num=0;
+	host_irq_start(_host_stress_producer,HOST_STRESS_PERIOD);
+	host_irq_atomic=HOST_STRESS_ATOMIC;
+	while(host_irq_num<HOST_STRESS_NUMIRQ)
+	{
+		r+=q->get(r,&rnd,&err);
+		host_work();
+	}
+	host_irq_stop();
+	// Remaining elements
+	while(!q->isempty())
+		r+=q->get(r,&rnd,&err);
+	printf("Interrupt producer, %s: %lu elements, %lu interrupts, %lu raised in and %lu deferred by atomic blocks, %lu errors\n",
+		name,r,host_irq_num,host_irq_numatomic,host_irq_numdeferred,err);
+	HOST_CHECK(r==_host_stress_num);
+	HOST_CHECK(err==0);
+	// A queue with atomic blocks defers some interrupts
+	HOST_CHECK(host_irq_numatomic==0 || host_irq_numdeferred>0);
+}
+/******************************************************************************
+	function: host_stress_write
+*******************************************************************************
+	The main code adds the elements which the interrupt routine reads from the
+	queue, waiting for space when it is full, for HOST_STRESS_NUMIRQ interrupts.
+	The routine then reads the remaining elements.
+
+	Parameters:
+		q			-	Queue under test
+		name		-	Name of the queue
+******************************************************************************/
+void host_stress_write(const HOSTQUEUE *q,const char *name)
+{
+	unsigned long w=0,k,numfull=0,rnd=4;
+
+	_host_stress_q=q;
+	q->clear();
+	_host_stress_rnd=2;
+	_host_stress_num=_host_stress_err=0;
+	host_irq_start(_host_stress_consumer,HOST_STRESS_PERIOD);
+	host_irq_atomic=HOST_STRESS_ATOMIC;
+	while(host_irq_num<HOST_STRESS_NUMIRQ)
+	{
+		if((k=q->put(w,&rnd))==0)
+		{
+			numfull++;
+			while((k=q->put(w,&rnd))==0);
+		}
+		w+=k;
+		host_work();
+	}
+	host_irq_stop();
+	// Remaining elements
+	while(!q->isempty())
+		_host_stress_consumer();
+	printf("Interrupt consumer, %s: %lu elements, %lu interrupts, %lu raised in and %lu deferred by atomic blocks, %lu puts waited for space, %lu errors\n",
+		name,w,host_irq_num,host_irq_numatomic,host_irq_numdeferred,numfull,_host_stress_err);
+	HOST_CHECK(_host_stress_num==w);
+	HOST_CHECK(_host_stress_err==0);
+	HOST_CHECK(host_irq_numatomic==0 || host_irq_numdeferred>0);
+}
+
+/******************************************************************************
+	Registers
+******************************************************************************/
+HOSTREG_SPDR SPDR;
+HOSTREG_SPSR SPSR;
+HOSTREG_PORTB PORTB;
+HOSTREG_PINB PINB;
+volatile unsigned char SPCR,DDRB,SREG;
+volatile unsigned short TCNT3,OCR3A;
+volatile unsigned char TIFR3;
+volatile unsigned short _timer_time_1024hz_ctr;
+unsigned char host_eeprom[E2END+1];
+static unsigned char _host_spdr;
+
+HOSTREG_SPDR &HOSTREG_SPDR::operator=(unsigned char v)
+{
+	_host_spdr=hostsd_spi(v);
+	return *this;
+}
+HOSTREG_SPDR::operator unsigned char() const
+{
+	return _host_spdr;
+}
+HOSTREG_PORTB &HOSTREG_PORTB::operator=(unsigned char x)
+{
+	v=x;
+	hostsd_select(!(v&0x10));
+	return *this;
+}
+HOSTREG_PINB &HOSTREG_PINB::operator=(unsigned char x)
+{
+	PORTB=PORTB.v^x;
+	return *this;
+}
+HOSTREG_PINB::operator unsigned char() const
+{
+	return PORTB.v;
+}
+
+/******************************************************************************
+	Streams
+******************************************************************************/
+static int _host_stdout_put(char c,FILE *f)
+{
+	putchar(c);
+	return 0;
+}
+static FILE _host_stdout = FDEV_SETUP_STREAM(_host_stdout_put,0,_FDEV_SETUP_WRITE);
+FILE *file_pri=&_host_stdout,*file_dbg=&_host_stdout,*file_usb=&_host_stdout,*file_bt=&_host_stdout,*file_fb=0;
+
+int host_fputc(int c,FILE *f)
+{
+	if(!f || !f->put)
+		return EOF;
+	if(f->put(c,f))
+		return EOF;
+	return c;
+}
+int host_fputs(const char *s,FILE *f)
+{
+	while(*s)
+		if(host_fputc(*s++,f)==EOF)
+			return EOF;
+	return 0;
+}
+int host_vfprintf(FILE *f,const char *fmt,va_list ap)
+{
+	char buf[512],hfmt[256];
+	unsigned short i=0;
+	int n;
+
+	// %S is a string in program memory in avr-libc, and a wide string in the C library of the host
+	while(*fmt && i<sizeof(hfmt)-2)
+	{
+		hfmt[i++]=*fmt;
+		if(*fmt++!='%')
+			continue;
+		while(*fmt && strchr("-+ #0123456789.*hl",*fmt) && i<sizeof(hfmt)-2)
+			hfmt[i++]=*fmt++;
+		if(*fmt)
+			hfmt[i++]=*fmt=='S'?'s':*fmt;
+		if(*fmt)
+			fmt++;
+	}
+	hfmt[i]=0;
+	n=vsnprintf(buf,sizeof(buf),hfmt,ap);
+	host_fputs(buf,f);
+	return n;
+}
+int host_fprintf(FILE *f,const char *fmt,...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap,fmt);
+	n=host_vfprintf(f,fmt,ap);
+	va_end(ap);
+	return n;
+}
+int host_fgetc(FILE *f)
+{
+	if(!f || !f->get)
+		return EOF;
+	return f->get(f);
+}
+int host_fflush(FILE *f)
+{
+#undef fflush
+	fflush(stdout);
+	return 0;
+}
+
+/******************************************************************************
+	Interfaces (serial)
+******************************************************************************/
+unsigned char fputbuf(FILE *stream,char *data,unsigned char n)
+{
+	SERIALPARAM *sp=(SERIALPARAM*)fdev_get_udata(stream);
+
+	if(sp && sp->putbuf)
+		return sp->putbuf(data,n);
+	for(unsigned char i=0;i<n;i++)
+		if(host_fputc(data[i],stream)==EOF)
+			return 1;
+	return 0;
+}
+unsigned short fgettxbuflevel(FILE *stream)
+{
+	SERIALPARAM *sp=(SERIALPARAM*)fdev_get_udata(stream);
+
+	if(sp && sp->txbuf)
+		return (sp->txbuf->wrptr-sp->txbuf->rdptr)&sp->txbuf->mask;
+	return 0;
+}
+unsigned short fgetrxbuflevel(FILE *stream)
+{
+	SERIALPARAM *sp=(SERIALPARAM*)fdev_get_udata(stream);
+
+	if(sp && sp->rxbuf)
+		return (sp->rxbuf->wrptr-sp->rxbuf->rdptr)&sp->rxbuf->mask;
+	return 0;
+}
+unsigned short fgettxbuffree(FILE *stream)
+{
+	SERIALPARAM *sp=(SERIALPARAM*)fdev_get_udata(stream);
+
+	if(sp && sp->txbuf)
+		return sp->txbuf->size-1-((sp->txbuf->wrptr-sp->txbuf->rdptr)&sp->txbuf->mask);
+	return 0xFFFF;
+}
+unsigned short fgetrxbuffree(FILE *stream)
+{
+	return 0xFFFF;
+}
+
+/******************************************************************************
+	Link
+******************************************************************************/
+static unsigned char _host_link_mem[HOST_LINK_MAXSIZE];
+CIRCULARBUFFER host_link_tx={_host_link_mem,0,0,512,511};
+unsigned long host_link_rate;						// Bytes per second, 0 if the link does not accept data
+unsigned long long host_link_time;					// Time up to which the transmit buffer is drained
+static unsigned long _host_link_corrupt;
+static void (*_host_link_receive)(unsigned char c);
+
+/******************************************************************************
+	function: host_link_init
+*******************************************************************************
+	Selects the link and empties its transmit buffer.
+	
+	Parameters:
+		rate		-	Rate of the link in bytes per second, 0 if the link does not accept data
+		size		-	Size of the transmit buffer: power of 2 up to HOST_LINK_MAXSIZE
+		corrupt		-	One byte in corrupt is corrupted on the link, 0 for none
+		receive		-	Receiver called with each byte transmitted
+******************************************************************************/
+void host_link_init(unsigned long rate,unsigned short size,unsigned long corrupt,void (*receive)(unsigned char c))
+{
+	host_link_rate=rate;
+	host_link_tx.size=size;
+	host_link_tx.mask=size-1;
+	buffer_clear(&host_link_tx);
+	host_link_time=host_time_ns;
+	_host_link_corrupt=corrupt;
+	_host_link_receive=receive;
+}
+/******************************************************************************
+	function: host_link_drain
+*******************************************************************************
+	Transmits the bytes of the transmit buffer up to the current time.
+******************************************************************************/
+void host_link_drain(void)
+{
+	unsigned char c;
+
+	while(host_link_rate && !buffer_isempty(&host_link_tx) && host_link_time+1000000000ULL/host_link_rate<=host_time_ns)
+	{
+		c=buffer_get(&host_link_tx);
+		host_link_time+=1000000000ULL/host_link_rate;
+		if(_host_link_corrupt && (unsigned long)rand()%_host_link_corrupt==0)
+			c^=1<<(rand()%8);
+		_host_link_receive(c);
+	}
+	if(host_link_rate==0 || buffer_isempty(&host_link_tx))
+		host_link_time=host_time_ns;
+}
+/******************************************************************************
+	function: host_link_putbuf
+*******************************************************************************
+	Puts data in the transmit buffer if there is space for all of it.
+	
+	Returns:
+		0		-	Success
+		1		-	Not enough space, nothing written
+******************************************************************************/
+unsigned char host_link_putbuf(char *data,unsigned char n)
+{
+	host_link_drain();
+	return buffer_write(&host_link_tx,data,n);
+}
+/******************************************************************************
+	function: host_link_flush
+*******************************************************************************
+	Advances the time until the transmit buffer is empty. The link must accept
+	data.
+******************************************************************************/
+void host_link_flush(void)
+{
+	while(!buffer_isempty(&host_link_tx))
+	{
+		host_time_advance_ns(1000000);
+		host_link_drain();
+	}
+}
+
+/******************************************************************************
+	Globals of the modules not compiled on the host
+******************************************************************************/
+unsigned char sample_mode __attribute__((weak));		// Defined by mpu.c when it is linked
+unsigned CurrentAnnotation;
+FILE *mode_sample_file_log;
+unsigned short host_battery=4000;
+unsigned short system_getbattery(void)
+{
+	return host_battery;
+}
+
+/******************************************************************************
+	Assembly functions (helper_num.S)
+******************************************************************************/
+extern "C" void u16toa(unsigned short v,char *ptr)
+{
+	sprintf(ptr,"%05u",v);
+}
+extern "C" void u32toa(unsigned long v,char *ptr)
+{
+	sprintf(ptr,"%010lu",v);
+}
+/*
+	packet_fletcher16_asm: the instructions of helper_num.S with 8-bit registers and the carry flag, so that the
+	host tests check the algorithm of the assembly (unrolled loop, remainder, end-around carry).
+*/
+static unsigned char _host_add(unsigned char &r,unsigned char v,unsigned char c)
+{
+	unsigned short s=r+v+c;
+	r=s;
+	return s>>8;
+}
+extern "C" unsigned short packet_fletcher16_asm(unsigned char *data,unsigned short len)
+{
+	unsigned char *x=data;							// movw r26,r24
+	unsigned char r25=0xff,r24=0xff;				// ldi
+	unsigned char r20=len&3;						// mov r20,r22; andi r20,3
+	unsigned short r23r22=len>>2;					// lsr/ror twice
+	unsigned char c,i;
+
+	if(r23r22)
+	{
+		do
+		{
+			for(i=0;i<4;i++)
+			{
+				c=_host_add(r25,*x++,0);			// ld r18,x+; add r25,r18
+				_host_add(r25,0,c);					// adc r25,r1
+				c=_host_add(r24,r25,0);				// add r24,r25
+				_host_add(r24,0,c);					// adc r24,r1
+			}
+		}
+		while(--r23r22);							// subi/sbci; brne
+	}
+	while(r20)
+	{
+		c=_host_add(r25,*x++,0);
+		_host_add(r25,0,c);
+		c=_host_add(r24,r25,0);
+		_host_add(r24,0,c);
+		r20--;
+	}
+	return (r25<<8)|r24;
+}
+/******************************************************************************
+	function: host_init
+*******************************************************************************
+	Initialises the simulated time and the timing model of the card.
+******************************************************************************/
+void host_init(void)
+{
+	host_time_ns=0;
+	memset(host_eeprom,0xff,sizeof(host_eeprom));
+	hostsd_defaultparam(&hostsd_param);
+	PORTB=0x10;
+	setvbuf(stdout,0,_IOLBF,0);
+}
+/******************************************************************************
+	function: host_sdinit
+*******************************************************************************
+	Opens the simulated card on an image and initialises the SPI interface.
+
+	Parameters:
+		image		-	File name of the image
+		capacity	-	Capacity of the card in sectors; must be a multiple of 1024
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char host_sdinit(const char *image,unsigned long capacity)
+{
+	if(hostsd_open(image,capacity))
+	{
+		printf("Cannot open the image %s\n",image);
+		return 1;
+	}
+	spi_init(SPI_DIV_2);
+	return 0;
+}
+/******************************************************************************
+	function: host_fletcher16
+*******************************************************************************
+	Fletcher-16 of the packets computed from its definition: sums modulo 255
+	starting at 0, with a sum of 0 stored as 255 (the sums of packet_fletcher16
+	start at 255 and are reduced with an end-around carry).
+
+	Returns:
+		First sum in the most significant byte, second sum in the least significant byte
+******************************************************************************/
+unsigned short host_fletcher16(const unsigned char *data,unsigned short len)
+{
+	unsigned short sum1=0,sum2=0;
+
+	for(unsigned short i=0;i<len;i++)
+	{
+		sum1=(sum1+data[i])%255;
+		sum2=(sum2+sum1)%255;
+	}
+	if(sum1==0)
+		sum1=255;
+	if(sum2==0)
+		sum2=255;
+	return (sum1<<8)|sum2;
+}
+/******************************************************************************
+	function: host_crc16
+*******************************************************************************
+	CRC-16/XMODEM computed from its definition: polynomial 0x1021, initial
+	value 0. This is the CRC of the data blocks of the card and of the frames
+	of the log readout.
+******************************************************************************/
+unsigned short host_crc16(const unsigned char *data,unsigned short len)
+{
+	unsigned short crc=0;
+
+	for(unsigned short i=0;i<len;i++)
+	{
+		crc^=(unsigned short)data[i]<<8;
+		for(unsigned char b=0;b<8;b++)
+			crc=crc&0x8000?(crc<<1)^0x1021:crc<<1;
+	}
+	return crc;
+}
+/******************************************************************************
+	function: host_clock_ns
+*******************************************************************************
+	Returns the monotonic time of the host in ns, independent of the simulated time.
+******************************************************************************/
+unsigned long long host_clock_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec*1000000000ULL+t.tv_nsec;
+}
+/******************************************************************************
+	function: host_result
+*******************************************************************************
+	Prints the number of checks and failures of a test program.
+
+	Returns:
+		Exit code of the test program: 0 if all checks passed
+******************************************************************************/
+int host_result(const char *name)
+{
+	printf("%s: %lu checks, %lu failures\n",name,host_numtest,host_numfail);
+	return host_numfail?1:0;
+}
@@ -0,0 +1,69 @@
+#ifndef __HOSTSHIM_H
+#define __HOSTSHIM_H
+
+/*
+	Hardware and system interface of the host build, and checks of the host tests (see hostshim.c).
+*/
+
+#include <stdio.h>
+#include "circbuf.h"
+
+extern unsigned long long host_time_ns;
+
+void host_time_advance_ns(unsigned long long ns);
+void host_init(void);
+unsigned char host_sdinit(const char *image,unsigned long capacity);
+
+// Result of the host tests
+extern unsigned long host_numtest,host_numfail;
+#define HOST_CHECK(c) do { host_numtest++; if(!(c)) { host_numfail++; printf("FAIL %s:%d: %s\n",__FILE__,__LINE__,#c); } } while(0)
+int host_result(const char *name);
+unsigned short host_fletcher16(const unsigned char *data,unsigned short len);
+unsigned short host_crc16(const unsigned char *data,unsigned short len);
+unsigned long long host_clock_ns(void);
+
+// Interrupt routine run asynchronously (see util/atomic.h)
+extern volatile unsigned short host_irq_atomic;
+extern volatile unsigned long host_irq_num,host_irq_numdeferred,host_irq_numatomic;
+void host_irq_start(void (*isr)(void),unsigned long period);
+void host_irq_stop(void);
+
+// Stress test of a queue shared by the main code and an interrupt routine (see hostshim.c)
+#define HOST_STRESS_NUMIRQ 20000					// Interrupts of a test
+#define HOST_STRESS_PERIOD 20						// Period of the interrupts (us)
+#define HOST_STRESS_ATOMIC 16						// One atomic block in HOST_STRESS_ATOMIC raises the interrupt
+typedef struct
+{
+	void (*clear)(void);
+	unsigned char (*isempty)(void);
+	// Adds elements first, first+1, ... of the test stream; returns the number added
+	unsigned long (*put)(unsigned long first,unsigned long *rnd);
+	// Removes elements and adds to err those which are not first, first+1, ...; returns the number removed
+	unsigned long (*get)(unsigned long first,unsigned long *rnd,unsigned long *err);
+} HOSTQUEUE;
+unsigned long host_rnd(unsigned long *s);
+void host_work(void);
+void host_stress_read(const HOSTQUEUE *q,const char *name);
+void host_stress_write(const HOSTQUEUE *q,const char *name);
+
+// Model of a slow link (see hostshim.c)
+#define HOST_LINK_MAXSIZE 2048
+extern CIRCULARBUFFER host_link_tx;
+extern unsigned long host_link_rate;
+extern unsigned long long host_link_time;
+void host_link_init(unsigned long rate,unsigned short size,unsigned long corrupt,void (*receive)(unsigned char c));
+void host_link_drain(void);
+unsigned char host_link_putbuf(char *data,unsigned char n);
+void host_link_flush(void);
+
+// Globals of the modules not compiled on the host
+extern unsigned short host_battery;
+unsigned short system_getbattery(void);				// Returns host_battery
+
+// Test pattern: byte i of a test stream
+static inline char host_pattern(unsigned long i)
+{
+	return i*7+(i>>9)+(i>>17);
+}
+
+#endif
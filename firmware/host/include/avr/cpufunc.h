@@ -0,0 +1,9 @@
+/*
+	file: avr/cpufunc.h (host build)
+	
+	Not used by the modules compiled on the host.
+*/
+#ifndef __HOST_AVR_CPUFUNC_H
+#define __HOST_AVR_CPUFUNC_H
+
+#endif
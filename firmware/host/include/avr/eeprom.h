@@ -0,0 +1,45 @@
+/*
+	file: avr/eeprom.h (host build)
+	
+	The EEPROM is an array of host_eeprom (hostshim), erased (0xFF) at start. The addresses are offsets in the EEPROM.
+*/
+#ifndef __HOST_AVR_EEPROM_H
+#define __HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define E2END 4095
+
+extern unsigned char host_eeprom[E2END+1];
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p)
+{
+	return host_eeprom[(uintptr_t)p&E2END];
+}
+static inline uint16_t eeprom_read_word(const uint16_t *p)
+{
+	uint16_t v;
+	memcpy(&v,&host_eeprom[(uintptr_t)p&E2END],2);
+	return v;
+}
+static inline uint32_t eeprom_read_dword(const uint32_t *p)
+{
+	uint32_t v;
+	memcpy(&v,&host_eeprom[(uintptr_t)p&E2END],4);
+	return v;
+}
+static inline void eeprom_write_byte(uint8_t *p,uint8_t v)
+{
+	host_eeprom[(uintptr_t)p&E2END]=v;
+}
+static inline void eeprom_write_word(uint16_t *p,uint16_t v)
+{
+	memcpy(&host_eeprom[(uintptr_t)p&E2END],&v,2);
+}
+static inline void eeprom_write_dword(uint32_t *p,uint32_t v)
+{
+	memcpy(&host_eeprom[(uintptr_t)p&E2END],&v,4);
+}
+
+#endif
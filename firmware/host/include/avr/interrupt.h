@@ -0,0 +1,20 @@
+/*
+	file: avr/interrupt.h (host build)
+	
+	Interrupts do not exist on the host: the interrupt routines are ordinary functions which the host 
+	programs may call, or run asynchronously with host_irq_start. sei and cli set the interrupt flag of 
+	the model (see util/atomic.h).
+*/
+#ifndef __HOST_AVR_INTERRUPT_H
+#define __HOST_AVR_INTERRUPT_H
+
+#include <util/atomic.h>
+
+#define ISR(vector,...) extern "C" void vector(void)
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define sei() __host_restore(1)
+#define cli() __host_cli()
+#define reti()
+
+#endif
@@ -0,0 +1,66 @@
+/*
+	file: avr/io.h (host build)
+	
+	Registers of the ATmega1284P used by the modules compiled on the host.
+	
+	SPDR, SPSR and PORTB are routed to the simulated SD card (see hostsd): writing SPDR exchanges one 
+	byte with the card and advances the simulated time, and bit 4 of PORTB is the chip select of the card.
+	The other registers are plain variables defined in hostshim.
+*/
+#ifndef __HOST_AVR_IO_H
+#define __HOST_AVR_IO_H
+
+#define SPIF	7
+#define WCOL	6
+#define SPI2X	0
+#define SPIE	7
+#define SPE		6
+#define DORD	5
+#define MSTR	4
+
+#define _BV(bit) (1<<(bit))
+
+// SPI data register: a write exchanges one byte with the card, a read returns the byte received
+class HOSTREG_SPDR
+{
+public:
+	HOSTREG_SPDR &operator=(unsigned char v);
+	operator unsigned char() const;
+};
+// SPI status register: SPIF is always set as the transfers complete immediately
+class HOSTREG_SPSR
+{
+public:
+	unsigned char v;
+	HOSTREG_SPSR &operator=(unsigned char x) { v=x; return *this; }
+	operator unsigned char() const { return v|(1<<SPIF); }
+};
+// Port B: bit 4 is the chip select of the card (active low)
+class HOSTREG_PORTB
+{
+public:
+	unsigned char v;
+	HOSTREG_PORTB &operator=(unsigned char x);
+	operator unsigned char() const { return v; }
+};
+// Writing a 1 to a bit of PINB toggles the bit of PORTB
+class HOSTREG_PINB
+{
+public:
+	HOSTREG_PINB &operator=(unsigned char x);
+	operator unsigned char() const;
+};
+
+extern HOSTREG_SPDR SPDR;
+extern HOSTREG_SPSR SPSR;
+extern HOSTREG_PORTB PORTB;
+extern HOSTREG_PINB PINB;
+
+extern volatile unsigned char SPCR,DDRB,SREG;
+
+// Timer 3 of the profiler (prof), which is not enabled on the host
+#define OCF3A 1
+extern volatile unsigned short TCNT3,OCR3A;
+extern volatile unsigned char TIFR3;
+
+#endif
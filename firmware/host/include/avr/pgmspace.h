@@ -0,0 +1,30 @@
+/*
+	file: avr/pgmspace.h (host build)
+	
+	Program memory is ordinary memory on the host.
+*/
+#ifndef __HOST_AVR_PGMSPACE_H
+#define __HOST_AVR_PGMSPACE_H
+
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define printf_P printf
+#define fprintf_P fprintf
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define fputs_P fputs
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const unsigned char *)(p))
+// Reads the element pointed to: the tables of pointers, 16 bits on the AVR, are read with pgm_read_word
+#define pgm_read_word(p) (*(p))
+#define pgm_read_dword(p) (*(const unsigned int *)(p))
+
+#endif
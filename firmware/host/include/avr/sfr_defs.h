@@ -0,0 +1,11 @@
+/*
+	file: avr/sfr_defs.h (host build)
+	
+	The bit macros are defined in avr/io.h.
+*/
+#ifndef __HOST_AVR_SFR_DEFS_H
+#define __HOST_AVR_SFR_DEFS_H
+
+#include <avr/io.h>
+
+#endif
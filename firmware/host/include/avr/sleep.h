@@ -0,0 +1,21 @@
+/*
+	file: avr/sleep.h (host build)
+	
+	The sleep instructions have no effect on the host.
+*/
+#ifndef __HOST_AVR_SLEEP_H
+#define __HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+#define SLEEP_MODE_PWR_SAVE 3
+#define SLEEP_MODE_STANDBY 6
+#define SLEEP_MODE_EXT_STANDBY 7
+
+#define set_sleep_mode(m)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+#define sleep_mode()
+
+#endif
@@ -0,0 +1,9 @@
+/*
+	file: avr/wdt.h (host build)
+	
+	Not used by the modules compiled on the host.
+*/
+#ifndef __HOST_AVR_WDT_H
+#define __HOST_AVR_WDT_H
+
+#endif
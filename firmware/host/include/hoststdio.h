@@ -0,0 +1,62 @@
+/*
+	file: hoststdio.h (host build)
+
+	avr-libc streams on the host. Included before any other header (-include).
+
+	The firmware creates its own streams with fdev_setup_stream and keeps data in them with fdev_set_udata,
+	which the streams of the C library of the host do not allow. FILE is therefore redefined as the stream
+	of avr-libc (a put function, a get function and user data) once the headers of the C library are included,
+	and the functions of the firmware writing to streams are redirected to the host implementations in
+	hostshim. printf and sprintf remain those of the C library and write to the standard output of the host.
+*/
+#ifndef __HOSTSTDIO_H
+#define __HOSTSTDIO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+
+typedef struct __hostfile
+{
+	int (*put)(char,struct __hostfile *);
+	int (*get)(struct __hostfile *);
+	void *udata;
+	unsigned char flags;
+} HOSTFILE;
+
+#define FILE HOSTFILE
+
+#define _FDEV_SETUP_READ	1
+#define _FDEV_SETUP_WRITE	2
+#define _FDEV_SETUP_RW		3
+#define _FDEV_ERR			(-1)
+#define _FDEV_EOF			(-2)
+
+#define FDEV_SETUP_STREAM(p,g,f) { p,g,0,f }
+#define fdev_setup_stream(s,p,g,f) do { (s)->put=p; (s)->get=g; (s)->flags=f; (s)->udata=0; } while(0)
+#define fdev_set_udata(s,u) do { (s)->udata=(void*)(u); } while(0)
+#define fdev_get_udata(s) ((s)->udata)
+
+int host_fputc(int c,HOSTFILE *f);
+int host_fputs(const char *s,HOSTFILE *f);
+int host_fprintf(HOSTFILE *f,const char *fmt,...);
+int host_vfprintf(HOSTFILE *f,const char *fmt,va_list ap);
+int host_fgetc(HOSTFILE *f);
+int host_fflush(HOSTFILE *f);
+
+#undef putc
+#undef getc
+#define fputc host_fputc
+#define putc host_fputc
+#define fputs host_fputs
+#define fprintf host_fprintf
+#define vfprintf host_vfprintf
+#define fgetc host_fgetc
+#define getc host_fgetc
+#define fflush host_fflush
+
+#endif
@@ -0,0 +1,56 @@
+/*
+	file: util/atomic.h (host build)
+
+	The global interrupt flag of the AVR is modelled by host_sreg_i. Most host programs are single threaded
+	and call the interrupt routines explicitly, for which the atomic blocks are only compiler barriers. A
+	host program may also run an interrupt routine asynchronously, from a timer signal (host_irq_start):
+	the routine then interrupts the main code at any instruction, except within the atomic blocks where it
+	is deferred until the interrupt flag is restored, as on the AVR. With host_irq_atomic set, the interrupt
+	is also raised within an atomic block with a probability of 1/host_irq_atomic, so that the routine runs
+	right after the block: this exposes the code which updates a pointer before the data it covers.
+*/
+#ifndef __HOST_UTIL_ATOMIC_H
+#define __HOST_UTIL_ATOMIC_H
+
+// Interrupt flag at the end of the block: ORed (ATOMIC) or ANDed (NONATOMIC) with the saved flag
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+#define NONATOMIC_RESTORESTATE 1
+#define NONATOMIC_FORCEOFF 0
+
+extern volatile unsigned char host_sreg_i,host_irq_pending;
+extern volatile unsigned short host_irq_atomic;
+void host_irq_deliver(void);
+void host_irq_atomic_raise(void);
+
+static inline unsigned char __host_cli(void)
+{
+	unsigned char s;
+	__asm__ __volatile__("" ::: "memory");
+	s=host_sreg_i;
+	host_sreg_i=0;
+	if(host_irq_atomic)
+		host_irq_atomic_raise();
+	__asm__ __volatile__("" ::: "memory");
+	return s;
+}
+static inline unsigned char __host_restore(unsigned char s)
+{
+	__asm__ __volatile__("" ::: "memory");
+	host_sreg_i=s;
+	if(s && host_irq_pending)
+		host_irq_deliver();
+	__asm__ __volatile__("" ::: "memory");
+	return 0;
+}
+static inline unsigned char __host_sei(void)
+{
+	unsigned char s=host_sreg_i;
+	__host_restore(1);
+	return s;
+}
+
+#define ATOMIC_BLOCK(type) for(unsigned char __host_save=__host_cli(),__host_atomic=1;__host_atomic;__host_atomic=__host_restore(__host_save|(type)))
+#define NONATOMIC_BLOCK(type) for(unsigned char __host_save=__host_sei(),__host_atomic=1;__host_atomic;__host_atomic=__host_restore(__host_save&(type)))
+
+#endif
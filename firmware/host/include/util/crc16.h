@@ -0,0 +1,22 @@
+/*
+	file: util/crc16.h (host build)
+	
+	Reference implementations of the avr-libc CRC functions.
+*/
+#ifndef __HOST_UTIL_CRC16_H
+#define __HOST_UTIL_CRC16_H
+
+static inline unsigned short _crc_xmodem_update(unsigned short crc,unsigned char data)
+{
+	crc=crc^((unsigned short)data<<8);
+	for(unsigned char i=0;i<8;i++)
+	{
+		if(crc&0x8000)
+			crc=(crc<<1)^0x1021;
+		else
+			crc<<=1;
+	}
+	return crc;
+}
+
+#endif
@@ -0,0 +1,14 @@
+/*
+	file: util/delay.h (host build)
+	
+	Delays advance the simulated time (see hostshim).
+*/
+#ifndef __HOST_UTIL_DELAY_H
+#define __HOST_UTIL_DELAY_H
+
+void host_time_advance_ns(unsigned long long ns);
+
+static inline void _delay_us(double us) { host_time_advance_ns((unsigned long long)(us*1000.0)); }
+static inline void _delay_ms(double ms) { host_time_advance_ns((unsigned long long)(ms*1000000.0)); }
+
+#endif
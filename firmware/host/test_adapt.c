@@ -0,0 +1,299 @@
+/*
+	file: test_adapt
+
+	Tests of the backpressure rate adaptation of the motion stream (stream_adapt_update, stream_adapt_skip,
+	stream_adapt_announce) on a model of a slow link.
+
+	The link is the model of hostshim: the transmit buffer of the interface (512 bytes, written all-or-nothing
+	by fputbuf as the interrupt driven UART does) drained at the rate of the link in simulated time, into a receiver which
+	decodes the DXX packets and the DDC announcements as a host would. The samples are streamed as in the loop
+	of the motion mode: 500Hz samples of 39 bytes (about 19.5KB/s), with the adaptation updated once per batch
+	of one sample and the announcement sent before the next sample.
+
+	For links faster and slower than the samples, over 60s:
+
+	* The stream received is intact (synchronisation and checksums) and every sample is received, decimated,
+	or counted as failed to send.
+	* The stream is coherent: the counter of the samples received advances by the announced decimation factor,
+	except after a change of factor and for the samples which failed to send.
+	* The announcements are powers of 2 up to STREAM_DECIM_MAX, their count of samples skipped increases, and
+	the last one is the factor in use.
+	* A link faster than the samples is never decimated. On slower links the adaptation fails far fewer samples
+	than streaming without it, and uses at least 40% of the link.
+
+	The text announcement is checked separately.
+
+	Usage: test_adapt [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpu.h"
+#include "mpu_config.h"
+#include "serial.h"
+#include "mode_global.h"
+#include "mode_sample_motion.h"
+#include "hostshim.h"
+
+#define TEST_DURATION 60000							// Duration of a stream (ms)
+#define TEST_PERIOD 2								// Period of the samples (ms)
+#define TEST_TXSIZE 512								// Transmit buffer of the interface
+#define TEST_DDCSIZE 11								// Size of a DDC packet
+
+extern MPUMOTIONDATA mpumotiondata;
+extern unsigned long stat_samplesendfailed,stat_sampledecimated;
+extern unsigned char stream_decim,stream_decim_announce,stream_adapt_failed;
+extern unsigned short stream_drain_hold;
+
+// Receiver
+unsigned char test_frame[64];
+unsigned char test_framen,test_framesize;
+unsigned char test_pktsize;							// Size of the DXX packets
+unsigned long test_d;								// Decimation factor announced
+unsigned long test_prevctr,test_lastskip;
+unsigned char test_hasprev,test_changed;
+unsigned long test_numrx,test_numddc,test_numcoherent,test_numincoherent,test_numerr,test_bytes;
+
+/******************************************************************************
+	function: test_get
+*******************************************************************************
+	Reads n bytes little endian.
+******************************************************************************/
+unsigned long test_get(const unsigned char *p,unsigned char n)
+{
+	unsigned long v=0;
+
+	for(unsigned char i=0;i<n;i++)
+		v|=(unsigned long)p[i]<<(8*i);
+	return v;
+}
+/******************************************************************************
+	function: test_packet
+*******************************************************************************
+	Receiver: processes a complete DXX or DDC packet.
+******************************************************************************/
+void test_packet(void)
+{
+	unsigned long ctr,d,skip;
+
+	if(test_frame[2]=='C')
+	{
+		d=test_get(test_frame+3,2);
+		skip=test_get(test_frame+5,4);
+		// Power of 2 up to the maximum, skips increasing
+		if(d==0 || (d&(d-1)) || d>STREAM_DECIM_MAX || d==test_d || skip<test_lastskip)
+			test_numerr++;
+		test_d=d;
+		test_lastskip=skip;
+		test_changed=1;
+		test_numddc++;
+		return;
+	}
+	ctr=test_get(test_frame+3,4);
+	// The first gap after a change depends on the phase of the decimation
+	if(test_hasprev && !test_changed)
+	{
+		if(ctr-test_prevctr==test_d)
+			test_numcoherent++;
+		else
+			test_numincoherent++;
+	}
+	test_changed=0;
+	test_hasprev=1;
+	test_prevctr=ctr;
+	test_numrx++;
+}
+/******************************************************************************
+	function: test_receive
+*******************************************************************************
+	Receiver: decodes the packets byte by byte, synchronising on the header and
+	checking the Fletcher-16.
+******************************************************************************/
+void test_receive(unsigned char c)
+{
+	test_bytes++;
+	test_frame[test_framen++]=c;
+	if(test_framen==3)
+	{
+		if(test_frame[0]=='D' && test_frame[1]=='X' && test_frame[2]=='X')
+			test_framesize=test_pktsize;
+		else if(test_frame[0]=='D' && test_frame[1]=='D' && test_frame[2]=='C')
+			test_framesize=TEST_DDCSIZE;
+		else
+		{
+			test_numerr++;
+			memmove(test_frame,test_frame+1,2);
+			test_framen=2;
+			return;
+		}
+	}
+	if(test_framen<3 || test_framen<test_framesize)
+		return;
+	if(host_fletcher16(test_frame,test_framesize-2)!=test_get(test_frame+test_framesize-2,2))
+		test_numerr++;
+	else
+		test_packet();
+	test_framen=0;
+}
+SERIALPARAM test_serial={0,&host_link_tx,0,host_link_putbuf};
+FILE test_file;
+
+// Capture of the text announcement
+char test_text[64];
+unsigned char test_textn;
+unsigned char test_capture(char *data,unsigned char n)
+{
+	memcpy(test_text+test_textn,data,n);
+	test_textn+=n;
+	return 0;
+}
+SERIALPARAM test_captureserial={0,0,0,test_capture};
+FILE test_capturefile;
+
+/******************************************************************************
+	function: test_stream
+*******************************************************************************
+	Streams the samples for TEST_DURATION on a link of rate bytes per second, as the
+	loop of the motion mode does.
+
+	Parameters:
+		rate		-	Rate of the link in bytes per second
+		adapt		-	1 to enable the rate adaptation
+		changes		-	Receives the number of changes of the decimation factor
+
+	Returns:
+		Number of samples which failed to send
+******************************************************************************/
+unsigned long test_stream(unsigned long rate,unsigned char adapt,unsigned long *changes)
+{
+	unsigned long n=0;
+	unsigned char d;
+
+	host_link_init(rate,TEST_TXSIZE,0,test_receive);
+	test_framen=0;
+	test_d=1;
+	test_hasprev=test_changed=0;
+	test_lastskip=0;
+	test_numrx=test_numddc=test_numcoherent=test_numincoherent=test_numerr=test_bytes=0;
+	stat_samplesendfailed=0;
+	stream_adapt_clear();
+	*changes=0;
+
+	for(unsigned long ms=1;ms<=TEST_DURATION;ms++)
+	{
+		host_time_advance_ns(1000000);
+		host_link_drain();
+		if(ms%TEST_PERIOD)
+			continue;
+		// Batch of one sample
+		mpumotiondata.packetctr=n++;
+		mpumotiondata.time=ms;
+		if(adapt)
+		{
+			d=stream_decim;
+			stream_adapt_update(&test_file);
+			if(stream_decim!=d)
+				(*changes)++;
+			if(stream_adapt_announce(&test_file))
+			{
+				stat_samplesendfailed++;
+				stream_adapt_failed=1;
+				continue;
+			}
+			if(stream_adapt_skip())
+				continue;
+		}
+		if(stream_sample(&test_file))
+		{
+			stat_samplesendfailed++;
+			stream_adapt_failed=1;
+		}
+	}
+	// Remaining bytes
+	host_link_flush();
+	HOST_CHECK(test_numerr==0 && test_framen==0);
+	HOST_CHECK(test_numrx+stat_sampledecimated+stat_samplesendfailed==n);
+	return stat_samplesendfailed;
+}
+/******************************************************************************
+	function: test_link
+*******************************************************************************
+	Streams on a link without and with the rate adaptation.
+******************************************************************************/
+void test_link(unsigned long rate)
+{
+	unsigned long failbase,fail,changes,rxbase,util;
+
+	failbase=test_stream(rate,0,&changes);
+	rxbase=test_numrx;
+	HOST_CHECK(test_numddc==0);
+	fail=test_stream(rate,1,&changes);
+	util=test_bytes*100/(rate*(TEST_DURATION/1000));
+	printf("%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%u\t%u\t%lu\t%lu\t%lu%%\n",rate,rxbase,failbase,test_numrx,stat_sampledecimated,fail,
+		stream_decim,stream_drain_hold,changes,test_numincoherent,util);
+
+	// Coherent stream: the gaps not explained by the decimation are the samples which failed to send
+	HOST_CHECK(test_numincoherent<=fail);
+	HOST_CHECK(test_numddc<=changes);
+	if(stream_decim_announce==0)
+		HOST_CHECK(test_d==stream_decim && test_lastskip<=stat_sampledecimated);
+	if(rate*TEST_PERIOD>=test_pktsize*1000ul*3/2)
+	{
+		// Faster link: full rate
+		HOST_CHECK(fail==0 && failbase==0);
+		HOST_CHECK(changes==0 && test_numddc==0 && stat_sampledecimated==0);
+	}
+	else
+	{
+		HOST_CHECK(fail*10<=failbase);
+		HOST_CHECK(util>=40);
+		HOST_CHECK(test_numddc>0);
+	}
+}
+/******************************************************************************
+	function: test_textannounce
+*******************************************************************************
+	Text announcement.
+******************************************************************************/
+void test_textannounce(void)
+{
+	mode_stream_format_bin=0;
+	stream_adapt_clear();
+	HOST_CHECK(stream_adapt_announce(&test_capturefile)==0);
+	HOST_CHECK(test_textn==0);
+	stream_decim=4;
+	stat_sampledecimated=123456;
+	stream_decim_announce=1;
+	HOST_CHECK(stream_adapt_announce(&test_capturefile)==0);
+	test_text[test_textn]=0;
+	HOST_CHECK(strcmp(test_text,"#decim=4; skip=123456\n")==0);
+	HOST_CHECK(stream_decim_announce==0);
+	stream_adapt_clear();
+}
+
+int main(int argc,char **argv)
+{
+	const unsigned long rate[]={30000,19000,12000,6000,2500};
+
+	host_init();
+	fdev_setup_stream(&test_file,0,0,_FDEV_SETUP_WRITE);
+	fdev_set_udata(&test_file,&test_serial);
+	fdev_setup_stream(&test_capturefile,0,0,_FDEV_SETUP_WRITE);
+	fdev_set_udata(&test_capturefile,&test_captureserial);
+
+	test_textannounce();
+
+	// Binary packets with counter and time, accelerometer, gyroscope, magnetometer and quaternions
+	mode_stream_format_bin=1;
+	mode_stream_format_pktctr=1;
+	mode_stream_format_ts=1;
+	mode_stream_format_bat=0;
+	mode_stream_format_label=0;
+	sample_mode=MPU_MODE_BM_A|MPU_MODE_BM_G|MPU_MODE_BM_M|MPU_MODE_BM_Q;
+	test_pktsize=stream_sample_bin_size();
+	printf("Samples: %u bytes every %u ms (%u B/s), transmit buffer of %u bytes\n",test_pktsize,TEST_PERIOD,test_pktsize*1000/TEST_PERIOD,TEST_TXSIZE);
+	printf("Link B/s\tNo adaptation: rx\tfailed\tAdaptation: rx\tdecimated\tfailed\tdecim\thold ms\tchanges\tincoherent\tlink used\n");
+	for(unsigned char i=0;i<sizeof(rate)/sizeof(rate[0]);i++)
+		test_link(rate[i]);
+	return host_result("test_adapt");
+}
@@ -0,0 +1,216 @@
+/*
+	file: test_checkpoint
+
+	Tests and benchmark of the log size checkpoints of uFAT (ufat_log_setcheckpoint) on the simulated card:
+
+	* Crash: a log is written in a child process which stops at a random point without closing the log, as a
+	power loss would. The card is then initialised again from the image, as after a reset. The size of the
+	log in the ROOT must be a multiple of the sector size, cover at least the data on the card at the last
+	checkpoint, not exceed the data written, and the data up to that size must be the data written.
+	Without checkpoints the size is 0.
+	* Benchmark: throughput in simulated time of the log written with several checkpoint intervals, penalty
+	compared to the log written without checkpoints, and duration of the suspensions of the multiblock write.
+	Differences below about 0.5% are within the variation of the erase-ahead between runs.
+
+	Usage: test_checkpoint <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "wait.h"
+#include "sd.h"
+#include "ufat.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+#define TEST_CAPACITY 262144						// Capacity of the card in sectors (128MB)
+#define TEST_SIZE (4*1024*1024l)					// Size of the log written by the benchmark
+#define TEST_RECSIZE 200							// Size of the records written to the log
+#define TEST_NUMCRASH 8								// Crashes per checkpoint interval
+
+extern LOGENTRY _logentries[];
+extern unsigned long _log_checkpoint_num,_log_checkpoint_err,_log_checkpoint_sect;
+extern unsigned long _sd_streamcache_numsuspend,_sd_streamcache_maxsuspendtime,_sd_streamcache_totsuspendtime;
+
+const char *test_image;
+
+// Checkpoint intervals: sectors, seconds
+const unsigned short test_interval[][2]={{0,0},{16,0},{128,0},{1024,0},{0,1},{0,5}};
+#define TEST_NUMINTERVAL (sizeof(test_interval)/sizeof(test_interval[0]))
+
+/******************************************************************************
+	function: test_reset
+*******************************************************************************
+	Initialises the card, and the file system if fs is nonzero, from the image,
+	as after a reset.
+******************************************************************************/
+void test_reset(unsigned char fs)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long capacity;
+
+	HOST_CHECK(host_sdinit(test_image,TEST_CAPACITY)==0);
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&capacity)==0);
+	if(fs)
+		HOST_CHECK(ufat_init()==0);
+}
+/******************************************************************************
+	function: test_write
+*******************************************************************************
+	Opens log 0 and writes size bytes of the test pattern in records.
+
+	Returns:
+		Simulated time in ms
+******************************************************************************/
+unsigned long test_write(unsigned long size)
+{
+	char rec[TEST_RECSIZE];
+	unsigned long n,t;
+	unsigned char s;
+
+	t=timer_ms_get();
+	HOST_CHECK(ufat_log_open(0)!=0);
+	for(n=0;n<size;n+=s)
+	{
+		s=size-n>TEST_RECSIZE?TEST_RECSIZE:size-n;
+		for(unsigned char i=0;i<s;i++)
+			rec[i]=host_pattern(n+i);
+		if(_ufat_log_fputbuf(rec,s))
+		{
+			HOST_CHECK(0);
+			break;
+		}
+	}
+	return timer_ms_get()-t;
+}
+/******************************************************************************
+	function: test_checkdata
+*******************************************************************************
+	Checks that the first n bytes of log 0 are the test pattern.
+******************************************************************************/
+void test_checkdata(unsigned long n)
+{
+	char sect[512];
+	unsigned long start=_logentries[0].startsector;
+
+	for(unsigned long i=0;i<n;i++)
+	{
+		if((i&511)==0)
+			HOST_CHECK(hostsd_readsector(start+i/512,sect)==0);
+		if(sect[i&511]!=host_pattern(i))
+		{
+			printf("Data differs at byte %lu\n",i);
+			HOST_CHECK(0);
+			return;
+		}
+	}
+}
+/******************************************************************************
+	function: test_crash
+*******************************************************************************
+	Writes size bytes to log 0 in a child process which exits without closing
+	the log, then checks the size of the log found after a reset.
+******************************************************************************/
+void test_crash(unsigned char iv,unsigned long size)
+{
+	unsigned long r[2],logsize;
+	int fd[2],status;
+	pid_t pid;
+
+	if(pipe(fd))
+	{
+		HOST_CHECK(0);
+		return;
+	}
+	pid=fork();
+	if(pid==0)
+	{
+		// Power loss after the last write: the data in the staging ring and the open multiblock write are lost
+		close(fd[0]);
+		ufat_log_setcheckpoint(test_interval[iv][0],test_interval[iv][1]);
+		test_write(size);
+		r[0]=(_log_checkpoint_sect-_logentries[0].startsector)<<9;
+		r[1]=_log_checkpoint_num;
+		if(r[0]>size)
+			r[0]=size;
+		if(_log_checkpoint_err || write(fd[1],r,sizeof(r))!=sizeof(r))
+			_exit(1);
+		_exit(host_numfail?1:0);
+	}
+	close(fd[1]);
+	status=read(fd[0],r,sizeof(r))==sizeof(r);
+	close(fd[0]);
+	HOST_CHECK(status);
+	HOST_CHECK(pid>0 && waitpid(pid,&status,0)==pid && WIFEXITED(status) && WEXITSTATUS(status)==0);
+
+	test_reset(1);
+	logsize=ufat_log_getlogsize(0);
+	printf("Interval %4u sectors %2u s: crash after %8lu bytes, %3lu checkpoints, size at the last checkpoint %8lu, size found %8lu\n",
+		test_interval[iv][0],test_interval[iv][1],size,r[1],r[0],logsize);
+	HOST_CHECK((logsize&511)==0);
+	HOST_CHECK(logsize>=r[0] && logsize<=size);
+	if(test_interval[iv][0]==0 && test_interval[iv][1]==0)
+		HOST_CHECK(logsize==0);
+	test_checkdata(logsize);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+}
+/******************************************************************************
+	function: test_bench
+*******************************************************************************
+	Throughput of the log written with each checkpoint interval.
+******************************************************************************/
+void test_bench(void)
+{
+	unsigned long t,t0=0;
+
+	printf("Interval\tChecks\tms\tKB/s\tPenalty\tSuspension mean/max (us)\n");
+	for(unsigned char iv=0;iv<TEST_NUMINTERVAL;iv++)
+	{
+		ufat_log_setcheckpoint(test_interval[iv][0],test_interval[iv][1]);
+		hostsd_clearstat();
+		sd_streamcache_clearstat();
+		t=test_write(TEST_SIZE);
+		HOST_CHECK(_log_checkpoint_err==0);
+		if(iv==0)
+		{
+			t0=t;
+			HOST_CHECK(_log_checkpoint_num==0);
+		}
+		else
+			HOST_CHECK(_log_checkpoint_num>=(test_interval[iv][0]?TEST_SIZE/512/test_interval[iv][0]:t/1000/test_interval[iv][1])-1);
+		printf("%us/%us\t%lu\t%lu\t%lu\t%.2f%%\t%lu/%lu\n",test_interval[iv][0],test_interval[iv][1],_log_checkpoint_num,t,TEST_SIZE/t*1000/1024,
+			100.0*((double)t-t0)/t0,_sd_streamcache_numsuspend?_sd_streamcache_totsuspendtime/_sd_streamcache_numsuspend:0,_sd_streamcache_maxsuspendtime);
+		HOST_CHECK(ufat_log_close()==0);
+		HOST_CHECK(ufat_log_getlogsize(0)==TEST_SIZE);
+		HOST_CHECK(hostsd_stat.protocol_errors==0);
+		HOST_CHECK(hostsd_stat.write_errors==0);
+	}
+	test_checkdata(TEST_SIZE);
+}
+
+int main(int argc,char **argv)
+{
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	test_image=argv[1];
+	test_reset(0);
+	HOST_CHECK(ufat_format(4,64)==0);
+	test_reset(1);
+
+	for(unsigned char iv=0;iv<TEST_NUMINTERVAL;iv++)
+		for(unsigned char i=0;i<TEST_NUMCRASH;i++)
+			test_crash(iv,rand()%TEST_SIZE+1);
+	test_bench();
+
+	hostsd_close();
+	return host_result("test_checkpoint");
+}
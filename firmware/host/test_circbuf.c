@@ -0,0 +1,240 @@
+/*
+	file: test_circbuf
+
+	Tests and benchmark of the block operations of the circular buffer (buffer_write, buffer_read,
+	buffer_peek_contiguous, buffer_skip) and of the byte operations:
+
+	* Model: random operations on buffers of several sizes compared to a model of the queue: the all-or-nothing
+	write, the reads of up to n bytes, the contiguous span up to the wraparound, the level and the free space.
+	* Interrupts: the stress tests of hostshim (host_stress_read, host_stress_write) run an interrupt routine
+	asynchronously from a timer signal, interrupting the main code at any point outside the atomic blocks as on
+	the AVR, and also within the atomic blocks so that it runs right after the pointer updates. The routine
+	consumes the bytes written by the main code (as the UDRE interrupt of the transmit buffers) or produces the
+	bytes read by the main code (as the RX interrupt), each side mixing the block and the byte operations with
+	random sizes. The stream of bytes must arrive complete and in order.
+	* Benchmark: time of the host per byte of 64-byte block writes and reads compared to buffer_put and
+	buffer_get.
+
+	Usage: test_circbuf [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "circbuf.h"
+#include "hostshim.h"
+
+#define TEST_MAXSIZE 1024							// Largest buffer
+#define TEST_NUMOP 200000							// Operations of the model test
+#define TEST_IRQSIZE 256							// Size of the buffer of the interrupt tests
+#define TEST_BENCHBYTES (16*1024*1024l)				// Bytes of the benchmark
+
+unsigned char test_mem[TEST_MAXSIZE];
+CIRCULARBUFFER test_cb;
+
+/******************************************************************************
+	function: test_init
+*******************************************************************************
+	Initialises test_cb with a buffer of size bytes.
+******************************************************************************/
+void test_init(unsigned short size)
+{
+	memset(test_mem,0,sizeof(test_mem));
+	test_cb.buffer=test_mem;
+	test_cb.size=size;
+	test_cb.mask=size-1;
+	buffer_clear(&test_cb);
+}
+/******************************************************************************
+	function: test_model
+*******************************************************************************
+	Random operations on a buffer of size bytes compared to the model of the queue.
+******************************************************************************/
+void test_model(unsigned short size)
+{
+	unsigned char data[TEST_MAXSIZE],*p;
+	unsigned long w=0,r=0,numwrap=0;				// Bytes written and read
+	unsigned short n,k,l;
+	unsigned char wrap;
+
+	test_init(size);
+	for(unsigned long it=0;it<TEST_NUMOP;it++)
+	{
+		l=w-r;
+		switch(rand()%6)
+		{
+			case 0:
+				n=rand()%(size+1);
+				for(unsigned short i=0;i<n;i++)
+					data[i]=host_pattern(w+i);
+				wrap=test_cb.wrptr+n>size;
+				k=buffer_write(&test_cb,data,n);
+				HOST_CHECK(k==(n>size-1-(w-r)));
+				if(k==0)
+				{
+					w+=n;
+					numwrap+=wrap;
+				}
+				break;
+			case 1:
+				n=rand()%(size+1);
+				k=buffer_read(&test_cb,data,n);
+				HOST_CHECK(k==(n<l?n:l));
+				for(unsigned short i=0;i<k;i++)
+					HOST_CHECK(data[i]==(unsigned char)host_pattern(r+i));
+				r+=k;
+				break;
+			case 2:
+				n=buffer_peek_contiguous(&test_cb,&p);
+				HOST_CHECK(p==test_mem+test_cb.rdptr);
+				// Up to the level or to the end of the buffer
+				HOST_CHECK(n<=l && (n==l || p+n==test_mem+size));
+				HOST_CHECK(l==0 || n>0);
+				for(unsigned short i=0;i<n;i++)
+					HOST_CHECK(p[i]==(unsigned char)host_pattern(r+i));
+				k=rand()%(n+1);
+				buffer_skip(&test_cb,k);
+				r+=k;
+				break;
+			case 3:
+				if(!buffer_isfull(&test_cb))
+					buffer_put(&test_cb,host_pattern(w++));
+				break;
+			case 4:
+				if(!buffer_isempty(&test_cb))
+					HOST_CHECK(buffer_get(&test_cb)==(unsigned char)host_pattern(r++));
+				break;
+			default:
+				// Empty or full the buffer
+				if(rand()%2)
+					r+=buffer_read(&test_cb,data,size);
+				else
+				{
+					n=buffer_freespace(&test_cb);
+					for(unsigned short i=0;i<n;i++)
+						data[i]=host_pattern(w+i);
+					HOST_CHECK(buffer_write(&test_cb,data,n)==0);
+					w+=n;
+				}
+				break;
+		}
+		l=w-r;
+		HOST_CHECK(buffer_level(&test_cb)==l && buffer_freespace(&test_cb)==size-1-l);
+		HOST_CHECK(buffer_isempty(&test_cb)==(l==0) && buffer_isfull(&test_cb)==(l==size-1));
+	}
+	printf("Model, size %u: %lu bytes, %lu writes across the wraparound\n",size,w,numwrap);
+	HOST_CHECK(numwrap>0);
+}
+/******************************************************************************
+	function: test_get
+*******************************************************************************
+	Queue of the stress tests: reads up to 128 bytes from test_cb with the byte
+	operations, buffer_read, or buffer_peek_contiguous and buffer_skip.
+******************************************************************************/
+unsigned long test_get(unsigned long first,unsigned long *rnd,unsigned long *err)
+{
+	unsigned char data[128],*p;
+	unsigned short n,k;
+
+	n=host_rnd(rnd)%128+1;
+	switch(host_rnd(rnd)%3)
+	{
+		case 0:
+			for(k=0;k<n && !buffer_isempty(&test_cb);k++)
+				data[k]=buffer_get(&test_cb);
+			break;
+		case 1:
+			k=buffer_read(&test_cb,data,n);
+			break;
+		default:
+			k=buffer_peek_contiguous(&test_cb,&p);
+			if(k>n)
+				k=n;
+			memcpy(data,p,k);
+			buffer_skip(&test_cb,k);
+			break;
+	}
+	for(unsigned short i=0;i<k;i++)
+		if(data[i]!=(unsigned char)host_pattern(first+i))
+			(*err)++;
+	return k;
+}
+/******************************************************************************
+	function: test_put
+*******************************************************************************
+	Queue of the stress tests: writes up to 128 bytes to test_cb with buffer_write,
+	or with buffer_put while the buffer is not full.
+******************************************************************************/
+unsigned long test_put(unsigned long first,unsigned long *rnd)
+{
+	unsigned char data[128];
+	unsigned short n,k;
+
+	n=host_rnd(rnd)%128+1;
+	if(host_rnd(rnd)%2)
+	{
+		for(unsigned short i=0;i<n;i++)
+			data[i]=host_pattern(first+i);
+		return buffer_write(&test_cb,data,n)?0:n;
+	}
+	for(k=0;k<n && !buffer_isfull(&test_cb);k++)
+		buffer_put(&test_cb,host_pattern(first+k));
+	return k;
+}
+void test_clear(void)
+{
+	test_init(TEST_IRQSIZE);
+}
+unsigned char test_isempty(void)
+{
+	return buffer_isempty(&test_cb);
+}
+const HOSTQUEUE test_queue={test_clear,test_isempty,test_put,test_get};
+
+/******************************************************************************
+	function: test_bench
+*******************************************************************************
+	Time per byte of the block and byte operations.
+******************************************************************************/
+void test_bench(void)
+{
+	unsigned char in[64],out[64];
+	unsigned long long t0,t1,t2;
+	unsigned long sum=0;
+
+	for(unsigned char i=0;i<64;i++)
+		in[i]=i;
+	test_init(TEST_MAXSIZE);
+	t0=host_clock_ns();
+	for(unsigned long n=0;n<TEST_BENCHBYTES;n+=64)
+	{
+		buffer_write(&test_cb,in,64);
+		buffer_read(&test_cb,out,64);
+		sum+=out[n/64%64];
+	}
+	t1=host_clock_ns();
+	for(unsigned long n=0;n<TEST_BENCHBYTES;n+=64)
+	{
+		for(unsigned char i=0;i<64;i++)
+			buffer_put(&test_cb,in[i]);
+		for(unsigned char i=0;i<64;i++)
+			out[i]=buffer_get(&test_cb);
+		sum+=out[n/64%64];
+	}
+	t2=host_clock_ns();
+	printf("Benchmark: 64-byte blocks %.2f ns/B, buffer_put/buffer_get %.2f ns/B (checksum %lu)\n",
+		(double)(t1-t0)/TEST_BENCHBYTES,(double)(t2-t1)/TEST_BENCHBYTES,sum);
+	HOST_CHECK(sum==2*(TEST_BENCHBYTES/64/64)*(63*64/2));
+	HOST_CHECK(t1-t0<t2-t1);
+}
+
+int main(int argc,char **argv)
+{
+	host_init();
+	srand(1);
+	for(unsigned short size=16;size<=TEST_MAXSIZE;size*=4)
+		test_model(size);
+	host_stress_write(&test_queue,"256 bytes");
+	host_stress_read(&test_queue,"256 bytes");
+	test_bench();
+	return host_result("test_circbuf");
+}
@@ -0,0 +1,542 @@
+/*
+	file: test_dxz
+
+	Decoder of the compressed motion stream (DXZ blocks, see stream_sample_z) and benchmark of the compression.
+
+	* Round trip: samples with random walks, large steps and wrap-arounds are encoded with stream_sample_z in
+	every stream format (pktctr, time, battery, label) and in sample modes with A/G/M/Q, with blocks which
+	randomly cannot be sent. Every block is decoded independently of the encoder: header, Fletcher-16,
+	varints and padding. The samples of the blocks sent must be the samples encoded, and the samples of the
+	blocks which could not be sent must be counted in stat_z_lost, except the sample for which
+	stream_sample_z reported the failure.
+	* Benchmark: synthetic traces (gravity, motion and sensor noise) and optionally a recorded trace are
+	encoded, and the compression ratio relative to DXX packets, the bytes per sample and the encoding time
+	on the host are reported.
+
+	A trace is a text file with one sample per line: ax ay az gx gy gz mx my mz (raw values; missing
+	channels are 0).
+
+	Usage: test_dxz [-t trace] [-r rate] [image]
+
+	-t <file>	Recorded trace to benchmark
+	-r <Hz>		Sample rate of the recorded trace (default 100)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "mpu.h"
+#include "mpu_config.h"
+#include "pkt.h"
+#include "serial.h"
+#include "mode_global.h"
+#include "mode_sample_motion.h"
+#include "commandset.h"
+#include "hostshim.h"
+
+#define TEST_QUEUE 4096								// Reference queue of the samples encoded and not yet decoded (power of 2)
+#define TEST_TRACE_MAX 200000						// Maximum number of samples of a recorded trace
+
+extern MPUMOTIONDATA mpumotiondata;
+extern MPUMOTIONGEOMETRY mpumotiongeometry;
+extern unsigned long stat_z_samples,stat_z_blocks,stat_z_bytes,stat_z_lost;
+
+unsigned long test_queue[TEST_QUEUE][STREAM_Z_MAXFIELDS];
+unsigned long test_qrd,test_qwr;					// Read and write index of the reference queue
+unsigned char test_n32,test_nf;						// Number of 32-bit fields and number of fields of the current format
+unsigned char test_failrate;						// Percentage of the blocks which cannot be sent
+unsigned long test_lost,test_numblock,test_numerr,test_bytes;
+unsigned long test_numfailed;						// Samples encoded in a block which failed when closed after them
+unsigned char test_decodeonly;						// Benchmark: only count the bytes
+
+/******************************************************************************
+	function: test_getbits
+*******************************************************************************
+	Reads n bits of the block, least significant bit first.
+******************************************************************************/
+unsigned long test_getbits(const unsigned char *b,unsigned short &bitptr,unsigned char n)
+{
+	unsigned long v=0;
+
+	for(unsigned char i=0;i<n;i++,bitptr++)
+		if(b[bitptr>>3]&(1<<(bitptr&7)))
+			v|=1UL<<i;
+	return v;
+}
+/******************************************************************************
+	function: dxz_decode
+*******************************************************************************
+	Decodes a DXZ block.
+
+	Parameters:
+		b		-	Block
+		s		-	Size of the block in bytes
+		n32		-	Number of 32-bit fields of the stream format
+		nf		-	Number of fields of the stream format
+		v		-	Receives the fields of the samples
+	Returns:
+		Number of samples; 0 if the block is invalid
+******************************************************************************/
+unsigned char dxz_decode(const unsigned char *b,unsigned short s,unsigned char n32,unsigned char nf,unsigned long v[][STREAM_Z_MAXFIELDS])
+{
+	unsigned short bitptr,check;
+	unsigned char n,i,j,g,shift;
+	unsigned long z,d;
+
+	if(s<4+n32*4+(nf-n32)*2+2 || b[0]!='D' || b[1]!='X' || b[2]!='Z')
+		return 0;
+	check=b[s-2]|(b[s-1]<<8);
+	if(check!=host_fletcher16(b,s-2))
+		return 0;
+	n=b[3];
+	if(n==0)
+		return 0;
+	// Keyframe
+	bitptr=32;
+	for(i=0;i<nf;i++)
+		v[0][i]=test_getbits(b,bitptr,i<n32?32:16);
+	// Deltas
+	for(j=1;j<n;j++)
+	{
+		for(i=0;i<nf;i++)
+		{
+			z=0;
+			shift=0;
+			do
+			{
+				if(bitptr+5>(s-2)*8 || shift>=(i<n32?32:16))
+					return 0;
+				g=test_getbits(b,bitptr,5);
+				z|=(unsigned long)(g&0x0f)<<shift;
+				shift+=4;
+			}
+			while(g&0x10);
+			d=(z>>1)^(0-(z&1));
+			v[j][i]=v[j-1][i]+d;
+			if(i>=n32)
+				v[j][i]&=0xffff;
+		}
+	}
+	// Padding: zero bits up to the checksum
+	if((bitptr+7)/8!=s-2)
+		return 0;
+	if(test_getbits(b,bitptr,(8-(bitptr&7))&7))
+		return 0;
+	return n;
+}
+/******************************************************************************
+	function: test_putbuf
+*******************************************************************************
+	Receives the blocks sent by stream_sample_z, decodes them and compares them
+	with the samples encoded. Fails test_failrate percent of the blocks.
+******************************************************************************/
+unsigned char test_putbuf(char *data,unsigned char s)
+{
+	unsigned long v[256][STREAM_Z_MAXFIELDS];
+	unsigned char n,fail;
+
+	test_numblock++;
+	fail=(unsigned)rand()%100<test_failrate;
+	if(!fail)
+		test_bytes+=s;
+	if(test_decodeonly)
+		return fail;
+
+	HOST_CHECK(s<=__PKT_DATA_MAXSIZE);
+	n=dxz_decode((unsigned char*)data,s,test_n32,test_nf,v);
+	if(n==0 || n>STREAM_Z_MAXSAMPLES || n>test_qwr-test_qrd)
+	{
+		if(test_numerr<10)
+			printf("Invalid block %lu: %u bytes, %u samples, %lu pending\n",test_numblock,s,n,test_qwr-test_qrd);
+		test_numerr++;
+		return fail;
+	}
+	for(unsigned char j=0;j<n;j++)
+	{
+		if(memcmp(v[j],test_queue[test_qrd%TEST_QUEUE],test_nf*sizeof(unsigned long)))
+		{
+			if(test_numerr<10)
+				printf("Block %lu sample %u differs from sample %lu\n",test_numblock,j,test_qrd);
+			test_numerr++;
+		}
+		test_qrd++;
+	}
+	if(fail)
+		test_lost+=n;
+	return fail;
+}
+SERIALPARAM test_serial={0,0,0,test_putbuf};
+FILE test_file;
+
+/******************************************************************************
+	function: test_setformat
+*******************************************************************************
+	Selects the stream format and sample mode, and computes the number of fields.
+******************************************************************************/
+void test_setformat(unsigned char format,unsigned char mode)
+{
+	mode_stream_format_pktctr=format&1?1:0;
+	mode_stream_format_ts=format&2?1:0;
+	mode_stream_format_bat=format&4?1:0;
+	mode_stream_format_label=format&8?1:0;
+	sample_mode=mode;
+	test_n32=mode_stream_format_pktctr+mode_stream_format_ts;
+	test_nf=test_n32+mode_stream_format_bat+mode_stream_format_label;
+	if(mode&MPU_MODE_BM_A)
+		test_nf+=3;
+	if(mode&MPU_MODE_BM_G)
+		test_nf+=3;
+	if(mode&MPU_MODE_BM_M)
+		test_nf+=3;
+	if(mode&MPU_MODE_BM_Q)
+		test_nf+=4;
+	stream_sample_z_clearstat();
+	test_qrd=test_qwr=0;
+	test_lost=test_numblock=test_numerr=test_bytes=test_numfailed=0;
+}
+/******************************************************************************
+	function: test_quat
+*******************************************************************************
+	Quaternion component as sent in DXX packets.
+******************************************************************************/
+unsigned short test_quat(float q)
+{
+	float k=q*10000.0;
+	signed short s=k;
+	return s;
+}
+/******************************************************************************
+	function: test_encode
+*******************************************************************************
+	Encodes the sample in mpumotiondata and mpumotiongeometry and records its
+	fields in the reference queue if it was encoded.
+******************************************************************************/
+unsigned char test_encode(void)
+{
+	unsigned long *v=test_queue[test_qwr%TEST_QUEUE];
+	unsigned long ns=stat_z_samples;
+	unsigned char rv;
+
+	// Fields in the order of the DXX packet
+	if(mode_stream_format_pktctr)
+		*v++=mpumotiondata.packetctr;
+	if(mode_stream_format_ts)
+		*v++=mpumotiondata.time;
+	if(mode_stream_format_bat)
+		*v++=host_battery;
+	if(mode_stream_format_label)
+		*v++=CurrentAnnotation&0xffff;
+	if(sample_mode&MPU_MODE_BM_A)
+	{
+		*v++=(unsigned short)mpumotiondata.ax;*v++=(unsigned short)mpumotiondata.ay;*v++=(unsigned short)mpumotiondata.az;
+	}
+	if(sample_mode&MPU_MODE_BM_G)
+	{
+		*v++=(unsigned short)mpumotiondata.gx;*v++=(unsigned short)mpumotiondata.gy;*v++=(unsigned short)mpumotiondata.gz;
+	}
+	if(sample_mode&MPU_MODE_BM_M)
+	{
+		*v++=(unsigned short)mpumotiondata.mx;*v++=(unsigned short)mpumotiondata.my;*v++=(unsigned short)mpumotiondata.mz;
+	}
+	if(sample_mode&MPU_MODE_BM_Q)
+	{
+		*v++=test_quat(mpumotiongeometry.q0);*v++=test_quat(mpumotiongeometry.q1);
+		*v++=test_quat(mpumotiongeometry.q2);*v++=test_quat(mpumotiongeometry.q3);
+	}
+	// The block closed after this sample includes it
+	test_qwr++;
+	rv=stream_sample_z(&test_file);
+	// A sample which fails is accounted for by the caller only, whether the previous block could not be sent
+	// before it (it is not encoded) or the block closed after it could not be sent
+	if(stat_z_samples==ns)
+	{
+		HOST_CHECK(rv==1);
+		if(test_qrd==test_qwr)
+			test_numfailed++;
+		else
+			test_qwr--;
+	}
+	else
+		HOST_CHECK(rv==0);
+	HOST_CHECK(test_qwr-test_qrd<TEST_QUEUE);
+	return rv;
+}
+/******************************************************************************
+	function: test_step
+*******************************************************************************
+	Returns the next value of a random walk: mostly small steps, sometimes
+	steps over the whole range.
+******************************************************************************/
+signed short test_step(signed short x,unsigned r)
+{
+	if(r%100==0)
+		return rand();
+	if(r%100<20)
+		return x+(signed short)(rand()%512-256);
+	return x+(signed short)(rand()%16-8);
+}
+/******************************************************************************
+	function: test_roundtrip
+*******************************************************************************
+	Round trip of random samples in the given stream format and sample mode.
+******************************************************************************/
+void test_roundtrip(unsigned char format,unsigned char mode)
+{
+	unsigned r;
+
+	test_setformat(format,mode);
+	srand(format*256+mode);
+	test_failrate=10;
+	memset(&mpumotiondata,0,sizeof(mpumotiondata));
+	mpumotiondata.time=0xffffff00;					// Wraps around
+	mpumotiondata.packetctr=rand();
+	for(unsigned long it=0;it<20000;it++)
+	{
+		r=rand();
+		mpumotiondata.packetctr+=r%50==0?r%1000:1;
+		mpumotiondata.time+=r%200==0?r%100000:r%3;
+		mpumotiondata.ax=test_step(mpumotiondata.ax,r);
+		mpumotiondata.ay=test_step(mpumotiondata.ay,r>>1);
+		mpumotiondata.az=test_step(mpumotiondata.az,r>>2);
+		mpumotiondata.gx=test_step(mpumotiondata.gx,r>>3);
+		mpumotiondata.gy=test_step(mpumotiondata.gy,r>>4);
+		mpumotiondata.gz=test_step(mpumotiondata.gz,r>>5);
+		mpumotiondata.mx=test_step(mpumotiondata.mx,r>>6);
+		mpumotiondata.my=test_step(mpumotiondata.my,r>>7);
+		mpumotiondata.mz=test_step(mpumotiondata.mz,r>>8);
+		mpumotiongeometry.q0=(rand()%20001-10000)/10000.0;
+		mpumotiongeometry.q1=(rand()%20001-10000)/10000.0;
+		mpumotiongeometry.q2=mpumotiongeometry.q2+(rand()%21-10)/10000.0;
+		mpumotiongeometry.q3=0.5;
+		if(r%300==0)
+			host_battery=rand();
+		else if(r%20==0)
+			host_battery+=rand()%3-1;
+		if(r%1000==0)
+			CurrentAnnotation=rand()%10;
+		test_encode();
+		// The mode ends, or the log is switched
+		if(r%5000==0)
+			stream_sample_z_flush(&test_file);
+	}
+	stream_sample_z_flush(&test_file);
+	HOST_CHECK(test_numerr==0);
+	HOST_CHECK(test_qrd==test_qwr);
+	HOST_CHECK(test_qwr-test_numfailed==stat_z_samples);
+	HOST_CHECK(test_lost-test_numfailed==stat_z_lost);
+	HOST_CHECK(test_bytes==stat_z_bytes);
+	HOST_CHECK(test_numblock-stat_z_blocks>0);
+	if(test_numerr || host_numfail)
+		printf("Format %u mode %u: %lu samples in %lu blocks, %lu lost, %lu errors\n",format,mode,test_qwr,test_numblock,test_lost,test_numerr);
+}
+
+/******************************************************************************
+	Benchmark
+******************************************************************************/
+typedef struct {
+	signed short ax,ay,az,gx,gy,gz,mx,my,mz;
+} TESTSAMPLE;
+
+TESTSAMPLE *test_trace;
+unsigned long test_tracen;
+
+/******************************************************************************
+	function: test_noise
+*******************************************************************************
+	Approximately gaussian noise of standard deviation sigma.
+******************************************************************************/
+signed short test_noise(double sigma)
+{
+	double s=0;
+
+	for(unsigned char i=0;i<12;i++)
+		s+=rand()/(double)RAND_MAX;
+	return (signed short)((s-6.0)*sigma);
+}
+/******************************************************************************
+	function: test_synth
+*******************************************************************************
+	Synthetic trace: gravity on z (+-2g range), a periodic motion of the given
+	amplitude (fraction of the range), and sensor noise of standard deviation
+	sigma (LSB).
+******************************************************************************/
+void test_synth(unsigned long n,unsigned short rate,double amp,double sigma)
+{
+	double t,m;
+
+	srand(n);
+	for(unsigned long i=0;i<n;i++)
+	{
+		t=(double)i/rate;
+		m=amp*sin(2*M_PI*1.8*t)+amp*0.3*sin(2*M_PI*5.3*t);
+		test_trace[i].ax=(signed short)(m*16384)+test_noise(sigma);
+		test_trace[i].ay=(signed short)(m*0.5*16384*cos(2*M_PI*0.3*t))+test_noise(sigma);
+		test_trace[i].az=16384+(signed short)(m*0.2*16384)+test_noise(sigma);
+		test_trace[i].gx=(signed short)(m*0.5*32767)+test_noise(sigma);
+		test_trace[i].gy=(signed short)(m*0.2*32767*cos(2*M_PI*0.7*t))+test_noise(sigma);
+		test_trace[i].gz=test_noise(sigma);
+		test_trace[i].mx=(signed short)(300*cos(2*M_PI*0.05*t))+test_noise(sigma/4);
+		test_trace[i].my=(signed short)(300*sin(2*M_PI*0.05*t))+test_noise(sigma/4);
+		test_trace[i].mz=-200+test_noise(sigma/4);
+	}
+	test_tracen=n;
+}
+/******************************************************************************
+	function: test_readtrace
+*******************************************************************************
+	Reads a recorded trace.
+
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char test_readtrace(const char *name)
+{
+	char *buf,*p,*e;
+	signed short v[9];
+	long n,size=0;
+	int fd;
+
+	fd=open(name,O_RDONLY);
+	if(fd<0)
+	{
+		printf("Cannot open the trace %s\n",name);
+		return 1;
+	}
+	buf=(char*)malloc(64*1024*1024+1);
+	while((n=read(fd,buf+size,64*1024*1024-size))>0)
+		size+=n;
+	close(fd);
+	buf[size]=0;
+	test_tracen=0;
+	for(p=buf;*p && test_tracen<TEST_TRACE_MAX;)
+	{
+		unsigned char i;
+		for(i=0;i<9;i++)
+		{
+			while(*p==' ' || *p=='\t' || *p==',')
+				p++;
+			if(*p=='\r' || *p=='\n')
+				break;
+			v[i]=strtol(p,&e,0);
+			if(e==p)
+				break;
+			p=e;
+		}
+		if(i>=6)
+		{
+			for(;i<9;i++)
+				v[i]=0;
+			memcpy(&test_trace[test_tracen++],v,sizeof(v));
+		}
+		// Next line
+		while(*p && *p!='\n')
+			p++;
+		if(*p)
+			p++;
+	}
+	free(buf);
+	printf("Trace %s: %lu samples\n",name,test_tracen);
+	return test_tracen?0:1;
+}
+/******************************************************************************
+	function: test_bench
+*******************************************************************************
+	Encodes the trace in the given stream format and sample mode at the given
+	rate and prints the compression ratio, the bytes per sample and the
+	encoding time on the host.
+******************************************************************************/
+void test_bench(const char *name,unsigned char format,unsigned char mode,unsigned short rate)
+{
+	unsigned long long t0;
+	unsigned long raw;
+	double ns;
+
+	test_setformat(format,mode);
+	test_failrate=0;
+	test_decodeonly=1;
+	memset(&mpumotiondata,0,sizeof(mpumotiondata));
+	mpumotiongeometry.q0=1;
+	mpumotiongeometry.q1=mpumotiongeometry.q2=mpumotiongeometry.q3=0;
+	t0=host_clock_ns();
+	for(unsigned long i=0;i<test_tracen;i++)
+	{
+		mpumotiondata.packetctr++;
+		mpumotiondata.time=i*1000/rate;
+		memcpy(&mpumotiondata,&test_trace[i],sizeof(TESTSAMPLE));
+		if(mode&MPU_MODE_BM_Q)
+		{
+			double a=i*0.001;
+			mpumotiongeometry.q0=cos(a);
+			mpumotiongeometry.q1=sin(a)*0.6;
+			mpumotiongeometry.q2=sin(a)*0.8;
+		}
+		stream_sample_z(&test_file);
+	}
+	stream_sample_z_flush(&test_file);
+	ns=host_clock_ns()-t0;
+	test_decodeonly=0;
+	raw=test_tracen*stream_sample_bin_size();
+	HOST_CHECK(stat_z_lost==0);
+	HOST_CHECK(test_bytes==stat_z_bytes);
+	printf("%-22s format %2u mode %2u %4uHz: DXX %2u B/sample, DXZ %5.2f B/sample, ratio %5.2f, %lu blocks, %5.0f ns/sample\n",
+		name,format,mode,rate,stream_sample_bin_size(),(double)stat_z_bytes/test_tracen,stat_z_bytes?(double)raw/stat_z_bytes:0,stat_z_blocks,ns/test_tracen);
+}
+
+int main(int argc,char **argv)
+{
+	static const unsigned char modes[]={0,MPU_MODE_BM_A,MPU_MODE_BM_G,MPU_MODE_BM_A|MPU_MODE_BM_G,MPU_MODE_BM_A|MPU_MODE_BM_G|MPU_MODE_BM_M,
+		MPU_MODE_BM_Q,MPU_MODE_BM_A|MPU_MODE_BM_G|MPU_MODE_BM_M|MPU_MODE_BM_Q};
+	static const char *noisename[]={"quiet, noise 2 LSB","walking, noise 8 LSB","running, noise 32 LSB"};
+	static const double noiseamp[]={0.01,0.25,0.8};
+	static const double noisesigma[]={2,8,32};
+	const char *trace=0;
+	unsigned short rate=100;
+	int c;
+
+	host_init();
+	while((c=getopt(argc,argv,"t:r:"))!=-1)
+	{
+		switch(c)
+		{
+			case 't': trace=optarg; break;
+			case 'r': rate=strtoul(optarg,0,0); break;
+			default:
+				printf("Usage: %s [-t trace] [-r rate] [image]\n",argv[0]);
+				return 1;
+		}
+	}
+	if(rate==0)
+		rate=100;
+	fdev_setup_stream(&test_file,0,0,_FDEV_SETUP_WRITE);
+	fdev_set_udata(&test_file,&test_serial);
+
+	for(unsigned char format=0;format<16;format++)
+		for(unsigned char m=0;m<sizeof(modes);m++)
+			test_roundtrip(format,modes[m]);
+	printf("Round trip: %lu checks, %lu failures\n",host_numtest,host_numfail);
+
+	test_trace=(TESTSAMPLE*)malloc(TEST_TRACE_MAX*sizeof(TESTSAMPLE));
+	for(unsigned char k=0;k<3;k++)
+	{
+		test_synth(20000,100,noiseamp[k],noisesigma[k]);
+		test_bench(noisename[k],2,MPU_MODE_BM_A|MPU_MODE_BM_G,100);
+		test_bench(noisename[k],3,MPU_MODE_BM_A|MPU_MODE_BM_G|MPU_MODE_BM_M,100);
+		test_bench(noisename[k],2,MPU_MODE_BM_A|MPU_MODE_BM_G|MPU_MODE_BM_M|MPU_MODE_BM_Q,100);
+		test_synth(50000,1000,noiseamp[k],noisesigma[k]);
+		test_bench(noisename[k],2,MPU_MODE_BM_A|MPU_MODE_BM_G,1000);
+	}
+	if(trace)
+	{
+		if(test_readtrace(trace))
+			HOST_CHECK(0);
+		else
+		{
+			test_bench(trace,2,MPU_MODE_BM_A|MPU_MODE_BM_G,rate);
+			test_bench(trace,2,MPU_MODE_BM_A|MPU_MODE_BM_G|MPU_MODE_BM_M,rate);
+		}
+	}
+	free(test_trace);
+	return host_result("test_dxz");
+}
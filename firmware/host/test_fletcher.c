@@ -0,0 +1,104 @@
+/*
+	file: test_fletcher
+
+	Equivalence of the Fletcher-16 variants of pkt on buffers of random content and of all 0x00 and all 0xFF,
+	for all the lengths up to 600 bytes (which covers the blocks of 21 bytes of packet_fletcher16 and the unrolled
+	loop of packet_fletcher16_asm) and random lengths up to 4096 bytes:
+
+	* packet_fletcher16 (reference implementation)
+	* packet_fletcher16_asm (on the host, a model of the instructions of helper_num.S)
+	* FLETCHER16, folded in as bytes are appended
+	* host_fletcher16, computed from the definition
+
+	packet_addchecksum_fletcher16_little must append the checksum of a PACKET filled with fields which are not
+	byte aligned, in little endian.
+
+	Usage: test_fletcher [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pkt.h"
+#include "hostshim.h"
+
+#define TEST_MAXLEN 4096
+
+unsigned long test_numerr;
+
+/******************************************************************************
+	function: test_buffer
+*******************************************************************************
+	Compares the checksums of a buffer.
+******************************************************************************/
+void test_buffer(unsigned char *b,unsigned short len,const char *name)
+{
+	FLETCHER16 f;
+	unsigned short c,ca,cf,ch;
+
+	fletcher16_init(&f);
+	for(unsigned short i=0;i<len;i++)
+		fletcher16_add8(&f,b[i]);
+	c=packet_fletcher16(b,len);
+	ca=packet_fletcher16_asm(b,len);
+	cf=fletcher16_get(&f);
+	ch=host_fletcher16(b,len);
+	if(c!=ca || c!=cf || c!=ch)
+	{
+		if(test_numerr<10)
+			printf("%s, %u bytes: packet_fletcher16 %04X asm %04X FLETCHER16 %04X reference %04X\n",name,len,c,ca,cf,ch);
+		test_numerr++;
+	}
+}
+/******************************************************************************
+	function: test_packet
+*******************************************************************************
+	Checksum of a PACKET with fields of random sizes.
+******************************************************************************/
+void test_packet(void)
+{
+	PACKET p;
+	unsigned short s,c;
+
+	packet_init(&p,"DXY",3);
+	while(((p.dptr-p.data)*8+p.bitptr)<(__PKT_DATA_MAXSIZE-3)*8-32)
+	{
+		unsigned char n=rand()%32+1;
+		packet_addbits_little(&p,rand()*65536UL+rand(),n);
+	}
+	packet_addchecksum_fletcher16_little(&p);
+	s=packet_size(&p);
+	c=p.data[s-2]|(p.data[s-1]<<8);
+	HOST_CHECK(p.bitptr==0);
+	HOST_CHECK(c==host_fletcher16(p.data,s-2));
+}
+
+int main(int argc,char **argv)
+{
+	static unsigned char b[TEST_MAXLEN];
+	unsigned short len;
+
+	host_init();
+	srand(1);
+	for(len=0;len<=600;len++)
+	{
+		for(unsigned short i=0;i<len;i++)
+			b[i]=rand();
+		test_buffer(b,len,"Random");
+		memset(b,0,len);
+		test_buffer(b,len,"0x00");
+		memset(b,0xff,len);
+		test_buffer(b,len,"0xFF");
+	}
+	for(unsigned short it=0;it<2000;it++)
+	{
+		len=rand()%(TEST_MAXLEN+1);
+		// Random bytes, or bytes near 0xFF which exercise the end-around carry
+		for(unsigned short i=0;i<len;i++)
+			b[i]=it&1?rand():0xff-rand()%4;
+		test_buffer(b,len,"Random length");
+	}
+	HOST_CHECK(test_numerr==0);
+	for(unsigned short it=0;it<1000;it++)
+		test_packet();
+	return host_result("test_fletcher");
+}
@@ -0,0 +1,324 @@
+/*
+	file: test_format
+
+	Checks of the FAT32 layout written by ufat_format on large simulated cards (8GB to 128GB), with several
+	numbers of logs and cluster sizes, as a FAT32 implementation of a host would read it. The checks decode
+	the image from the FAT32 specification only, not from the structures of uFAT:
+
+	* MBR: signature, one FAT32 LBA partition (0x0C) within the card.
+	* Boot sector: jump, 512 byte sectors, power of two cluster size, one FAT, FAT32 fields (no fixed root, 32-bit
+	sizes), hidden sectors and size equal to the partition, signature; FSInfo sector and backup boot sector.
+	* Enough clusters to be FAT32 (at least 65525), and a FAT large enough for all of them.
+	* FAT: media and end of chain entries, ROOT directory chain.
+	* ROOT: volume label and log files with valid 8.3 names, ended by an empty entry. Each file has a chain of
+	consecutive clusters, within the partition, large enough for its size, not larger than the FAT32 4GB
+	limit and not shared with another file or the ROOT.
+	* After logs are written on the card formatted with uFAT, the files contain the data written.
+
+	Usage: test_format <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd.h"
+#include "ufat.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+#define TEST_MAXFILE 64
+
+typedef struct
+{
+	char name[13];
+	unsigned long cluster;
+	unsigned long size;
+	unsigned long numcluster;						// Length of the chain
+} TEST_FILE;
+
+// Decoded layout
+unsigned long test_spc,test_fat,test_data,test_numcluster;
+unsigned char test_fatsect[512];
+unsigned long test_fatsectnum=0xffffffff;
+TEST_FILE test_files[TEST_MAXFILE];
+unsigned char test_numfiles;
+
+// Cards: capacity in sectors, number of logs, sectors per cluster
+const unsigned long test_cards[][3]={
+	{16777216,4,64},									// 8GB
+	{67108864,14,64},									// 32GB
+	{134217728,40,128},									// 64GB: 3 ROOT sectors
+	{268435456,16,128},									// 128GB
+	{268435456,4,128},									// 128GB: logs limited to 4GB
+	{67108864,30,0},									// 32GB: default cluster size
+};
+#define TEST_NUMCARD (sizeof(test_cards)/sizeof(test_cards[0]))
+
+unsigned long test_u32(const unsigned char *p)
+{
+	return p[0]|((unsigned long)p[1]<<8)|((unsigned long)p[2]<<16)|((unsigned long)p[3]<<24);
+}
+unsigned short test_u16(const unsigned char *p)
+{
+	return p[0]|(p[1]<<8);
+}
+/******************************************************************************
+	function: test_fatentry
+*******************************************************************************
+	Entry of cluster c in the FAT, without the 4 reserved bits.
+******************************************************************************/
+unsigned long test_fatentry(unsigned long c)
+{
+	if(c/128!=test_fatsectnum)
+	{
+		test_fatsectnum=c/128;
+		HOST_CHECK(hostsd_readsector(test_fat+test_fatsectnum,(char*)test_fatsect)==0);
+	}
+	return test_u32(test_fatsect+(c&127)*4)&0x0fffffff;
+}
+/******************************************************************************
+	function: test_chain
+*******************************************************************************
+	Follows the chain of cluster c, which must be made of consecutive clusters
+	in the partition ended by an end of chain mark.
+
+	Returns:
+		Number of clusters of the chain, 0 if invalid
+******************************************************************************/
+unsigned long test_chain(unsigned long c)
+{
+	unsigned long n=1,next;
+
+	if(c<2 || c>=test_numcluster+2)
+		return 0;
+	while(1)
+	{
+		next=test_fatentry(c);
+		if(next>=0x0ffffff8)
+			return n;
+		if(next!=c+1 || next>=test_numcluster+2)
+		{
+			printf("Cluster %lu: next cluster %lu\n",c,next);
+			return 0;
+		}
+		c=next;
+		n++;
+	}
+}
+/******************************************************************************
+	function: test_validname
+*******************************************************************************
+	Whether the name or extension has only valid characters of 8.3 names,
+	padded with spaces.
+******************************************************************************/
+unsigned char test_validname(const unsigned char *s,unsigned char n)
+{
+	unsigned char pad=0;
+
+	for(unsigned char i=0;i<n;i++)
+	{
+		if(s[i]==' ')
+			pad=1;
+		else if(pad || s[i]<0x20 || (s[i]>='a' && s[i]<='z') || strchr("\"*+,./:;<=>?[\\]|",s[i]))
+			return 0;
+	}
+	return s[0]!=' ' || n==3;
+}
+/******************************************************************************
+	function: test_check
+*******************************************************************************
+	Checks the FAT32 file system of the card and decodes the files of the ROOT.
+******************************************************************************/
+void test_check(unsigned long capacity)
+{
+	unsigned char b[512],bk[512],*e;
+	unsigned long part,numsec,tot,root,rootlen;
+	unsigned char end=0,media;
+
+	test_fatsectnum=0xffffffff;
+	test_numfiles=0;
+	// MBR
+	HOST_CHECK(hostsd_readsector(0,(char*)b)==0);
+	HOST_CHECK(b[510]==0x55 && b[511]==0xAA);
+	HOST_CHECK(b[446+4]==0x0C);
+	part=test_u32(b+446+8);
+	numsec=test_u32(b+446+12);
+	HOST_CHECK(part>0 && part+numsec<=capacity);
+	// Boot sector
+	HOST_CHECK(hostsd_readsector(part,(char*)b)==0);
+	HOST_CHECK((b[0]==0xEB && b[2]==0x90) || b[0]==0xE9);
+	HOST_CHECK(test_u16(b+11)==512);
+	test_spc=b[13];
+	HOST_CHECK(test_spc>=1 && test_spc<=128 && (test_spc&(test_spc-1))==0);
+	HOST_CHECK(test_u16(b+14)>=8);						// Reserved sectors: boot, FSInfo, backup boot sector
+	HOST_CHECK(b[16]==1);
+	HOST_CHECK(test_u16(b+17)==0 && test_u16(b+19)==0 && test_u16(b+22)==0);
+	media=b[21];
+	HOST_CHECK(media>=0xF0);
+	HOST_CHECK(test_u32(b+28)==part);
+	tot=test_u32(b+32);
+	HOST_CHECK(tot==numsec);
+	HOST_CHECK(test_u16(b+42)==0);						// FAT32 version 0.0
+	HOST_CHECK(b[66]==0x29 && memcmp(b+82,"FAT32   ",8)==0);
+	HOST_CHECK(b[510]==0x55 && b[511]==0xAA);
+	test_fat=part+test_u16(b+14);
+	test_data=test_fat+b[16]*test_u32(b+36);
+	test_numcluster=(tot-(test_data-part))/test_spc;
+	root=test_u32(b+44);
+	HOST_CHECK(test_numcluster>=65525);
+	HOST_CHECK(test_u32(b+36)*128>=test_numcluster+2);
+	// Backup boot sector and FSInfo
+	HOST_CHECK(test_u16(b+50)==6);
+	HOST_CHECK(hostsd_readsector(part+6,(char*)bk)==0 && memcmp(b,bk,512)==0);
+	HOST_CHECK(test_u16(b+48)==1);
+	HOST_CHECK(hostsd_readsector(part+1,(char*)b)==0);
+	HOST_CHECK(test_u32(b)==0x41615252 && test_u32(b+484)==0x61417272 && test_u32(b+508)==0xAA550000);
+	HOST_CHECK(test_u32(b+488)==0xffffffff || test_u32(b+488)<=test_numcluster);
+	// FAT: media in entry 0, entry 1 end of chain
+	HOST_CHECK(test_fatentry(0)==(0x0fffff00|media));
+	HOST_CHECK(test_fatentry(1)>=0x0ffffff8);
+	// ROOT
+	rootlen=test_chain(root);
+	HOST_CHECK(rootlen>=1);
+	for(unsigned long s=0;s<rootlen*test_spc && !end;s++)
+	{
+		HOST_CHECK(hostsd_readsector(test_data+(root-2)*test_spc+s,(char*)b)==0);
+		for(unsigned short i=0;i<512 && !end;i+=32)
+		{
+			e=b+i;
+			if(e[0]==0)
+			{
+				end=1;
+				break;
+			}
+			if(e[0]==0xE5)
+				continue;
+			if(e[11]&0x08)
+			{
+				// Volume label in the first entry only
+				HOST_CHECK(s==0 && i==0);
+				continue;
+			}
+			HOST_CHECK(test_validname(e,8) && test_validname(e+8,3));
+			HOST_CHECK((e[11]&0x18)==0);
+			if(test_numfiles>=TEST_MAXFILE)
+			{
+				HOST_CHECK(0);
+				continue;
+			}
+			TEST_FILE *f=&test_files[test_numfiles++];
+			memcpy(f->name,e,8);
+			f->name[8]='.';
+			memcpy(f->name+9,e+8,3);
+			f->name[12]=0;
+			f->cluster=((unsigned long)test_u16(e+20)<<16)|test_u16(e+26);
+			f->size=test_u32(e+28);
+			f->numcluster=test_chain(f->cluster);
+			HOST_CHECK(f->numcluster>0);
+			HOST_CHECK(f->numcluster*test_spc*512>=f->size);
+			HOST_CHECK((unsigned long long)f->numcluster*test_spc*512<=0x100000000ULL);
+			// No cluster shared with the ROOT or another file (the chains are runs of consecutive clusters)
+			HOST_CHECK(f->cluster>=root+rootlen || f->cluster+f->numcluster<=root);
+			for(unsigned char j=0;j+1<test_numfiles;j++)
+				HOST_CHECK(f->cluster>=test_files[j].cluster+test_files[j].numcluster || f->cluster+f->numcluster<=test_files[j].cluster);
+		}
+	}
+}
+/******************************************************************************
+	function: test_checkdata
+*******************************************************************************
+	Checks that file f holds the test pattern of log n.
+******************************************************************************/
+void test_checkdata(TEST_FILE *f,unsigned char n)
+{
+	char sect[512];
+	unsigned long start=test_data+(f->cluster-2)*test_spc;
+
+	for(unsigned long i=0;i<f->size;i++)
+	{
+		if((i&511)==0)
+			HOST_CHECK(hostsd_readsector(start+i/512,sect)==0);
+		if(sect[i&511]!=(char)(host_pattern(i)^n))
+		{
+			printf("%s: data differs at byte %lu\n",f->name,i);
+			HOST_CHECK(0);
+			return;
+		}
+	}
+}
+/******************************************************************************
+	function: test_card
+*******************************************************************************
+	Formats a card, checks the file system, writes some logs and checks the
+	files again.
+******************************************************************************/
+void test_card(const char *image,unsigned long capacity,unsigned char numlog,unsigned char spc)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long sdcapacity,size[3];
+	char rec[200];
+	unsigned char log[3],s;
+
+	// The erase of the whole card by ufat_format must end within SD_ERASE_TIMEOUT: 100us per MB (13s for 128GB)
+	hostsd_param.erase_busy_per_mb_us=100;
+	if(host_sdinit(image,capacity))
+	{
+		HOST_CHECK(0);
+		return;
+	}
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&sdcapacity)==0);
+	HOST_CHECK(ufat_format(numlog,spc)==0);
+	// ufat_format creates at most as many logs as the ROOT holds
+	if(numlog>_UFAT_NUMLOGENTRY)
+		numlog=_UFAT_NUMLOGENTRY;
+	log[0]=0;
+	log[1]=1;
+	log[2]=numlog-1;
+	test_check(capacity);
+	printf("Card %lu GB, %u logs, %u sectors per cluster: %lu clusters, FAT %lu sectors, %u files of %lu clusters (%llu MB)\n",
+		capacity>>21,numlog,(unsigned char)test_spc,test_numcluster,test_data-test_fat,test_numfiles,test_files[0].numcluster,
+		(unsigned long long)test_files[0].numcluster*test_spc/2048);
+	HOST_CHECK(test_numfiles==numlog);
+	HOST_CHECK(test_spc==(spc?spc:UFAT_SECTPERCLUST_DEFAULT));
+	for(unsigned char i=0;i<test_numfiles;i++)
+		HOST_CHECK(test_files[i].size==0 && test_files[i].numcluster==test_files[0].numcluster);
+
+	// Logs in the first and last ROOT sectors
+	HOST_CHECK(ufat_init()==0);
+	for(unsigned char l=0;l<3;l++)
+	{
+		size[l]=100000*(l+1)+rand()%1000;
+		HOST_CHECK(ufat_log_open(log[l])!=0);
+		for(unsigned long n=0;n<size[l];n+=s)
+		{
+			s=size[l]-n>sizeof(rec)?sizeof(rec):size[l]-n;
+			for(unsigned char i=0;i<s;i++)
+				rec[i]=host_pattern(n+i)^log[l];
+			HOST_CHECK(_ufat_log_fputbuf(rec,s)==0);
+		}
+		HOST_CHECK(ufat_log_close()==0);
+	}
+	test_check(capacity);
+	for(unsigned char l=0;l<3;l++)
+	{
+		HOST_CHECK(test_files[log[l]].size==size[l]);
+		test_checkdata(&test_files[log[l]],log[l]);
+	}
+	HOST_CHECK(hostsd_stat.protocol_errors==0 && hostsd_stat.write_errors==0);
+	hostsd_close();
+}
+
+int main(int argc,char **argv)
+{
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	for(unsigned char i=0;i<TEST_NUMCARD;i++)
+		test_card(argv[1],test_cards[i][0],test_cards[i][1],test_cards[i][2]);
+	return host_result("test_format");
+}
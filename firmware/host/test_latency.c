@@ -0,0 +1,206 @@
+/*
+	file: test_latency
+
+	Tests of the write latency characterisation (sd_bench_latency) on the simulated card:
+
+	* Histograms: counts, mean, busy tail and maximum of SDLATENCY, and the percentiles of
+	sd_lat_percentile compared to the exact percentiles of random latencies: the percentile is the
+	upper bound of its bin, i.e. at least the exact percentile and at most twice it (or 64us).
+	* Card: sd_bench_latency_run with each write method on cards with known busy times and stalls.
+	The data is written, the histogram holds one entry per sector, the median is at least the busy
+	time of the sectors written (erased or not), the stalls of the card appear in the maximum and in the
+	busy tail. Sectors written back to back exceed the rate of the card, so the cached writes fill the
+	staging ring and then wait for the card as the multiblock writes do.
+	* The report of sd_bench_latency with the default timing of the card, for regression tracking.
+
+	Usage: test_latency <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "helper.h"
+#include "sd.h"
+#include "ufat.h"
+#include "test_sd.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+#define TEST_CAPACITY 262144						// Capacity of the card in sectors (128MB)
+#define TEST_NUMSECT 2048							// Sectors written by each method
+#define TEST_NUMVAL 5000							// Latencies of the histogram tests
+
+/******************************************************************************
+	function: test_cmp
+*******************************************************************************
+	Comparison of latencies for qsort.
+******************************************************************************/
+int test_cmp(const void *a,const void *b)
+{
+	unsigned long x=*(const unsigned long*)a,y=*(const unsigned long*)b;
+
+	return x<y?-1:x>y;
+}
+/******************************************************************************
+	function: test_hist
+*******************************************************************************
+	Histograms of random latencies spread over 10us-2s.
+******************************************************************************/
+void test_hist(void)
+{
+	static unsigned long v[TEST_NUMVAL];
+	const unsigned short permil[]={10,100,500,900,990,999,1000};
+	SDLATENCY l;
+	unsigned long long tot,totbusy;
+	unsigned long numbusy,sum,e,p;
+
+	for(unsigned char it=0;it<20;it++)
+	{
+		sd_lat_clear(&l);
+		HOST_CHECK(l.n==0 && l.max==0 && sd_lat_percentile(&l,500)==0);
+		tot=totbusy=numbusy=0;
+		for(unsigned short i=0;i<TEST_NUMVAL;i++)
+		{
+			// Log-uniform, with a share of values on the bin boundaries
+			v[i]=10*(1ul<<rand()%18)+(rand()%4?rand()%1000:0);
+			if(rand()%8==0)
+				v[i]=64ul<<rand()%16;
+			sd_lat_insert(&l,v[i]);
+			tot+=v[i];
+			if(v[i]>=1000)
+			{
+				numbusy++;
+				totbusy+=v[i];
+			}
+		}
+		qsort(v,TEST_NUMVAL,sizeof(v[0]),test_cmp);
+		sum=0;
+		for(unsigned char b=0;b<SD_LAT_NUMBIN;b++)
+			sum+=l.bin[b];
+		HOST_CHECK(sum==TEST_NUMVAL && l.n==TEST_NUMVAL);
+		HOST_CHECK(l.max==v[TEST_NUMVAL-1]);
+		HOST_CHECK(l.tot==tot && l.numbusy==numbusy && l.totbusy==totbusy);
+		for(unsigned char i=0;i<sizeof(permil)/sizeof(permil[0]);i++)
+		{
+			// Exact percentile: the smallest latency with at least permil of the latencies not above it
+			e=v[((unsigned long)TEST_NUMVAL*permil[i]+999)/1000-1];
+			p=sd_lat_percentile(&l,permil[i]);
+			HOST_CHECK(p>=e && p<=l.max);
+			HOST_CHECK(p<=64 || p<=2*e);
+		}
+	}
+}
+/******************************************************************************
+	function: test_checkdata
+*******************************************************************************
+	Checks the sectors written by sd_bench_latency_run.
+******************************************************************************/
+void test_checkdata(unsigned long startsect)
+{
+	char e[512],sect[512];
+
+	memset(e,'0',512);
+	for(unsigned long i=0;i<TEST_NUMSECT;i++)
+	{
+		format1u32(e,i);
+		HOST_CHECK(hostsd_readsector(startsect+i,sect)==0);
+		if(memcmp(e,sect,512))
+		{
+			printf("Sector %lu differs\n",startsect+i);
+			HOST_CHECK(0);
+			return;
+		}
+	}
+}
+/******************************************************************************
+	function: test_card
+*******************************************************************************
+	Runs each write method on a card with the given busy times.
+
+	Parameters:
+		busy		-	Busy time after writing an erased sector (us)
+		dirty		-	Busy time after writing a sector which is not erased (us)
+		stallevery	-	The card stalls every stallevery blocks written, 0 for none
+		stall		-	Duration of a stall (us)
+******************************************************************************/
+void test_card(unsigned long busy,unsigned long dirty,unsigned long stallevery,unsigned long stall)
+{
+	const char *name[5]={"single block","multiblock","multiblock, pre-erase","multiblock, erased","multiblock, cached"};
+	SDLATENCY l;
+	unsigned long startsect,sum,mean[5],p50[5],numstall;
+
+	hostsd_param.write_busy_us=busy;
+	hostsd_param.write_busy_dirty_us=dirty;
+	hostsd_param.write_stall_every=stallevery;
+	hostsd_param.write_stall_us=stall;
+	printf("Card: busy %lu us erased, %lu us not erased, stall of %lu us every %lu blocks\n",busy,dirty,stall,stallevery);
+	for(unsigned char type=0;type<5;type++)
+	{
+		// Sectors which are not erased, as on a used card
+		startsect=rand()%(TEST_CAPACITY/TEST_NUMSECT-1)*TEST_NUMSECT;
+		hostsd_clearstat();
+		HOST_CHECK(sd_bench_latency_run(type,startsect,TEST_NUMSECT,&l)==0);
+		printf("%s:\n",name[type]);
+		sd_lat_print(file_pri,&l);
+		test_checkdata(startsect);
+		HOST_CHECK(hostsd_stat.protocol_errors==0 && hostsd_stat.write_errors==0);
+		HOST_CHECK(hostsd_stat.blocks_written==TEST_NUMSECT);
+
+		sum=0;
+		for(unsigned char b=0;b<SD_LAT_NUMBIN;b++)
+			sum+=l.bin[b];
+		HOST_CHECK(l.n==TEST_NUMSECT && sum==TEST_NUMSECT);
+		mean[type]=l.tot/l.n;
+		p50[type]=sd_lat_percentile(&l,500);
+		numstall=stallevery?TEST_NUMSECT/stallevery:0;
+		if(type<4)
+		{
+			// The transfer of a sector and the busy time of the card are in the latency of the write
+			HOST_CHECK(p50[type]>=(type==3?busy:dirty));
+			HOST_CHECK(mean[type]>=(type==3?busy:dirty)+512*hostsd_param.byte_ns/1000);
+			HOST_CHECK(numstall==0 || l.max>=stall);
+			if(stall>=1000)
+				HOST_CHECK(l.numbusy>=numstall);
+		}
+		else
+		{
+			// The staging ring is full after the first sectors: the rate is that of the multiblock write
+			HOST_CHECK(mean[type]<=mean[1]*105/100);
+			HOST_CHECK(l.max<=stall+dirty+2000);
+		}
+	}
+	HOST_CHECK(busy==dirty || p50[3]<p50[1]);
+}
+
+int main(int argc,char **argv)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long capacity;
+
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	test_hist();
+	if(host_sdinit(argv[1],TEST_CAPACITY))
+		return 1;
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&capacity)==0);
+
+	test_card(250,900,0,0);
+	test_card(250,900,512,40000);
+	test_card(100,3000,128,250000);
+	test_card(600,600,0,0);
+
+	// Report with the default timing: 100Hz of 64 byte samples
+	hostsd_defaultparam(&hostsd_param);
+	sd_bench_latency(0,TEST_NUMSECT,100,64);
+	HOST_CHECK(hostsd_stat.protocol_errors==0 && hostsd_stat.write_errors==0);
+
+	hostsd_close();
+	return host_result("test_latency");
+}
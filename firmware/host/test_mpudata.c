@@ -0,0 +1,215 @@
+/*
+	file: test_mpudata
+
+	Round trip of the motion data buffer (mpu_data) in every mode of mpu_config.
+
+	For each mode the buffer layout is selected as when automatic read is enabled, and samples are produced
+	as in the interrupt routine of mpu (oldest sample discarded when the buffer is full and the new sample is
+	stored, unless samples are claimed) with lost samples and gaps in time exceeding the header of compacted records. The samples are
+	consumed with mpu_data_getnext_raw and with mpu_data_getspans/mpu_data_unpack/mpu_data_commit, with
+	samples produced while others are claimed. Every sample read must equal the sample written, with the
+	channels not stored by the layout returned as 0.
+
+	Usage: test_mpudata [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpu.h"
+#include "mpu_config.h"
+#include "hostshim.h"
+
+#define TEST_QUEUE 1024								// Reference queue of the samples in the buffer (power of 2)
+
+MPUMOTIONDATA test_queue[TEST_QUEUE];
+unsigned long test_qrd,test_qwr;					// Read and write index of the reference queue
+unsigned long test_time,test_packetctr,test_dt;
+unsigned char test_burst;
+unsigned long test_numwr,test_numrd,test_numdiscard,test_numsync,test_numerr;
+
+/******************************************************************************
+	function: test_expected
+*******************************************************************************
+	Returns the sample d as returned by the buffer with the given layout.
+******************************************************************************/
+MPUMOTIONDATA test_expected(const MPUMOTIONDATA &d,unsigned char layout)
+{
+	MPUMOTIONDATA e;
+
+	if(!layout)
+		return d;
+	memset(&e,0,sizeof(e));
+	if(layout&MPU_MODE_BM_A)
+	{
+		e.ax=d.ax;e.ay=d.ay;e.az=d.az;
+	}
+	if(layout&MPU_MODE_BM_G)
+	{
+		e.gx=d.gx;e.gy=d.gy;e.gz=d.gz;
+	}
+	e.time=d.time;
+	e.packetctr=d.packetctr;
+	return e;
+}
+/******************************************************************************
+	function: test_check
+*******************************************************************************
+	Compares a sample read from the buffer with the next sample of the
+	reference queue.
+******************************************************************************/
+void test_check(const MPUMOTIONDATA &d)
+{
+	MPUMOTIONDATA e;
+
+	if(test_qrd==test_qwr)
+	{
+		printf("Sample read from an empty buffer\n");
+		test_numerr++;
+		return;
+	}
+	e=test_expected(test_queue[test_qrd%TEST_QUEUE],mpu_data_layout);
+	test_qrd++;
+	test_numrd++;
+	if(memcmp(&d,&e,sizeof(e)))
+	{
+		if(test_numerr<10)
+			printf("Sample %lu differs: time %lu/%lu packetctr %lu/%lu ax %d/%d gx %d/%d mx %d/%d\n",test_qrd-1,d.time,e.time,d.packetctr,e.packetctr,d.ax,e.ax,d.gx,e.gx,d.mx,e.mx);
+		test_numerr++;
+	}
+}
+/******************************************************************************
+	function: test_produce
+*******************************************************************************
+	Produces a sample as the interrupt routine of mpu does.
+******************************************************************************/
+void test_produce(void)
+{
+	MPUMOTIONDATA d;
+	unsigned long r=rand();
+	unsigned char level;
+
+	// Lost samples, and rarely gaps in packetctr or time which do not fit in the header of a compacted record
+	test_packetctr+=(r%100<5)?r%MPU_DATA_RECDCMAX+1:1;
+	if(r%1000==1 || test_burst)
+		test_packetctr+=MPU_DATA_RECDCMAX+r%100;
+	// Rarely a burst of such gaps, which exhausts the sync entries
+	if(test_burst)
+		test_burst--;
+	else if(r%10000==2)
+		test_burst=2*MPU_DATA_NUMSYNC;
+	test_time+=test_dt;
+	if(r%1000==0)
+		test_time+=MPU_DATA_RECDTMAX+r%10000;
+
+	d.ax=rand();d.ay=rand();d.az=rand();
+	d.gx=rand();d.gy=rand();d.gz=rand();
+	d.mx=rand();d.my=rand();d.mz=rand();
+	d.ms=rand();
+	d.temp=rand();
+	d.time=test_time;
+	d.packetctr=test_packetctr;
+
+	if(mpu_data_isfull() && mpu_data_claimed)
+	{
+		test_numdiscard++;
+		return;
+	}
+	// The sample is stored in the free entry at mpu_data_wrptr before the oldest is discarded
+	if(mpu_data_layout)
+	{
+		level=mpu_data_level();
+		if(_mpu_data_wrpack(&d))
+		{
+			// A sample not stored costs only this sample
+			HOST_CHECK(mpu_data_level()==level);
+			test_numsync++;
+			return;
+		}
+	}
+	else
+		memcpy(&mpu_data[mpu_data_wrptr*mpu_data_recsize],&d,sizeof(d));
+	if(mpu_data_isfull())
+	{
+		_mpu_data_rdnext();
+		test_qrd++;
+		test_numdiscard++;
+	}
+	_mpu_data_wrnext();
+	test_queue[test_qwr%TEST_QUEUE]=d;
+	test_qwr++;
+	test_numwr++;
+}
+/******************************************************************************
+	function: test_mode
+*******************************************************************************
+	Round trip of the samples in mode m of config_sensorsr_settings.
+******************************************************************************/
+void test_mode(unsigned char m)
+{
+	unsigned char mode=config_sensorsr_settings[m][0];
+	unsigned short splrate=config_sensorsr_settings[m][11];
+	MPUMOTIONDATA d;
+	unsigned char *s1,*s2,*p,n1,n2,n;
+
+	mpu_clearbuffer();
+	_mpu_data_setlayout(mode);
+	HOST_CHECK(mpu_data_recsize==_mpu_data_getrecsize(mpu_data_layout));
+	HOST_CHECK(mpu_data_capacity>=MPU_MOTIONBUFFERSIZE);
+	HOST_CHECK((unsigned)mpu_data_capacity*mpu_data_recsize<=MPU_MOTIONBUFFERBYTES);
+
+	srand(m);
+	test_qrd=test_qwr=0;
+	test_time=1000;
+	test_packetctr=0;
+	test_burst=0;
+	test_dt=splrate?(1000+splrate-1)/splrate:1;
+	test_numwr=test_numrd=test_numdiscard=test_numsync=test_numerr=0;
+	for(unsigned long it=0;it<100000;it++)
+	{
+		unsigned r=rand()%100;
+		// One phase in four the consumer is stalled and the buffer overflows
+		if(r<55 || (it/2000)%4==3)
+			test_produce();
+		else if(r<80)
+		{
+			if(mpu_data_getnext_raw(d)==0)
+				test_check(d);
+			else
+				HOST_CHECK(test_qrd==test_qwr);
+		}
+		else
+		{
+			n=mpu_data_getspans(&s1,&n1,&s2,&n2,rand()%64+1);
+			HOST_CHECK(n==n1+n2);
+			HOST_CHECK(n<=test_qwr-test_qrd);
+			p=s1;
+			for(unsigned char i=0;i<n;i++)
+			{
+				if(i==n1)
+					p=s2;
+				mpu_data_unpack(p,d);
+				test_check(d);
+				p+=mpu_data_recsize;
+				// The interrupt routine keeps producing while samples are claimed
+				if(rand()%4==0)
+					test_produce();
+			}
+			mpu_data_commit(n);
+		}
+		HOST_CHECK(mpu_data_level()==test_qwr-test_qrd);
+	}
+	// Drain
+	while(mpu_data_getnext_raw(d)==0)
+		test_check(d);
+	HOST_CHECK(test_qrd==test_qwr);
+	HOST_CHECK(test_numerr==0);
+	printf("Mode %2u (layout %u, %2u bytes, %3u samples, %4uHz): written %lu read %lu discarded %lu no sync %lu errors %lu\n",m,mpu_data_layout,mpu_data_recsize,mpu_data_capacity,splrate,test_numwr,test_numrd,test_numdiscard,test_numsync,test_numerr);
+}
+
+int main(int argc,char **argv)
+{
+	host_init();
+	for(unsigned char m=0;m<MOTIONCONFIG_NUM;m++)
+		test_mode(m);
+	return host_result("test_mpudata");
+}
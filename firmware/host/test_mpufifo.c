@@ -0,0 +1,376 @@
+/*
+	file: test_mpufifo
+
+	Tests of the FIFO burst readout of the MPU (_mpu_isr_fifoburst) against a model of the MPU.
+
+	The model holds the registers and the 512-byte FIFO of the MPU. At each sample of the output data rate, the
+	accelerometer and/or gyroscope selected in FIFO_EN are pushed in the FIFO, big-endian, if the FIFO is enabled
+	in USER_CTRL; when the FIFO is full the sample is dropped (FIFO_MODE set in CONFIG) or overwrites the oldest
+	bytes. The interrupt is raised every divider+1 samples (init_timer_mpucapture) after a random latency,
+	and a fraction of the interrupts find the SPI interface busy with another transfer, which cannot complete
+	during the interrupt. The channels of sample i encode i, so that the order, the losses and the byte order
+	of the samples read can be checked.
+
+	For every mode of mpu_config and several burst sizes:
+
+	* _mpu_fifoburst_start configures the FIFO and the interrupt divider only in the modes where the burst
+	applies, and _mpu_fifoburst_stop restores them.
+	* The samples in the motion buffer are the samples of the MPU, in order. The samples missing are those
+	dropped by the MPU when the FIFO was full (which must be counted in mpu_cnt_fifo_overflow), with
+	interrupts masked for several bursts or missed because of a busy interface.
+	* The interpolated time of each sample is within the interrupt latency of the time the MPU acquired it,
+	including after an overflow.
+	* The SPI transactions per sample are reported, to compare with the 2 transactions (INT_STATUS and data)
+	of the readout of each sample.
+
+	Usage: test_mpufifo [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpu.h"
+#include "mpu_config.h"
+#include "hostshim.h"
+
+#define TEST_NUM 20000								// Samples of the MPU per test
+
+/******************************************************************************
+	Model of the MPU
+******************************************************************************/
+unsigned char test_reg[128];
+unsigned char test_fifo[MPU_FIFO_SIZE];
+unsigned short test_fifo_rd,test_fifo_n;
+unsigned char test_divider;
+unsigned char test_busy;							// Percentage of the interrupts finding the interface busy
+unsigned char test_spibusy;							// The interface is busy
+unsigned long test_xfer,test_xferbytes,test_fifo_drop;
+
+void mpu_writereg(unsigned char reg,unsigned char v)
+{
+	test_reg[reg&0x7f]=v;
+	// FIFO_RST
+	if(reg==MPU_R_USR_CTRL && (v&0x04))
+	{
+		test_fifo_rd=test_fifo_n=0;
+		test_reg[reg]&=~0x04;
+	}
+}
+unsigned char mpu_readreg(unsigned char reg)
+{
+	return test_reg[reg&0x7f];
+}
+void init_timer_mpucapture(char divider)
+{
+	test_divider=divider;
+}
+unsigned char test_fifo_pop(void)
+{
+	unsigned char v;
+
+	if(test_fifo_n==0)
+		return 0xff;
+	v=test_fifo[test_fifo_rd];
+	test_fifo_rd=(test_fifo_rd+1)%MPU_FIFO_SIZE;
+	test_fifo_n--;
+	return v;
+}
+unsigned char mpu_readregs_int_try_raw(unsigned char *d,unsigned char reg,unsigned char n)
+{
+	// Limit of the transfers of mpu-usart0
+	if(n>=33)
+	{
+		HOST_CHECK(n<33);
+		return 1;
+	}
+	if(test_spibusy)
+		return 1;
+	test_xfer++;
+	test_xferbytes+=n+1;
+	d[0]=0;
+	for(unsigned char i=0;i<n;i++)
+	{
+		if(reg==MPU_R_FIFORW)
+			d[1+i]=test_fifo_pop();					// FIFO_R_W does not increment
+		else if(reg+i==MPU_R_FIFOCNTH)
+			d[1+i]=test_fifo_n>>8;
+		else if(reg+i==MPU_R_FIFOCNTH+1)
+			d[1+i]=test_fifo_n;
+		else
+			d[1+i]=test_reg[(reg+i)&0x7f];
+	}
+	return 0;
+}
+/******************************************************************************
+	function: test_channels
+*******************************************************************************
+	Channels of sample i: ax ay az gx gy gz.
+******************************************************************************/
+void test_channels(unsigned long i,unsigned short *ch)
+{
+	ch[0]=i;
+	ch[1]=i>>16;
+	ch[2]=i*7+3;
+	ch[3]=~i;
+	ch[4]=(i>>16)^0x5555;
+	ch[5]=i*13;
+}
+/******************************************************************************
+	function: test_mpu_sample
+*******************************************************************************
+	The MPU acquires sample i.
+******************************************************************************/
+void test_mpu_sample(unsigned long i)
+{
+	unsigned short ch[6];
+	unsigned char b[12],n=0;
+
+	if(!(test_reg[MPU_R_USR_CTRL]&0x40))
+		return;
+	test_channels(i,ch);
+	for(unsigned char c=0;c<6;c++)
+	{
+		if((c<3 && (test_reg[MPU_R_FIFOEN]&0x08)) || (c>=3 && (test_reg[MPU_R_FIFOEN]&0x70)==0x70))
+		{
+			b[n++]=ch[c]>>8;
+			b[n++]=ch[c];
+		}
+	}
+	if(test_fifo_n+n>MPU_FIFO_SIZE)
+	{
+		test_fifo_drop++;
+		if(test_reg[MPU_R_CONFIG]&0x40)
+			return;
+	}
+	for(unsigned char k=0;k<n;k++)
+	{
+		if(test_fifo_n==MPU_FIFO_SIZE)
+			test_fifo_pop();
+		test_fifo[(test_fifo_rd+test_fifo_n)%MPU_FIFO_SIZE]=b[k];
+		test_fifo_n++;
+	}
+}
+
+/******************************************************************************
+	Tests
+******************************************************************************/
+unsigned long test_next,test_numrd,test_numgap,test_numlost,test_numerr;
+signed long test_errmin,test_errmax;
+unsigned long long test_t0;
+unsigned long test_period_us;
+unsigned long test_lastpacketctr,test_lasttime;
+
+/******************************************************************************
+	function: test_check
+*******************************************************************************
+	Checks a sample read from the motion buffer.
+
+	Parameters:
+		d		-	Sample
+******************************************************************************/
+void test_check(const MPUMOTIONDATA &d)
+{
+	unsigned short ch[6];
+	unsigned long i;
+	signed long err;
+
+	// Index of the sample from the channels stored
+	if(mpu_data_layout&MPU_MODE_BM_A)
+		i=(unsigned short)d.ax|((unsigned long)(unsigned short)d.ay<<16);
+	else
+		i=(unsigned short)~d.gx|((unsigned long)((unsigned short)d.gy^0x5555)<<16);
+	test_channels(i,ch);
+	if(((mpu_data_layout&MPU_MODE_BM_A) && (d.ax!=(signed short)ch[0] || d.ay!=(signed short)ch[1] || d.az!=(signed short)ch[2]))
+		|| ((mpu_data_layout&MPU_MODE_BM_G) && (d.gx!=(signed short)ch[3] || d.gy!=(signed short)ch[4] || d.gz!=(signed short)ch[5])))
+	{
+		if(test_numerr<10)
+			printf("Sample %lu: channels %d %d %d %d %d %d\n",i,d.ax,d.ay,d.az,d.gx,d.gy,d.gz);
+		test_numerr++;
+		return;
+	}
+	// Order and losses
+	if(i!=test_next)
+	{
+		if(i<test_next)
+		{
+			if(test_numerr<10)
+				printf("Sample %lu after sample %lu\n",i,test_next-1);
+			test_numerr++;
+			return;
+		}
+		test_numgap++;
+		test_numlost+=i-test_next;
+	}
+	if(test_numrd && (d.time<test_lasttime || d.packetctr<=test_lastpacketctr))
+	{
+		if(test_numerr<10)
+			printf("Sample %lu: time %lu after %lu, packetctr %lu after %lu\n",i,d.time,test_lasttime,d.packetctr,test_lastpacketctr);
+		test_numerr++;
+	}
+	test_next=i+1;
+	test_lasttime=d.time;
+	test_lastpacketctr=d.packetctr;
+	test_numrd++;
+	// Interpolated time minus the time the MPU acquired the sample
+	err=(signed long)(d.time*1000-(unsigned long)((test_t0/1000+(i+1)*test_period_us)));
+	if(err<test_errmin)
+		test_errmin=err;
+	if(err>test_errmax)
+		test_errmax=err;
+}
+/******************************************************************************
+	function: test_mode
+*******************************************************************************
+	Acquisition in mode m with a requested burst of n samples.
+
+	Parameters:
+		stall	-	Nonzero to mask the interrupt for 8 bursts from time to time,
+					which overflows the FIFO
+******************************************************************************/
+void test_mode(unsigned char m,unsigned char n,unsigned char stall)
+{
+	unsigned char mode=config_sensorsr_settings[m][0];
+	unsigned char softdiv=config_sensorsr_settings[m][8];
+	unsigned short splrate=config_sensorsr_settings[m][11];
+	unsigned char burst,recsize;
+	unsigned long pulses,lat_us,maxlat_us=0;
+	MPUMOTIONDATA d;
+
+	memset(test_reg,0,sizeof(test_reg));
+	test_fifo_rd=test_fifo_n=0;
+	test_divider=0xff;
+	sample_mode=mode;
+	_mpu_samplerate=splrate;
+	mpu_clearbuffer();
+	mpu_clearstat();
+	_mpu_data_setlayout(mode);
+	mpu_config_fifoburst(n);
+	_mpu_fifoburst_start(softdiv);
+	burst=__mpu_fifoburst_n;
+
+	// The burst applies to the compacted layouts with accelerometer and/or gyroscope, without low power or software divider
+	if(mpu_data_layout==0 || (mode&MPU_MODE_BM_LP) || softdiv || splrate==0)
+	{
+		HOST_CHECK(burst==0);
+		HOST_CHECK(test_divider==softdiv);
+		HOST_CHECK(!(test_reg[MPU_R_USR_CTRL]&0x40));
+		_mpu_fifoburst_stop();
+		return;
+	}
+	recsize=(mpu_data_layout&MPU_MODE_BM_A?6:0)+(mpu_data_layout&MPU_MODE_BM_G?6:0);
+	HOST_CHECK(burst>1 && burst<=n && burst*recsize<=MPU_FIFO_SIZE/2);
+	HOST_CHECK(test_divider==burst-1);
+	HOST_CHECK(test_reg[MPU_R_USR_CTRL]&0x40);
+	HOST_CHECK(test_reg[MPU_R_CONFIG]&0x40);
+	HOST_CHECK(test_reg[MPU_R_FIFOEN]==((mpu_data_layout&MPU_MODE_BM_A?0x08:0)|(mpu_data_layout&MPU_MODE_BM_G?0x70:0)));
+
+	srand(m*256+n);
+	test_period_us=1000000/splrate;
+	test_t0=host_time_ns-host_time_ns%1000000+1000000;
+	host_time_ns=test_t0;
+	_mpu_fifoburst_start(softdiv);					// Time base of the first burst
+	test_next=test_numrd=test_numgap=test_numlost=test_numerr=test_fifo_drop=test_xfer=test_xferbytes=0;
+	test_errmin=0x7fffffff;
+	test_errmax=-0x7fffffff;
+	pulses=0;
+	for(unsigned long i=0;i<TEST_NUM;i++)
+	{
+		unsigned long long t=test_t0+(unsigned long long)(i+1)*test_period_us*1000;
+		if(host_time_ns<t)
+			host_time_ns=t;
+		test_mpu_sample(i);
+		if(++pulses<=test_divider)
+			continue;
+		pulses=0;
+		// Interrupts masked during 8 bursts from time to time
+		if(stall && (i/(8*burst))%16==15)
+			continue;
+		// Interrupt latency up to a quarter of the sample period
+		lat_us=rand()%(test_period_us/4+1);
+		if(lat_us>maxlat_us)
+			maxlat_us=lat_us;
+		host_time_advance_ns(lat_us*1000ULL);
+		test_spibusy=(unsigned)rand()%100<test_busy;
+		_mpu_isr_fifoburst();
+		test_spibusy=0;
+		// The consumer drains the buffer
+		while(mpu_data_getnext_raw(d)==0)
+			test_check(d);
+	}
+	// Interrupt right after the last sample, which reads the samples left in the FIFO
+	_mpu_isr_fifoburst();
+	while(mpu_data_getnext_raw(d)==0)
+		test_check(d);
+	printf("Mode %2u (%4uHz, %2u B/sample) burst %2u busy %2u%%%s: read %5lu lost %4lu overflows %3lu, %.2f SPI transactions and %.1f bytes per sample, time error %ld..%ld us\n",
+		m,splrate,recsize,burst,test_busy,stall?" stalls":"",test_numrd,test_numlost,mpu_cnt_fifo_overflow,(double)test_xfer/test_numrd,(double)test_xferbytes/test_numrd,test_errmin,test_errmax);
+	HOST_CHECK(test_numerr==0);
+	// The samples lost are those dropped by the MPU
+	HOST_CHECK(test_fifo_n==0);
+	HOST_CHECK(test_numlost+TEST_NUM-test_next==test_fifo_drop);
+	HOST_CHECK(test_numrd+test_fifo_drop==TEST_NUM);
+	HOST_CHECK(test_fifo_drop==0 || mpu_cnt_fifo_overflow>0);
+	HOST_CHECK(mpu_cnt_sample_errfull==0);
+	if(!stall && test_busy==0)
+		HOST_CHECK(test_numlost==0);
+	// The time is within the interrupt latency and the ms resolution of the timer
+	HOST_CHECK(test_errmin>=-1000 && test_errmax<=(signed long)(maxlat_us+1000));
+	_mpu_fifoburst_stop();
+	HOST_CHECK(__mpu_fifoburst_n==0);
+	HOST_CHECK(test_divider==0);
+	HOST_CHECK(!(test_reg[MPU_R_USR_CTRL]&0x40));
+	HOST_CHECK(!(test_reg[MPU_R_CONFIG]&0x40));
+}
+/******************************************************************************
+	function: test_kill
+*******************************************************************************
+	The channels killed with _mpu_kill are stored as 0.
+******************************************************************************/
+void test_kill(unsigned char m)
+{
+	MPUMOTIONDATA d;
+	unsigned char nrd=0;
+
+	memset(test_reg,0,sizeof(test_reg));
+	test_fifo_rd=test_fifo_n=0;
+	sample_mode=config_sensorsr_settings[m][0];
+	mpu_clearbuffer();
+	_mpu_data_setlayout(sample_mode);
+	mpu_config_fifoburst(4);
+	_mpu_fifoburst_start(0);
+	HOST_CHECK(__mpu_fifoburst_n==4);
+	test_busy=0;
+	_mpu_kill=4;
+	for(unsigned long i=1;i<=8;i++)
+		test_mpu_sample(i);
+	_mpu_isr_fifoburst();
+	_mpu_kill=0;
+	while(mpu_data_getnext_raw(d)==0)
+	{
+		nrd++;
+		HOST_CHECK(d.ax==0 && d.ay==0 && d.az==0);
+		HOST_CHECK(d.gx==(signed short)~nrd);
+	}
+	HOST_CHECK(nrd==8);
+	_mpu_fifoburst_stop();
+}
+
+int main(int argc,char **argv)
+{
+	static const unsigned char bursts[]={2,8,32,255};
+
+	host_init();
+	for(unsigned char m=0;m<MOTIONCONFIG_NUM;m++)
+	{
+		for(unsigned char b=0;b<sizeof(bursts);b++)
+		{
+			test_busy=0;
+			test_mode(m,bursts[b],0);
+			test_busy=20;
+			test_mode(m,bursts[b],0);
+		}
+		test_busy=5;
+		test_mode(m,32,1);
+	}
+	// 1000Hz accelerometer and gyroscope
+	test_kill(15);
+	return host_result("test_mpufifo");
+}
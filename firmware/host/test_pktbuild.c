@@ -0,0 +1,296 @@
+/*
+	file: test_pktbuild
+
+	Tests and benchmark of the binary sample packet builder (stream_sample_bin_pack):
+
+	* Equivalence: for all the stream formats (pktctr, time, battery, label) and the 16 channel layouts
+	(A, G, M, Q), packets of random samples and of extreme values are built with the byte store builder and with
+	the generic PACKET functions (test_packet, the builder which it replaced). Both must be byte-identical to the
+	packet laid out from the definition of DXX, with the reference Fletcher-16, and have the size returned by
+	stream_sample_bin_size.
+	* stream_sample_bin sends the same packet through fputbuf.
+	* Benchmark: time per packet on the host of both builders for each channel layout.
+
+	Usage: test_pktbuild [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpu.h"
+#include "mpu_config.h"
+#include "pkt.h"
+#include "serial.h"
+#include "mode_global.h"
+#include "mode_sample_motion.h"
+#include "commandset.h"
+#include "hostshim.h"
+
+#define TEST_NUM 200								// Random samples per format and channel layout
+#define TEST_BENCH_NUM 200000						// Packets per builder and channel layout in the benchmark
+
+extern MPUMOTIONDATA mpumotiondata;
+extern MPUMOTIONGEOMETRY mpumotiongeometry;
+void _stream_get_quaternion(signed short *q);
+unsigned char *_stream_sample_bin_pack(unsigned char *buffer,unsigned char mode);
+unsigned char stream_sample_bin(FILE *f);
+
+unsigned char test_sent[256];
+unsigned char test_sentn;
+unsigned long test_numerr;
+
+/******************************************************************************
+	function: test_putbuf
+*******************************************************************************
+	Keeps the last packet sent with fputbuf.
+******************************************************************************/
+unsigned char test_putbuf(char *data,unsigned char n)
+{
+	memcpy(test_sent,data,n);
+	test_sentn=n;
+	return 0;
+}
+SERIALPARAM test_serial={0,0,0,test_putbuf};
+FILE test_file;
+
+/******************************************************************************
+	function: test_setformat
+*******************************************************************************
+	Selects the stream format: bit 0 pktctr, bit 1 time, bit 2 battery, bit 3 label.
+******************************************************************************/
+void test_setformat(unsigned char format)
+{
+	mode_stream_format_pktctr=format&1?1:0;
+	mode_stream_format_ts=format&2?1:0;
+	mode_stream_format_bat=format&4?1:0;
+	mode_stream_format_label=format&8?1:0;
+}
+/******************************************************************************
+	function: test_put
+*******************************************************************************
+	Stores n bytes of v in little endian.
+******************************************************************************/
+unsigned char *test_put(unsigned char *p,unsigned long v,unsigned char n)
+{
+	for(unsigned char i=0;i<n;i++,v>>=8)
+		*p++=v;
+	return p;
+}
+/******************************************************************************
+	function: test_reference
+*******************************************************************************
+	Lays out the DXX packet of the current sample from its definition.
+
+	Returns:
+		Size of the packet
+******************************************************************************/
+unsigned char test_reference(unsigned char *b,unsigned char mode)
+{
+	unsigned char *p=b;
+	unsigned short check;
+	const float *q=&mpumotiongeometry.q0;
+
+	*p++='D';*p++='X';*p++='X';
+	if(mode_stream_format_pktctr)
+		p=test_put(p,mpumotiondata.packetctr,4);
+	if(mode_stream_format_ts)
+		p=test_put(p,mpumotiondata.time,4);
+	if(mode_stream_format_bat)
+		p=test_put(p,host_battery,2);
+	if(mode_stream_format_label)
+		p=test_put(p,CurrentAnnotation,2);
+	if(mode&MPU_MODE_BM_A)
+	{
+		p=test_put(p,mpumotiondata.ax,2);p=test_put(p,mpumotiondata.ay,2);p=test_put(p,mpumotiondata.az,2);
+	}
+	if(mode&MPU_MODE_BM_G)
+	{
+		p=test_put(p,mpumotiondata.gx,2);p=test_put(p,mpumotiondata.gy,2);p=test_put(p,mpumotiondata.gz,2);
+	}
+	if(mode&MPU_MODE_BM_M)
+	{
+		p=test_put(p,mpumotiondata.mx,2);p=test_put(p,mpumotiondata.my,2);p=test_put(p,mpumotiondata.mz,2);
+	}
+	if(mode&MPU_MODE_BM_Q)
+	{
+		for(unsigned char i=0;i<4;i++)
+		{
+			float k=q[i]*10000.0;
+			signed short s=k;
+			p=test_put(p,(unsigned short)s,2);
+		}
+	}
+	check=host_fletcher16(b,p-b);
+	p=test_put(p,check,2);
+	return p-b;
+}
+/******************************************************************************
+	function: test_packet
+*******************************************************************************
+	Builds the DXX packet of the current sample with the generic PACKET functions,
+	as the firmware did before stream_sample_bin_pack.
+******************************************************************************/
+void test_packet(PACKET *packet,unsigned char mode)
+{
+	PACKET &p = *packet;
+	packet_init(&p,"DXX",3);
+	if(mode_stream_format_pktctr)
+		packet_add32_little(&p,mpumotiondata.packetctr);
+	if(mode_stream_format_ts)
+	{
+		packet_add16_little(&p,mpumotiondata.time&0xffff);
+		packet_add16_little(&p,(mpumotiondata.time>>16)&0xffff);
+	}
+	if(mode_stream_format_bat)
+		packet_add16_little(&p,system_getbattery());
+	if(mode_stream_format_label)
+		packet_add16_little(&p,CurrentAnnotation);
+	if(mode & MPU_MODE_BM_A)
+	{
+		packet_add16_little(&p,mpumotiondata.ax);
+		packet_add16_little(&p,mpumotiondata.ay);
+		packet_add16_little(&p,mpumotiondata.az);
+	}
+	if(mode & MPU_MODE_BM_G)
+	{
+		packet_add16_little(&p,mpumotiondata.gx);
+		packet_add16_little(&p,mpumotiondata.gy);
+		packet_add16_little(&p,mpumotiondata.gz);
+	}
+	if(mode & MPU_MODE_BM_M)
+	{
+		packet_add16_little(&p,mpumotiondata.mx);
+		packet_add16_little(&p,mpumotiondata.my);
+		packet_add16_little(&p,mpumotiondata.mz);
+	}
+	if(mode & MPU_MODE_BM_Q)
+	{
+		signed short q[4];
+		_stream_get_quaternion(q);
+		for(unsigned char i=0;i<4;i++)
+			packet_add16_little(&p,q[i]);
+	}
+	packet_end(&p);
+	packet_addchecksum_fletcher16_little(&p);
+}
+/******************************************************************************
+	function: test_randsample
+*******************************************************************************
+	Random sample; one sample in four has extreme values.
+******************************************************************************/
+void test_randsample(void)
+{
+	static const unsigned short extreme[]={0x0000,0xffff,0x8000,0x7fff,0x00ff,0xff00};
+	signed short *ch=&mpumotiondata.ax;
+	unsigned char e=rand()%4==0;
+
+	for(unsigned char i=0;i<9;i++)
+		ch[i]=e?extreme[rand()%6]:rand();
+	mpumotiondata.time=e?0xffffffff:rand()*65536UL+rand();
+	mpumotiondata.packetctr=e?0x80000000:rand()*65536UL+rand();
+	host_battery=e?0xffff:rand();
+	CurrentAnnotation=rand();
+	mpumotiongeometry.q0=(rand()%20001-10000)/10000.0;
+	mpumotiongeometry.q1=(rand()%20001-10000)/10000.0;
+	mpumotiongeometry.q2=e?1.0:(rand()%20001-10000)/10000.0;
+	mpumotiongeometry.q3=e?-1.0:(rand()%20001-10000)/10000.0;
+}
+/******************************************************************************
+	function: test_equivalence
+*******************************************************************************
+	Compares the builders with the reference layout in all the formats and
+	channel layouts.
+******************************************************************************/
+void test_equivalence(void)
+{
+	PACKET pkt;
+	unsigned char ref[STREAM_BIN_MAXSIZE+8],buf[STREAM_BIN_MAXSIZE+8];
+	unsigned char *e,n,mode;
+
+	srand(1);
+	for(unsigned char format=0;format<16;format++)
+	{
+		test_setformat(format);
+		for(unsigned char ch=0;ch<16;ch++)
+		{
+			mode=ch<<1;
+			sample_mode=mode;
+			for(unsigned short it=0;it<TEST_NUM;it++)
+			{
+				test_randsample();
+				n=test_reference(ref,mode);
+				HOST_CHECK(n==stream_sample_bin_size());
+				HOST_CHECK(n<=STREAM_BIN_MAXSIZE);
+				memset(buf,0x55,sizeof(buf));
+				e=_stream_sample_bin_pack(buf,mode);
+				test_packet(&pkt,mode);
+				if(e-buf!=n || memcmp(buf,ref,n) || buf[n]!=0x55)
+				{
+					if(test_numerr<10)
+						printf("stream_sample_bin_pack differs: format %u mode %02X size %u/%u\n",format,mode,(unsigned)(e-buf),n);
+					test_numerr++;
+				}
+				if(packet_size(&pkt)!=n || memcmp(pkt.data,ref,n))
+				{
+					if(test_numerr<10)
+						printf("test_packet differs: format %u mode %02X size %u/%u\n",format,mode,packet_size(&pkt),n);
+					test_numerr++;
+				}
+				test_sentn=0;
+				HOST_CHECK(stream_sample_bin(&test_file)==0);
+				HOST_CHECK(test_sentn==n && memcmp(test_sent,ref,n)==0);
+			}
+		}
+	}
+	HOST_CHECK(test_numerr==0);
+}
+/******************************************************************************
+	function: test_bench
+*******************************************************************************
+	Time per packet of both builders for each channel layout, with the
+	timestamp format.
+******************************************************************************/
+void test_bench(void)
+{
+	PACKET pkt;
+	unsigned char buf[STREAM_BIN_MAXSIZE];
+	unsigned char *e=buf;
+	unsigned long long t0,t1,t2;
+	unsigned long sum=0;
+
+	test_setformat(2);
+	srand(2);
+	test_randsample();
+	printf("Chan\tSize\tPACKET\tLayout (ns per packet on the host)\n");
+	for(unsigned char ch=0;ch<16;ch++)
+	{
+		t0=host_clock_ns();
+		for(unsigned long i=0;i<TEST_BENCH_NUM;i++)
+		{
+			mpumotiondata.ax=i;
+			test_packet(&pkt,ch<<1);
+			sum+=pkt.data[5];
+		}
+		t1=host_clock_ns();
+		for(unsigned long i=0;i<TEST_BENCH_NUM;i++)
+		{
+			mpumotiondata.ax=i;
+			e=_stream_sample_bin_pack(buf,ch<<1);
+			sum+=buf[5];
+		}
+		t2=host_clock_ns();
+		printf("%02X\t%u\t%.1f\t%.1f\n",ch<<1,(unsigned)(e-buf),(double)(t1-t0)/TEST_BENCH_NUM,(double)(t2-t1)/TEST_BENCH_NUM);
+	}
+	// Keeps the packets alive
+	if(sum==1)
+		printf("\n");
+}
+
+int main(int argc,char **argv)
+{
+	host_init();
+	fdev_setup_stream(&test_file,0,0,_FDEV_SETUP_WRITE);
+	fdev_set_udata(&test_file,&test_serial);
+	test_equivalence();
+	test_bench();
+	return host_result("test_pktbuild");
+}
@@ -0,0 +1,215 @@
+/*
+	file: test_read
+
+	Tests and benchmark of the multiblock read path (sd_stream_read_open/sd_stream_read/sd_read) on the
+	simulated card:
+
+	* Integrity: sectors read with sd_block_read, sd_stream_read and sd_read equal the image, and the checksum
+	returned by sd_stream_read is the CRC-16 of the data.
+	* Window: the multiblock read terminates by itself after the last sector of the read-ahead window, and
+	is terminated early by sd_stream_read_close and by other card accesses, which then succeed.
+	* sd_read continues the open multiblock read for consecutive sectors and restarts it otherwise.
+	* Benchmark: time in simulated time, and SPI bytes clocked per payload byte as counted by the card and by
+	sd_read_printstat, of reads of n consecutive sectors with CMD17 and with CMD18; and cost of the uFAT mount.
+
+	Usage: test_read <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sd.h"
+#include "sd_int.h"
+#include "ufat.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+#define TEST_CAPACITY 262144						// Capacity of the card in sectors (128MB)
+#define TEST_START 100000							// First sector of the test area
+#define TEST_NUMSECT 2048							// Sectors of the test area
+
+extern unsigned char _sd_read_stream_open;
+
+/******************************************************************************
+	function: test_sector
+*******************************************************************************
+	Content of sector s of the test area.
+******************************************************************************/
+void test_sector(unsigned long s,char *b)
+{
+	for(unsigned short i=0;i<512;i++)
+		b[i]=host_pattern(s*512+i);
+}
+/******************************************************************************
+	function: test_check
+*******************************************************************************
+	Checks that b holds sector s of the test area.
+******************************************************************************/
+void test_check(unsigned long s,const char *b)
+{
+	char e[512];
+
+	test_sector(s,e);
+	if(memcmp(b,e,512))
+	{
+		printf("Sector %lu differs\n",s);
+		HOST_CHECK(0);
+	}
+}
+/******************************************************************************
+	function: test_integrity
+*******************************************************************************
+	Reads of random windows, terminated by the window, by sd_stream_read_close
+	or by another access.
+******************************************************************************/
+void test_integrity(void)
+{
+	char b[512];
+	unsigned short crc;
+	unsigned long s,n,k;
+
+	for(unsigned short it=0;it<300;it++)
+	{
+		s=rand()%(TEST_NUMSECT-64);
+		n=rand()%64+1;
+		HOST_CHECK(sd_stream_read_open(TEST_START+s,n)==0);
+		// Read all the window, or terminate early
+		k=rand()%3?n:rand()%n;
+		for(unsigned long i=0;i<k;i++)
+		{
+			HOST_CHECK(sd_stream_read(b,&crc)==0);
+			test_check(s+i,b);
+			HOST_CHECK(crc==host_crc16((unsigned char*)b,512));
+		}
+		if(k==n)
+		{
+			HOST_CHECK(_sd_read_stream_open==0);
+			HOST_CHECK(sd_stream_read(b,&crc)!=0);
+		}
+		else
+			HOST_CHECK(_sd_read_stream_open==1);
+		switch(rand()%3)
+		{
+			case 0:
+				HOST_CHECK(sd_stream_read_close()==0);
+				break;
+			case 1:
+				// Another access terminates the read
+				HOST_CHECK(sd_block_read(TEST_START+s,b)==0);
+				test_check(s,b);
+				break;
+			default:
+				test_sector(TEST_NUMSECT,b);
+				HOST_CHECK(sd_block_write(TEST_START+TEST_NUMSECT,b)==0);
+				break;
+		}
+		HOST_CHECK(_sd_read_stream_open==0);
+	}
+	// Unlimited window
+	HOST_CHECK(sd_stream_read_open(TEST_START,0)==0);
+	for(unsigned long i=0;i<TEST_NUMSECT;i++)
+	{
+		HOST_CHECK(sd_stream_read(b,&crc)==0);
+		test_check(i,b);
+	}
+	HOST_CHECK(_sd_read_stream_open==1);
+	HOST_CHECK(sd_stream_read_close()==0);
+
+	// sd_read: sequential runs at random addresses
+	for(unsigned short it=0;it<300;it++)
+	{
+		s=rand()%(TEST_NUMSECT-64);
+		n=rand()%64+1;
+		for(unsigned long i=0;i<n;i++)
+		{
+			HOST_CHECK(sd_read(TEST_START+s+i,b,n-i)==0);
+			test_check(s+i,b);
+		}
+		HOST_CHECK(_sd_read_stream_open==0);
+	}
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+}
+/******************************************************************************
+	function: test_bench
+*******************************************************************************
+	Reads n consecutive sectors with CMD17 and with CMD18.
+******************************************************************************/
+void test_bench(unsigned long n)
+{
+	char b[512];
+	unsigned short crc;
+	unsigned long long t0,t1,t2,c1;
+
+	sd_read_clearstat();
+	hostsd_clearstat();
+	t0=host_time_ns;
+	for(unsigned long i=0;i<n;i++)
+		HOST_CHECK(sd_block_read(TEST_START+i,b)==0);
+	t1=host_time_ns;
+	c1=hostsd_stat.bytes;
+	// The counters of the firmware cover the bytes of the card, except the chip select and the response to CMD17
+	HOST_CHECK(_sd_read_clocked<=c1 && _sd_read_clocked*11/10>=c1);
+	HOST_CHECK(_sd_read_payload==n*512);
+
+	sd_read_clearstat();
+	hostsd_clearstat();
+	HOST_CHECK(sd_stream_read_open(TEST_START,n)==0);
+	for(unsigned long i=0;i<n;i++)
+		HOST_CHECK(sd_stream_read(b,&crc)==0);
+	t2=host_time_ns;
+	HOST_CHECK(_sd_read_clocked<=hostsd_stat.bytes && _sd_read_clocked*11/10>=hostsd_stat.bytes);
+	HOST_CHECK(_sd_read_payload==n*512);
+
+	printf("%lu\t%llu\t%llu\t%.3f\t%llu\t%llu\t%.3f\n",n,(t1-t0)/1000,n*512000000ULL/(t1-t0),(double)c1/(n*512),
+		(t2-t1)/1000,n*512000000ULL/(t2-t1),(double)hostsd_stat.bytes/(n*512));
+	// CMD18 saves the command of each sector, and costs the CMD12 and busy at the end of the window
+	if(n>=16)
+	{
+		HOST_CHECK(hostsd_stat.bytes<c1);
+		HOST_CHECK(t2-t1<t1-t0);
+	}
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+}
+
+int main(int argc,char **argv)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long capacity;
+	char b[512];
+
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	if(host_sdinit(argv[1],TEST_CAPACITY))
+		return 1;
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&capacity)==0);
+	for(unsigned long s=0;s<TEST_NUMSECT;s++)
+	{
+		test_sector(s,b);
+		HOST_CHECK(hostsd_writesector(TEST_START+s,b)==0);
+	}
+
+	test_integrity();
+
+	printf("Sectors\tCMD17 us\tKB/s\tSPI/byte\tCMD18 us\tKB/s\tSPI/byte\n");
+	for(unsigned long n=1;n<=1024;n*=4)
+		test_bench(n);
+
+	// Mount of uFAT
+	HOST_CHECK(ufat_format(4,64)==0);
+	sd_read_clearstat();
+	hostsd_clearstat();
+	HOST_CHECK(ufat_init()==0);
+	sd_read_printstat(file_pri);
+	hostsd_printstat(file_pri);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+
+	hostsd_close();
+	return host_result("test_read");
+}
@@ -0,0 +1,232 @@
+/*
+	file: test_readout
+
+	Loopback tests of the binary log readout (ufat_log_readout) on the simulated card.
+
+	The stream of the readout is the model of a link of hostshim: a transmit buffer drained at the rate of the
+	link in simulated time, as the interrupts of dbg or uart1 do, into a receiver which decodes the DRD frames as a
+	host would: it synchronises on the header, checks the CRC-16/XMODEM, and keeps the frames in order.
+	When a frame is lost the receiver sends a character, which interrupts the readout, and resumes from the
+	first missing sector.
+
+	* Integrity: the log read out equals the sectors of the log on the card, on an error free link and on
+	a link corrupting bytes.
+	* Windows: the first sector and number of sectors are honoured, and a readout beyond the end of the log
+	sends nothing.
+	* A link which does not accept data aborts the readout.
+	* Throughput: payload rate in simulated time compared to the rate of the link, for the dbg interface
+	(about 14KB/s) and Bluetooth at 115200 and 460800bps.
+
+	Usage: test_readout <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wait.h"
+#include "sd.h"
+#include "ufat.h"
+#include "serial.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+#define TEST_CAPACITY 262144						// Capacity of the card in sectors (128MB)
+#define TEST_LOGSIZE (128*1024l+77)					// Size of the log read out
+#define TEST_FRAMESIZE 521							// Size of a frame: header, sector, data, CRC
+#define TEST_RECSIZE 200							// Size of the records written to the log
+
+extern LOGENTRY _logentries[];
+
+CIRCULARBUFFER test_rx={0,0,0,256,255};							// Characters sent by the receiver (only the level is used)
+
+// Receiver
+unsigned char test_frame[TEST_FRAMESIZE];
+unsigned short test_framen;
+unsigned long test_expected;						// Next sector expected
+unsigned long test_numok,test_numcrc,test_numskip,test_numerr;
+
+/******************************************************************************
+	function: test_receive
+*******************************************************************************
+	Receiver: decodes the frames byte by byte.
+******************************************************************************/
+void test_receive(unsigned char c)
+{
+	unsigned long sector;
+	unsigned short crc;
+	unsigned char chk[516];
+	char sect[512];
+
+	test_frame[test_framen++]=c;
+	if(test_framen<TEST_FRAMESIZE)
+		return;
+	// Synchronisation on the header and CRC of the data followed by the sector
+	crc=test_frame[TEST_FRAMESIZE-2]|((unsigned short)test_frame[TEST_FRAMESIZE-1]<<8);
+	memcpy(chk,test_frame+7,512);
+	memcpy(chk+512,test_frame+3,4);
+	if(test_frame[0]!='D' || test_frame[1]!='R' || test_frame[2]!='D' || host_crc16(chk,516)!=crc)
+	{
+		if(test_frame[0]=='D' && test_frame[1]=='R' && test_frame[2]=='D')
+			test_numcrc++;
+		memmove(test_frame,test_frame+1,TEST_FRAMESIZE-1);
+		test_framen--;
+		test_rx.wrptr=1;
+		return;
+	}
+	test_framen=0;
+	sector=test_frame[3]|((unsigned long)test_frame[4]<<8)|((unsigned long)test_frame[5]<<16)|((unsigned long)test_frame[6]<<24);
+	if(sector!=test_expected)
+	{
+		// Frames following a lost frame are discarded until the readout resumes
+		test_numskip++;
+		test_rx.wrptr=1;
+		return;
+	}
+	HOST_CHECK(hostsd_readsector(_logentries[0].startsector+sector,sect)==0);
+	if(memcmp(sect,test_frame+7,512))
+	{
+		if(test_numerr<10)
+			printf("Sector %lu differs\n",sector);
+		test_numerr++;
+	}
+	test_expected++;
+	test_numok++;
+}
+SERIALPARAM test_serial={0,&host_link_tx,&test_rx,host_link_putbuf};
+FILE test_file;
+
+/******************************************************************************
+	function: test_link
+*******************************************************************************
+	Selects the link and clears the receiver.
+******************************************************************************/
+void test_link(unsigned long rate,unsigned short txsize,unsigned long corrupt)
+{
+	host_link_init(rate,txsize,corrupt,test_receive);
+	test_rx.wrptr=test_rx.rdptr=0;
+	test_framen=0;
+	test_expected=0;
+	test_numok=test_numcrc=test_numskip=test_numerr=0;
+}
+/******************************************************************************
+	function: test_readout
+*******************************************************************************
+	Reads out log 0, resuming after the lost frames.
+
+	Parameters:
+		name		-	Name of the link
+		rate		-	Rate of the link in bytes per second
+		corrupt		-	One byte in corrupt is corrupted, 0 for none
+******************************************************************************/
+void test_readout(const char *name,unsigned long rate,unsigned long corrupt)
+{
+	unsigned long numsect=(ufat_log_getlogsize(0)+511)>>9,numsent,numcall=0,t;
+	unsigned long long t0;
+	unsigned char rv;
+
+	test_link(rate,512,corrupt);
+	t0=host_time_ns;
+	while(test_expected<numsect && numcall<1000)
+	{
+		test_rx.wrptr=0;
+		rv=ufat_log_readout(&test_file,0,test_expected,0,&numsent);
+		HOST_CHECK(rv==0 || rv==2);
+		numcall++;
+		host_link_flush();
+	}
+	t=(host_time_ns-t0)/1000000;
+	printf("%s (%lu B/s) corrupting 1 byte in %lu: %lu sectors in %lu ms (%lu B/s, %lu%% of the link), %lu readouts, %lu CRC errors, %lu frames discarded\n",
+		name,rate,corrupt,test_numok,t,test_numok*512000/t,test_numok*512000/t*100/rate,numcall,test_numcrc,test_numskip);
+	HOST_CHECK(test_expected==numsect);
+	HOST_CHECK(test_numerr==0);
+	HOST_CHECK(test_framen==0);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+	if(corrupt==0)
+	{
+		HOST_CHECK(numcall==1);
+		HOST_CHECK(test_numcrc==0 && test_numskip==0);
+		// The payload rate is within 5% of the rate of the link minus the frame overhead
+		HOST_CHECK(test_numok*512000/t>=(unsigned long long)rate*512/TEST_FRAMESIZE*95/100);
+	}
+}
+/******************************************************************************
+	function: test_window
+*******************************************************************************
+	Readout of a window of the log, and beyond the end of the log.
+******************************************************************************/
+void test_window(void)
+{
+	unsigned long numsect=(ufat_log_getlogsize(0)+511)>>9,numsent;
+
+	test_link(46080,512,0);
+	test_expected=5;
+	HOST_CHECK(ufat_log_readout(&test_file,0,5,3,&numsent)==0);
+	host_link_flush();
+	HOST_CHECK(numsent==3 && test_numok==3 && test_numskip==0 && test_expected==8);
+
+	// The window is clipped to the end of the log
+	test_link(46080,512,0);
+	test_expected=numsect-2;
+	HOST_CHECK(ufat_log_readout(&test_file,0,numsect-2,10,&numsent)==0);
+	host_link_flush();
+	HOST_CHECK(numsent==2 && test_numok==2 && test_expected==numsect);
+
+	test_link(46080,512,0);
+	HOST_CHECK(ufat_log_readout(&test_file,0,numsect,0,&numsent)==0);
+	host_link_flush();
+	HOST_CHECK(numsent==0 && test_numok==0);
+	HOST_CHECK(ufat_log_readout(&test_file,_fsinfo.lognum,0,0,&numsent)==1);
+
+	// A link which does not accept data
+	test_link(0,512,0);
+	HOST_CHECK(ufat_log_readout(&test_file,0,0,0,&numsent)==1);
+	HOST_CHECK(numsent==0);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+}
+
+int main(int argc,char **argv)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long capacity;
+	char rec[TEST_RECSIZE];
+	unsigned char s;
+
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	fdev_setup_stream(&test_file,0,0,_FDEV_SETUP_WRITE);
+	fdev_set_udata(&test_file,&test_serial);
+	if(host_sdinit(argv[1],TEST_CAPACITY))
+		return 1;
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&capacity)==0);
+	HOST_CHECK(ufat_format(4,64)==0);
+	HOST_CHECK(ufat_init()==0);
+
+	// Log 0 with the test pattern, not ending on a sector boundary
+	HOST_CHECK(ufat_log_open(0)!=0);
+	for(unsigned long n=0;n<TEST_LOGSIZE;n+=s)
+	{
+		s=TEST_LOGSIZE-n>TEST_RECSIZE?TEST_RECSIZE:TEST_LOGSIZE-n;
+		for(unsigned char i=0;i<s;i++)
+			rec[i]=host_pattern(n+i);
+		HOST_CHECK(_ufat_log_fputbuf(rec,s)==0);
+	}
+	HOST_CHECK(ufat_log_close()==0);
+	HOST_CHECK(ufat_log_getlogsize(0)==TEST_LOGSIZE);
+	hostsd_clearstat();
+
+	test_window();
+	test_readout("dbg",14336,0);
+	test_readout("Bluetooth 115200bps",11520,0);
+	test_readout("Bluetooth 460800bps",46080,0);
+	test_readout("dbg",14336,20000);
+	test_readout("Bluetooth 460800bps",46080,5000);
+
+	hostsd_close();
+	return host_result("test_readout");
+}
@@ -0,0 +1,290 @@
+/*
+	file: test_ring
+
+	Tests of the single producer single consumer ring (SPSCRING, ring.h) with 8-bit counters (a ring of 10-byte
+	structures of 128 elements, and of 4 elements) and 16-bit counters (a byte ring of 256 elements):
+
+	* Model: random put, put_overwrite, get, at, pop and clear compared to a model of the queue, including the
+	wraparound of the free running counters; all N elements are usable.
+	* Interrupts: in the stress tests of hostshim (host_stress_read, host_stress_write), an interrupt routine
+	run asynchronously from a timer signal, and also within the atomic blocks, produces the elements read by
+	the main code or consumes the elements written by the main code, mixing get, and at followed by pop. The
+	elements must arrive complete and in order.
+	* Overwrite: an interrupt routine adds elements with put_overwrite while the main code reads them with
+	interrupts disabled, as for the battery statistics of the LTC2942: the elements read are in order, and
+	those missing were dropped by put_overwrite.
+	* Size: the ring costs its elements and two counters.
+
+	Usage: test_ring [image]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/atomic.h>
+#include "ring.h"
+#include "hostshim.h"
+
+#define TEST_NUMOP 300000							// Operations of the model test
+
+typedef struct
+{
+	unsigned long t;
+	short a,b,c;
+} TESTSTRUCT;
+
+SPSCRING<TESTSTRUCT,4> test_r4;
+SPSCRING<TESTSTRUCT,128> test_rs;
+SPSCRING<unsigned char,256> test_rb;
+
+// Side of the interrupt routine of the overwrite test
+unsigned long test_isr_rnd;							// State of the random generator of the routine
+volatile unsigned long test_isr_num;				// Elements added by the routine
+
+/******************************************************************************
+	Elements: element i of a test stream
+******************************************************************************/
+void test_make(unsigned long i,TESTSTRUCT &s)
+{
+	s.t=i;
+	s.a=i;
+	s.b=~i;
+	s.c=i*3;
+}
+void test_make(unsigned long i,unsigned char &c)
+{
+	// Not periodic in the size of the ring, so that a stale element differs
+	c=i*7+(i>>8);
+}
+unsigned char test_ok(const TESTSTRUCT &s,unsigned long i)
+{
+	return s.t==i && s.a==(short)i && s.b==(short)~i && s.c==(short)(i*3);
+}
+unsigned char test_ok(const unsigned char &c,unsigned long i)
+{
+	unsigned char e;
+
+	test_make(i,e);
+	return c==e;
+}
+// Index of element s of a stream, for the overwrite test
+unsigned long test_index(const TESTSTRUCT &s)
+{
+	return s.t;
+}
+/******************************************************************************
+	function: test_model
+*******************************************************************************
+	Random operations on ring compared to the model of the queue.
+******************************************************************************/
+template<class T,unsigned short N> void test_model(SPSCRING<T,N> &ring,const char *name)
+{
+	unsigned long w=0,r=0,numfull=0;				// Elements written and read
+	unsigned short l,k;
+	T v;
+
+	ring.clear();
+	for(unsigned long it=0;it<TEST_NUMOP;it++)
+	{
+		l=w-r;
+		switch(rand()%6)
+		{
+			case 0:
+				test_make(w,v);
+				k=ring.put(v);
+				HOST_CHECK(k==(l==N));
+				if(k==0)
+					w++;
+				else
+					numfull++;
+				break;
+			case 1:
+				test_make(w++,v);
+				ring.put_overwrite(v);
+				if(l==N)
+					r++;
+				break;
+			case 2:
+				k=ring.get(v);
+				HOST_CHECK(k==(l==0));
+				if(k==0)
+					HOST_CHECK(test_ok(v,r++));
+				break;
+			case 3:
+				for(unsigned short i=0;i<l;i++)
+					HOST_CHECK(test_ok(ring.at(i),r+i));
+				k=rand()%(l+1);
+				ring.pop(k);
+				r+=k;
+				break;
+			case 4:
+				// Fill the ring
+				while(w-r<N)
+				{
+					test_make(w++,v);
+					HOST_CHECK(ring.put(v)==0);
+				}
+				break;
+			default:
+				if(rand()%64==0)
+				{
+					ring.clear();
+					r=w;
+				}
+				break;
+		}
+		l=w-r;
+		HOST_CHECK(ring.level()==l);
+		HOST_CHECK(ring.isempty()==(l==0) && ring.isfull()==(l==N));
+	}
+	printf("Model, %s: %lu elements, %lu puts on a full ring\n",name,w,numfull);
+	HOST_CHECK(w>65536 && numfull>0);
+}
+/******************************************************************************
+	function: test_put
+*******************************************************************************
+	Queue of the stress tests: adds up to N elements to R while it is not full;
+	one call in two fills the ring, so that the reader often frees the element
+	which is written next.
+******************************************************************************/
+template<class T,unsigned short N,SPSCRING<T,N> &R> unsigned long test_put(unsigned long first,unsigned long *rnd)
+{
+	unsigned short n,i;
+	T v;
+
+	n=host_rnd(rnd)%2?N:host_rnd(rnd)%N+1;
+	for(i=0;i<n;i++)
+	{
+		test_make(first+i,v);
+		if(R.put(v))
+			break;
+	}
+	return i;
+}
+/******************************************************************************
+	function: test_get
+*******************************************************************************
+	Queue of the stress tests: reads up to N elements from R, with get or with at
+	and pop.
+******************************************************************************/
+template<class T,unsigned short N,SPSCRING<T,N> &R> unsigned long test_get(unsigned long first,unsigned long *rnd,unsigned long *err)
+{
+	unsigned short n,l;
+	T v;
+
+	n=host_rnd(rnd)%N+1;
+	if(host_rnd(rnd)%2)
+	{
+		for(l=0;l<n && R.get(v)==0;l++)
+			if(!test_ok(v,first+l))
+				(*err)++;
+		return l;
+	}
+	l=R.level();
+	if(n>l)
+		n=l;
+	for(unsigned short i=0;i<n;i++)
+		if(!test_ok(R.at(i),first+i))
+			(*err)++;
+	R.pop(n);
+	return n;
+}
+template<class T,unsigned short N,SPSCRING<T,N> &R> void test_clear(void)
+{
+	R.clear();
+}
+template<class T,unsigned short N,SPSCRING<T,N> &R> unsigned char test_isempty(void)
+{
+	return R.isempty();
+}
+template<class T,unsigned short N,SPSCRING<T,N> &R> const HOSTQUEUE *test_queue(void)
+{
+	static const HOSTQUEUE q={test_clear<T,N,R>,test_isempty<T,N,R>,test_put<T,N,R>,test_get<T,N,R>};
+
+	return &q;
+}
+/******************************************************************************
+	function: test_isr_overwrite
+*******************************************************************************
+	Interrupt routine adding up to 8 elements to test_rs with put_overwrite.
+******************************************************************************/
+void test_isr_overwrite(void)
+{
+	unsigned short n;
+	TESTSTRUCT v;
+
+	n=host_rnd(&test_isr_rnd)%8+1;
+	for(unsigned short i=0;i<n;i++)
+	{
+		test_make(test_isr_num++,v);
+		test_rs.put_overwrite(v);
+	}
+}
+/******************************************************************************
+	function: test_overwrite
+*******************************************************************************
+	The main code reads the elements added with put_overwrite by the interrupt
+	routine, with interrupts disabled, and occasionally pauses so that the ring
+	overflows.
+******************************************************************************/
+void test_overwrite(void)
+{
+	unsigned long next=0,numread=0,numdrop=0,err=0,i;
+	unsigned long long t;
+	unsigned char ok;
+	TESTSTRUCT v;
+
+	test_rs.clear();
+	test_isr_rnd=3;
+	test_isr_num=0;
+	host_irq_start(test_isr_overwrite,HOST_STRESS_PERIOD);
+	host_irq_atomic=HOST_STRESS_ATOMIC;
+	while(host_irq_num<HOST_STRESS_NUMIRQ || !test_rs.isempty())
+	{
+		if(host_irq_num>=HOST_STRESS_NUMIRQ)
+			host_irq_stop();
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			ok=test_rs.get(v)==0;
+		}
+		if(!ok)
+			continue;
+		i=test_index(v);
+		if(i<next || !test_ok(v,i))
+			err++;
+		else
+			numdrop+=i-next;
+		next=i+1;
+		numread++;
+		if(rand()%1024==0)
+		{
+			t=host_clock_ns()+rand()%2000*1000;
+			while(host_clock_ns()<t);
+		}
+	}
+	host_irq_stop();
+	printf("Overwrite: %lu elements added, %lu read, %lu dropped, %lu errors\n",test_isr_num,numread,numdrop,err);
+	HOST_CHECK(err==0);
+	HOST_CHECK(numread+numdrop==test_isr_num);
+	HOST_CHECK(numdrop>0);
+}
+
+int main(int argc,char **argv)
+{
+	host_init();
+	srand(1);
+
+	// The ring costs its elements and the two counters
+	HOST_CHECK(sizeof(test_rs)==128*sizeof(TESTSTRUCT)+2);
+	HOST_CHECK(sizeof(test_rb)==256+4);
+	HOST_CHECK(sizeof(TESTSTRUCT)==10);
+
+	test_model(test_r4,"4 structures");
+	test_model(test_rs,"128 structures");
+	test_model(test_rb,"256 bytes");
+	host_stress_read(test_queue<TESTSTRUCT,128,test_rs>(),"128 structures");
+	host_stress_read(test_queue<unsigned char,256,test_rb>(),"256 bytes");
+	host_stress_write(test_queue<TESTSTRUCT,128,test_rs>(),"128 structures");
+	host_stress_write(test_queue<unsigned char,256,test_rb>(),"256 bytes");
+	test_overwrite();
+	return host_result("test_ring");
+}
@@ -0,0 +1,162 @@
+/*
+	file: test_streamcache
+
+	Tests of the staging ring of sd_streamcache_write on the simulated card:
+
+	* Integrity: writes of random sizes (including sizes larger than the staging ring), interleaved with
+	sd_streamcache_poll and card stalls, are read back from the image.
+	* The staging ring never holds more than SD_CACHE_SIZE bytes.
+	* Latency hiding: records written at a rate below the bandwidth of the card never block when the stalls
+	of the card are shorter than the time to fill the staging ring.
+	* Flush: a write of size 0 empties the staging ring.
+
+	Usage: test_streamcache <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sd.h"
+#include "hostsd.h"
+#include "hostshim.h"
+
+#define TEST_CAPACITY 262144
+
+/******************************************************************************
+	function: test_checkdata
+*******************************************************************************
+	Checks that the n bytes from sector startsect are the test pattern.
+******************************************************************************/
+void test_checkdata(unsigned long startsect,unsigned long n)
+{
+	char sect[512];
+
+	for(unsigned long i=0;i<n;i++)
+	{
+		if((i&511)==0)
+			HOST_CHECK(hostsd_readsector(startsect+i/512,sect)==0);
+		if(sect[i&511]!=host_pattern(i))
+		{
+			printf("Data differs at byte %lu (sector %lu)\n",i,startsect+i/512);
+			HOST_CHECK(0);
+			return;
+		}
+	}
+}
+/******************************************************************************
+	function: test_random
+*******************************************************************************
+	Writes records of random sizes, with stalls of the card and random polls.
+******************************************************************************/
+void test_random(unsigned long startsect,unsigned long size)
+{
+	char rec[1500];
+	unsigned long n,err,cur,prev;
+	unsigned short s;
+
+	printf("Random sizes: %lu bytes from sector %lu\n",size,startsect);
+	hostsd_param.write_stall_every=64;
+	hostsd_param.write_stall_us=5000;
+	sd_streamcache_clearstat();
+	hostsd_clearstat();
+	sd_stream_open(startsect,0);
+	err=0;
+	prev=startsect;
+	for(n=0;n<size;n+=s)
+	{
+		s=rand()%sizeof(rec)+1;
+		if(n+s>size)
+			s=size-n;
+		for(unsigned short i=0;i<s;i++)
+			rec[i]=host_pattern(n+i);
+		if(sd_streamcache_write(rec,s,&cur))
+			err++;
+		// The current sector only moves forward, and never beyond the data written
+		HOST_CHECK(cur>=prev && cur<=startsect+(n+s)/512);
+		prev=cur;
+		HOST_CHECK(_sdbuffer_n<=SD_CACHE_SIZE);
+		if(rand()%4==0)
+		{
+			host_time_advance_ns((rand()%2000)*1000ULL);
+			if(sd_streamcache_poll())
+				err++;
+		}
+	}
+	// Flush
+	HOST_CHECK(sd_streamcache_write(0,0,0)==0);
+	HOST_CHECK(_sdbuffer_n==0);
+	if(sd_streamcache_close(0))
+		err++;
+	sd_streamcache_printstat(file_pri);
+	hostsd_printstat(file_pri);
+	HOST_CHECK(err==0);
+	HOST_CHECK(_sdbuffer_maxn<=SD_CACHE_SIZE);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+	HOST_CHECK(hostsd_stat.write_errors==0);
+	test_checkdata(startsect,size);
+	hostsd_defaultparam(&hostsd_param);
+}
+/******************************************************************************
+	function: test_paced
+*******************************************************************************
+	Writes records of recsize bytes every period_us on a card which stalls
+	stall_us every 16 blocks. Checks that no write blocks.
+******************************************************************************/
+void test_paced(unsigned long startsect,unsigned long size,unsigned short recsize,unsigned long period_us,unsigned long stall_us)
+{
+	char rec[512];
+	unsigned long n,err;
+
+	printf("Paced: %u bytes every %lu us, card stall %lu us every 16 blocks\n",recsize,period_us,stall_us);
+	hostsd_param.write_stall_every=16;
+	hostsd_param.write_stall_us=stall_us;
+	sd_streamcache_clearstat();
+	hostsd_clearstat();
+	sd_stream_open(startsect,0);
+	err=0;
+	for(n=0;n<size;n+=recsize)
+	{
+		for(unsigned short i=0;i<recsize;i++)
+			rec[i]=host_pattern(n+i);
+		if(sd_streamcache_write(rec,recsize,0))
+			err++;
+		host_time_advance_ns(period_us*1000ULL);
+	}
+	if(sd_streamcache_close(0))
+		err++;
+	sd_streamcache_printstat(file_pri);
+	HOST_CHECK(err==0);
+	HOST_CHECK(_sd_streamcache_numblock==0);
+	HOST_CHECK(hostsd_stat.protocol_errors==0);
+	test_checkdata(startsect,n);
+	hostsd_defaultparam(&hostsd_param);
+}
+
+int main(int argc,char **argv)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long capacity;
+
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	if(host_sdinit(argv[1],TEST_CAPACITY))
+		return 1;
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&capacity)==0);
+
+	test_random(1000,1000000);
+	test_random(20001,3*SD_CACHE_SIZE+17);
+	// 100 bytes every 500us (200KB/s): a stall of 3ms (600 bytes) needs more than one sector of staging
+	test_paced(40000,500000,100,500,3000);
+	// 32 bytes every 100us (320KB/s): a stall of 1.5ms (480 bytes) plus the busy time of the block
+	test_paced(60000,500000,32,100,1500);
+
+	hostsd_close();
+	return host_result("test_streamcache");
+}
@@ -0,0 +1,219 @@
+/*
+	file: test_timeindex
+
+	Tests of the time index of the uFAT logs, written by the firmware on the simulated card and read back from
+	the image with the reader of the host tools (ufatimg):
+
+	* The reader decodes the geometry and the logs of the image as the firmware does.
+	* Entry k of the index is the time at which the first data of sector k*UFAT_INDEX_NUMSECT was written, and
+	the index costs one extra sector write per entry.
+	* ufatimg_findtime and ufat_log_findtime return the same sector for random times, the data of that sector is
+	not later than the time, and the data of the time is at most UFAT_INDEX_NUMSECT sectors further. The search
+	reads about log2 of the number of index sectors.
+	* A log with less than a sector has one entry, a log never written has none, and a log written again has
+	the index of the last write only.
+
+	The log is written in records which start with the time of their write, at a rate which varies and with
+	pauses, so that the times of the index are irregular.
+
+	Usage: test_timeindex <image>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wait.h"
+#include "sd.h"
+#include "ufat.h"
+#include "hostsd.h"
+#include "hostshim.h"
+#include "ufatimg.h"
+
+#define TEST_CAPACITY 4194304						// Capacity of the card in sectors (2GB): 4 index sectors per log
+#define TEST_SIZE (40*1024*1024l+1000)				// Size of log 0
+#define TEST_RECSIZE 128							// Size of the records: 4 per sector
+#define TEST_NUMSECT (TEST_SIZE/512+1)
+
+extern LOGENTRY _logentries[];
+extern unsigned long _log_index_num,_log_index_err;
+
+unsigned long test_time[TEST_NUMSECT];				// Time of the first record of each sector of log 0
+const char *test_image;
+
+/******************************************************************************
+	function: test_write
+*******************************************************************************
+	Writes size bytes to log n in records starting with the time of the write.
+	The rate changes every 256KB and the log pauses for up to 3s every 4MB.
+******************************************************************************/
+void test_write(unsigned char n,unsigned long size,unsigned long *sectortime)
+{
+	char rec[TEST_RECSIZE];
+	unsigned long t,gap=0;
+
+	HOST_CHECK(ufat_log_open(n)!=0);
+	for(unsigned long i=0;i<size;i+=TEST_RECSIZE)
+	{
+		if(i%(256*1024)==0)
+			gap=rand()%2000;
+		if(i%(4*1024*1024)==0)
+			host_time_advance_ns((unsigned long long)(rand()%3000)*1000000);
+		host_time_advance_ns((unsigned long long)gap*1000);
+		t=timer_ms_get();
+		if(sectortime && i%512==0)
+			sectortime[i/512]=t;
+		memset(rec,0,TEST_RECSIZE);
+		memcpy(rec,&t,4);
+		memcpy(rec+4,&i,4);
+		if(_ufat_log_fputbuf(rec,size-i<TEST_RECSIZE?size-i:TEST_RECSIZE))
+		{
+			HOST_CHECK(0);
+			break;
+		}
+	}
+	HOST_CHECK(_log_index_err==0);
+	HOST_CHECK(ufat_log_close()==0);
+	HOST_CHECK(ufat_log_getlogsize(n)==size);
+}
+/******************************************************************************
+	function: test_sectortime
+*******************************************************************************
+	Time of the first record of sector s of log 0, read from the image.
+******************************************************************************/
+unsigned long test_sectortime(UFATIMG *u,unsigned long s)
+{
+	unsigned char b[512];
+	unsigned long t;
+
+	HOST_CHECK(ufatimg_readsector(u,u->startsector[0]+s,b)==0);
+	memcpy(&t,b,4);
+	return t;
+}
+/******************************************************************************
+	function: test_geometry
+*******************************************************************************
+	Checks that the reader decodes the image as the firmware.
+******************************************************************************/
+void test_geometry(UFATIMG *u)
+{
+	HOST_CHECK(u->lognum==_fsinfo.lognum);
+	HOST_CHECK(u->sectors_per_cluster==_fsinfo.sectors_per_cluster);
+	HOST_CHECK(u->cluster_begin==_fsinfo.cluster_begin);
+	HOST_CHECK(u->logsizecluster==_fsinfo.logsizecluster);
+	HOST_CHECK(u->logsizebytes==_fsinfo.logsizebytes);
+	HOST_CHECK(u->logindexsectors==_fsinfo.logindexsectors);
+	for(unsigned char n=0;n<u->lognum;n++)
+	{
+		HOST_CHECK(u->startsector[n]==_logentries[n].startsector);
+		HOST_CHECK(u->size[n]==ufat_log_getlogsize(n));
+	}
+}
+/******************************************************************************
+	function: test_index
+*******************************************************************************
+	Checks the entries of the index of log 0 against the times of the writes.
+******************************************************************************/
+void test_index(UFATIMG *u)
+{
+	unsigned long ne,t,tprev=0;
+
+	ne=ufatimg_numentry(u,0);
+	printf("Log 0: %lu sectors, %lu index entries\n",(unsigned long)TEST_NUMSECT,ne);
+	HOST_CHECK(ne==(TEST_NUMSECT-1)/UFAT_INDEX_NUMSECT+1);
+	for(unsigned long k=0;k<ne;k++)
+	{
+		HOST_CHECK(ufatimg_getentry(u,0,k,&t)==0);
+		// The entry is taken after the write of the first data of the sector, before the next sector
+		HOST_CHECK(t>=test_time[k*UFAT_INDEX_NUMSECT] && t>=tprev);
+		if(k*UFAT_INDEX_NUMSECT+1<TEST_NUMSECT)
+			HOST_CHECK(t<=test_time[k*UFAT_INDEX_NUMSECT+1]);
+		tprev=t;
+	}
+	HOST_CHECK(ufatimg_getentry(u,0,ne,&t)==0 && (t==0 || t==0xffffffff));
+}
+/******************************************************************************
+	function: test_find
+*******************************************************************************
+	Finds random times in log 0 with the reader and with the firmware.
+******************************************************************************/
+void test_find(UFATIMG *u)
+{
+	unsigned long t,first,last,s1,s2,e1,e2,maxread=0,nsect=TEST_NUMSECT;
+	unsigned char rv1,rv2;
+
+	HOST_CHECK(ufatimg_getentry(u,0,0,&first)==0);
+	last=test_time[TEST_NUMSECT-1];
+	for(unsigned short it=0;it<1000;it++)
+	{
+		t=first-1000+rand()%(last-first+2000);
+		u->numread=0;
+		rv1=ufatimg_findtime(u,0,t,&s1,&e1);
+		rv2=ufat_log_findtime(0,t,&s2,&e2);
+		HOST_CHECK(rv1==rv2);
+		HOST_CHECK(rv1==(t<first?2:0));
+		if(u->numread>maxread)
+			maxread=u->numread;
+		if(rv1!=0 || rv2!=0)
+			continue;
+		HOST_CHECK(s1==s2 && e1==e2);
+		HOST_CHECK(s1%UFAT_INDEX_NUMSECT==0 && s1<nsect);
+		// The data of the sector is not later than the time, and the data of the time is at most one group further
+		HOST_CHECK(test_sectortime(u,s1)<=t);
+		if(s1+UFAT_INDEX_NUMSECT+1<nsect)
+			HOST_CHECK(test_sectortime(u,s1+UFAT_INDEX_NUMSECT+1)>t);
+	}
+	printf("Search: at most %lu sectors read from %lu index sectors\n",maxread,u->logindexsectors);
+	HOST_CHECK(maxread<=3);
+}
+
+int main(int argc,char **argv)
+{
+	CID cid;
+	CSD csd;
+	SDSTAT sdstat;
+	unsigned long capacity,ne,s,e,written;
+	UFATIMG u;
+
+	if(argc!=2)
+	{
+		printf("Usage: %s <image>\n",argv[0]);
+		return 1;
+	}
+	host_init();
+	srand(1);
+	test_image=argv[1];
+	if(host_sdinit(test_image,TEST_CAPACITY))
+		return 1;
+	HOST_CHECK(sd_init(&cid,&csd,&sdstat,&capacity)==0);
+	HOST_CHECK(ufat_format(4,64)==0);
+	HOST_CHECK(ufat_init()==0);
+	HOST_CHECK(ufatimg_open(&u,"/nonexistent")==1);
+	ufat_log_setcheckpoint(0,0);
+
+	// Log 0: index of several groups; the writes beyond the data are those of the index and of the ROOT
+	hostsd_clearstat();
+	test_write(0,TEST_SIZE,test_time);
+	written=hostsd_stat.blocks_written;
+	// Log 1: one entry. Log 3: written twice
+	test_write(1,100,0);
+	test_write(3,6*1024*1024,0);
+	test_write(3,2*1024*1024-1,0);
+	HOST_CHECK(hostsd_stat.protocol_errors==0 && hostsd_stat.write_errors==0);
+
+	HOST_CHECK(ufatimg_open(&u,test_image)==0);
+	test_geometry(&u);
+	test_index(&u);
+	ne=ufatimg_numentry(&u,0);
+	printf("Log 0: %lu sector writes for %lu sectors of data and %lu index entries\n",written,(unsigned long)TEST_NUMSECT,ne);
+	HOST_CHECK(written>=TEST_NUMSECT+ne && written<=TEST_NUMSECT+ne+4);
+	test_find(&u);
+	HOST_CHECK(ufatimg_numentry(&u,1)==1);
+	HOST_CHECK(ufatimg_numentry(&u,2)==0);
+	HOST_CHECK(ufatimg_findtime(&u,2,0xfffffffe,&s,&e)==2);
+	HOST_CHECK(ufat_log_findtime(2,0xfffffffe,&s,&e)==2);
+	HOST_CHECK(ufatimg_numentry(&u,3)==2);
+	HOST_CHECK(ufatimg_findtime(&u,4,0,&s,&e)==1);
+	ufatimg_close(&u);
+
+	hostsd_close();
+	return host_result("test_timeindex");
+}
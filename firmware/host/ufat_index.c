@@ -0,0 +1,79 @@
+/*
+	file: ufat_index
+
+	Prints the logs and the time index of a uFAT card image, and finds the data of a given time.
+
+	Usage: ufat_index <image> [<log> [<time>]]
+
+	Without log, prints the geometry of the logs and, for each log, its size and the time span of its index.
+	With log, prints the entries of the index of the log. With log and time (in ms, as timer_ms_get), prints
+	the sector of the log from which to read the data of the time, and its offset in the image.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "ufat.h"
+#include "ufatimg.h"
+
+int main(int argc,char **argv)
+{
+	UFATIMG u;
+	unsigned long n,ne,t0,t1,time,sector,entrytime;
+	unsigned char rv;
+
+	if(argc<2 || argc>4)
+	{
+		printf("Usage: %s <image> [<log> [<time>]]\n",argv[0]);
+		return 1;
+	}
+	if(ufatimg_open(&u,argv[1]))
+	{
+		printf("%s: not a uFAT image\n",argv[1]);
+		return 1;
+	}
+	if(argc==2)
+	{
+		printf("Logs: %lu. Area: %lu clusters of %lu sectors. Data: %lu bytes. Index: %lu sectors, 1 entry per %u sectors\n",
+			u.lognum,u.logsizecluster,u.sectors_per_cluster,u.logsizebytes,u.logindexsectors,UFAT_INDEX_NUMSECT);
+		for(n=0;n<u.lognum;n++)
+		{
+			ne=ufatimg_numentry(&u,n);
+			printf("Log %lu: start sector %lu, size %lu, %lu index entries",n,u.startsector[n],u.size[n],ne);
+			if(ne && ufatimg_getentry(&u,n,0,&t0)==0 && ufatimg_getentry(&u,n,ne-1,&t1)==0)
+				printf(", %lu-%lu ms",t0,t1);
+			printf("\n");
+		}
+		ufatimg_close(&u);
+		return 0;
+	}
+	n=strtoul(argv[2],0,0);
+	if(n>=u.lognum)
+	{
+		printf("Log %lu does not exist\n",n);
+		ufatimg_close(&u);
+		return 1;
+	}
+	if(argc==3)
+	{
+		ne=ufatimg_numentry(&u,n);
+		for(unsigned long k=0;k<ne;k++)
+		{
+			if(ufatimg_getentry(&u,n,k,&t0))
+				break;
+			printf("%lu\t%lu\n",k*UFAT_INDEX_NUMSECT,t0);
+		}
+		ufatimg_close(&u);
+		return 0;
+	}
+	time=strtoul(argv[3],0,0);
+	u.numread=0;
+	rv=ufatimg_findtime(&u,n,time,&sector,&entrytime);
+	if(rv==0)
+		printf("Log %lu, time %lu ms: sector %lu (entry at %lu ms), image offset %llu. %lu sectors read\n",
+			n,time,sector,entrytime,(unsigned long long)(u.startsector[n]+sector)*512,u.numread);
+	else if(rv==2)
+		printf("Log %lu, time %lu ms: no data at or before this time\n",n,time);
+	else
+		printf("Log %lu: error reading the index\n",n);
+	ufatimg_close(&u);
+	return rv==1;
+}
@@ -0,0 +1,230 @@
+/*
+	file: ufatimg
+
+	Reader of the logs and of the time index of a uFAT card image, for the host tools and tests.
+
+	The reader does not use the storage stack of the firmware: it decodes the image from the layout
+	documented in ufat.c, so that the image of a card read with a card reader (e.g. with dd) can be used
+	directly. The MBR gives the partition, the boot sector the FAT32 geometry, the metadata entry of the
+	ROOT (entry 15) the start and size of the log areas, and the ROOT entries the logs.
+
+	The time index of log n is at the end of its area: logindexsectors sectors from
+	startsector+logsizebytes/512, one 32-bit little endian entry per UFAT_INDEX_NUMSECT sectors of data.
+	Entry k is the time in ms at which the log reached the sector k*UFAT_INDEX_NUMSECT; unused entries are
+	0x00000000 or 0xFFFFFFFF. ufatimg_findtime finds the sector of a time with a binary search which reads
+	about log2(number of index sectors)+1 sectors of the image.
+
+	* ufatimg_open:				Opens an image and decodes the file system.
+	* ufatimg_close:			Closes the image.
+	* ufatimg_readsector:		Reads a sector of the image.
+	* ufatimg_getentry:			Reads an entry of the time index of a log.
+	* ufatimg_numentry:			Returns the number of entries of the time index of a log.
+	* ufatimg_findtime:			Finds the sector of a log which holds the data of a given time.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "ufat.h"
+#include "ufatimg.h"
+
+static unsigned long _ufatimg_u32(const unsigned char *p)
+{
+	return p[0]|((unsigned long)p[1]<<8)|((unsigned long)p[2]<<16)|((unsigned long)p[3]<<24);
+}
+static unsigned short _ufatimg_u16(const unsigned char *p)
+{
+	return p[0]|(p[1]<<8);
+}
+static unsigned char _ufatimg_isvalid(unsigned long v)
+{
+	return v!=0 && v!=0xffffffff;
+}
+/******************************************************************************
+	function: ufatimg_readsector
+*******************************************************************************
+	Reads a sector of the image.
+
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char ufatimg_readsector(UFATIMG *u,unsigned long sector,unsigned char *buffer)
+{
+	u->numread++;
+	if(pread(u->fd,buffer,512,(off_t)sector*512)!=512)
+		return 1;
+	return 0;
+}
+/******************************************************************************
+	function: ufatimg_open
+*******************************************************************************
+	Opens an image and decodes the partition, the FAT32 boot sector, the uFAT
+	metadata and the ROOT entries of the logs.
+
+	Returns:
+		0			-	Success
+		1			-	Error: the image cannot be read or is not formatted with uFAT
+******************************************************************************/
+unsigned char ufatimg_open(UFATIMG *u,const char *image)
+{
+	unsigned char b[512],*fe,checksum;
+	unsigned long part,rootsector,logstartcluster,sect,s,o;
+
+	memset(u,0,sizeof(UFATIMG));
+	u->fd=open(image,O_RDONLY);
+	if(u->fd<0)
+		return 1;
+	// MBR: first partition, FAT32
+	if(ufatimg_readsector(u,0,b) || b[510]!=0x55 || b[511]!=0xAA || (b[446+4]!=0x0b && b[446+4]!=0x0c))
+		goto err;
+	part=_ufatimg_u32(b+446+8);
+	// Boot sector
+	if(ufatimg_readsector(u,part,b) || b[510]!=0x55 || b[511]!=0xAA || memcmp(b+82,"FAT32   ",8) || _ufatimg_u16(b+11)!=512 || b[13]==0)
+		goto err;
+	u->sectors_per_cluster=b[13];
+	u->cluster_begin=part+_ufatimg_u16(b+14)+b[16]*_ufatimg_u32(b+36);
+	rootsector=u->cluster_begin+(_ufatimg_u32(b+44)-2)*u->sectors_per_cluster;
+	// Metadata in the last entry of the first ROOT sector, protected by a checksum
+	if(ufatimg_readsector(u,rootsector,b))
+		goto err;
+	fe=b+480;
+	checksum=0;
+	for(unsigned char i=0;i<10;i++)
+		checksum+=fe[i];
+	if(fe[0]!=0xE5 || fe[10]!=checksum || fe[9]==0)
+		goto err;
+	logstartcluster=_ufatimg_u32(fe+1);
+	u->logsizecluster=_ufatimg_u32(fe+5);
+	u->lognum=fe[9];
+	// Size of the data and of the index of the log areas, as _ufat_log_setsize
+	sect=u->logsizecluster*u->sectors_per_cluster;
+	u->logindexsectors=(sect/UFAT_INDEX_NUMSECT+1+127)/128;
+	u->logsizebytes=(sect-u->logindexsectors)*512;
+	// Logs: 14 in the first ROOT sector, 16 in each further sector
+	for(unsigned long n=0;n<u->lognum;n++)
+	{
+		s=n<14?0:1+(n-14)/16;
+		o=n<14?32+n*32:((n-14)&15)*32;
+		if((n==0 || o==0) && ufatimg_readsector(u,rootsector+s,b))
+			goto err;
+		fe=b+o;
+		u->startsector[n]=u->cluster_begin+((((unsigned long)_ufatimg_u16(fe+20)<<16)|_ufatimg_u16(fe+26))-2)*u->sectors_per_cluster;
+		u->size[n]=_ufatimg_u32(fe+28);
+	}
+	if(u->startsector[0]!=u->cluster_begin+(logstartcluster-2)*u->sectors_per_cluster)
+		goto err;
+	return 0;
+err:
+	ufatimg_close(u);
+	return 1;
+}
+/******************************************************************************
+	function: ufatimg_close
+*******************************************************************************
+	Closes the image.
+******************************************************************************/
+void ufatimg_close(UFATIMG *u)
+{
+	if(u->fd>=0)
+		close(u->fd);
+	u->fd=-1;
+}
+/******************************************************************************
+	function: ufatimg_getentry
+*******************************************************************************
+	Reads entry k of the time index of log n.
+
+	Parameters:
+		time		-	Pointer to the time of the entry in ms; 0 or 0xFFFFFFFF if the entry is unused
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char ufatimg_getentry(UFATIMG *u,unsigned char n,unsigned long k,unsigned long *time)
+{
+	unsigned char b[512];
+
+	if(n>=u->lognum || k>=u->logindexsectors*128)
+		return 1;
+	if(ufatimg_readsector(u,u->startsector[n]+(u->logsizebytes>>9)+k/128,b))
+		return 1;
+	*time=_ufatimg_u32(b+(k&127)*4);
+	return 0;
+}
+/******************************************************************************
+	function: ufatimg_numentry
+*******************************************************************************
+	Returns the number of entries of the time index of log n, i.e. the index of
+	the first unused entry.
+******************************************************************************/
+unsigned long ufatimg_numentry(UFATIMG *u,unsigned char n)
+{
+	unsigned char b[512];
+
+	if(n>=u->lognum)
+		return 0;
+	for(unsigned long s=0;s<u->logindexsectors;s++)
+	{
+		if(ufatimg_readsector(u,u->startsector[n]+(u->logsizebytes>>9)+s,b))
+			return s*128;
+		for(unsigned char i=0;i<128;i++)
+			if(!_ufatimg_isvalid(_ufatimg_u32(b+i*4)))
+				return s*128+i;
+	}
+	return u->logindexsectors*128;
+}
+/******************************************************************************
+	function: ufatimg_findtime
+*******************************************************************************
+	Finds the sector of log n which holds the data written at a given time, with
+	the same binary search as ufat_log_findtime.
+
+	The returned sector is the first sector of the last group of
+	UFAT_INDEX_NUMSECT sectors which was reached at or before time: its data is
+	not later than time, and the data of time is at most UFAT_INDEX_NUMSECT
+	sectors further.
+
+	Parameters:
+		n			-	Number of the log
+		time		-	Time in ms
+		sector		-	Pointer to the sector offset from the start of the log
+		entrytime	-	Pointer to the time of the index entry of the sector
+	Returns:
+		0			-	Success
+		1			-	Error
+		2			-	The log has no index or all the entries are after time
+******************************************************************************/
+unsigned char ufatimg_findtime(UFATIMG *u,unsigned char n,unsigned long time,unsigned long *sector,unsigned long *entrytime)
+{
+	unsigned char b[512];
+	unsigned long lo,hi,mid,cur=0xffffffff,v;
+
+	if(n>=u->lognum)
+		return 1;
+	// Invariant: entry lo is valid and not after time, or lo=-1; entry hi is invalid, after time, or past the end of the index.
+	lo=0xffffffff;
+	hi=u->logindexsectors*128;
+	while(hi-lo>1)
+	{
+		mid=lo+(hi-lo)/2;
+		if(mid/128!=cur)
+		{
+			cur=mid/128;
+			if(ufatimg_readsector(u,u->startsector[n]+(u->logsizebytes>>9)+cur,b))
+				return 1;
+		}
+		v=_ufatimg_u32(b+(mid&127)*4);
+		if(_ufatimg_isvalid(v) && v<=time)
+		{
+			lo=mid;
+			*entrytime=v;
+		}
+		else
+			hi=mid;
+	}
+	if(lo==0xffffffff)
+		return 2;
+	*sector=lo*UFAT_INDEX_NUMSECT;
+	return 0;
+}
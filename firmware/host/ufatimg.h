@@ -0,0 +1,31 @@
+#ifndef __UFATIMG_H
+#define __UFATIMG_H
+
+/*
+	Reader of the logs and of the time index of a uFAT card image (see ufatimg.c).
+*/
+
+#define UFATIMG_MAXLOG 255
+
+typedef struct
+{
+	int fd;
+	unsigned long sectors_per_cluster;
+	unsigned long cluster_begin;						// Sector of cluster 2
+	unsigned long lognum;
+	unsigned long logsizecluster;
+	unsigned long logsizebytes;							// Size of the data area of the logs, without the index
+	unsigned long logindexsectors;						// Number of sectors of the time index at the end of the area of each log
+	unsigned long startsector[UFATIMG_MAXLOG];			// First sector of each log
+	unsigned long size[UFATIMG_MAXLOG];					// Size of each log in the ROOT
+	unsigned long numread;								// Sectors read from the image
+} UFATIMG;
+
+unsigned char ufatimg_open(UFATIMG *u,const char *image);
+void ufatimg_close(UFATIMG *u);
+unsigned char ufatimg_readsector(UFATIMG *u,unsigned long sector,unsigned char *buffer);
+unsigned char ufatimg_getentry(UFATIMG *u,unsigned char n,unsigned long k,unsigned long *time);
+unsigned long ufatimg_numentry(UFATIMG *u,unsigned char n);
+unsigned char ufatimg_findtime(UFATIMG *u,unsigned char n,unsigned long time,unsigned long *sector,unsigned long *entrytime);
+
+#endif
@@ -14,6 +14,7 @@
 #include "i2c.h"
 #include "i2c_int.h"
 #include "wait.h"
+#include "ring.h"
 
 /*
 	Convert last into mAh using prescaler
@@ -99,8 +100,7 @@ unsigned char _ltc2942_previousreadexists=0;				// Flag used to indicate whether
 char _ltc2924_batterytext[42];								// Holds a text description of the battery status.
 volatile signed short _ltc2942_last_mWs[LTC2942NUMLASTMW];		// Holds the last LTC2942NUMLASTMW mW
 
-LTC2942_BATSTAT _ltc2942_batstat[LTC2942NUMLONGBATSTAT];	// Circular buffer holding battery status on long time scales (typically updated every ~150 seconds or more)
-volatile unsigned char _ltc2942_batstat_rdptr=0,_ltc2942_batstat_wrptr=0;	// Read/write pointers. This is used for fast removal of old entries avoiding memory copy
+SPSCRING<LTC2942_BATSTAT,LTC2942NUMLONGBATSTAT> _ltc2942_batstat;	// Ring holding battery status on long time scales (typically updated every ~180 seconds or more); the oldest entries are overwritten
 unsigned long _ltc2942_batstat_lastupdate=0;
 const unsigned long _ltc2942_batstat_updateevery=LTC2942NUMLONGBATSTAT_UPDATEEVERY;	// Store every 3mn. 
 volatile unsigned _ltc2942_backgroundgetstate_ongoing=0;	// Mutex to ensure only one background read at any time
@@ -824,7 +824,7 @@ Battery statistics notes
 	Returns how many long battery statistics are available.
 	
 	The number is zero, when the system is initialised, up to 
-	LTC2942NUMLONGBATSTAT-1.
+	LTC2942NUMLONGBATSTAT.
 	
 	As the battery statistics are stored in an interrupt routine, there may be
 	more battery statistics available that the value returned, but there 
@@ -836,14 +836,12 @@ Battery statistics notes
 *******************************************************************************/
 unsigned char ltc2942_get_numlongbatstat()
 {
-	signed short n;
+	unsigned short n;
+	// The producer also moves the read counter when dropping the oldest entry
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		n = _ltc2942_batstat_wrptr-_ltc2942_batstat_rdptr;
+		n = _ltc2942_batstat.level();
 	}
-	// n can be negative if one of the pointer wraps around. In which case correct this
-	if(n<0)
-		n+=LTC2942NUMLONGBATSTAT;
 	return n;	
 }
 /******************************************************************************
@@ -880,17 +878,9 @@ unsigned char ltc2942_get_numlongbatstat()
 *******************************************************************************/
 void ltc2942_get_longbatstat(unsigned char idx,LTC2942_BATSTAT *batstat)
 {
-	signed short n;
-	
-	if(idx>LTC2942NUMLONGBATSTAT-2)		// Clamp to avoid reads to other memory locations; there is a maximum of LTC2942NUMLONGBATSTAT-1 entries, from 0 to LTC2942NUMLONGBATSTAT-2
-		idx=LTC2942NUMLONGBATSTAT-2;
-		
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	// Get the actual index and copy the data
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)	// Copy the data; at masks the index, hence never reads other memory locations
 	{
-		n=_ltc2942_batstat_rdptr+idx;
-		if(n>=LTC2942NUMLONGBATSTAT)
-			n-=LTC2942NUMLONGBATSTAT;
-		*batstat=_ltc2942_batstat[n];
+		*batstat=_ltc2942_batstat.at(idx);
 	}	
 }
 
@@ -904,10 +894,7 @@ void ltc2942_get_longbatstat(unsigned char idx,LTC2942_BATSTAT *batstat)
 *******************************************************************************/
 void ltc2942_clear_longbatstat()
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		_ltc2942_batstat_wrptr=_ltc2942_batstat_rdptr=0;
-	}
+	_ltc2942_batstat.clear();
 	_ltc2942_batstat_lastupdate=0;
 }
 /******************************************************************************
@@ -922,35 +909,21 @@ void ltc2942_clear_longbatstat()
 *******************************************************************************/
 void _ltc2942_add_longbatstat(LTC2942_BATSTAT *batstat)
 {
-	// Data can always be added at the write pointer
-	_ltc2942_batstat[_ltc2942_batstat_wrptr]=*batstat;
-	// Increment the write pointer and check for wraparounds
-	_ltc2942_batstat_wrptr++;
-	if(_ltc2942_batstat_wrptr>=LTC2942NUMLONGBATSTAT)
-		_ltc2942_batstat_wrptr-=LTC2942NUMLONGBATSTAT;
-	// Now check whether wrptr and rdptr equal - if yes the buffer is full and rdptr must be incremented
-	if(_ltc2942_batstat_wrptr==_ltc2942_batstat_rdptr)
-	{
-		// Increment rdptr and wrap around
-		_ltc2942_batstat_rdptr++;
-		if(_ltc2942_batstat_rdptr>=LTC2942NUMLONGBATSTAT)
-			_ltc2942_batstat_rdptr-=LTC2942NUMLONGBATSTAT;
-	}	
+	_ltc2942_batstat.put_overwrite(*batstat);
 }
 
 // For debugging
 void _ltc2942_dump_longbatstat()
 {
-	printf("dump longbatstat: rd: %d wr: %d\n",_ltc2942_batstat_rdptr,_ltc2942_batstat_wrptr);
+	printf("dump longbatstat\n");
 	printf("\tnum: %d\n",ltc2942_get_numlongbatstat());
 	for(unsigned char i=0;i<LTC2942NUMLONGBATSTAT;i++)
-		printf("\t%d: %lu %d %d %d\n",i,_ltc2942_batstat[i].t,_ltc2942_batstat[i].mV,_ltc2942_batstat[i].mA,_ltc2942_batstat[i].mW);	
+		printf("\t%d: %lu %d %d %d\n",i,_ltc2942_batstat.at(i).t,_ltc2942_batstat.at(i).mV,_ltc2942_batstat.at(i).mA,_ltc2942_batstat.at(i).mW);	
 }
 // For debugging
 void ltc2942_print_longbatstat(FILE *f)
 {
 	LTC2942_BATSTAT b;
-	//printf("print longbatstat: rd: %d wr: %d\n",_ltc2942_batstat_rdptr,_ltc2942_batstat_wrptr);
 	fprintf_P(f,PSTR("Battery info:\n"));
 	fprintf_P(f,PSTR("\tT[ms]\t\tmV\tmA\tmW\n"));
 	for(unsigned char i=0;i<ltc2942_get_numlongbatstat();i++)
@@ -20,10 +20,10 @@
 // Short term battery status
 #define LTC2942NUMLASTMW 10
 // Long term battery status
-// The number of entries in is equal to LTC2942NUMLONGBATSTAT-1
-// The sensor has a battery life of <6 hours, hence 144 entries needed with a readout every 2.5mn.
-#define LTC2942NUMLONGBATSTAT 150
-#define LTC2942NUMLONGBATSTAT_UPDATEEVERY 150000l
+// The number of entries is equal to LTC2942NUMLONGBATSTAT, which must be a power of 2 (SPSCRING).
+// The sensor has a battery life of <6 hours; 128 entries with a readout every 3mn hold the last 6.4 hours.
+#define LTC2942NUMLONGBATSTAT 128
+#define LTC2942NUMLONGBATSTAT_UPDATEEVERY 180000l
 
 typedef struct {
 	unsigned long t;
@@ -68,7 +68,7 @@ TODO-DONE:	Time synchronisation including epoch on boot
 TODO:	Verify time synchronisation including epoch
 TODO-DONE:	PC program to synchronise clocks
 TODO:	Verify sample rate regularity with high sample rate modes (200Hz-1KHz)
-TODO:	Readout of files (never practical due to slow transfer)
+TODO-DONE:	Readout of files (SD mode command O: binary frames with CRC, resumable)
 TODO:	PC program to converto to quaternions
 TODO:	Magnetic field: check effect of quantisation and sample rate (8/100) on quaternions
 TODO:	Improve idle bluetooth power efficiency w/ inquiry and scan pages (SI,S
@@ -139,6 +139,7 @@ BUG:	Stopeeing logging and quitting motion sampling mode with ! does not write b
 #include "wait.h"
 #include "mode.h"
 #include "a3d.h"
+#include "prof.h"
 
 FILE *file_bt;			// Bluetooth
 FILE *file_usb;			// USB
@@ -252,7 +253,9 @@ ISR(TIMER1_COMPA_vect)
 		system_led_toggle(0b001);*/
 	
 	// No need to check signal edge, directly call interrupt vector
+	PROF_START(PROF_ISR);
 	mpu_isr();
+	PROF_STOP(PROF_ISR);
 	// Clear the compare match interrut, if it was set again prior to mpu_isr returning
 	TIFR1=0b00000010;
 }
@@ -266,7 +269,9 @@ ISR(TIMER1_CAPT_vect)
 		system_led_toggle(0b100);*/
 	
 	// No need to check signal edge, directly call interrupt vector
+	PROF_START(PROF_ISR);
 	mpu_isr();
+	PROF_STOP(PROF_ISR);
 	// Clear the input capture interrut, if it was set again prior to mpu_isr returning
 	TIFR1=0b00100000;
 }
@@ -319,13 +324,21 @@ ISR(PCINT2_vect)
 
 	#if (HWVER==9)
 	if((PINB&0x02)==0)			// MPU ISR on falling edge; hack to avoid missing interrupts
-		mpu_isr();				
+	{
+		PROF_START(PROF_ISR);
+		mpu_isr();
+		PROF_STOP(PROF_ISR);
+	}
 	//if(PINB&0x02)			// MPU ISR on rising edge; technically correct but misses interrupts.
 	//	mpu_isr();
 	PCIFR=0b0010;		// Clear pending interrupts
 	#else
 	if((PINC&0x20)==0)			// MPU ISR on falling edge; hack to avoid missing interrupts
-		mpu_isr();				
+	{
+		PROF_START(PROF_ISR);
+		mpu_isr();
+		PROF_STOP(PROF_ISR);
+	}
 	//if(PINC&0x20)			// MPU ISR on rising edge; technically correct but misses interrupts.
 	//	mpu_isr();
 	PCIFR=0b0100;		// Clear pending interrupts
@@ -36,9 +36,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 	
 	Safe to use in interrupts.
 	
+	*Block operations*
+	
+	buffer_write, buffer_read, buffer_peek_contiguous and buffer_skip transfer several bytes at once: the data is copied 
+	with at most two memcpy (before and after the wraparound) and the read or write pointer is updated once, after the 
+	copy. They assume one producer and one consumer (e.g. user code and an interrupt routine); the pointer update is 
+	done in an atomic block so that the other side never sees a partially updated 16-bit pointer nor a pointer 
+	ahead of the data.
+	
 	*Notes*
 	
-	Must analyse the code and possibly introduce ATOMIC_BLOCK(ATOMIC_RESTORESTATE) for all the functions which use both the rdptr and wrptr (e.g. buffer_isfull, buffer_clear, buffer_isempty, buffer_level, etc).
+	The 16-bit rdptr and wrptr are read and updated in atomic blocks, so that a pointer being updated by an interrupt 
+	routine is never seen half-written. For new fixed-size queues, especially of structures, prefer SPSCRING (ring.h).
 	
 	
 	
@@ -74,10 +83,11 @@ BUFFER MANAGEMENT   BUFFER MANAGEMENT   BUFFER MANAGEMENT   BUFFER MANAGEMENT
 ******************************************************************************/
 void buffer_put(volatile CIRCULARBUFFER *io, unsigned char c)
 {
-	//ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	unsigned short wrptr=io->wrptr;
+	io->buffer[wrptr]=c;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-	io->buffer[io->wrptr]=c;
-	io->wrptr=(io->wrptr+1)&(io->mask);
+		io->wrptr=(wrptr+1)&(io->mask);
 	}
 }
 /******************************************************************************
@@ -93,10 +103,11 @@ void buffer_put(volatile CIRCULARBUFFER *io, unsigned char c)
 unsigned char buffer_get(volatile CIRCULARBUFFER *io)
 {
 	unsigned char c;
-	//ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	unsigned short rdptr=io->rdptr;
+	c = io->buffer[rdptr];
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-	c = io->buffer[io->rdptr];
-	io->rdptr=(io->rdptr+1)&(io->mask);	
+		io->rdptr=(rdptr+1)&(io->mask);	
 	}
 	return c;
 }
@@ -119,8 +130,12 @@ unsigned char buffer_get(volatile CIRCULARBUFFER *io)
 ******************************************************************************/
 unsigned char buffer_unget(volatile CIRCULARBUFFER *io,unsigned char c)
 {
-	io->rdptr=(io->rdptr-1)&(io->mask);
-	io->buffer[io->rdptr]=c;	
+	unsigned short rdptr=(io->rdptr-1)&(io->mask);
+	io->buffer[rdptr]=c;	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		io->rdptr=rdptr;
+	}
 	return c;
 }
 
@@ -140,12 +155,9 @@ unsigned char buffer_unget(volatile CIRCULARBUFFER *io,unsigned char c)
 unsigned char buffer_isempty(volatile CIRCULARBUFFER *io)
 {
 	unsigned char v;
-	//ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-	if(io->rdptr==io->wrptr)
-		v=1;
-	else
-		v=0;
+		v=(io->rdptr==io->wrptr);
 	}
 	return v;
 }
@@ -160,7 +172,10 @@ unsigned char buffer_isempty(volatile CIRCULARBUFFER *io)
 ******************************************************************************/
 void buffer_clear(volatile CIRCULARBUFFER *io)
 {
-	io->wrptr=io->rdptr=0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		io->wrptr=io->rdptr=0;
+	}
 }
 
 /******************************************************************************
@@ -178,14 +193,11 @@ void buffer_clear(volatile CIRCULARBUFFER *io)
 unsigned char buffer_isfull(volatile CIRCULARBUFFER *io)
 {
 	unsigned char v;
-	//ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
 	// We loose 1 character in the buffer because rd=wr means empty buffer, and 
 	// wr+1=rd means buffer full (whereas it would actually mean that one more byte can be stored).
-	if( ((io->wrptr+1)&io->mask) == io->rdptr )
-		v=1;
-	else
-		v=0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		v=( ((io->wrptr+1)&io->mask) == io->rdptr );
 	}
 	return v;
 }
@@ -203,9 +215,9 @@ unsigned char buffer_isfull(volatile CIRCULARBUFFER *io)
 unsigned short buffer_level(volatile CIRCULARBUFFER *io)
 {
 	unsigned short l;
-	//ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-	l = ((io->wrptr-io->rdptr)&io->mask);
+		l = ((io->wrptr-io->rdptr)&io->mask);
 	}
 	return l;
 }
@@ -224,3 +236,119 @@ unsigned short buffer_freespace(volatile CIRCULARBUFFER *io)
 {
 	return io->size-buffer_level(io)-1;
 }
+/******************************************************************************
+   function: buffer_write
+*******************************************************************************
+	Adds n bytes to the circular buffer, or nothing if there is not enough space.
+	
+	Parameters:
+		io		-		CIRCULARBUFFER buffer
+		data	-		Data to add to the buffer
+		n		-		Number of bytes to add
+		
+	Returns:
+		0		-		Success
+		1		-		Not enough space; nothing is written
+******************************************************************************/
+unsigned char buffer_write(volatile CIRCULARBUFFER *io,const void *data,unsigned short n)
+{
+	unsigned short wrptr,n1;
+	
+	if(buffer_freespace(io)<n)
+		return 1;
+	
+	wrptr=io->wrptr;
+	// First chunk up to the end of the buffer, second chunk from the start
+	n1=io->size-wrptr;
+	if(n1>n)
+		n1=n;
+	memcpy((unsigned char*)io->buffer+wrptr,data,n1);
+	memcpy((unsigned char*)io->buffer,(const unsigned char*)data+n1,n-n1);
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		io->wrptr=(wrptr+n)&io->mask;
+	}
+	return 0;
+}
+/******************************************************************************
+   function: buffer_read
+*******************************************************************************
+	Reads up to n bytes from the circular buffer.
+	
+	Parameters:
+		io		-		CIRCULARBUFFER buffer
+		data	-		Buffer receiving the data
+		n		-		Maximum number of bytes to read
+		
+	Returns:
+		Number of bytes read
+******************************************************************************/
+unsigned short buffer_read(volatile CIRCULARBUFFER *io,void *data,unsigned short n)
+{
+	unsigned short rdptr,n1,l;
+	
+	l=buffer_level(io);
+	if(n>l)
+		n=l;
+	
+	rdptr=io->rdptr;
+	n1=io->size-rdptr;
+	if(n1>n)
+		n1=n;
+	memcpy(data,(unsigned char*)io->buffer+rdptr,n1);
+	memcpy((unsigned char*)data+n1,(unsigned char*)io->buffer,n-n1);
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		io->rdptr=(rdptr+n)&io->mask;
+	}
+	return n;
+}
+/******************************************************************************
+   function: buffer_peek_contiguous
+*******************************************************************************
+	Returns the number of bytes which can be read contiguously from the buffer,
+	i.e. until the first wraparound, and a pointer to them.
+	
+	The data is not removed from the buffer: call buffer_skip once the data
+	has been processed.
+	
+	Parameters:
+		io		-		CIRCULARBUFFER buffer
+		ptr		-		Pointer receiving the address of the first byte
+		
+	Returns:
+		Number of contiguous bytes at *ptr
+******************************************************************************/
+unsigned short buffer_peek_contiguous(volatile CIRCULARBUFFER *io,unsigned char **ptr)
+{
+	unsigned short rdptr,n,l;
+	
+	l=buffer_level(io);
+	rdptr=io->rdptr;
+	n=io->size-rdptr;
+	if(n>l)
+		n=l;
+	*ptr=(unsigned char*)io->buffer+rdptr;
+	return n;
+}
+/******************************************************************************
+   function: buffer_skip
+*******************************************************************************
+	Removes n bytes from the buffer, e.g. after processing them with 
+	buffer_peek_contiguous.
+	
+	This must only be called with n lower or equal to the buffer level.
+	
+	Parameters:
+		io		-		CIRCULARBUFFER buffer
+		n		-		Number of bytes to remove
+******************************************************************************/
+void buffer_skip(volatile CIRCULARBUFFER *io,unsigned short n)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		io->rdptr=(io->rdptr+n)&io->mask;
+	}
+}
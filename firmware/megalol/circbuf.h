@@ -46,5 +46,9 @@ void buffer_clear(volatile CIRCULARBUFFER *io);
 unsigned char buffer_isfull(volatile CIRCULARBUFFER *io);
 unsigned short buffer_level(volatile CIRCULARBUFFER *io);
 unsigned short buffer_freespace(volatile CIRCULARBUFFER *io);
+unsigned char buffer_write(volatile CIRCULARBUFFER *io,const void *data,unsigned short n);
+unsigned short buffer_read(volatile CIRCULARBUFFER *io,void *data,unsigned short n);
+unsigned short buffer_peek_contiguous(volatile CIRCULARBUFFER *io,unsigned char **ptr);
+void buffer_skip(volatile CIRCULARBUFFER *io,unsigned short n);
 
 #endif
\ No newline at end of file
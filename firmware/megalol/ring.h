@@ -0,0 +1,200 @@
+/*
+   MEGALOL - ATmega LOw level Library
+   Single producer single consumer ring Module
+*/
+/*
+Copyright (C) 2009-2016:
+         Daniel Roggen, droggen@gmail.com
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/*
+	file: ring
+
+	Single producer single consumer ring of N elements of type T, typically used to pass data from an interrupt
+	routine to the main loop (or the opposite). N must be a power of 2, at most 32768.
+
+	Example:
+
+	SPSCRING<LTC2942_BATSTAT,128> batstat;
+
+	The read and write counters run freely and are masked on access: all N elements are usable and the level is
+	the difference of the counters. The counters are 8-bit up to N=128, which is atomic on AVR and costs no more
+	than a byte buffer with hand-written pointers; above they are 16-bit and the accesses to the counter of the
+	other side are done in atomic blocks.
+
+	Publish ordering: the producer stores the element before incrementing the write counter, and the consumer
+	reads the element before incrementing the read counter. A compiler barrier enforces this order, so that the
+	other side never sees a counter ahead of the data.
+
+	*Usage in interrupts*
+
+	Safe with one producer and one consumer, one of which may be an interrupt routine. put_overwrite also
+	modifies the read counter and must only be used when the consumer cannot interrupt the producer (e.g. the
+	producer is an interrupt routine and the consumer reads with interrupts disabled).
+*/
+
+#ifndef __RING_H
+#define __RING_H
+
+#include <util/atomic.h>
+
+// Counter type: 8-bit when all levels 0..N fit in 8 bits
+template<bool SMALL> struct _SPSCRING_INDEX { typedef unsigned char type; };
+template<> struct _SPSCRING_INDEX<false> { typedef unsigned short type; };
+
+#define _SPSCRING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template<class T,unsigned short N> class SPSCRING
+{
+	static_assert(N>=2 && N<=32768 && (N&(N-1))==0,"SPSCRING size must be a power of 2");
+	typedef typename _SPSCRING_INDEX<(N<=128)>::type IDX;
+
+	T data[N];
+	volatile IDX wr,rd;
+
+	// Reads a counter modified by the other side; the data is not accessed before. The counters are passed
+	// by address: C++ does not bind references to the 16-bit members of packed structures (host build)
+	static IDX load(volatile IDX *i)
+	{
+		IDX v;
+		if(sizeof(IDX)==1)
+			v=*i;
+		else
+		{
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				v=*i;
+			}
+		}
+		_SPSCRING_BARRIER();
+		return v;
+	}
+	// Publishes a counter to the other side
+	static void store(volatile IDX *i,IDX v)
+	{
+		_SPSCRING_BARRIER();
+		if(sizeof(IDX)==1)
+		{
+			*i=v;
+			return;
+		}
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			*i=v;
+		}
+	}
+
+public:
+	/******************************************************************************
+		function: clear
+	*******************************************************************************
+		Empties the ring. Must not be called while the other side accesses the ring.
+	******************************************************************************/
+	void clear(void)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			wr=rd=0;
+		}
+	}
+	/******************************************************************************
+		function: level
+	*******************************************************************************
+		Returns:
+			Number of elements in the ring
+	******************************************************************************/
+	unsigned short level(void)
+	{
+		IDX r=load(&rd);
+		return (IDX)(load(&wr)-r);
+	}
+	unsigned char isempty(void) { return level()==0; }
+	unsigned char isfull(void) { return level()==N; }
+	unsigned short capacity(void) { return N; }
+
+	/******************************************************************************
+		function: put
+	*******************************************************************************
+		Producer: adds an element to the ring.
+
+		Returns:
+			0	-	Success
+			1	-	Ring full, the element is not added
+	******************************************************************************/
+	unsigned char put(const T &v)
+	{
+		IDX w=wr;
+		if((IDX)(w-load(&rd))==N)
+			return 1;
+		data[w&(N-1)]=v;
+		store(&wr,(IDX)(w+1));
+		return 0;
+	}
+	/******************************************************************************
+		function: put_overwrite
+	*******************************************************************************
+		Producer: adds an element to the ring, dropping the oldest element if the
+		ring is full. See the usage in interrupts.
+	******************************************************************************/
+	void put_overwrite(const T &v)
+	{
+		IDX w=wr;
+		data[w&(N-1)]=v;
+		if((IDX)(w-rd)==N)
+			store(&rd,(IDX)(rd+1));
+		store(&wr,(IDX)(w+1));
+	}
+	/******************************************************************************
+		function: get
+	*******************************************************************************
+		Consumer: removes the oldest element from the ring.
+
+		Returns:
+			0	-	Success
+			1	-	Ring empty, v is not modified
+	******************************************************************************/
+	unsigned char get(T &v)
+	{
+		IDX r=rd;
+		if(load(&wr)==r)
+			return 1;
+		v=data[r&(N-1)];
+		store(&rd,(IDX)(r+1));
+		return 0;
+	}
+	/******************************************************************************
+		function: at
+	*******************************************************************************
+		Consumer: returns the element idx, 0 being the oldest, without removing it.
+		idx must be lower than level().
+	******************************************************************************/
+	T &at(unsigned short idx)
+	{
+		return data[(IDX)(rd+idx)&(N-1)];
+	}
+	/******************************************************************************
+		function: pop
+	*******************************************************************************
+		Consumer: removes the n oldest elements, e.g. after processing them with at.
+		n must be lower or equal to level().
+	******************************************************************************/
+	void pop(unsigned short n=1)
+	{
+		store(&rd,(IDX)(rd+n));
+	}
+};
+
+#endif
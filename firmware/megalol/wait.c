@@ -123,6 +123,7 @@ volatile unsigned long _timer_time_us=0;					// Current time in microseconds; in
 volatile unsigned long _timer_time_ms_monotonic=0;			// Current time in milliseconds; initialised by the 1Hz callback to _timer_1hztimer_in_ms and incremented by the internal clock, guaranteed to be monotonic
 volatile unsigned long _timer_time_us_monotonic=0;			// Current time in microseconds; initialised by the 1Hz callback to _timer_1hztimer_in_us and incremented by the internal clock, guaranteed to be monotonic
 volatile unsigned long _timer_time_us_lastreturned=0;		// Last returned microseconds; combination of _timer_time_us_monotonic and timer counter; used to ensure monotonic time in the call to timer_us_get
+volatile unsigned short _timer_time_1024hz_ctr=0;			// Incremented at each 1024Hz tick and never reset; combined with WAIT_TCNT for cycle-level timing
 
 // State
 unsigned char _timer_time_1024to1000_divider=0;				// This variable is used by _timer_tick_1024hz to generate a 1000Hz update from a 1024Hz clock and to approximate the 976.5625uS increment of the uS counter
@@ -282,6 +283,8 @@ void _timer_tick_hz(void)
 ******************************************************************************/
 void _timer_tick_1024hz(void)
 {
+	_timer_time_1024hz_ctr++;
+	
 	// _timer_time_us should increment by 976.5625uS
 	// Use _timer_time_1024to1000_divider to pad up _timer_time_us to approximate increment by 976.5625uS
 	// An unsuitable alternative is to increment by 976uS - this leads to 576uS under-estimation error after 1 second, which is too large
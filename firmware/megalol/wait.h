@@ -58,6 +58,7 @@ extern volatile unsigned long _timer_1hztimer_in_ms;							// We count time from
 //extern volatile unsigned long _timer_time_1024;
 //extern volatile unsigned long _timer_time_1000;
 extern volatile unsigned long _timer_time_ms_intclk;
+extern volatile unsigned short _timer_time_1024hz_ctr;
 //extern volatile unsigned long _timer_lastmillisec;							// 32-bit: max 49 days
 extern volatile unsigned long long _timer_lastreturned_microsec;
 
@@ -95,7 +95,7 @@ void mode_main(void)
 				system_mode=0;
 				break;
 			case APP_MODE_BENCHIO:
-				//mode_bench();
+				mode_bench();
 				system_mode=0;
 				break;
 			case APP_MODE_BT:
@@ -18,11 +18,9 @@
 #include "rn41.h"
 #include "mpu.h"
 #include "mpu_test.h"
-#include "test_mmc.h"
 #include "pkt.h"
 #include "wait.h"
 #include "init.h"
-#include "ui.h"
 #include "lcd.h"
 #include "fb.h"
 #include "uiconfig.h"
@@ -30,8 +28,9 @@
 #include "i2c_internal.h"
 #include "system.h"
 #include "pkt.h"
+#include "serial1.h"
 
-#include "demo.h"
+#include "mode.h"
 #include "mode_bench.h"
 
 #include "commandset.h"
@@ -39,43 +38,71 @@
 
 
 
-#define CommandParsersBenchNum 3
+/*
+	File: mode_bench
+	
+	Benchmark mode: measures the bandwidth of the USB and Bluetooth interfaces.
+	
+	*Throughput and CPU load*
+	
+	The T command streams data as fast as the interface accepts it (non-blocking fputbuf) and measures the CPU load 
+	at the same time by counting the iterations of an idle loop, compared to the same loop without transmission.
+	The CPU load includes the transmit interrupts and the writes to the transmit buffer, which is what streaming 
+	costs to the sampling modes. For Bluetooth the number of bytes per transmit interrupt is also reported.
+*/
+
+const char help_bench_io[] PROGMEM="B,<if>: Transfer 128KB with blocking writes. if=0 for USB, 1 for BT";
+const char help_bench_throughput[] PROGMEM="T,<if>,<s>: Stream during s seconds and report bandwidth and CPU load. if=0 for USB, 1 for BT";
+
+#define CommandParsersBenchNum 4
 const COMMANDPARSER CommandParsersBench[CommandParsersBenchNum] =
 { 
 	{'H', CommandParserHelp,help_h},
-	{'B', CommandParserBench,help_b},
+	{'B', CommandParserBenchIO,help_bench_io},
+	{'T', CommandParserBenchThroughput,help_bench_throughput},
 	{'!', CommandParserQuit,help_quit}
 };
 
-unsigned char mode_bench_io=0;
-
-
 unsigned char CommandParserBench(char *buffer,unsigned char size)
-{	
-	if(size!=2 || buffer[0]!=',')
-		return 2;
-	
-	buffer++;	// Skip comma
+{
+	CommandChangeMode(APP_MODE_BENCHIO);
+	return 0;
+}
+unsigned char CommandParserBenchIO(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int io;
 	
-	unsigned io;
-	if(sscanf((char*)buffer,"%u",&io)!=1)
+	rv = ParseCommaGetInt((char*)buffer,1,&io);
+	if(rv || io<0 || io>1)
 		return 2;
-	if(!(io==0 || io==1))
-		return 2;
-	
-	system_mode = APP_MODE_BENCHIO;
-	CommandQuit=1;
 	
-	mode_bench_io=io;
+	mode_bench_io(io?file_bt:file_usb);
+	return 0;
+}
+unsigned char CommandParserBenchThroughput(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int io,sec;
 	
+	rv = ParseCommaGetInt((char*)buffer,2,&io,&sec);
+	if(rv || io<0 || io>1 || sec<1)
+		return 2;
 	
+	mode_bench_throughput(io?file_bt:file_usb,sec);
 	return 0;
 }
 
-
-void mode_bench(void)
+/******************************************************************************
+	function: mode_bench_io
+*******************************************************************************	
+	Transfers 128KB to an interface with blocking writes and prints the bandwidth.
+	
+	Parameters:
+		f		-	Interface to benchmark
+******************************************************************************/
+void mode_bench_io(FILE *f)
 {
-	fprintf_P(file_pri,PSTR("bench mode\n"));
 	char s[256];
 	int c;
 	
@@ -83,48 +110,117 @@ void mode_bench(void)
 		s[i] = '0'+i%10;
 	s[255] = '\n';
 	
+	// Transfer 128KB
+	unsigned long size = 128*1024l;
+	unsigned it = size/256;
+	unsigned long t1,t2;
+	t1 = timer_ms_get();
+	for(unsigned i=0;i<it;i++)
+	{
+		fwrite(s,256,1,f);
+		if((i&0xf)==0) 
+			fputc('.',file_usb);
+			
+		// Get feedback if any
+		while((c=fgetc(file_bt))!=-1)
+			fputc(c,file_usb);
+	}	
+	t2 = timer_ms_get();
+	unsigned long bps = size*1000/(t2-t1);
+	fprintf_P(file_pri,PSTR("Transfer of %lu bytes in %lu ms. Bandwidth: %lu byte/s\n"),size,t2-t1,bps);	
+	fprintf_P(file_dbg,PSTR("Transfer of %lu bytes in %lu ms. Bandwidth: %lu byte/s\n"),size,t2-t1,bps);	
+}
+
+/******************************************************************************
+	function: _mode_bench_loop
+*******************************************************************************	
+	Idle loop of mode_bench_throughput: counts iterations during dur ms and, if
+	f is not null, writes data to f whenever it has space.
+	
+	The write test is done once every 64 iterations, so that its cost does not 
+	dominate the loop.
+	
+	Parameters:
+		f		-	Interface to write to, or 0 for the reference loop
+		s		-	Data to write (MODE_BENCH_CHUNK bytes)
+		dur		-	Duration in ms
+		bytes	-	Receives the number of bytes written
+	Returns:
+		Number of iterations
+******************************************************************************/
+unsigned long _mode_bench_loop(FILE *f,char *s,unsigned long dur,unsigned long *bytes)
+{
+	unsigned long t1,n=0;
+	volatile unsigned char ctr;
+	
+	*bytes=0;
+	t1=timer_ms_get();
+	do
+	{
+		if(f && (n&63)==0 && fgettxbuffree(f)>=MODE_BENCH_CHUNK)
+		{
+			if(fputbuf(f,s,MODE_BENCH_CHUNK)==0)
+				*bytes+=MODE_BENCH_CHUNK;
+		}
+		for(ctr=0;ctr<64;ctr++);
+		n++;
+	}
+	while(timer_ms_get()-t1<dur);
+	return n;
+}
+/******************************************************************************
+	function: mode_bench_throughput
+*******************************************************************************	
+	Streams data to an interface during sec seconds and prints the achieved 
+	bandwidth and the CPU load of streaming.
+	
+	Parameters:
+		f		-	Interface to benchmark
+		sec		-	Duration of the measurement in seconds
+******************************************************************************/
+void mode_bench_throughput(FILE *f,unsigned short sec)
+{
+	char s[MODE_BENCH_CHUNK];
+	unsigned long dur=sec*1000l;
+	unsigned long nidle,nbusy,bytes,bw,load,isr;
+	
+	for(unsigned char i=0;i<MODE_BENCH_CHUNK-1;i++)
+		s[i] = '0'+i%10;
+	s[MODE_BENCH_CHUNK-1] = '\n';
+	
+	// Reference without transmission; wait for the output of the command to be sent
+	while(fgettxbuflevel(file_pri));
+	nidle=_mode_bench_loop(0,s,dur,&bytes);
 	
+	isr=Serial1TxInt;
+	nbusy=_mode_bench_loop(f,s,dur,&bytes);
+	isr=Serial1TxInt-isr;
+	// Wait for the data to be sent before printing the results
+	while(fgettxbuflevel(f));
+	
+	// dur is a multiple of 1000: no overflow of bytes*1000 for large transfers
+	bw=bytes/(dur/1000);
+	// CPU load in permil; 64-bit as the iteration counts may exceed 4 millions
+	if(nbusy>nidle)
+		nbusy=nidle;
+	load=1000-(unsigned long long)nbusy*1000/nidle;
+	
+	fprintf_P(file_pri,PSTR("Bandwidth: %lu byte/s. CPU load: %lu.%lu%%\n"),bw,load/10,load%10);
+	if(bw)
+		fprintf_P(file_pri,PSTR("CPU cycles per byte: %lu\n"),(F_CPU/1000)*load/bw);
+	if(f==file_bt && isr)
+		fprintf_P(file_pri,PSTR("Transmit interrupts: %lu. Bytes per interrupt: %lu.%02lu\n"),isr,bytes/isr,(bytes%isr)*100/isr);
+}
+
+void mode_bench(void)
+{
+	fprintf_P(file_pri,PSTR("BENCH>\n"));
 	
 	while(1)
 	{
-		while(CommandProcess(CommandParsersBench,CommandParsersBenchNum));		
+		CommandProcess(CommandParsersBench,CommandParsersBenchNum);
 		if(CommandShouldQuit())
 			break;
-			
-		FILE *f;
-		if(mode_bench_io==0)
-			f=file_usb;
-		else
-			f=file_bt;
-			
-		// Transfer 128KB
-		unsigned long size = 128*1024l;
-		unsigned it = size/256;
-		unsigned long t1,t2;
-		printf("size: %ld\n",size);
-		printf("it: %d\n",it);
-		t1 = timer_ms_get();
-		for(unsigned i=0;i<it;i++)
-		{
-			fwrite(s,256,1,f);
-			if((i&0xf)==0) 
-				fputc('.',file_usb);
-				
-			// Get feedback if any
-			while((c=fgetc(file_bt))!=-1)
-				fputc(c,file_usb);
-		}	
-		t2 = timer_ms_get();
-		unsigned long bps = size*1000/(t2-t1);
-		fprintf_P(file_pri,PSTR("Transfer of %lu bytes in %lu ms. Bandwidth: %lu byte/s\n"),size,t2-t1,bps);	
-		fprintf_P(file_dbg,PSTR("Transfer of %lu bytes in %lu ms. Bandwidth: %lu byte/s\n"),size,t2-t1,bps);	
-		
-		_delay_ms(5000);
-				
-
 	}
-	fprintf_P(file_pri,PSTR("bench end\n"));
-
-	return 0;
+	fprintf_P(file_pri,PSTR("<BENCH\n"));
 }
-
@@ -1,13 +1,20 @@
 #ifndef __MODE_BENCH_H
 #define __MODE_BENCH_H
 
+#include <stdio.h>
 #include "command.h"
 
 
-extern unsigned char mode_bench_io;
+// Size of the writes of mode_bench_throughput
+#define MODE_BENCH_CHUNK 64
 
 void mode_bench(void);
+void mode_bench_io(FILE *f);
+void mode_bench_throughput(FILE *f,unsigned short sec);
+unsigned long _mode_bench_loop(FILE *f,char *s,unsigned long dur,unsigned long *bytes);
 unsigned char CommandParserBench(char *buffer,unsigned char size);
+unsigned char CommandParserBenchIO(char *buffer,unsigned char size);
+unsigned char CommandParserBenchThroughput(char *buffer,unsigned char size);
 
 #endif
 
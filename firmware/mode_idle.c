@@ -76,7 +76,7 @@ const COMMANDPARSER CommandParsersIdle[] =
 	{'A', CommandParserADC,help_a},
 	//{'C', CommandParserClock,help_c},
 	//{'V', CommandParserDemo,help_demo},
-	//{'B', CommandParserBench,help_b},
+	{'B', CommandParserBench,help_b},
 	{'I', CommandParserIO,help_i},
 	{'M', CommandParserMotion,help_M},
 	{'m', CommandParserMPUTest,help_m},
@@ -92,6 +92,7 @@ const COMMANDPARSER CommandParsersIdle[] =
 	{'Q', CommandParserBatteryInfoLong,help_batterylong},
 	{'q', CommandParserBatteryInfo,help_battery},
 	{'c', CommandParserCallback,help_callback},
+	{'P', CommandParserProfile,help_profile},
 	{'X', CommandParserSD,help_sd},
 	//{'p', CommandParserPowerTest,help_powertest},
 	{'S', CommandParserTeststream,help_s},
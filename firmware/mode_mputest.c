@@ -27,6 +27,7 @@
 #include "mpu_config.h"
 #include "commandset.h"
 #include "uiconfig.h"
+#include "spi-usart0.h"
 
 
 #include "MadgwickAHRS.h"
@@ -112,6 +113,10 @@ const char help_mt_l[] PROGMEM ="l[,<scale>] read or set the gyroscope full scal
 const char help_mt_o[] PROGMEM ="o,<offX>,<offY>,<offZ> Set the gyro bias";
 const char help_mt_k[] PROGMEM ="K,bitmap: 3-bit bitmap indicating whether to null acc|gyr|mag (not persistent)";
 const char help_mt_beta[] PROGMEM ="b[,betax100]: gets or sets the beta correction gain for the orientation sensing; suggested: 35 for b=0.035 (persistent)";
+const char help_mt_D[] PROGMEM ="Check the motion buffer layout of all motion modes (compaction round trip)";
+const char help_mt_y[] PROGMEM ="y[,<0|1>] read or set the MPU readout: 0=blocking in interrupt, 1=asynchronous interrupt-driven transfer (not persistent)";
+const char help_mt_Y[] PROGMEM ="Y[,<sec>] benchmark CPU load of blocking and asynchronous MPU readout at each SPI clock divider";
+const char help_mt_u[] PROGMEM ="u[,<n>] read or set the FIFO burst readout of n samples; 0=per-sample readout; applies at the next motion mode change (HW9, acc/gyr modes; not persistent)";
 
 
 
@@ -145,6 +150,10 @@ const COMMANDPARSER CommandParsersMPUTest[] =
 	//{'Q', CommandParserMPUTest_Quaternion,help_mt_Q},	
 	{'t', CommandParserMPUTest_MagneticSelfTest,help_mt_t},
 	{'K', CommandParserMPUTest_Kill,help_mt_k},
+	{'D', CommandParserMPUTest_Layout,help_mt_D},
+	{'u', CommandParserMPUTest_FifoBurst,help_mt_u},
+	{'y', CommandParserMPUTest_AsyncRead,help_mt_y},
+	{'Y', CommandParserMPUTest_BenchAsync,help_mt_Y},
 	//{'b', CommandParserMPUTest_BenchMath,help_mt_b},
 	// Quit
 	{'!', CommandParserQuit,help_quit}
@@ -1768,6 +1777,201 @@ unsigned char CommandParserMPUTest_Beta(char *buffer,unsigned char size)
 	return 0;
 }
 
+/******************************************************************************
+	CommandParserMPUTest_Layout
+*******************************************************************************
+	For each motion mode, stores a sequence of test patterns in records of the 
+	motion buffer layout used by that mode and checks that they read back 
+	identical to MPUMOTIONDATA for the channels acquired, and 0 for the others.
+	The sequence covers time and packetctr increments which fit in the header 
+	of compacted records and increments which require a sync entry.
+	Does not modify the motion buffer.
+******************************************************************************/
+unsigned char CommandParserMPUTest_Layout(char *buffer,unsigned char size)
+{
+	MPUMOTIONDATA ref,out;
+	MPUDATAREF wref,rref,sync;
+	unsigned char rec[sizeof(MPUMOTIONDATA)];
+	unsigned char nerr=0;
+	// Increments of time and packetctr: first record and last two need a sync entry
+	const unsigned short dt[5]={0,1,4095,4096,10};
+	const unsigned char dc[5]={0,1,15,1,16};
+	
+	// Test pattern: distinct non-zero values in every field
+	signed short *sp = &ref.ax;
+	
+	for(unsigned char i=0;i<MOTIONCONFIG_NUM;i++)
+	{
+		unsigned char mode = config_sensorsr_settings[i][0];
+		unsigned char layout = _mpu_data_getlayout(mode);
+		unsigned char recsize = _mpu_data_getrecsize(layout);
+		unsigned char ok=1;
+		
+		ref.time=0x89ABCDEF;
+		ref.packetctr=0x12345678;
+		wref.time=wref.packetctr=0;
+		rref=wref;
+		for(unsigned char k=0;k<5;k++)
+		{
+			for(unsigned char c=0;c<9;c++)
+				sp[c]=0x1111*(c+1)-0x8000+k;
+			ref.ms=0xA5;
+			ref.temp=-1234;
+			ref.time+=dt[k];
+			ref.packetctr+=dc[k];
+			
+			if(layout)
+			{
+				// Keep the absolute values as the motion buffer does in a sync entry
+				if(_mpu_data_pack(&ref,rec,layout,wref))
+				{
+					sync.time=ref.time;
+					sync.packetctr=ref.packetctr;
+				}
+			}
+			else
+				memcpy(rec,&ref,sizeof(MPUMOTIONDATA));
+			memset(&out,0x5A,sizeof(MPUMOTIONDATA));
+			_mpu_data_unpack(rec,out,layout,rref,&sync);
+			
+			if(layout==0)
+			{
+				if(memcmp(&out,&ref,sizeof(MPUMOTIONDATA)))
+					ok=0;
+			}
+			else
+			{
+				if(out.time!=ref.time || out.packetctr!=ref.packetctr)
+					ok=0;
+				for(unsigned char c=0;c<9;c++)
+				{
+					signed short expect=0;
+					if( (c<3 && (layout&MPU_MODE_BM_A)) || (c>=3 && c<6 && (layout&MPU_MODE_BM_G)) )
+						expect=sp[c];
+					if((&out.ax)[c]!=expect)
+						ok=0;
+				}
+				if(out.ms!=0 || out.temp!=0)
+					ok=0;
+			}
+		}
+		fprintf_P(file_pri,PSTR("[%02d] mode %02X: record %02d bytes, %03u samples: %s\n"),i,mode,recsize,(unsigned)(MPU_MOTIONBUFFERBYTES/recsize>255?255:MPU_MOTIONBUFFERBYTES/recsize),ok?"ok":"FAIL");
+		if(!ok)
+			nerr++;
+	}
+	if(nerr)
+		return 1;
+	return 0;
+}
+
+/******************************************************************************
+	CommandParserMPUTest_FifoBurst
+*******************************************************************************
+	Reads or sets the number of samples of the FIFO burst readout.
+******************************************************************************/
+unsigned char CommandParserMPUTest_FifoBurst(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int n;
+	
+	if(strlen(buffer)==0)
+	{
+		fprintf_P(file_pri,PSTR("FIFO burst: requested=%d active=%d\n"),_mpu_fifoburst,__mpu_fifoburst_n);
+		return 0;
+	}
+	rv = ParseCommaGetInt((char*)buffer,1,&n);
+	if(rv)
+		return 1;
+	if(n<0 || n>255)
+		return 1;
+	mpu_config_fifoburst(n);
+	return 0;
+}
+
+/******************************************************************************
+	CommandParserMPUTest_AsyncRead
+*******************************************************************************
+	Reads or sets whether the MPU samples are read with a blocking or an 
+	asynchronous transfer.
+******************************************************************************/
+unsigned char CommandParserMPUTest_AsyncRead(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int async;
+	
+	if(strlen(buffer)==0)
+	{
+		fprintf_P(file_pri,PSTR("MPU readout: %s\n"),__mpu_isr_async?"async":"blocking");
+		return 0;
+	}
+	rv = ParseCommaGetInt((char*)buffer,1,&async);
+	if(rv)
+		return 1;
+	if(async<0 || async>1)
+		return 1;
+	mpu_config_asyncread(async);
+	return 0;
+}
+
+/******************************************************************************
+	CommandParserMPUTest_BenchAsync
+*******************************************************************************
+	Compares the CPU load of the blocking (mpu_isr) and asynchronous 
+	(_mpu_isr_async) readouts at each SPI clock divider.
+	
+	The CPU load is derived from the number of iterations of the main loop of
+	perfbench_withreadout, compared to the MPU turned off. The motion mode is 
+	configured at the default SPI clock and the divider is only changed during
+	the measurement, as register writes are not reliable at the highest clocks.
+******************************************************************************/
+unsigned char CommandParserMPUTest_BenchAsync(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int mintime=3;
+	long refperf,perf,load;
+	unsigned long cnt_tot,cnt_succ,cnt_busy,cnt_full;
+	const unsigned char dividers[]={0,1,3,5,9};
+	unsigned char mode = MPU_MODE_1KHZ_ACC_BW460_GYRO_BW250_MAG_100;
+	
+	if(strlen(buffer))
+	{
+		rv = ParseCommaGetInt((char*)buffer,1,&mintime);
+		if(rv || mintime<1)
+			return 1;
+	}
+	
+	unsigned char divider_default = spiusart0_getdivider();
+	unsigned char async_default = __mpu_isr_async;
+	
+	mpu_config_motionmode(MPU_MODE_OFF,0);
+	refperf = perfbench_withreadout(mintime);
+	fprintf_P(file_pri,PSTR("Reference performance: %ld\n"),refperf);
+	
+	for(unsigned char di=0;di<sizeof(dividers);di++)
+	{
+		for(unsigned char async=0;async<2;async++)
+		{
+			mpu_config_asyncread(async);
+			mpu_config_motionmode(mode,1);
+			spiusart0_setdivider(dividers[di]);
+			perf = perfbench_withreadout(mintime);
+			mpu_getstat(0,&cnt_tot,&cnt_succ,&cnt_busy,&cnt_full);
+			spiusart0_setdivider(divider_default);
+			mpu_config_motionmode(MPU_MODE_OFF,0);
+			
+			load = 100-(perf*100/refperf);
+			if(load<0)
+				load=0;
+			fprintf_P(file_pri,PSTR("UBRR %u (%lu KHz) %s: perf %ld CPU load %ld %%. Samples %lu ok %lu busy %lu full %lu\n"),
+						dividers[di],F_CPU/2000/(dividers[di]+1),async?"async   ":"blocking",perf,load,cnt_tot,cnt_succ,cnt_busy,cnt_full);
+		}
+	}
+	
+	mpu_config_asyncread(async_default);
+	
+	return 0;
+}
+
 /******************************************************************************
 	function: mode_mputest
 *******************************************************************************
@@ -30,6 +30,10 @@ unsigned char CommandParserMPUTest_GyroScale(char *buffer,unsigned char size);
 unsigned char CommandParserMPUTest_SetGyroBias(char *buffer,unsigned char size);
 unsigned char CommandParserMPUTest_Kill(char *buffer,unsigned char size);
 unsigned char CommandParserMPUTest_Beta(char *buffer,unsigned char size);
+unsigned char CommandParserMPUTest_Layout(char *buffer,unsigned char size);
+unsigned char CommandParserMPUTest_FifoBurst(char *buffer,unsigned char size);
+unsigned char CommandParserMPUTest_AsyncRead(char *buffer,unsigned char size);
+unsigned char CommandParserMPUTest_BenchAsync(char *buffer,unsigned char size);
 
 
 void mode_mputest(void);
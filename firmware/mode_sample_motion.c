@@ -7,6 +7,26 @@
 	
 	This mode contains conditional codepath depending on the #defines FIXEDPOINTQUATERNION, FIXEDPOINTQUATERNIONSHIFT and ENABLEQUATERNION.
 	
+	*Backpressure rate adaptation*
+	
+	When enabled with the d command, the samples streamed to the primary interface are decimated when the interface 
+	cannot keep up, instead of being randomly lost when fputbuf fails. When the tx buffer stays more than 3/4 full 
+	for STREAM_BP_HOLD ms, or a sample could not be sent, the decimation factor is doubled (every 2nd, 4th, ... sample 
+	is sent, up to STREAM_DECIM_MAX); when it stays less than 1/4 full for the drain time (initially STREAM_DRAIN_HOLD ms) 
+	the factor is halved, down to full rate. 
+	
+	The level of the buffer does not tell whether the link can sustain the higher rate, which is only known by trying. 
+	If backpressure returns soon after halving the factor, the drain time is doubled, up to STREAM_DRAIN_HOLD_MAX, so 
+	that a link whose bandwidth lies between two rates is probed rarely rather than continuously oscillating. 
+	
+	Each change is announced in-band before the next sample, with the number of samples skipped so far:
+	
+	* Text:		#decim=<factor>; skip=<samples>
+	* Binary:	DDC packet: decimation factor (u16), samples skipped (u32), checksum. Pending compressed blocks are 
+				flushed first.
+	
+	Logging is not affected.
+	
 	*TODO*
 	
 	* Statistics when logging could display log-only information (samples acquired, samples lost, samples per second)
@@ -22,6 +42,7 @@
 #include <avr/eeprom.h>
 #include <util/delay.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "mpu_geometry.h"
@@ -40,6 +61,7 @@
 #include "mode_global.h"
 #include "mpu_config.h"
 #include "commandset.h"
+#include "prof.h"
 #include "uiconfig.h"
 #include "ufat.h"
 #include "sd.h"
@@ -63,6 +85,15 @@ float atog=1.0/16384.0;
 unsigned char enableinfo;
 
 unsigned long stat_samplesendfailed;
+unsigned long stat_sampledecimated;				// Samples skipped by the rate adaptation
+unsigned char stream_adapt=0;					// Rate adaptation enabled
+unsigned char stream_decim;						// Current decimation factor
+unsigned char stream_decim_ctr;					// Samples since the last sample sent
+unsigned char stream_decim_announce;			// Change of decimation not yet announced
+unsigned long stream_bp_t,stream_drain_t;		// Start of the current backpressure/drained period, 0 if none
+unsigned long stream_up_t;						// Time of the last decrease of the decimation factor
+unsigned short stream_drain_hold;				// Current drain time (ms)
+unsigned char stream_adapt_failed;				// A sample could not be sent since the last update
 unsigned long stat_totsample;
 unsigned long stat_timems_start,stat_t_cur,stat_wakeup,stat_time_laststatus;
 unsigned long int time_lastblink;
@@ -73,6 +104,8 @@ MPUMOTIONGEOMETRY mpumotiongeometry;
 
 const char help_samplestatus[] PROGMEM="Battery and logging status";
 const char help_batbench[] PROGMEM="Battery benchmark";
+const char help_streambench[] PROGMEM="Benchmark the binary packet builder for all channel layouts and check the checksum variants";
+const char help_streamadapt[] PROGMEM="d,<en>: en=1 to decimate the stream when the interface cannot keep up, 0 to disable";
 
 const COMMANDPARSER CommandParsersMotionStream[] =
 { 
@@ -87,6 +120,9 @@ const COMMANDPARSER CommandParsersMotionStream[] =
 	{'q', CommandParserBatteryInfo,help_battery},
 	{'s', CommandParserSampleStatus,help_samplestatus},
 	{'x', CommandParserBatBench,help_batbench},
+	{'b', CommandParserStreamBench,help_streambench},
+	{'d', CommandParserStreamAdapt,help_streamadapt},
+	{'P', CommandParserProfile,help_profile},
 	{'!', CommandParserQuit,help_quit}
 };
 const unsigned char CommandParsersMotionStreamNum=sizeof(CommandParsersMotionStream)/sizeof(COMMANDPARSER); 
@@ -112,11 +148,15 @@ void clearstat(void)
 	// If there was a successful change in logging (start, stop, etc) then reset the statistics.
 	mpu_clearstat();	// Clear MPU ISR statistics
 	mpu_clearbuffer();
+	stream_sample_z_clearstat();
+	stream_adapt_clear();
 }
 
 unsigned char CommandParserSampleLogMPU(char *buffer,unsigned char size)
 {
 	// MPU specific code to start/stop the log
+	// Send the pending compressed block where the samples were going
+	stream_sample_z_flush(mode_sample_file_log?mode_sample_file_log:file_pri);
 	unsigned char rv=CommandParserSampleLog(buffer,size);
 	if(!rv)
 	{		
@@ -128,6 +168,21 @@ unsigned char CommandParserSampleLogMPU(char *buffer,unsigned char size)
 unsigned char CommandParserSampleStatus(char *buffer,unsigned char size)
 {
 	stream_status(file_pri,mode_stream_format_bin);
+	if(mode_stream_format_bin==2)
+		stream_sample_z_printstat(file_pri);
+	return 0;
+}
+
+unsigned char CommandParserStreamAdapt(char *buffer,unsigned char size)
+{
+	unsigned char rv;
+	int en;
+	
+	rv = ParseCommaGetInt((char*)buffer,1,&en);
+	if(rv || en<0 || en>1)
+		return 2;
+	stream_adapt=en;
+	stream_adapt_clear();
 	return 0;
 }
 
@@ -214,104 +269,784 @@ unsigned char stream_sample_text(FILE *f)
 		return 1;
 	return 0;	
 }
-unsigned char stream_sample_bin(FILE *f)
+/******************************************************************************
+	function: _stream_get_quaternion
+*******************************************************************************	
+	Returns the quaternion components as sent in the binary packets: scaled by 
+	10000 and truncated to 16 bits, or the identity quaternion if quaternions 
+	are disabled.
+	
+	Parameters:
+		q		-	Array of 4 receiving q0, q1, q2, q3
+******************************************************************************/
+void _stream_get_quaternion(signed short *q)
+{
+	#if ENABLEQUATERNION==1
+		#if FIXEDPOINTQUATERNION==1
+			_Accum k;
+			k = q0*10000k; q[0] = k;
+			k = q1*10000k; q[1] = k;
+			k = q2*10000k; q[2] = k;
+			k = q3*10000k; q[3] = k;
+		#else
+			float k;
+			k = mpumotiongeometry.q0*10000.0; q[0] = k;
+			k = mpumotiongeometry.q1*10000.0; q[1] = k;
+			k = mpumotiongeometry.q2*10000.0; q[2] = k;
+			k = mpumotiongeometry.q3*10000.0; q[3] = k;
+		#endif
+	#else
+	q[0]=1;
+	q[1]=q[2]=q[3]=0;
+	#endif
+}
+/******************************************************************************
+	function: stream_sample_bin_size
+*******************************************************************************	
+	Returns the size in bytes of the binary sample packet (header DXX and checksum 
+	included) for the current stream format and sample mode.
+******************************************************************************/
+unsigned char stream_sample_bin_size(void)
 {
-	PACKET p;
-	packet_init(&p,"DXX",3);
+	unsigned char s=3+2;			// Header and checksum
 	
+	if(mode_stream_format_pktctr)
+		s+=4;
+	if(mode_stream_format_ts)
+		s+=4;
+	if(mode_stream_format_bat)
+		s+=2;
+	if(mode_stream_format_label)
+		s+=2;
+	if(sample_mode & MPU_MODE_BM_A)
+		s+=6;
+	if(sample_mode & MPU_MODE_BM_G)
+		s+=6;
+	if(sample_mode & MPU_MODE_BM_M)
+		s+=6;
+	if(sample_mode & MPU_MODE_BM_Q)
+		s+=8;
+	return s;
+}
+/******************************************************************************
+	_stream_put8, _stream_put16, _stream_put32
+*******************************************************************************	
+	Store 8, 16 or 32 bits in little endian and fold them in the checksum.
+	Inlined in the instances of _stream_pack_header and _stream_pack_channels.
+	
+	Returns:
+		Pointer past the last byte stored
+******************************************************************************/
+static inline unsigned char *_stream_put8(unsigned char *p,unsigned char v,FLETCHER16 *c)
+{
+	*p++=v;
+	fletcher16_add8(c,v);
+	return p;
+}
+static inline unsigned char *_stream_put16(unsigned char *p,unsigned short v,FLETCHER16 *c)
+{
+	p=_stream_put8(p,v,c);
+	p=_stream_put8(p,v>>8,c);
+	return p;
+}
+static inline unsigned char *_stream_put32(unsigned char *p,unsigned long v,FLETCHER16 *c)
+{
+	p=_stream_put8(p,v,c);
+	p=_stream_put8(p,v>>8,c);
+	p=_stream_put8(p,v>>16,c);
+	p=_stream_put8(p,v>>24,c);
+	return p;
+}
+/******************************************************************************
+	_stream_putcheck
+*******************************************************************************	
+	Stores the checksum in little endian.
+******************************************************************************/
+static inline unsigned char *_stream_putcheck(unsigned char *p,FLETCHER16 *c)
+{
+	unsigned short check = fletcher16_get(c);
+	*p++=check;
+	*p++=check>>8;
+	return p;
+}
+static inline unsigned char *_stream_put_quaternion(unsigned char *p,FLETCHER16 *c)
+{
+	signed short q[4];
+	
+	_stream_get_quaternion(q);
+	p=_stream_put16(p,q[0],c);
+	p=_stream_put16(p,q[1],c);
+	p=_stream_put16(p,q[2],c);
+	p=_stream_put16(p,q[3],c);
+	return p;
+}
+/******************************************************************************
+	function: _stream_pack_header
+*******************************************************************************	
+	Stores the header of the binary sample packet: DXX and the fields of the 
+	stream format.
+	
+	The fields are given by the template parameter FMT: bit 0 packet counter, 
+	bit 1 timestamp, bit 2 battery, bit 3 label (see _stream_format). Each 
+	instance is resolved at compile time into a sequence of byte stores; the 
+	instance matching the stream format is selected at runtime from 
+	_stream_pack_header_tbl.
+	
+	Parameters:
+		p		-	Pointer where to store the header
+		c		-	Checksum in which the header is folded
+	
+	Returns:
+		Pointer past the last byte stored
+******************************************************************************/
+template<unsigned char FMT> unsigned char *_stream_pack_header(unsigned char *p,FLETCHER16 *c)
+{
+	p=_stream_put8(p,'D',c);
+	p=_stream_put8(p,'X',c);
+	p=_stream_put8(p,'X',c);
+	if(FMT&1)
+		p=_stream_put32(p,mpumotiondata.packetctr,c);
+	if(FMT&2)
+		p=_stream_put32(p,mpumotiondata.time,c);
+	if(FMT&4)
+		p=_stream_put16(p,system_getbattery(),c);
+	if(FMT&8)
+		p=_stream_put16(p,CurrentAnnotation,c);
+	return p;
+}
+typedef unsigned char *(*STREAM_PACK)(unsigned char *p,FLETCHER16 *c);
+const STREAM_PACK _stream_pack_header_tbl[16] PROGMEM = 
+{
+	_stream_pack_header<0>,_stream_pack_header<1>,_stream_pack_header<2>,_stream_pack_header<3>,
+	_stream_pack_header<4>,_stream_pack_header<5>,_stream_pack_header<6>,_stream_pack_header<7>,
+	_stream_pack_header<8>,_stream_pack_header<9>,_stream_pack_header<10>,_stream_pack_header<11>,
+	_stream_pack_header<12>,_stream_pack_header<13>,_stream_pack_header<14>,_stream_pack_header<15>
+};
+/******************************************************************************
+	function: _stream_format
+*******************************************************************************	
+	Returns the stream format as the selector of _stream_pack_header_tbl.
+******************************************************************************/
+unsigned char _stream_format(void)
+{
+	unsigned char fmt=0;
 	
-	// Format packet counter
 	if(mode_stream_format_pktctr)
+		fmt|=1;
+	if(mode_stream_format_ts)
+		fmt|=2;
+	if(mode_stream_format_bat)
+		fmt|=4;
+	if(mode_stream_format_label)
+		fmt|=8;
+	return fmt;
+}
+/******************************************************************************
+	function: _stream_pack_channels
+*******************************************************************************	
+	Stores the motion channels of the binary sample packet. 
+	
+	The channels are given by the template parameter CH, which holds the bits
+	MPU_MODE_BM_A, MPU_MODE_BM_G, MPU_MODE_BM_M, MPU_MODE_BM_Q of the sample mode
+	shifted right by one. As for _stream_pack_header, each instance is a sequence
+	of byte stores, selected at runtime from _stream_pack_channels_tbl.
+	
+	Parameters:
+		p		-	Pointer where to store the channels
+		c		-	Checksum in which the channels are folded
+	
+	Returns:
+		Pointer past the last byte stored
+******************************************************************************/
+template<unsigned char CH> unsigned char *_stream_pack_channels(unsigned char *p,FLETCHER16 *c)
+{
+	if((CH<<1) & MPU_MODE_BM_A)
 	{
-		packet_add32_little(&p,mpumotiondata.packetctr);
+		p=_stream_put16(p,mpumotiondata.ax,c);
+		p=_stream_put16(p,mpumotiondata.ay,c);
+		p=_stream_put16(p,mpumotiondata.az,c);
 	}
-	// Format timestamp
-	if(mode_stream_format_ts)
+	if((CH<<1) & MPU_MODE_BM_G)
 	{
-		packet_add16_little(&p,mpumotiondata.time&0xffff);
-		packet_add16_little(&p,(mpumotiondata.time>>16)&0xffff);
+		p=_stream_put16(p,mpumotiondata.gx,c);
+		p=_stream_put16(p,mpumotiondata.gy,c);
+		p=_stream_put16(p,mpumotiondata.gz,c);
 	}
-	// Format battery
+	if((CH<<1) & MPU_MODE_BM_M)
+	{
+		p=_stream_put16(p,mpumotiondata.mx,c);
+		p=_stream_put16(p,mpumotiondata.my,c);
+		p=_stream_put16(p,mpumotiondata.mz,c);
+	}
+	if((CH<<1) & MPU_MODE_BM_Q)
+		p=_stream_put_quaternion(p,c);
+	return p;
+}
+const STREAM_PACK _stream_pack_channels_tbl[16] PROGMEM = 
+{
+	_stream_pack_channels<0>,_stream_pack_channels<1>,_stream_pack_channels<2>,_stream_pack_channels<3>,
+	_stream_pack_channels<4>,_stream_pack_channels<5>,_stream_pack_channels<6>,_stream_pack_channels<7>,
+	_stream_pack_channels<8>,_stream_pack_channels<9>,_stream_pack_channels<10>,_stream_pack_channels<11>,
+	_stream_pack_channels<12>,_stream_pack_channels<13>,_stream_pack_channels<14>,_stream_pack_channels<15>
+};
+/******************************************************************************
+	function: _stream_sample_bin_pack
+*******************************************************************************	
+	Stores the binary sample packet for the specified sample mode.
+	See stream_sample_bin_pack.
+******************************************************************************/
+unsigned char *_stream_sample_bin_pack(unsigned char *buffer,unsigned char mode)
+{
+	unsigned char *p;
+	FLETCHER16 check;
+	STREAM_PACK header = (STREAM_PACK)pgm_read_word(_stream_pack_header_tbl+_stream_format());
+	STREAM_PACK channels = (STREAM_PACK)pgm_read_word(_stream_pack_channels_tbl+((mode>>1)&0x0f));
+	
+	fletcher16_init(&check);
+	p=header(buffer,&check);
+	p=channels(p,&check);
+	return _stream_putcheck(p,&check);
+}
+/******************************************************************************
+	function: stream_sample_bin_pack
+*******************************************************************************	
+	Stores the binary sample packet (header DXX and checksum included) for the 
+	current stream format and sample mode in a buffer.
+	
+	All the fields are byte aligned: the packet is built with byte stores instead 
+	of the generic PACKET functions, and the checksum is folded in as the bytes
+	are stored. The layout is fixed at compile time for each stream format and 
+	channel layout: the packet is built by one instance of _stream_pack_header 
+	and one of _stream_pack_channels, without a test per field.
+	
+	Parameters:
+		buffer	-	Buffer of at least stream_sample_bin_size bytes
+	
+	Returns:
+		Pointer past the last byte of the packet
+******************************************************************************/
+unsigned char *stream_sample_bin_pack(unsigned char *buffer)
+{
+	PROF_START(PROF_PKT);
+	buffer = _stream_sample_bin_pack(buffer,sample_mode);
+	PROF_STOP(PROF_PKT);
+	return buffer;
+}
+unsigned char stream_sample_bin(FILE *f)
+{
+	unsigned char buffer[STREAM_BIN_MAXSIZE];
+	unsigned char *p;
+	
+	p = stream_sample_bin_pack(buffer);
+	if(fputbuf(f,(char*)buffer,p-buffer))
+		return 1;
+	return 0;
+}
+/******************************************************************************
+	function: stream_sample_bin_log
+*******************************************************************************	
+	Logs the binary sample packet by serialising it directly in the sector staging 
+	buffer of the log (zero-copy).
+	
+	The packet is byte-identical to the one built by stream_sample_bin, but it is 
+	written once in place instead of being built in a buffer and then copied by 
+	fputbuf into the SD card cache.
+	
+	Returns:
+		0		-		Success
+		1		-		Error (log full or card error)
+******************************************************************************/
+unsigned char stream_sample_bin_log(void)
+{
+	unsigned char size;
+	unsigned char *p;
+	
+	size = stream_sample_bin_size();
+	p = (unsigned char*)ufat_log_reserve(size);
+	if(!p)
+		return 1;
+	stream_sample_bin_pack(p);
+	if(ufat_log_commit(size))
+		return 1;
+	return 0;
+}
+/******************************************************************************
+	function: CommandParserStreamBench
+*******************************************************************************	
+	Benchmarks stream_sample_bin_pack for all the channel layouts with the current
+	stream format. Its equivalence with the generic PACKET implementation is 
+	checked by the host test test_pktbuild.
+	
+	Checks that the Fletcher-16 variants (packet_fletcher16, packet_fletcher16_asm,
+	FLETCHER16) agree on random packets, and benchmarks them on a full PACKET.
+	
+	The current sample is used as data. Timings include the interrupt load of 
+	the ongoing acquisition.
+******************************************************************************/
+unsigned char CommandParserStreamBench(char *buffer,unsigned char size)
+{
+	PACKET pkt;
+	unsigned char buf[STREAM_BIN_MAXSIZE];
+	unsigned char *e=buf;
+	unsigned char ch,nerr=0;
+	unsigned short i;
+	unsigned long t1,t2,t3;
+	
+	// Timing with the current format
+	fprintf_P(file_pri,PSTR("Chan\tSize\tLayout (us per %u packets)\n"),STREAM_BENCH_NUM);
+	for(ch=0;ch<16;ch++)
+	{
+		t1=timer_us_get();
+		for(i=0;i<STREAM_BENCH_NUM;i++)
+			e=_stream_sample_bin_pack(buf,ch<<1);
+		t2=timer_us_get();
+		fprintf_P(file_pri,PSTR("%02X\t%u\t%lu\n"),ch<<1,(unsigned)(e-buf),t2-t1);
+	}
+	
+	// Checksum variants on random packets
+	FLETCHER16 c;
+	for(i=0;i<STREAM_BENCH_NUM;i++)
+	{
+		unsigned char len=rand()%(__PKT_DATA_MAXSIZE+1);
+		fletcher16_init(&c);
+		for(unsigned char j=0;j<len;j++)
+		{
+			pkt.data[j]=rand();
+			fletcher16_add8(&c,pkt.data[j]);
+		}
+		unsigned short c1=packet_fletcher16(pkt.data,len);
+		if(c1!=packet_fletcher16_asm(pkt.data,len) || c1!=fletcher16_get(&c))
+			nerr++;
+	}
+	fprintf_P(file_pri,PSTR("Checksum equivalence: %u errors\n"),nerr);
+	t1=timer_us_get();
+	for(i=0;i<STREAM_BENCH_NUM;i++)
+		packet_fletcher16(pkt.data,__PKT_DATA_MAXSIZE);
+	t2=timer_us_get();
+	for(i=0;i<STREAM_BENCH_NUM;i++)
+		packet_fletcher16_asm(pkt.data,__PKT_DATA_MAXSIZE);
+	t3=timer_us_get();
+	fprintf_P(file_pri,PSTR("Fletcher-16 of %u bytes (us per %u): C %lu asm %lu\n"),__PKT_DATA_MAXSIZE,STREAM_BENCH_NUM,t2-t1,t3-t2);
+	if(nerr)
+		return 1;
+	return 0;
+}
+
+
+/******************************************************************************
+	Compressed binary format
+*******************************************************************************
+	Blocks of samples are sent in packets with header DXZ. A block starts with
+	a keyframe holding the first sample uncompressed; each following sample is 
+	coded as the difference to the previous sample, field by field.
+	
+	Block layout:
+		'D','X','Z'	-	Header
+		n			-	Number of samples in the block (8 bits), including the keyframe
+		keyframe	-	Fields of the first sample, identical to the payload of a DXX packet:
+						pktctr (32), time (32), battery (16), label (16), acc (3x16), gyr (3x16), 
+						mag (3x16), quaternions (4x16), each present according to the stream
+						format and sample mode.
+		deltas		-	n-1 samples. For each field: the difference to the same field of the 
+						previous sample, modulo 2^16 or 2^32 according to the width of the field, 
+						zigzag-coded (0,-1,1,-2... -> 0,1,2,3...) and stored as a varint of 5-bit 
+						groups: 4 value bits (least significant first) and a continuation bit 
+						(bit 4) set when further groups follow.
+		padding		-	0 to 7 bits to the next byte boundary
+		checksum	-	Fletcher-16 of the block from 'D' to the padding included, little endian
+						(as in DXX).
+	
+	Bits are packed with packet_addbits_little: least significant bit first within 
+	each byte.
+	
+	A block is closed when the worst case encoding of the next sample would not fit
+	in a PACKET, after STREAM_Z_MAXSAMPLES samples, or after STREAM_Z_MAXTIME ms.
+******************************************************************************/
+PACKET _stream_z_packet;
+unsigned char _stream_z_n;										// Number of samples in the current block; 0 if no block open
+unsigned long _stream_z_prev[STREAM_Z_MAXFIELDS];				// Fields of the previous sample
+unsigned long _stream_z_tblock;									// Time of the keyframe
+unsigned long stat_z_samples,stat_z_blocks,stat_z_bytes,stat_z_time;
+unsigned long stat_z_lost;										// Samples of the blocks which could not be sent
+
+/******************************************************************************
+	function: _stream_z_getfields
+*******************************************************************************	
+	Collects the fields of the current sample in the order of the DXX packet.
+	
+	Parameters:
+		v		-	Array of STREAM_Z_MAXFIELDS receiving the fields
+		n32		-	Receives the number of 32-bit fields, which are first in v; 
+					the other fields are 16-bit
+	
+	Returns:
+		Number of fields
+******************************************************************************/
+unsigned char _stream_z_getfields(unsigned long *v,unsigned char *n32)
+{
+	unsigned long *v0=v;
+	
+	if(mode_stream_format_pktctr)
+		*v++=mpumotiondata.packetctr;
+	if(mode_stream_format_ts)
+		*v++=mpumotiondata.time;
+	*n32=v-v0;
 	if(mode_stream_format_bat)
-		packet_add16_little(&p,system_getbattery());
+		*v++=system_getbattery();
 	if(mode_stream_format_label)
-		packet_add16_little(&p,CurrentAnnotation);
-		
-	// Formats acceleration if selected
+		*v++=CurrentAnnotation;
 	if(sample_mode & MPU_MODE_BM_A)
 	{
-		packet_add16_little(&p,mpumotiondata.ax);
-		packet_add16_little(&p,mpumotiondata.ay);
-		packet_add16_little(&p,mpumotiondata.az);
+		*v++=(unsigned short)mpumotiondata.ax;
+		*v++=(unsigned short)mpumotiondata.ay;
+		*v++=(unsigned short)mpumotiondata.az;
 	}
-	// Formats gyro if selected
 	if(sample_mode & MPU_MODE_BM_G)
 	{
-		packet_add16_little(&p,mpumotiondata.gx);
-		packet_add16_little(&p,mpumotiondata.gy);
-		packet_add16_little(&p,mpumotiondata.gz);
+		*v++=(unsigned short)mpumotiondata.gx;
+		*v++=(unsigned short)mpumotiondata.gy;
+		*v++=(unsigned short)mpumotiondata.gz;
 	}
-	// Formats magnetic if selected
 	if(sample_mode & MPU_MODE_BM_M)
 	{
-		packet_add16_little(&p,mpumotiondata.mx);
-		packet_add16_little(&p,mpumotiondata.my);
-		packet_add16_little(&p,mpumotiondata.mz);
+		*v++=(unsigned short)mpumotiondata.mx;
+		*v++=(unsigned short)mpumotiondata.my;
+		*v++=(unsigned short)mpumotiondata.mz;
 	}
-	// Formats quaternions if selected
 	if(sample_mode & MPU_MODE_BM_Q)
 	{	
-		#if ENABLEQUATERNION==1
-			#if FIXEDPOINTQUATERNION==1
-				_Accum k;
-				signed short v;
-				k = q0*10000k; v = k;
-				packet_add16_little(&p,v);
-				k = q1*10000k; v = k;
-				packet_add16_little(&p,v);
-				k = q2*10000k; v = k;
-				packet_add16_little(&p,v);
-				k = q3*10000k; v = k;
-				packet_add16_little(&p,v);	
-			#else
-				float k;
-				signed short v;
-				k = mpumotiongeometry.q0*10000.0; v = k;
-				packet_add16_little(&p,v);
-				k = mpumotiongeometry.q1*10000.0; v = k;
-				packet_add16_little(&p,v);
-				k = mpumotiongeometry.q2*10000.0; v = k;
-				packet_add16_little(&p,v);
-				k = mpumotiongeometry.q3*10000.0; v = k;
-				packet_add16_little(&p,v);	
-			#endif
-		#else
-		packet_add16_little(&p,1);
-		packet_add16_little(&p,0);
-		packet_add16_little(&p,0);
-		packet_add16_little(&p,0);
-		#endif
+		signed short q[4];
+		_stream_get_quaternion(q);
+		for(unsigned char i=0;i<4;i++)
+			*v++=(unsigned short)q[i];
 	}
+	return v-v0;
+}
+/******************************************************************************
+	function: _stream_z_addvarint
+*******************************************************************************	
+	Appends a zigzag-coded value as a varint of 5-bit groups.
+******************************************************************************/
+void _stream_z_addvarint(PACKET *p,unsigned long z)
+{
+	unsigned char g;
+	do
+	{
+		g=z&0x0f;
+		z>>=4;
+		if(z)
+			g|=0x10;
+		packet_addbits_little(p,g,5);
+	}
+	while(z);
+}
+/******************************************************************************
+	function: stream_sample_z_flush
+*******************************************************************************	
+	Closes the current DXZ block, if any, and sends it to the specified file.
 	
-	packet_end(&p);
-	packet_addchecksum_fletcher16_little(&p);
-	int s = packet_size(&p);
-	if(fputbuf(f,(char*)p.data,s))
+	Returns:
+		0		-		Success (or no block open)
+		1		-		Error sending the block; the block is discarded and its samples 
+						are counted in stat_z_lost
+******************************************************************************/
+unsigned char stream_sample_z_flush(FILE *f)
+{
+	unsigned short s;
+	unsigned char n;
+	
+	if(_stream_z_n==0)
+		return 0;
+	packet_end(&_stream_z_packet);
+	_stream_z_packet.data[3]=_stream_z_n;
+	packet_addchecksum_fletcher16_little(&_stream_z_packet);
+	n=_stream_z_n;
+	_stream_z_n=0;
+	s = packet_size(&_stream_z_packet);
+	if(fputbuf(f,(char*)_stream_z_packet.data,s))
+	{
+		stat_z_lost+=n;
 		return 1;
+	}
+	stat_z_blocks++;
+	stat_z_bytes+=s;
 	return 0;
 }
-
+/******************************************************************************
+	function: stream_sample_z
+*******************************************************************************	
+	Adds the current sample to the DXZ block and sends the block to the specified
+	file when it is complete.
+	
+	If the block cannot be sent before adding the sample, the function returns 
+	without encoding the sample, so that the sample is accounted for as failed 
+	by the caller and the next sample starts a new block. If the block closed 
+	after adding the sample cannot be sent, the sample is likewise accounted for
+	by the caller only: it is removed from stat_z_samples and stat_z_lost, which
+	then hold the other samples of the block.
+	
+	Returns:
+		0		-		Success
+		1		-		Error sending a block
+******************************************************************************/
+unsigned char stream_sample_z(FILE *f)
+{
+	unsigned long v[STREAM_Z_MAXFIELDS];
+	unsigned char n,n32,i;
+	unsigned char rv=0;
+	unsigned long t1;
+	PACKET *p = &_stream_z_packet;
+	
+	t1=timer_us_get();
+	
+	n = _stream_z_getfields(v,&n32);
+	
+	// Close the block if the worst case encoding of this sample does not fit: 8 groups for 32-bit fields, 4 groups for 16-bit fields
+	if(_stream_z_n)
+	{
+		unsigned short used = (p->dptr-p->data)*8+p->bitptr;
+		unsigned short worst = n32*40+(n-n32)*20;
+		if(used+worst>(__PKT_DATA_MAXSIZE-2)*8)
+		{
+			if(stream_sample_z_flush(f))
+			{
+				stat_z_time+=timer_us_get()-t1;
+				return 1;
+			}
+		}
+	}
+	
+	if(_stream_z_n==0)
+	{
+		// Keyframe
+		packet_init(p,"DXZ",3);
+		packet_add8(p,0);								// Number of samples, filled when the block is closed
+		for(i=0;i<n32;i++)
+			packet_add32_little(p,v[i]);
+		for(;i<n;i++)
+			packet_add16_little(p,v[i]);
+		_stream_z_tblock=mpumotiondata.time;
+	}
+	else
+	{
+		// Zigzag-coded differences
+		for(i=0;i<n32;i++)
+		{
+			signed long d = v[i]-_stream_z_prev[i];
+			_stream_z_addvarint(p,((unsigned long)d<<1)^(unsigned long)(d>>31));
+		}
+		for(;i<n;i++)
+		{
+			signed short d = v[i]-_stream_z_prev[i];
+			_stream_z_addvarint(p,(unsigned short)(((unsigned short)d<<1)^(unsigned short)(d>>15)));
+		}
+	}
+	memcpy(_stream_z_prev,v,n*sizeof(unsigned long));
+	_stream_z_n++;
+	stat_z_samples++;
+	
+	if(_stream_z_n>=STREAM_Z_MAXSAMPLES || mpumotiondata.time-_stream_z_tblock>=STREAM_Z_MAXTIME)
+	{
+		if(stream_sample_z_flush(f))
+		{
+			// The caller counts this sample as failed
+			stat_z_samples--;
+			stat_z_lost--;
+			rv=1;
+		}
+	}
+	
+	stat_z_time+=timer_us_get()-t1;
+	
+	return rv;
+}
+/******************************************************************************
+	function: stream_sample_z_clearstat
+*******************************************************************************	
+	Discards the current DXZ block and clears the compression statistics.
+******************************************************************************/
+void stream_sample_z_clearstat(void)
+{
+	_stream_z_n=0;
+	stat_z_samples=stat_z_blocks=stat_z_bytes=stat_z_time=stat_z_lost=0;
+}
+/******************************************************************************
+	function: stream_sample_z_printstat
+*******************************************************************************	
+	Prints the compression statistics: the compression ratio is relative to 
+	the size of DXX packets for the same stream format and only accounts for the
+	blocks sent, and the encoding time includes sending the blocks.
+******************************************************************************/
+void stream_sample_z_printstat(FILE *f)
+{
+	unsigned long raw = (stat_z_samples-stat_z_lost)*stream_sample_bin_size();
+	
+	fprintf_P(f,PSTR("Compressed stream: %lu samples in %lu blocks, %lu bytes (DXX: %lu bytes)"),stat_z_samples,stat_z_blocks,stat_z_bytes,raw);
+	if(stat_z_bytes)
+		fprintf_P(f,PSTR(", ratio %lu.%02lu"),raw/stat_z_bytes,(raw%stat_z_bytes)*100/stat_z_bytes);
+	if(stat_z_samples)
+		fprintf_P(f,PSTR(", %lu us/sample"),stat_z_time/stat_z_samples);
+	if(stat_z_lost)
+		fprintf_P(f,PSTR(", %lu samples lost in blocks not sent"),stat_z_lost);
+	fputc('\n',f);
+}
 
 
 unsigned char stream_sample(FILE *f)
 {
 	if(mode_stream_format_bin==0)
 		return stream_sample_text(f);
+	if(mode_stream_format_bin==2)
+		return stream_sample_z(f);
+	// Binary packets to the log are serialised in place in the SD card staging buffer
+	if(f==mode_sample_file_log)
+		return stream_sample_bin_log();
+	return stream_sample_bin(f);
+}
+
+/******************************************************************************
+	function: stream_adapt_clear
+*******************************************************************************	
+	Returns to full rate and clears the statistics of the rate adaptation.
+*******************************************************************************/
+void stream_adapt_clear(void)
+{
+	stream_decim=1;
+	stream_decim_ctr=0;
+	stream_decim_announce=0;
+	stream_bp_t=stream_drain_t=0;
+	stream_up_t=0;
+	stream_drain_hold=STREAM_DRAIN_HOLD;
+	stream_adapt_failed=0;
+	stat_sampledecimated=0;
+}
+/******************************************************************************
+	function: stream_adapt_update
+*******************************************************************************	
+	Updates the decimation factor from the level of the tx buffer of f; called
+	once per batch of samples.
+	
+	Parameters:
+		f		-	Interface to which the samples are streamed
+*******************************************************************************/
+void stream_adapt_update(FILE *f)
+{
+	unsigned short lvl,cap;
+	unsigned long t;
+	
+	lvl=fgettxbuflevel(f);
+	cap=lvl+fgettxbuffree(f);
+	t=timer_ms_get();
+	
+	if(lvl>cap/4*3 || stream_adapt_failed)
+	{
+		// Backpressure: a failed send is acted upon immediately
+		stream_drain_t=0;
+		if(stream_bp_t==0)
+			stream_bp_t=t;
+		if((t-stream_bp_t>=STREAM_BP_HOLD || stream_adapt_failed) && stream_decim<STREAM_DECIM_MAX)
+		{
+			stream_decim<<=1;
+			stream_decim_announce=1;
+			stream_bp_t=t;
+			// Failed recovery: probe less often
+			if(stream_up_t && t-stream_up_t<2ul*stream_drain_hold && stream_drain_hold<STREAM_DRAIN_HOLD_MAX)
+				stream_drain_hold<<=1;
+		}
+		stream_adapt_failed=0;
+	}
+	else if(lvl<cap/4)
+	{
+		// Drained
+		stream_bp_t=0;
+		if(stream_drain_t==0)
+			stream_drain_t=t;
+		else if(t-stream_drain_t>=stream_drain_hold && stream_decim>1)
+		{
+			stream_decim>>=1;
+			stream_decim_announce=1;
+			stream_drain_t=t;
+			stream_up_t=t;
+		}
+		// Full rate sustained: the link recovered
+		if(stream_decim==1 && stream_up_t && t-stream_up_t>=2ul*stream_drain_hold)
+		{
+			stream_drain_hold=STREAM_DRAIN_HOLD;
+			stream_up_t=0;
+		}
+	}
 	else
-		return stream_sample_bin(f);
+		stream_bp_t=stream_drain_t=0;
+}
+/******************************************************************************
+	function: stream_adapt_skip
+*******************************************************************************	
+	Indicates whether the current sample must be skipped by the decimation.
+	
+	Returns:
+		0		-	Send the sample
+		1		-	Skip the sample
+*******************************************************************************/
+unsigned char stream_adapt_skip(void)
+{
+	if(stream_decim_ctr)
+	{
+		if(++stream_decim_ctr>=stream_decim)
+			stream_decim_ctr=0;
+		stat_sampledecimated++;
+		return 1;
+	}
+	if(stream_decim>1)
+		stream_decim_ctr=1;
+	return 0;
+}
+/******************************************************************************
+	function: stream_adapt_announce
+*******************************************************************************	
+	Announces in-band a change of decimation factor, if one is pending. 
+	
+	The announcement is retried at the next call if the interface has not enough
+	space.
+	
+	Parameters:
+		f		-	Interface to which the samples are streamed
+	Returns:
+		0		-	Nothing pending, or announcement sent
+		1		-	Announcement pending
+*******************************************************************************/
+unsigned char stream_adapt_announce(FILE *f)
+{
+	if(!stream_decim_announce)
+		return 0;
+	if(mode_stream_format_bin==0)
+	{
+		char str[40];
+		sprintf_P(str,PSTR("#decim=%u; skip=%lu\n"),stream_decim,stat_sampledecimated);
+		if(fputbuf(f,str,strlen(str)))
+			return 1;
+	}
+	else
+	{
+		unsigned char buffer[3+2+4+2];
+		unsigned char *p=buffer;
+		FLETCHER16 check,*c=&check;
+		
+		// Samples of the pending compressed block precede the change
+		if(mode_stream_format_bin==2 && stream_sample_z_flush(f))
+			return 1;
+		fletcher16_init(c);
+		p=_stream_put8(p,'D',c);
+		p=_stream_put8(p,'D',c);
+		p=_stream_put8(p,'C',c);
+		p=_stream_put16(p,stream_decim,c);
+		p=_stream_put32(p,stat_sampledecimated,c);
+		p=_stream_putcheck(p,c);
+		if(fputbuf(f,(char*)buffer,p-buffer))
+			return 1;
+	}
+	stream_decim_announce=0;
 	return 0;
 }
-
 /******************************************************************************
 	function: stream_status
 *******************************************************************************	
@@ -352,23 +1087,26 @@ void stream_status(FILE *f,unsigned char bin)
 	}
 	else
 	{
-		// Information packet
-		PACKET p;
-		packet_init(&p,"DII",3);
-		packet_add32_little(&p,stat_t_cur-stat_timems_start);		
-		packet_add16_little(&p,ltc2942_last_mV());
-		packet_add16_little(&p,ltc2942_last_mA());
-		packet_add16_little(&p,ltc2942_last_mW());
-		packet_add32_little(&p,wps);
-		packet_add32_little(&p,stat_totsample);
-		packet_add32_little(&p,stat_samplesendfailed);
-		packet_add32_little(&p,ufat_log_getsize()>>10);
-		packet_add32_little(&p,ufat_log_getmaxsize()>>10);
-		packet_add8(&p,ufat_log_getsize()/(ufat_log_getmaxsize()/100l));
-		packet_end(&p);
-		packet_addchecksum_fletcher16_little(&p);
-		int s = packet_size(&p);
-		fputbuf(f,(char*)p.data,s);
+		// Information packet: all fields are byte aligned
+		unsigned char buffer[3+31+2];
+		unsigned char *p=buffer;
+		FLETCHER16 check,*c=&check;
+		fletcher16_init(c);
+		p=_stream_put8(p,'D',c);
+		p=_stream_put8(p,'I',c);
+		p=_stream_put8(p,'I',c);
+		p=_stream_put32(p,stat_t_cur-stat_timems_start,c);
+		p=_stream_put16(p,ltc2942_last_mV(),c);
+		p=_stream_put16(p,ltc2942_last_mA(),c);
+		p=_stream_put16(p,ltc2942_last_mW(),c);
+		p=_stream_put32(p,wps,c);
+		p=_stream_put32(p,stat_totsample,c);
+		p=_stream_put32(p,stat_samplesendfailed,c);
+		p=_stream_put32(p,ufat_log_getsize()>>10,c);
+		p=_stream_put32(p,ufat_log_getmaxsize()>>10,c);
+		p=_stream_put8(p,ufat_log_getsize()/(ufat_log_getmaxsize()/100l),c);
+		p=_stream_putcheck(p,c);
+		fputbuf(f,(char*)buffer,p-buffer);
 	}
 }
 
@@ -539,8 +1277,14 @@ void mode_motionstream(void)
 			}
 		}
 		
-		// Stream existing data
-		unsigned char l = mpu_data_level();
+		// Stream existing data: claim a batch of samples from the auto read buffer with a single critical section
+		unsigned char *span1,*span2,*sample;
+		unsigned char n1,n2,i;
+		unsigned char l = mpu_data_getspans(&span1,&n1,&span2,&n2,MSM_BATCH);
+		// Rate adaptation only applies to streaming
+		unsigned char adapt = stream_adapt && !mode_sample_file_log;
+		if(adapt)
+			stream_adapt_update(file_pri);
 		if(!l)
 		{
 			sleep_cpu();
@@ -548,11 +1292,15 @@ void mode_motionstream(void)
 		}
 		else
 		{
-			for(unsigned char i=0;i<l;i++)
+			sample=span1;
+			for(i=0;i<l;i++)
 			{
-				// Get the data from the auto read buffer; if no data available break
-				if(mpu_data_getnext(mpumotiondata,mpumotiongeometry))
-					break;
+				// Get the data from the claimed spans and compute the geometry
+				if(i==n1)
+					sample=span2;
+				mpu_data_unpack(sample,mpumotiondata);
+				sample+=mpu_data_recsize;
+				mpu_compute_geometry(mpumotiondata,mpumotiongeometry);
 				
 				//fprintf(file_pri,"%lu\n",mpu_compute_geometry_time());
 			
@@ -564,6 +1312,24 @@ void mode_motionstream(void)
 				else
 					file_stream=file_pri;
 
+				// Announce a change of decimation before the next sample, and skip the samples removed by the decimation
+				if(adapt)
+				{
+					if(stream_adapt_announce(file_stream))
+					{
+						// No space for the announcement: the sample would not fit either
+						stat_samplesendfailed++;
+						stream_adapt_failed=1;
+						stat_totsample++;
+						continue;
+					}
+					if(stream_adapt_skip())
+					{
+						stat_totsample++;
+						continue;
+					}
+				}
+				
 				// Send the samples and check for error
 				putbufrv = stream_sample(file_stream);
 				
@@ -572,15 +1338,19 @@ void mode_motionstream(void)
 				{
 					// There was an error in fputbuf: increment the number of samples failed to send.			
 					stat_samplesendfailed++;
+					stream_adapt_failed=1;
 					// Check whether the fputbuf was done on a log file; in which case close the log file.
 					if(file_stream==mode_sample_file_log)
 					{
 						fprintf_P(file_pri,PSTR("Motion mode: log file full or log error\n"));
+						i++;				// The failed sample is discarded
 						break;
 					}
 				}
 				stat_totsample++;
 			} // End iterating sample buffer
+			// Release the samples processed
+			mpu_data_commit(i);
 		}
 		
 		
@@ -593,6 +1363,10 @@ void mode_motionstream(void)
 		
 	} // End sample loop
 	
+	// Send the pending compressed block
+	if(stream_sample_z_flush(mode_sample_file_log?mode_sample_file_log:file_pri))
+		stat_samplesendfailed++;
+	
 	// Stop acquiring data
 	stream_stop();	
 	
@@ -619,6 +1393,8 @@ void mode_motionstream(void)
 				stream_status(mode_sample_file_log,0);	
 				mpu_printstat(mode_sample_file_log);
 				fprintf_P(mode_sample_file_log,PSTR("MPU Geometry time: %lu us\n"),mpu_compute_geometry_time());
+				if(mode_stream_format_bin==2)
+					stream_sample_z_printstat(mode_sample_file_log);
 				
 				unsigned long cnt_sample_errbusy, cnt_sample_errfull,toterr;
 				mpu_getstat(0, 0, 0, &cnt_sample_errbusy, &cnt_sample_errfull);
@@ -634,6 +1410,8 @@ void mode_motionstream(void)
 	mpu_printstat(file_pri);
 	
 	fprintf_P(file_pri,PSTR("MPU Geometry time: %lu us\n"),mpu_compute_geometry_time());
+	if(mode_stream_format_bin==2)
+		stream_sample_z_printstat(file_pri);
 	
 	// Total errors
 	unsigned long cnt_sample_errbusy, cnt_sample_errfull,toterr;
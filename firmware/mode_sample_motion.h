@@ -5,9 +5,39 @@
 
 #define MSM_LOGBAT
 
+// Maximum number of motion samples claimed from the auto read buffer at once
+#define MSM_BATCH 32
+
+// Maximum size of a binary sample packet (DXX): header, pktctr, time, battery, label, acc, gyr, mag, quaternions, checksum
+#define STREAM_BIN_MAXSIZE (3+4+4+2+2+6+6+6+8+2)
+// Number of packets built by the packet builder benchmark
+#define STREAM_BENCH_NUM 100
+
+// Compressed binary format (DXZ blocks)
+#define STREAM_Z_MAXFIELDS 17			// pktctr, time, battery, label, acc, gyr, mag, quaternions
+#define STREAM_Z_MAXSAMPLES 32			// Maximum number of samples in a block
+#define STREAM_Z_MAXTIME 250			// Maximum time span of a block (ms), to bound the latency at low sample rates
+
+// Backpressure rate adaptation (stream_adapt_update)
+#define STREAM_DECIM_MAX 16				// Maximum decimation factor, power of 2
+#define STREAM_BP_HOLD 250				// Time (ms) the tx buffer must stay above 3/4 full before the decimation is doubled
+#define STREAM_DRAIN_HOLD 1000			// Time (ms) the tx buffer must stay below 1/4 full before the decimation is halved
+#define STREAM_DRAIN_HOLD_MAX 16000		// Maximum drain time after repeated failed recoveries
+
 extern const char help_streamlog[] PROGMEM;
 
 unsigned char stream_sample(FILE *f);
+unsigned char stream_sample_bin_size(void);
+unsigned char stream_sample_bin_log(void);
+unsigned char *stream_sample_bin_pack(unsigned char *buffer);
+unsigned char stream_sample_z(FILE *f);
+unsigned char stream_sample_z_flush(FILE *f);
+void stream_sample_z_clearstat(void);
+void stream_sample_z_printstat(FILE *f);
+void stream_adapt_clear(void);
+void stream_adapt_update(FILE *f);
+unsigned char stream_adapt_skip(void);
+unsigned char stream_adapt_announce(FILE *f);
 
 // Structure to hold the volatile parameters of this mode
 typedef struct {
@@ -24,6 +54,8 @@ void mode_sample_motion_setparam(unsigned char mode, int logfile, int duration);
 unsigned char CommandParserSampleLogMPU(char *buffer,unsigned char size);
 unsigned char CommandParserSampleStatus(char *buffer,unsigned char size);
 unsigned char CommandParserBatBench(char *buffer,unsigned char size);
+unsigned char CommandParserStreamBench(char *buffer,unsigned char size);
+unsigned char CommandParserStreamAdapt(char *buffer,unsigned char size);
 void stream_status(FILE *f,unsigned char bin);
 unsigned char CommandParserMotion(char *buffer,unsigned char size);
 void mode_motionstream(void);
@@ -44,14 +44,21 @@ const char help_write[] PROGMEM="W,<sector>,<value>: Fills a sector with the giv
 const char help_stream[] PROGMEM="S,<sector>,<value>,<size>,<bsize>: Writes size bytes data in streaming mode with caching; sends data by blocks of size bsize";
 const char help_read[] PROGMEM="R,<sector>: Reads a sector (sector number in decimal)";
 const char help_volume[] PROGMEM="Initialise volume";
-const char help_format[] PROGMEM="F,<numlogfiles>: Format the card for numlogfiles and initialise the volume (maximum numlogfiles=14)";
+const char help_format[] PROGMEM="F,<numlogfiles>[,<sectorspercluster>]: Format the card for numlogfiles and initialise the volume (maximum numlogfiles=14 with a one-sector ROOT); clusters of 64 sectors by default, up to 128";
 const char help_logtest[] PROGMEM="l,<lognum>,<sizekb>: QA test. Logs test data to <lognum> up to <sizekb> KB. Use to validate speed/consistency of SD card writes.";
+const char help_logtestmulti[] PROGMEM="m,<lognum>,<numlog>,<sizekb>: Logs sizekb KB of test data to log lognum alone, then spread over the logs lognum to lognum+numlog-1 written at the same time, and compares the speed";
+const char help_recover[] PROGMEM="r,<lognum>: Recovers the size of a log which was not closed (e.g. after a power loss) from its content and writes it in the directory";
+const char help_readout[] PROGMEM="O,<lognum>,<sector>,<numsector>: Reads out a log as binary DRD frames of one sector from the sector offset <sector>; <numsector>=0 reads up to the end. Any key interrupts";
+const char help_findtime[] PROGMEM="t,<lognum>,<timems>: Finds the sector offset of a log holding the data of time timems (timer_ms_get) with the time index of the log; use with O to read out from that time";
+const char help_readbench[] PROGMEM="M,<sector>,<numsector>: Benchmarks reading numsector sectors from sector with single block reads and with a multiblock read";
+const char help_checkpoint[] PROGMEM="K[,<sectors>,<seconds>]: Prints or sets the interval at which the log size is saved while logging; 0 disables the interval. Use with L to measure the throughput cost.";
 //const char help_logtest2[] PROGMEM="L,<lognum>,<sizebytes>,<char>,<bsiz>: Writes to lognum sizebytes character char in bsiz blocks";
 const char help_sdbench[] PROGMEM="B,<benchtype>";
+const char help_sdlatency[] PROGMEM="T,<startsect>,<numsect>,<samplerate>,<samplesize>: Write latency histograms of single block, multiblock, pre-erased, erased and cached writes of numsect sectors each (5*numsect sectors from startsect are overwritten); recommends the staging size for samplerate Hz samples of samplesize bytes";
 const char help_sdbench2[] PROGMEM="b,<startsect>,<sizekb> stream cache write from startsect up to sizekb";
 const char help_sdbench3[] PROGMEM="1,<startsect>,<sizekb>,<preerasekb> stream cache write from startsect up to sizekb, optional preerase kb";
 
-#define CommandParsersSDNum 15
+#define CommandParsersSDNum 22
 const COMMANDPARSER CommandParsersSD[CommandParsersSDNum] =
 { 
 	{'I', CommandParserSDInit,help_sdinit},
@@ -64,8 +71,15 @@ const COMMANDPARSER CommandParsersSD[CommandParsersSDNum] =
 	{'V', CommandParserSDVolume,help_volume},
 	{'F', CommandParserSDFormat,help_format},
 	{'L', CommandParserSDLogTest,help_logtest},
+	{'m', CommandParserSDLogTestMulti,help_logtestmulti},
+	{'K', CommandParserSDCheckpoint,help_checkpoint},
+	{'r', CommandParserSDRecover,help_recover},
+	{'O', CommandParserSDReadout,help_readout},
+	{'t', CommandParserSDFindTime,help_findtime},
+	{'M', CommandParserSDReadBench,help_readbench},
 	//{'l', CommandParserSDLogTest2,help_logtest2},
 	{'B', CommandParserSDBench,help_sdbench},
+	{'T', CommandParserSDLatency,help_sdlatency},
 	{'b', CommandParserSDBench2,help_sdbench2},
 	{'1', CommandParserSDBench_t1,help_sdbench3},
 	{'2', CommandParserSDBench_t2,help_sdbench2},
@@ -152,6 +166,18 @@ unsigned char CommandParserSDBench(char *buffer,unsigned char size)
 	}
 	return 0;
 }
+unsigned char CommandParserSDLatency(char *buffer,unsigned char size)
+{
+	unsigned long startsect,numsect,samplerate,samplesize;
+	
+	if(ParseCommaGetLong(buffer,4,&startsect,&numsect,&samplerate,&samplesize))
+		return 2;
+	if(numsect==0 || startsect+5*numsect>_fsinfo.card_capacity_sector)
+		return 2;
+	
+	sd_bench_latency(startsect,numsect,samplerate,samplesize);
+	return 0;
+}
 unsigned char CommandParserSDBench2(char *buffer,unsigned char size)
 {
 	// Parse arguments
@@ -196,12 +222,18 @@ unsigned char CommandParserSDBench_t2(char *buffer,unsigned char size)
 
 unsigned char CommandParserSDFormat(char *buffer,unsigned char size)
 {
-	unsigned int numlog;
-	if(ParseCommaGetInt((char*)buffer,1,&numlog))
+	unsigned int numlog,sectperclust;
+	if(ParseCommaGetInt((char*)buffer,2,&numlog,&sectperclust))
+	{
+		if(ParseCommaGetInt((char*)buffer,1,&numlog))
+			return 2;
+		sectperclust=UFAT_SECTPERCLUST_DEFAULT;
+	}
+	if(sectperclust==0 || sectperclust>128 || (sectperclust&(sectperclust-1)))
 		return 2;
 		
-	fprintf_P(file_pri,PSTR("Formatting with %u log files\n"),numlog);
-	ufat_format(numlog);
+	fprintf_P(file_pri,PSTR("Formatting with %u log files, %u sectors per cluster\n"),numlog,sectperclust);
+	ufat_format(numlog,sectperclust);
 	return 0;
 }
 /*unsigned char CommandParserSDLogTest2(char *buffer,unsigned char size)
@@ -225,7 +257,143 @@ unsigned char CommandParserSDLogTest(char *buffer,unsigned char size)
 	
 	printf("lognum: %u\n",lognum);
 	printf("sz: %u KB\n",sz);
-	ufat_log_test(lognum,(unsigned long)sz*1024l,65536);
+	sd_bench_log(lognum,(unsigned long)sz*1024l,65536);
+	return 0;
+}
+unsigned char CommandParserSDLogTestMulti(char *buffer,unsigned char size)
+{
+	unsigned int lognum,numlog,sz;
+	unsigned long s1,sn;
+	
+	if(ParseCommaGetInt((char*)buffer,3,&lognum,&numlog,&sz))
+		return 2;
+	if(numlog==0 || numlog>1+UFAT_NUMLOG2 || lognum+numlog>ufat_log_getnumlogs())
+		return 2;
+	
+	s1=ufat_log_test_multi(lognum,1,(unsigned long)sz*1024l);
+	sn=ufat_log_test_multi(lognum,numlog,(unsigned long)sz*1024l);
+	fprintf_P(file_pri,PSTR("1 log: %lu KB/s. %u logs: %lu KB/s\n"),s1,numlog,sn);
+	return 0;
+}
+unsigned char CommandParserSDCheckpoint(char *buffer,unsigned char size)
+{
+	unsigned long sectors,seconds;
+	unsigned short s;
+	
+	if(size!=0)
+	{
+		if(ParseCommaGetLong(buffer,2,&sectors,&seconds))
+			return 2;
+		ufat_log_setcheckpoint(sectors,seconds);
+	}
+	ufat_log_getcheckpoint(&sectors,&s);
+	fprintf_P(file_pri,PSTR("Log checkpoint every %lu sectors, every %u s\n"),sectors,s);
+	return 0;
+}
+unsigned char CommandParserSDRecover(char *buffer,unsigned char size)
+{
+	unsigned int lognum;
+	unsigned long sz;
+	unsigned long numread;
+	unsigned long t1;
+	
+	if(ParseCommaGetInt((char*)buffer,1,&lognum))
+		return 2;
+	if(lognum>=ufat_log_getnumlogs())
+		return 2;
+	
+	fprintf_P(file_pri,PSTR("Recovering log %u\n"),lognum);
+	t1=timer_ms_get();
+	if(ufat_log_recover(lognum,&sz,&numread))
+	{
+		fprintf_P(file_pri,PSTR("Error\n"));
+		return 1;
+	}
+	fprintf_P(file_pri,PSTR("Size: %lu bytes. %lu sectors read in %lu ms\n"),sz,numread,timer_ms_get()-t1);
+	return 0;
+}
+unsigned char CommandParserSDReadout(char *buffer,unsigned char size)
+{
+	unsigned long lognum,sector,numsector;
+	unsigned long numsent;
+	unsigned long t1,dt;
+	unsigned char rv;
+	
+	if(ParseCommaGetLong(buffer,3,&lognum,&sector,&numsector))
+		return 2;
+	if(lognum>=ufat_log_getnumlogs())
+		return 2;
+	
+	fprintf_P(file_pri,PSTR("Readout log %lu: %lu bytes from sector %lu\n"),lognum,ufat_log_getlogsize(lognum),sector);
+	t1=timer_ms_get();
+	rv=ufat_log_readout(file_pri,lognum,sector,numsector,&numsent);
+	dt=timer_ms_get()-t1;
+	// Discard the character which interrupted the readout
+	if(rv==2)
+		fgetc(file_pri);
+	if(dt==0)
+		dt=1;
+	fprintf_P(file_pri,PSTR("\nReadout %s: %lu sectors up to sector %lu in %lu ms (%lu KB/s)\n"),rv==0?"done":(rv==2?"interrupted":"error"),numsent,sector+numsent,dt,numsent*500/dt);
+	return rv==1?1:0;
+}
+unsigned char CommandParserSDFindTime(char *buffer,unsigned char size)
+{
+	unsigned long lognum,time,sector,entrytime;
+	unsigned long t1;
+	unsigned char rv;
+	
+	if(ParseCommaGetLong(buffer,2,&lognum,&time))
+		return 2;
+	if(lognum>=ufat_log_getnumlogs())
+		return 2;
+	
+	t1=timer_ms_get();
+	rv=ufat_log_findtime(lognum,time,&sector,&entrytime);
+	if(rv==1)
+		return 1;
+	if(rv==2)
+		fprintf_P(file_pri,PSTR("No index entry at or before %lu\n"),time);
+	else
+		fprintf_P(file_pri,PSTR("Time %lu: from sector %lu (index entry %lu ms) in %lu ms\n"),time,sector,entrytime,timer_ms_get()-t1);
+	return 0;
+}
+unsigned char CommandParserSDReadBench(char *buffer,unsigned char size)
+{
+	unsigned long sector,numsector;
+	unsigned long t1,dt;
+	unsigned short checksum;
+	unsigned char rv;
+	
+	if(ParseCommaGetLong(buffer,2,&sector,&numsector))
+		return 2;
+	if(numsector==0)
+		return 2;
+	
+	for(unsigned char mode=0;mode<2;mode++)
+	{
+		fprintf_P(file_pri,PSTR("%s: "),mode==0?"CMD17":"CMD18");
+		sd_read_clearstat();
+		rv=0;
+		t1=timer_ms_get();
+		if(mode==0)
+		{
+			for(unsigned long i=0;i<numsector && !rv;i++)
+				rv=sd_block_read(sector+i,ufatblock);
+		}
+		else
+		{
+			rv=sd_stream_read_open(sector,numsector);
+			for(unsigned long i=0;i<numsector && !rv;i++)
+				rv=sd_stream_read(ufatblock,&checksum);
+		}
+		dt=timer_ms_get()-t1;
+		if(dt==0)
+			dt=1;
+		if(rv)
+			fprintf_P(file_pri,PSTR("error. "));
+		fprintf_P(file_pri,PSTR("%lu ms (%lu KB/s). "),dt,numsector*500/dt);
+		sd_read_printstat(file_pri);
+	}
 	return 0;
 }
 unsigned char CommandParserSDWrite(char *buffer,unsigned char size)
@@ -18,8 +18,15 @@ unsigned char CommandParserSDVolume(char *buffer,unsigned char size);
 unsigned char CommandParserSDFormat(char *buffer,unsigned char size);
 unsigned char CommandParserSDLogTest(char *buffer,unsigned char size);
 unsigned char CommandParserSDLogTest2(char *buffer,unsigned char size);
+unsigned char CommandParserSDLogTestMulti(char *buffer,unsigned char size);
+unsigned char CommandParserSDCheckpoint(char *buffer,unsigned char size);
+unsigned char CommandParserSDRecover(char *buffer,unsigned char size);
+unsigned char CommandParserSDReadout(char *buffer,unsigned char size);
+unsigned char CommandParserSDFindTime(char *buffer,unsigned char size);
+unsigned char CommandParserSDReadBench(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench2(char *buffer,unsigned char size);
+unsigned char CommandParserSDLatency(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench_t1(char *buffer,unsigned char size);
 unsigned char CommandParserSDBench_t2(char *buffer,unsigned char size);
 
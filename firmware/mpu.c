@@ -20,6 +20,9 @@
 #include "helper.h"
 #include "uiconfig.h"
 #include "mpu_geometry.h"
+#include "init.h"
+#include "spi-usart0.h"
+#include "prof.h"
 
 /*
 	File: mpu
@@ -44,6 +47,15 @@
 	* mpu_data_level:			Function indicating how many samples are in the buffer
 	* mpu_data_getnext_raw:		Returns the next data in the buffer (when automatic read is active).
 	* mpu_data_getnext:			Returns the next raw and geometry data (when automatic read is active).
+	* mpu_data_getspans:		Claims the pending samples as one or two contiguous spans (when automatic read is active).
+	* mpu_data_commit:			Releases the samples claimed with mpu_data_getspans.
+	* mpu_data_unpack:			Converts a record returned by mpu_data_getspans into MPUMOTIONDATA.
+	
+	*Buffer layout*
+	The buffer holds MPU_MOTIONBUFFERBYTES bytes. In modes acquiring the magnetometer (or computing the orientation) each sample is stored 
+	as a full MPUMOTIONDATA. In modes acquiring only the accelerometer and/or gyroscope each sample is stored as a compacted record 
+	containing the enabled channels and the increments of time and packetctr: acc-only and gyro-only modes hold 232 samples and acc+gyro 
+	modes hold 132 samples instead of 64. See mpu_data.c.
 	
 	
 	In non automatic read, the functions mpu_get_a, mpu_get_g, mpu_get_agt or mpu_get_agmt must be used to acquire the MPU data. These functions can also be called in automatic
@@ -174,10 +186,8 @@ const char _str_mpu[] = "MPU: ";
 
 unsigned char __mpu_sample_softdivider_ctr=0,__mpu_sample_softdivider_divider=0;
 
-// Data buffers
-MPUMOTIONDATA mpu_data[MPU_MOTIONBUFFERSIZE];
+// Data buffers (the buffer itself is in mpu_data.c)
 volatile unsigned long __mpu_data_packetctr_current;
-volatile unsigned char mpu_data_rdptr,mpu_data_wrptr;
 volatile MPUMOTIONDATA _mpumotiondata_test;
 
 // Magnetometer Axis Sensitivity Adjustment
@@ -195,6 +205,19 @@ unsigned long mpu_cnt_spurious;
 
 unsigned char __mpu_autoread=0;
 
+// FIFO burst readout (HW9+)
+unsigned char _mpu_fifoburst=0;							// Requested number of samples per burst; 0 to read each sample individually
+unsigned char __mpu_fifoburst_n=0;						// Number of samples per burst when active; 0 when inactive
+unsigned char __mpu_fifoburst_fiforecsize;				// Size of a sample in the MPU FIFO
+unsigned long __mpu_fifoburst_tlast;					// Time of the last sample stored by the burst readout
+unsigned long mpu_cnt_fifo_burst, mpu_cnt_fifo_overflow;
+
+// Asynchronous readout
+unsigned char __mpu_isr_async=0;						// 1 to read the samples with an interrupt-driven transfer instead of a blocking one
+volatile unsigned char __mpu_async_pending=0;			// 1 while an asynchronous transfer is queued or ongoing
+unsigned char __mpu_async_buf[_MPU_ASYNC_XFER];			// Transfer buffer: command, INT_STATUS, 21 bytes of data
+unsigned long __mpu_async_time;							// Time of the sample being transferred
+
 unsigned char _mpu_current_motionmode=0;
 
 unsigned char _mpu_kill=0;
@@ -213,7 +236,7 @@ _Accum mpu_gtorps=3.14159665k/180.0k/131.0k;
 
 
 
-// 
+// 
 unsigned char sample_mode;
 
 /******************************************************************************
@@ -300,6 +323,20 @@ void mpu_isr(void)	// Blocking SPI read within this interrupt
 {
 	static signed short mxo=0,myo=0,mzo=0;
 
+	#if HWVER==9
+	// In burst mode the interrupt comes every __mpu_fifoburst_n samples and the data is in the FIFO
+	if(__mpu_fifoburst_n)
+	{
+		_mpu_isr_fifoburst();
+		return;
+	}
+	#endif
+	if(__mpu_isr_async)
+	{
+		_mpu_isr_async();
+		return;
+	}
+
 	// motionint always called (e.g. WoM)
 	/*if(isr_motionint!=0)
 			isr_motionint();	*/
@@ -346,22 +383,25 @@ void mpu_isr(void)	// Blocking SPI read within this interrupt
 			// Registers start at 59d (ACCEL_XOUT_H) until 79 (EXT_SENS_DATA_06). 
 			// The EXT_SENS_DATA_xx is populated from the magnetometer
 			unsigned char spibuf[32];
+			PROF_START(PROF_SPI);
 			unsigned char r = mpu_readregs_int_try_raw(spibuf,59,21);
+			PROF_STOP(PROF_SPI);
 			if(r)
 			{
 				mpu_cnt_sample_errbusy++;
 				return;
 			}
-			// Discard oldest data and store new one
-			if(mpu_data_isfull())
+			// Discard oldest data and store new one, unless the oldest data is claimed by the consumer in which case the new data is discarded.
+			// The oldest data is only discarded once the new one is stored in the free entry at mpu_data_wrptr.
+			if(mpu_data_isfull() && mpu_data_claimed)
 			{
-				_mpu_data_rdnext();
 				mpu_cnt_sample_errfull++;
-				mpu_cnt_sample_succcess--;		// This plays with the increment of mpu_cnt_sample_succcess on the last line of this function; i.e. mpu_cnt_sample_succcess does not change.
+				return;
 			}
 			
-			// Pointer to memory structure
-			MPUMOTIONDATA *mdata = &mpu_data[mpu_data_wrptr];
+			// Pointer to memory structure: decode in place with the full layout, otherwise in a temporary structure which is then compacted
+			MPUMOTIONDATA mtmp;
+			MPUMOTIONDATA *mdata = mpu_data_layout?&mtmp:(MPUMOTIONDATA*)&mpu_data[mpu_data_wrptr*mpu_data_recsize];
 			
 			mdata->time=timer_ms_get();											
 			
@@ -402,11 +442,13 @@ void mpu_isr(void)	// Blocking SPI read within this interrupt
 			mdata->packetctr=__mpu_data_packetctr_current;
 			
 			// correct the magnetometer
+			PROF_START(PROF_MAG);
 			if(_mpu_mag_correctionmode==1)
 				//mpu_mag_correct1(mdata->mx,mdata->my,mdata->mz,&mdata->mx,&mdata->my,&mdata->mz);		// This call to be used with __mpu_copy_spibuf_to_mpumotiondata_asm
 				mpu_mag_correct1(mdata->my,mdata->mx,mdata->mz,&mdata->my,&mdata->mx,&mdata->mz);		// This call to be used with __mpu_copy_spibuf_to_mpumotiondata_magcor_asm: swap mx and my to ensure the right ASA coefficients are applied
 			if(_mpu_mag_correctionmode==2)
 				mpu_mag_correct2_inplace(&mdata->mx,&mdata->my,&mdata->mz);								// Call identical regardless of __mpu_copy_spibuf_to_mpumotiondata_asm or __mpu_copy_spibuf_to_mpumotiondata_magcor_asm as calibration routine uses corrected coordinate system.
+			PROF_STOP(PROF_MAG);
 						
 
 			// Implement the channel kill
@@ -435,6 +477,21 @@ void mpu_isr(void)	// Blocking SPI read within this interrupt
 			
 
 
+			// Compact the sample; discard it if it cannot be stored
+			if(mpu_data_layout && _mpu_data_wrpack(mdata))
+			{
+				mpu_cnt_sample_errfull++;
+				return;
+			}
+			
+			// Discard the oldest data
+			if(mpu_data_isfull())
+			{
+				_mpu_data_rdnext();
+				mpu_cnt_sample_errfull++;
+				mpu_cnt_sample_succcess--;		// This plays with the increment of mpu_cnt_sample_succcess on the last line of this function; i.e. mpu_cnt_sample_succcess does not change.
+			}
+
 			// Next buffer	
 			_mpu_data_wrnext();	
 			
@@ -447,6 +504,261 @@ void mpu_isr(void)	// Blocking SPI read within this interrupt
 	#endif
 }
 
+#if HWVER==9
+/******************************************************************************
+	function: _mpu_isr_fifoburst
+*******************************************************************************	
+	Burst readout of the MPU FIFO, called from mpu_isr when the FIFO burst
+	mode is active.
+	
+	The interrupt is raised by the timer every __mpu_fifoburst_n MPU samples.
+	All the complete samples in the FIFO are read, in as many SPI transactions 
+	as needed, and stored in the compacted motion buffer.
+	
+	The MPU only provides the sample rate, not the time of each sample: the
+	samples of a burst are spread evenly between the time of the last sample 
+	of the previous burst and the current time.
+	
+	When the FIFO overflowed, the MPU dropped the newest samples: the samples in
+	the FIFO follow the previous burst at the sample rate, and the samples after
+	this burst start at the current time.
+*******************************************************************************/
+void _mpu_isr_fifoburst(void)
+{
+	unsigned char spibuf[_MPU_FIFOBURST_XFER+1];
+	unsigned short cnt;
+	unsigned char k,n,nx,recsize,ovf;
+	unsigned long tnow,tbase,dt,tacc;
+	
+	mpu_cnt_int++;
+	
+	// Number of bytes in the FIFO
+	if(mpu_readregs_int_try_raw(spibuf,MPU_R_FIFOCNTH,2))
+	{
+		mpu_cnt_sample_errbusy++;
+		return;
+	}
+	cnt = (((unsigned short)(spibuf[1]&0x1f))<<8)|spibuf[2];
+	recsize = __mpu_fifoburst_fiforecsize;
+	ovf = cnt+recsize>MPU_FIFO_SIZE && _mpu_samplerate;		// The FIFO was full and the MPU dropped samples
+	k = cnt/recsize;
+	if(k==0)
+	{
+		mpu_cnt_spurious++;
+		return;
+	}
+	mpu_cnt_fifo_burst++;
+	
+	// Time increment between samples in 1/256ms
+	tnow = timer_ms_get();
+	tbase = __mpu_fifoburst_tlast;
+	if(ovf)
+	{
+		mpu_cnt_fifo_overflow++;
+		dt = (1000l<<8)/_mpu_samplerate;
+	}
+	else
+		dt = ((tnow-tbase)<<8)/k;
+	tacc = 0;
+	
+	// Samples per SPI transaction
+	nx = _MPU_FIFOBURST_XFER/recsize;
+	
+	while(k)
+	{
+		n = k>nx?nx:k;
+		if(mpu_readregs_int_try_raw(spibuf,MPU_R_FIFORW,n*recsize))
+		{
+			// The remaining samples stay in the FIFO and are read with the next burst
+			mpu_cnt_sample_errbusy++;
+			break;
+		}
+		k-=n;
+		unsigned char *fifo = spibuf+1;
+		for(unsigned char i=0;i<n;i++)
+		{
+			mpu_cnt_sample_tot++;
+			tacc+=dt;
+			__mpu_fifoburst_tlast = tbase+(tacc>>8);
+			
+			// Discard oldest data and store new one, unless the oldest data is claimed by the consumer in which case the new data is discarded
+			if(mpu_data_isfull() && mpu_data_claimed)
+			{
+				mpu_cnt_sample_errfull++;
+				fifo+=recsize;
+				continue;
+			}
+			
+			// The FIFO holds the channels big-endian in the same order as the record: accelerometer, then gyroscope
+			unsigned char *rec = _mpu_data_wrhdr(__mpu_fifoburst_tlast,mpu_cnt_sample_tot);
+			if(!rec)
+			{
+				mpu_cnt_sample_errfull++;
+				fifo+=recsize;
+				continue;
+			}
+			// The record is in the free entry at mpu_data_wrptr: the oldest data can be discarded
+			if(mpu_data_isfull())
+			{
+				_mpu_data_rdnext();
+				mpu_cnt_sample_errfull++;
+				mpu_cnt_sample_succcess--;
+			}
+			for(unsigned char j=0;j<recsize;j+=2)
+			{
+				// Implement the channel kill
+				if( (j<6 && (mpu_data_layout&MPU_MODE_BM_A))?(_mpu_kill&4):(_mpu_kill&2) )
+					rec[j]=rec[j+1]=0;
+				else
+				{
+					rec[j]=fifo[j+1];
+					rec[j+1]=fifo[j];
+				}
+			}
+			fifo+=recsize;
+			
+			_mpu_data_wrnext();
+			mpu_cnt_sample_succcess++;
+		}
+	}
+	// The FIFO was emptied after an overflow: the next samples are acquired from now on
+	if(ovf && k==0)
+		__mpu_fifoburst_tlast = tnow;
+}
+#endif
+
+/******************************************************************************
+	function: _mpu_isr_async
+*******************************************************************************	
+	Asynchronous variant of mpu_isr, used when __mpu_isr_async is set. 
+	
+	The INT_STATUS check and the data read are chained in a single 
+	interrupt-driven transfer starting at INT_STATUS, which is queued if the
+	SPI interface is busy. The interrupt returns immediately; the status check
+	and the conversion are done in the completion handler __mpu_isr_async_cb.
+	The CPU is therefore free during the transfer at any SPI clock.
+	
+	mpu_cnt_int counts all the interrupts, including spurious ones which are
+	only identified when the transfer completes.
+*******************************************************************************/
+void _mpu_isr_async(void)
+{
+	// Statistics
+	mpu_cnt_int++;
+
+	#if HWVER!=9
+	// HW9+ implements the softdivider by means of a timer/counter
+	__mpu_sample_softdivider_ctr++;
+	if(__mpu_sample_softdivider_ctr<=__mpu_sample_softdivider_divider)
+		return;
+	__mpu_sample_softdivider_ctr=0;
+	#endif
+	
+	if(!__mpu_autoread)
+		return;
+	
+	// Statistics
+	mpu_cnt_sample_tot++;
+	
+	// The transfer buffer is still in use by the previous sample
+	if(__mpu_async_pending)
+	{
+		mpu_cnt_sample_errbusy++;
+		return;
+	}
+	__mpu_async_time=timer_ms_get();
+	__mpu_data_packetctr_current=mpu_cnt_sample_tot;
+	__mpu_async_buf[0]=0x80|MPU_R_INT_STATUS;
+	if(spiusart0_rwn_int_cb_queue(__mpu_async_buf,_MPU_ASYNC_XFER,__mpu_isr_async_cb))
+	{
+		mpu_cnt_sample_errbusy++;
+		return;
+	}
+	__mpu_async_pending=1;
+}
+/******************************************************************************
+	function: __mpu_isr_async_cb
+*******************************************************************************	
+	Completion handler of the transfer initiated by _mpu_isr_async. Called from
+	the SPI interrupt.
+	
+	__mpu_async_buf holds INT_STATUS at index 1 followed by the registers 59 
+	(ACCEL_XOUT_H) to 79 (EXT_SENS_DATA_06) as read by mpu_isr.
+*******************************************************************************/
+void __mpu_isr_async_cb(void)
+{
+	__mpu_async_pending=0;
+	
+	// No data ready: the interrupt was spurious and no sample is accounted for
+	if( (__mpu_async_buf[1]&1) == 0)
+	{
+		mpu_cnt_spurious++;
+		mpu_cnt_sample_tot--;
+		return;
+	}
+	
+	// Discard oldest data and store new one, unless the oldest data is claimed by the consumer in which case the new data is discarded
+	if(mpu_data_isfull() && mpu_data_claimed)
+	{
+		mpu_cnt_sample_errfull++;
+		return;
+	}
+	
+	MPUMOTIONDATA mtmp;
+	MPUMOTIONDATA *mdata = mpu_data_layout?&mtmp:(MPUMOTIONDATA*)&mpu_data[mpu_data_wrptr*mpu_data_recsize];
+	
+	mdata->time=__mpu_async_time;
+	__mpu_copy_spibuf_to_mpumotiondata_magcor_asm_mathias(__mpu_async_buf+2,mdata);
+	mdata->packetctr=__mpu_data_packetctr_current;
+	
+	// Correct the magnetometer, as in mpu_isr
+	if(_mpu_mag_correctionmode==1)
+		mpu_mag_correct1(mdata->my,mdata->mx,mdata->mz,&mdata->my,&mdata->mx,&mdata->mz);
+	if(_mpu_mag_correctionmode==2)
+		mpu_mag_correct2_inplace(&mdata->mx,&mdata->my,&mdata->mz);
+	
+	// Implement the channel kill
+	if(_mpu_kill&1)
+		mdata->mx=mdata->my=mdata->mz=0;
+	if(_mpu_kill&2)
+		mdata->gx=mdata->gy=mdata->gz=0;
+	if(_mpu_kill&4)
+		mdata->ax=mdata->ay=mdata->az=0;
+	
+	if(mpu_data_layout && _mpu_data_wrpack(mdata))
+	{
+		mpu_cnt_sample_errfull++;
+		return;
+	}
+	
+	// Discard the oldest data once the new one is stored, as in mpu_isr
+	if(mpu_data_isfull())
+	{
+		_mpu_data_rdnext();
+		mpu_cnt_sample_errfull++;
+		mpu_cnt_sample_succcess--;
+	}
+	
+	_mpu_data_wrnext();
+	mpu_cnt_sample_succcess++;
+}
+/******************************************************************************
+	function: mpu_config_asyncread
+*******************************************************************************	
+	Selects how the automatic read transfers the samples from the MPU.
+	
+	Parameters:
+		async	-	0: blocking SPI transfer within the MPU interrupt (mpu_isr)
+					1: interrupt-driven SPI transfer with completion handler (_mpu_isr_async)
+*******************************************************************************/
+void mpu_config_asyncread(unsigned char async)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		__mpu_isr_async=async?1:0;
+	}
+}
+
 /******************************************************************************
 	function: mpu_clearstat
 *******************************************************************************	
@@ -465,6 +777,8 @@ void mpu_clearstat(void)
 		mpu_cnt_sample_errbusy=0;
 		mpu_cnt_sample_errfull=0;
 		mpu_cnt_spurious=0;
+		mpu_cnt_fifo_burst=0;
+		mpu_cnt_fifo_overflow=0;
 	}
 }
 /******************************************************************************
@@ -502,35 +816,22 @@ void mpu_getstat(unsigned long *cnt_int, unsigned long *cnt_sample_tot, unsigned
 	}
 }
 
-/******************************************************************************
-	function: mpu_clearbuffer
-*******************************************************************************	
-	Clears all sensor data held in the MPU buffers.
-	
-	Parameters:
-		-
-	
-	Returns:
-		-
-*******************************************************************************/
-void mpu_clearbuffer(void)
-{
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		mpu_data_rdptr=mpu_data_wrptr=0;
-	}	
-}
-
 void _mpu_enableautoread(void)
 {
 	_mpu_disableautoread();		// Temporarily disable the interrupts to allow clearing the old statistics+buffer
 	_delay_ms(1);				// Wait that the last potential interrupt transfer completes
+	// Drop the asynchronous transfer which may still be queued behind another SPI transfer
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		spiusart0_rwn_int_cb_unqueue(__mpu_isr_async_cb);
+		__mpu_async_pending=0;
+	}
 	// Clear the software divider counter
 	__mpu_sample_softdivider_ctr=0;
 	// Clear statistics counters
 	mpu_clearstat();	
-	// Clear data buffers
-	mpu_clearbuffer();
+	// Select the buffer layout for the current mode and clear data buffers
+	_mpu_data_setlayout(sample_mode);
 	// Enable automatic read
 	__mpu_autoread=1;
 	// Enable motion interrupts
@@ -544,6 +845,96 @@ void _mpu_disableautoread(void)
 	__mpu_autoread=0;
 }
 
+/******************************************************************************
+	function: mpu_config_fifoburst
+*******************************************************************************	
+	Requests the FIFO burst readout of the motion data (HW9+ only). 
+	
+	Instead of an interrupt and a register read for each sample, the MPU 
+	stores the samples in its FIFO and the interrupt is raised every n 
+	samples to read them all at once.
+	
+	The burst readout is only used in modes acquiring the accelerometer and/or 
+	gyroscope without downsampling; other modes read each sample individually.
+	The setting takes effect at the next call to mpu_config_motionmode.
+	
+	Parameters:
+		n		-	Number of samples per burst; 0 or 1 to read each sample individually
+*******************************************************************************/
+void mpu_config_fifoburst(unsigned char n)
+{
+	_mpu_fifoburst = n>1?n:0;
+}
+/******************************************************************************
+	function: _mpu_fifoburst_start
+*******************************************************************************	
+	Activates the FIFO burst readout if requested and possible with the 
+	current sample mode. Must be called after the sample mode is configured
+	and before automatic read is enabled.
+	
+	Otherwise the MPU interrupt divider is set to the software divider of the
+	motion mode, so that no burst divider remains from a previous mode.
+	
+	Parameters:
+		softdiv	-	Software divider of the motion mode
+*******************************************************************************/
+void _mpu_fifoburst_start(unsigned char softdiv)
+{
+	#if HWVER==9
+	unsigned char layout,flags,n;
+	
+	__mpu_fifoburst_n=0;
+	layout = _mpu_data_getlayout(sample_mode);
+	if(_mpu_fifoburst==0 || layout==0 || (sample_mode&MPU_MODE_BM_LP) || softdiv)
+	{
+		init_timer_mpucapture(softdiv);
+		return;
+	}
+		
+	flags=0;
+	__mpu_fifoburst_fiforecsize=0;
+	if(layout&MPU_MODE_BM_A)
+	{
+		flags|=0b00001000;
+		__mpu_fifoburst_fiforecsize+=6;
+	}
+	if(layout&MPU_MODE_BM_G)
+	{
+		flags|=0b01110000;
+		__mpu_fifoburst_fiforecsize+=6;
+	}
+	// Keep half of the FIFO as margin for the interrupt latency
+	n = _mpu_fifoburst;
+	if(n>MPU_FIFO_SIZE/2/__mpu_fifoburst_fiforecsize)
+		n=MPU_FIFO_SIZE/2/__mpu_fifoburst_fiforecsize;
+	
+	// FIFO mode: when full, new samples are dropped so that the FIFO content remains aligned on samples
+	mpu_writereg(MPU_R_CONFIG,mpu_readreg(MPU_R_CONFIG)|0b01000000);
+	mpu_fifoenable(flags,1,1);
+	init_timer_mpucapture(n-1);
+	__mpu_fifoburst_tlast = timer_ms_get();
+	__mpu_fifoburst_n=n;
+	#endif
+}
+/******************************************************************************
+	function: _mpu_fifoburst_stop
+*******************************************************************************	
+	Deactivates the FIFO burst readout and restores an interrupt on every MPU
+	interrupt. Automatic read must be disabled.
+*******************************************************************************/
+void _mpu_fifoburst_stop(void)
+{
+	#if HWVER==9
+	if(__mpu_fifoburst_n)
+	{
+		__mpu_fifoburst_n=0;
+		mpu_fifoenable(0,0,1);
+		mpu_writereg(MPU_R_CONFIG,mpu_readreg(MPU_R_CONFIG)&0b10111111);
+		init_timer_mpucapture(0);
+	}
+	#endif
+}
+
 /******************************************************************************
 	__mpu_read_cb
 *******************************************************************************	
@@ -560,16 +951,17 @@ void __mpu_read_cb(void)
 		mpu_cnt_sample_errfull++;
 		return;
 	}*/	
-	// Discard oldest data and store new one
-	if(mpu_data_isfull())
+	// Discard oldest data and store new one, unless the oldest data is claimed by the consumer in which case the new data is discarded.
+	// The oldest data is only discarded once the new one is stored in the free entry at mpu_data_wrptr.
+	if(mpu_data_isfull() && mpu_data_claimed)
 	{
-		_mpu_data_rdnext();
 		mpu_cnt_sample_errfull++;
-		mpu_cnt_sample_succcess--;		// This plays with the increment of mpu_cnt_sample_succcess on the last line of this function; i.e. mpu_cnt_sample_succcess does not change.
+		return;
 	}
 	
-	// Pointer to memory structure
-	MPUMOTIONDATA *mdata = &mpu_data[mpu_data_wrptr];
+	// Pointer to memory structure: decode in place with the full layout, otherwise in a temporary structure which is then compacted
+	MPUMOTIONDATA mtmp;
+	MPUMOTIONDATA *mdata = mpu_data_layout?&mtmp:(MPUMOTIONDATA*)&mpu_data[mpu_data_wrptr*mpu_data_recsize];
 	
 	//__mpu_copy_spibuf_to_mpumotiondata_asm(_mpu_tmp_reg,mdata);		// Copy and conver the spi buffer to MPUMOTIONDATA
 	__mpu_copy_spibuf_to_mpumotiondata_magcor_asm(_mpu_tmp_reg,mdata);	// Copy and conver the spi buffer to MPUMOTIONDATA including changing the magnetic coordinate system (mx <= -my; my<= -mx)
@@ -602,7 +994,20 @@ void __mpu_read_cb(void)
 		mdata->ax=mdata->ay=mdata->az=0;
 	}		
 	
-
+	// Compact the sample; discard it if it cannot be stored
+	if(mpu_data_layout && _mpu_data_wrpack(mdata))
+	{
+		mpu_cnt_sample_errfull++;
+		return;
+	}
+	
+	// Discard the oldest data
+	if(mpu_data_isfull())
+	{
+		_mpu_data_rdnext();
+		mpu_cnt_sample_errfull++;
+		mpu_cnt_sample_succcess--;		// This plays with the increment of mpu_cnt_sample_succcess on the last line of this function; i.e. mpu_cnt_sample_succcess does not change.
+	}
 			
 	// Next buffer	
 	_mpu_data_wrnext();	
@@ -616,71 +1021,6 @@ void __mpu_read_cb(void)
 
 
 
-/******************************************************************************
-	function: mpu_data_isfull
-*******************************************************************************	
-	Returns 1 if the buffer is full, 0 otherwise.
-*******************************************************************************/
-unsigned char mpu_data_isfull(void)
-{
-	if( ((mpu_data_wrptr+1)&(MPU_MOTIONBUFFERSIZE-1)) == mpu_data_rdptr )
-		return 1;
-	return 0;
-}
-/*unsigned char mpu_data_isempty(void)
-{
-	if(mpu_data_rdptr==mpu_data_wrptr)
-		return 1;
-	return 0;
-}*/
-/******************************************************************************
-	function: mpu_data_level
-*******************************************************************************	
-	Returns how many samples are in the buffer, when automatic read is active.
-*******************************************************************************/
-unsigned char mpu_data_level(void)
-{
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		return (mpu_data_wrptr-mpu_data_rdptr)&(MPU_MOTIONBUFFERSIZE-1);
-	}
-	return 0;	// To avoid compiler warning
-}
-/******************************************************************************
-	function: mpu_data_getnext_raw
-*******************************************************************************	
-	Returns the next data in the buffer, when automatic read is active and data
-	is available.	
-	This function returns raw reads, without applying the calibration to take into 
-	account the accelerometer and gyroscope scale.
-	
-	This function removes the data from the automatic read buffer and the next call 
-	to this function will return the next available data.
-	
-	If no data is available, the function returns an error.
-	
-	Returns:
-		0	-	Success
-		1	-	Error (no data available in the buffer)
-*******************************************************************************/
-unsigned char mpu_data_getnext_raw(MPUMOTIONDATA &data)
-{
-	//return (mpu_data_wrptr-mpu_data_rdptr)&(MPU_MOTIONBUFFERSIZE-1);
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		// Check if buffer is empty
-		if(mpu_data_wrptr==mpu_data_rdptr)
-			return 1;
-		// Copy the data
-		//memcpy((void*)&data,(void*)&mpu_data[mpu_data_rdptr],sizeof(MPUMOTIONDATA));
-		data = *(MPUMOTIONDATA*)&mpu_data[mpu_data_rdptr];
-		//data = mpu_data[mpu_data_rdptr];
-		// Increment the read pointer
-		_mpu_data_rdnext();
-		return 0;
-	}
-	return 1;	// To avoid compiler warning
-}
 /******************************************************************************
 	function: mpu_data_getnext
 *******************************************************************************	
@@ -700,19 +1040,9 @@ unsigned char mpu_data_getnext_raw(MPUMOTIONDATA &data)
 *******************************************************************************/
 unsigned char mpu_data_getnext(MPUMOTIONDATA &data,MPUMOTIONGEOMETRY &geometry)
 {
-	//return (mpu_data_wrptr-mpu_data_rdptr)&(MPU_MOTIONBUFFERSIZE-1);
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-	{
-		// Check if buffer is empty
-		if(mpu_data_wrptr==mpu_data_rdptr)
-			return 1;
-		// Copy the data
-		//memcpy((void*)&data,(void*)&mpu_data[mpu_data_rdptr],sizeof(MPUMOTIONDATA));
-		data = *(MPUMOTIONDATA*)&mpu_data[mpu_data_rdptr];
-		//data = mpu_data[mpu_data_rdptr];
-		// Increment the read pointer
-		_mpu_data_rdnext();
-	}
+	// Get the data
+	if(mpu_data_getnext_raw(data))
+		return 1;
 	// Compute the geometry
 	mpu_compute_geometry(data,geometry);
 	
@@ -720,27 +1050,6 @@ unsigned char mpu_data_getnext(MPUMOTIONDATA &data,MPUMOTIONGEOMETRY &geometry)
 }
 
 
-/******************************************************************************
-	_mpu_data_wrnext
-*******************************************************************************	
-	Advances the write pointer. Do not call if the buffer is full.
-*******************************************************************************/
-void _mpu_data_wrnext(void)
-{
-	mpu_data_wrptr = (mpu_data_wrptr+1)&(MPU_MOTIONBUFFERSIZE-1);
-}
-/******************************************************************************
-	function: _mpu_data_rdnext
-*******************************************************************************	
-	Advances the read pointer to access the next sample in the data buffer
-	at index mpu_data_rdptr. 
-	Do not call if the buffer is empty.
-*******************************************************************************/
-void _mpu_data_rdnext(void)
-{
-	mpu_data_rdptr = (mpu_data_rdptr+1)&(MPU_MOTIONBUFFERSIZE-1);
-}
-
 /******************************************************************************
 *******************************************************************************
 ACC GYRO CONFIG   ACC GYRO CONFIG   ACC GYRO CONFIG   ACC GYRO CONFIG   ACC GYR
@@ -2024,7 +2333,7 @@ void _mpu_mag_mode(unsigned char mode,unsigned char magdiv)
 	{
 		case 0:
 			mpu_mag_writereg(0x0a,0b00010000);		// Power down, 16 bit
-			_mpu_mag_regshadow(0,0,0,0);			// Stop shadowing
+			_mpu_mag_regshadow(0,0,0,0);			// Stop shadowing
 			_mpu_mag_interfaceenable(0);			// Stop I2C interface
 			break;
 		case 1:
@@ -2346,7 +2655,7 @@ void mpu_mag_storecalib(void)
 {
 	for(unsigned char i=0;i<3;i++)
 	{
-		eeprom_write_byte((uint8_t*)(CONFIG_ADDR_MAG_BIASXL+i*2),_mpu_mag_bias[i]&0xff);
+		eeprom_write_byte((uint8_t*)CONFIG_ADDR_MAG_BIASXL+i*2,_mpu_mag_bias[i]&0xff);
 		eeprom_write_byte((uint8_t*)CONFIG_ADDR_MAG_BIASXL+i*2+1,(_mpu_mag_bias[i]>>8)&0xff);
 		
 		eeprom_write_byte((uint8_t*)CONFIG_ADDR_MAG_SENSXL+i*2,_mpu_mag_sens[i]&0xff);
@@ -2630,8 +2939,10 @@ void mpu_printstat(FILE *file)
 	fprintf_P(file,PSTR(" Samples: %lu\n"),mpu_cnt_sample_tot);
 	fprintf_P(file,PSTR(" Samples success: %lu\n"),mpu_cnt_sample_succcess);
 	fprintf_P(file,PSTR(" Errors: MPU I/O busy=%lu buffer=%lu\n"),mpu_cnt_sample_errbusy,mpu_cnt_sample_errfull);
-	fprintf_P(file,PSTR(" Buffer level: %u/%u\n"),mpu_data_level(),MPU_MOTIONBUFFERSIZE);
+	fprintf_P(file,PSTR(" Buffer level: %u/%u\n"),mpu_data_level(),mpu_data_capacity);
 	fprintf_P(file,PSTR(" Spurious ISR: %lu\n"),mpu_cnt_spurious);
+	if(__mpu_fifoburst_n)
+		fprintf_P(file,PSTR(" FIFO burst of %u samples: bursts=%lu overflow=%lu\n"),__mpu_fifoburst_n,mpu_cnt_fifo_burst,mpu_cnt_fifo_overflow);
 }
 
 
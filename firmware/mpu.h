@@ -95,6 +95,14 @@ typedef struct {
 #define MPU_R_I2C_SLV4_CTRL		52
 #define MPU_R_I2C_SLV4_DI 		53
 #define MPU_R_INT_STATUS		58
+#define MPU_R_FIFOCNTH			114
+#define MPU_R_FIFORW			116
+
+#define MPU_FIFO_SIZE			512
+// Maximum number of FIFO bytes read in one SPI transaction by the burst readout
+#define _MPU_FIFOBURST_XFER		32
+// Size of the asynchronous transfer: command, INT_STATUS, registers 59 to 79
+#define _MPU_ASYNC_XFER			23
 
 #define MPU_R_I2C_MST_CTRL		36
 #define MPU_R_I2C_MST_STATUS	54
@@ -217,15 +225,34 @@ void mpu_isr(void);
 
 // Data buffers
 // 32 buffers works on all cards which are U-1 or faster without data loss at 500Hz LBW and 500Hz HBW. Also works at 1KHz, although the effective sample rate is 800Hz.
+// MPU_MOTIONBUFFERSIZE is the number of samples held with the full MPUMOTIONDATA layout; modes without magnetometer store compacted records and hold more samples in the same memory.
 #define MPU_MOTIONBUFFERSIZE 64		
 //#define MPU_MOTIONBUFFERSIZE 32
 //#define MPU_MOTIONBUFFERSIZE 16
 //#define MPU_MOTIONBUFFERSIZE 8
 //#define MPU_MOTIONBUFFERSIZE 4
 //#define MPU_MOTIONBUFFERSIZE 128
-extern MPUMOTIONDATA mpu_data[];
+#define MPU_MOTIONBUFFERBYTES (MPU_MOTIONBUFFERSIZE*sizeof(MPUMOTIONDATA))
+// Compacted records: 2-byte header with the increments of time (bits 4-15, ms) and packetctr (bits 0-3) from the previous record
+#define MPU_DATA_RECHDR 2
+#define MPU_DATA_RECDTMAX 4095
+#define MPU_DATA_RECDCMAX 15
+// Number of records whose increments do not fit in the header that the buffer can hold
+#define MPU_DATA_NUMSYNC 4
+#define MPU_DATA_SYNCFREE 255
+typedef struct {
+	unsigned long time;
+	unsigned long packetctr;
+} MPUDATAREF;
+typedef struct {
+	unsigned char idx;
+	MPUDATAREF ref;
+} MPUDATASYNC;
+extern unsigned char mpu_data[];
 extern volatile unsigned long __mpu_data_packetctr_current;
 extern volatile unsigned char mpu_data_rdptr,mpu_data_wrptr;
+extern volatile unsigned char mpu_data_claimed;
+extern unsigned char mpu_data_layout,mpu_data_recsize,mpu_data_capacity;
 
 extern volatile MPUMOTIONDATA _mpumotiondata_test;
 
@@ -244,6 +271,11 @@ extern unsigned char _mpu_current_motionmode;
 // Automatic read statistic counters
 extern unsigned long mpu_cnt_int, mpu_cnt_sample_tot, mpu_cnt_sample_succcess, mpu_cnt_sample_errbusy, mpu_cnt_sample_errfull;
 extern unsigned long mpu_cnt_spurious;
+extern unsigned long mpu_cnt_fifo_burst, mpu_cnt_fifo_overflow;
+
+extern unsigned char _mpu_fifoburst;
+extern unsigned char __mpu_fifoburst_n;
+extern unsigned char __mpu_isr_async;
 
 extern unsigned char _mpu_kill;
 extern unsigned short _mpu_samplerate;
@@ -257,8 +289,22 @@ unsigned char mpu_data_isfull(void);
 unsigned char mpu_data_level(void);
 unsigned char mpu_data_getnext_raw(MPUMOTIONDATA &data);
 unsigned char mpu_data_getnext(MPUMOTIONDATA &data,MPUMOTIONGEOMETRY &geometry);
+unsigned char mpu_data_getspans(unsigned char **span1,unsigned char *n1,unsigned char **span2,unsigned char *n2,unsigned char max);
+void mpu_data_commit(unsigned char n);
+void mpu_data_unpack(const unsigned char *rec,MPUMOTIONDATA &data);
 void _mpu_data_wrnext(void);
 void _mpu_data_rdnext(void);
+unsigned char _mpu_data_getlayout(unsigned char mode);
+unsigned char _mpu_data_getrecsize(unsigned char layout);
+void _mpu_data_setlayout(unsigned char mode);
+const MPUDATAREF *_mpu_data_getsync(unsigned char idx);
+unsigned char *_mpu_data_wrhdr(unsigned long time,unsigned long packetctr);
+unsigned char _mpu_data_wrpack(const MPUMOTIONDATA *data);
+unsigned short _mpu_data_enchdr(MPUDATAREF &ref,unsigned long time,unsigned long packetctr);
+void _mpu_data_dechdr(unsigned short hdr,MPUDATAREF &ref,const MPUDATAREF *sync);
+void _mpu_data_packch(const MPUMOTIONDATA *data,unsigned char *p,unsigned char layout);
+unsigned char _mpu_data_pack(const MPUMOTIONDATA *data,unsigned char *rec,unsigned char layout,MPUDATAREF &ref);
+void _mpu_data_unpack(const unsigned char *rec,MPUMOTIONDATA &data,unsigned char layout,MPUDATAREF &ref,const MPUDATAREF *sync);
 
 void mpu_clearstat(void);
 void mpu_clearbuffer(void);
@@ -272,6 +318,13 @@ void mpu_mode_off(void);
 
 void _mpu_enableautoread(void);
 void _mpu_disableautoread(void);
+void mpu_config_fifoburst(unsigned char n);
+void _mpu_fifoburst_start(unsigned char softdiv);
+void _mpu_fifoburst_stop(void);
+void _mpu_isr_fifoburst(void);
+void mpu_config_asyncread(unsigned char async);
+void _mpu_isr_async(void);
+void __mpu_isr_async_cb(void);
 
 
 void mpu_init(void);
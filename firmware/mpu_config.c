@@ -277,6 +277,7 @@ void mpu_config_motionmode(unsigned char sensorsr,unsigned char autoread)
 
 	// Turn off MPU always
 	_mpu_disableautoread();
+	_mpu_fifoburst_stop();
 	mpu_mode_off();
 	
 		
@@ -343,7 +344,10 @@ void mpu_config_motionmode(unsigned char sensorsr,unsigned char autoread)
 	}
 	
 	if(autoread)
+	{
+		_mpu_fifoburst_start(config_sensorsr_settings[sensorsr][8]);
 		_mpu_enableautoread();
+	}
 	//printf("return from mpu_config_motionmode\n");
 	
 	// Initialise Madgwick
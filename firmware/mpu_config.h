@@ -86,6 +86,7 @@
 
 
 extern PGM_P const mc_options[];
+extern const short config_sensorsr_settings[MOTIONCONFIG_NUM][12];
 void mpu_config_motionmode(unsigned char sensorsr,unsigned char autoread);
 unsigned char mpu_get_motionmode(unsigned char *autoread);
 void mpu_getmodename(unsigned char motionmode,char *buffer);
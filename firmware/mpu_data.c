@@ -0,0 +1,539 @@
+#include <util/atomic.h>
+#include <string.h>
+
+#include "mpu.h"
+#include "mpu_config.h"
+
+/*
+	File: mpu_data
+
+	Motion data buffer filled by the MPU automatic read.
+
+	The buffer holds MPU_MOTIONBUFFERBYTES bytes. In modes acquiring the magnetometer (or computing the orientation) each sample is stored
+	as a full MPUMOTIONDATA. In modes acquiring only the accelerometer and/or gyroscope each sample is stored as a compacted record
+	containing a 2-byte header followed by the enabled channels.
+
+	The header holds the increments of time (bits 4-15, 0-4095 ms) and packetctr (bits 0-3, 1-15) from the previous record, so
+	that time and packetctr are reconstructed by reading the records in order. A record whose increments do not fit (first record,
+	sample rate lower than 0.25Hz, or more than 14 consecutive samples lost) has a header of 0: its absolute time and packetctr are kept
+	in one of MPU_DATA_NUMSYNC sync entries until the record is removed from the buffer. If no sync entry is free the sample is discarded.
+
+	Capacities: acc-only and gyro-only modes hold 232 samples (8-byte records) and acc+gyro modes hold 132 samples (14-byte records)
+	instead of 64. The channels not stored (including the temperature) are returned as 0. The layout is selected from sample_mode when
+	automatic read is enabled.
+
+	This module has no hardware dependency.
+*/
+
+// Data buffers
+unsigned char mpu_data[MPU_MOTIONBUFFERBYTES];
+volatile unsigned char mpu_data_rdptr,mpu_data_wrptr;
+volatile unsigned char mpu_data_claimed;				// Number of samples claimed by mpu_data_getspans and not yet released
+unsigned char mpu_data_layout=0;						// 0: full MPUMOTIONDATA; otherwise MPU_MODE_BM_A and/or MPU_MODE_BM_G channels stored after the header
+unsigned char mpu_data_recsize=sizeof(MPUMOTIONDATA);	// Size of a record in mpu_data
+unsigned char mpu_data_capacity=MPU_MOTIONBUFFERSIZE;	// Number of records in mpu_data
+
+// Compacted records
+MPUDATAREF _mpu_data_wrref;								// Time and packetctr of the last record written
+MPUDATAREF _mpu_data_rdref;								// Time and packetctr of the last record removed
+MPUDATAREF _mpu_data_cursor;							// Time and packetctr of the last record converted by mpu_data_unpack
+MPUDATASYNC _mpu_data_sync[MPU_DATA_NUMSYNC];			// Absolute time and packetctr of the records with a header of 0
+
+/******************************************************************************
+	function: mpu_clearbuffer
+*******************************************************************************
+	Clears all sensor data held in the MPU buffers.
+
+	Parameters:
+		-
+
+	Returns:
+		-
+*******************************************************************************/
+void mpu_clearbuffer(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		mpu_data_rdptr=mpu_data_wrptr=0;
+		mpu_data_claimed=0;
+		_mpu_data_wrref.time=_mpu_data_wrref.packetctr=0;
+		_mpu_data_rdref=_mpu_data_cursor=_mpu_data_wrref;
+		for(unsigned char i=0;i<MPU_DATA_NUMSYNC;i++)
+			_mpu_data_sync[i].idx=MPU_DATA_SYNCFREE;
+	}
+}
+/******************************************************************************
+	function: mpu_data_isfull
+*******************************************************************************
+	Returns 1 if the buffer is full, 0 otherwise.
+*******************************************************************************/
+unsigned char mpu_data_isfull(void)
+{
+	unsigned char wr = mpu_data_wrptr+1;
+	if(wr==mpu_data_capacity)
+		wr=0;
+	if(wr == mpu_data_rdptr)
+		return 1;
+	return 0;
+}
+/*unsigned char mpu_data_isempty(void)
+{
+	if(mpu_data_rdptr==mpu_data_wrptr)
+		return 1;
+	return 0;
+}*/
+/******************************************************************************
+	function: mpu_data_level
+*******************************************************************************
+	Returns how many samples are in the buffer, when automatic read is active.
+*******************************************************************************/
+unsigned char mpu_data_level(void)
+{
+	unsigned char rd,wr;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		rd=mpu_data_rdptr;
+		wr=mpu_data_wrptr;
+	}
+	if(wr>=rd)
+		return wr-rd;
+	return mpu_data_capacity-rd+wr;
+}
+/******************************************************************************
+	function: mpu_data_getnext_raw
+*******************************************************************************
+	Returns the next data in the buffer, when automatic read is active and data
+	is available.
+	This function returns raw reads, without applying the calibration to take into
+	account the accelerometer and gyroscope scale.
+
+	This function removes the data from the automatic read buffer and the next call
+	to this function will return the next available data.
+
+	If no data is available, the function returns an error.
+
+	Returns:
+		0	-	Success
+		1	-	Error (no data available in the buffer)
+*******************************************************************************/
+unsigned char mpu_data_getnext_raw(MPUMOTIONDATA &data)
+{
+	//return (mpu_data_wrptr-mpu_data_rdptr)&(MPU_MOTIONBUFFERSIZE-1);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Check if buffer is empty
+		if(mpu_data_wrptr==mpu_data_rdptr)
+			return 1;
+		// Copy the data
+		MPUDATAREF ref=_mpu_data_rdref;
+		_mpu_data_unpack(&mpu_data[mpu_data_rdptr*mpu_data_recsize],data,mpu_data_layout,ref,_mpu_data_getsync(mpu_data_rdptr));
+		// Increment the read pointer
+		_mpu_data_rdnext();
+		return 0;
+	}
+	return 1;	// To avoid compiler warning
+}
+/******************************************************************************
+	function: mpu_data_getspans
+*******************************************************************************
+	Returns the pending samples in the buffer as at most two contiguous spans,
+	when automatic read is active.
+
+	The first span starts at the oldest sample; the second span is only non-empty
+	when the pending samples wrap around the end of the buffer.
+	The spans contain records of mpu_data_recsize bytes which must be converted
+	with mpu_data_unpack, in order starting with the first record of the first span.
+
+	The read and write pointers are sampled in a single critical section: the
+	samples can then be processed without disabling interrupts for each sample.
+	The samples remain in the buffer until released with mpu_data_commit.
+	While samples are claimed the interrupt routine does not discard the oldest
+	samples when the buffer is full, but discards the new sample instead (counted
+	in mpu_cnt_sample_errfull).
+
+	This function returns raw reads; the geometry can be computed with
+	mpu_compute_geometry.
+
+	Parameters:
+		span1	-	Pointer to a pointer receiving the start of the first span
+		n1		-	Pointer to a variable receiving the number of samples in the first span
+		span2	-	Pointer to a pointer receiving the start of the second span
+		n2		-	Pointer to a variable receiving the number of samples in the second span
+		max		-	Maximum number of samples to claim
+
+	Returns:
+		Total number of samples claimed (n1+n2)
+*******************************************************************************/
+unsigned char mpu_data_getspans(unsigned char **span1,unsigned char *n1,unsigned char **span2,unsigned char *n2,unsigned char max)
+{
+	unsigned char rd,wr,n;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		rd = mpu_data_rdptr;
+		wr = mpu_data_wrptr;
+		if(wr>=rd)
+			n = wr-rd;
+		else
+			n = mpu_data_capacity-rd+wr;
+		if(n>max)
+			n=max;
+		mpu_data_claimed=n;
+		_mpu_data_cursor=_mpu_data_rdref;
+	}
+	*span1 = &mpu_data[rd*mpu_data_recsize];
+	*span2 = &mpu_data[0];
+	if(n<=mpu_data_capacity-rd)
+	{
+		*n1=n;
+		*n2=0;
+	}
+	else
+	{
+		*n1=mpu_data_capacity-rd;
+		*n2=n-*n1;
+	}
+	return n;
+}
+/******************************************************************************
+	function: mpu_data_commit
+*******************************************************************************
+	Releases samples claimed with mpu_data_getspans, removing them from the buffer.
+
+	Parameters:
+		n		-	Number of samples to release, at most the number claimed
+*******************************************************************************/
+void mpu_data_commit(unsigned char n)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		while(n--)
+			_mpu_data_rdnext();
+		mpu_data_claimed=0;
+	}
+}
+/******************************************************************************
+	function: mpu_data_unpack
+*******************************************************************************
+	Converts a record of the motion data buffer, as returned by mpu_data_getspans,
+	into MPUMOTIONDATA according to the current buffer layout.
+	Channels which are not stored in the current layout are set to 0.
+
+	The records must be converted in order, each record once, starting with the
+	first record of the first span: the time and packetctr of compacted records
+	are relative to the previous record.
+
+	Parameters:
+		rec		-	Pointer to the record
+		data	-	Structure receiving the sample
+*******************************************************************************/
+void mpu_data_unpack(const unsigned char *rec,MPUMOTIONDATA &data)
+{
+	const MPUDATAREF *sync=0;
+
+	if(mpu_data_layout && *(const unsigned short*)rec==0)
+		sync=_mpu_data_getsync((rec-mpu_data)/mpu_data_recsize);
+	_mpu_data_unpack(rec,data,mpu_data_layout,_mpu_data_cursor,sync);
+}
+
+/******************************************************************************
+	_mpu_data_wrnext
+*******************************************************************************
+	Advances the write pointer. Do not call if the buffer is full.
+*******************************************************************************/
+void _mpu_data_wrnext(void)
+{
+	unsigned char wr = mpu_data_wrptr+1;
+	if(wr==mpu_data_capacity)
+		wr=0;
+	mpu_data_wrptr = wr;
+}
+/******************************************************************************
+	function: _mpu_data_rdnext
+*******************************************************************************
+	Advances the read pointer to access the next sample in the data buffer
+	at index mpu_data_rdptr.
+	Do not call if the buffer is empty.
+
+	With compacted records the time and packetctr of the removed record become
+	the reference of the next one, and its sync entry, if any, is released.
+*******************************************************************************/
+void _mpu_data_rdnext(void)
+{
+	unsigned char rd = mpu_data_rdptr;
+
+	if(mpu_data_layout)
+	{
+		unsigned short hdr = *(unsigned short*)&mpu_data[rd*mpu_data_recsize];
+		if(hdr)
+			_mpu_data_dechdr(hdr,_mpu_data_rdref,0);
+		else
+		{
+			for(unsigned char i=0;i<MPU_DATA_NUMSYNC;i++)
+			{
+				if(_mpu_data_sync[i].idx==rd)
+				{
+					_mpu_data_rdref=_mpu_data_sync[i].ref;
+					_mpu_data_sync[i].idx=MPU_DATA_SYNCFREE;
+					break;
+				}
+			}
+		}
+	}
+	rd++;
+	if(rd==mpu_data_capacity)
+		rd=0;
+	mpu_data_rdptr = rd;
+}
+/******************************************************************************
+	function: _mpu_data_getsync
+*******************************************************************************
+	Returns the absolute time and packetctr of the record idx if it has a sync
+	entry, 0 otherwise.
+*******************************************************************************/
+const MPUDATAREF *_mpu_data_getsync(unsigned char idx)
+{
+	for(unsigned char i=0;i<MPU_DATA_NUMSYNC;i++)
+		if(_mpu_data_sync[i].idx==idx)
+			return &_mpu_data_sync[i].ref;
+	return 0;
+}
+/******************************************************************************
+	function: _mpu_data_wrhdr
+*******************************************************************************
+	Writes the header of the compacted record at mpu_data_wrptr for a sample with
+	the given time and packetctr, using a sync entry if the increments from the
+	previous record do not fit in the header.
+
+	The record must then be completed with the channels and the write pointer
+	advanced with _mpu_data_wrnext.
+	Must only be called by the producer with a compacted layout.
+
+	Parameters:
+		time		-	Time of the sample
+		packetctr	-	Packet counter of the sample
+
+	Returns:
+		0			-	No sync entry is free: the sample must be discarded
+		nonzero		-	Pointer where to store the channels of the record
+*******************************************************************************/
+unsigned char *_mpu_data_wrhdr(unsigned long time,unsigned long packetctr)
+{
+	unsigned char *rec = &mpu_data[mpu_data_wrptr*mpu_data_recsize];
+	MPUDATAREF ref = _mpu_data_wrref;
+	unsigned short hdr = _mpu_data_enchdr(ref,time,packetctr);
+
+	if(!hdr)
+	{
+		unsigned char i;
+		for(i=0;i<MPU_DATA_NUMSYNC;i++)
+			if(_mpu_data_sync[i].idx==MPU_DATA_SYNCFREE)
+				break;
+		if(i==MPU_DATA_NUMSYNC)
+			return 0;
+		_mpu_data_sync[i].ref=ref;
+		_mpu_data_sync[i].idx=mpu_data_wrptr;
+	}
+	_mpu_data_wrref=ref;
+	*(unsigned short*)rec=hdr;
+	return rec+MPU_DATA_RECHDR;
+}
+/******************************************************************************
+	function: _mpu_data_wrpack
+*******************************************************************************
+	Stores a sample as a compacted record at mpu_data_wrptr. The write pointer
+	must then be advanced with _mpu_data_wrnext.
+	Must only be called by the producer with a compacted layout.
+
+	Returns:
+		0	-	Success
+		1	-	No sync entry is free: the sample must be discarded
+*******************************************************************************/
+unsigned char _mpu_data_wrpack(const MPUMOTIONDATA *data)
+{
+	unsigned char *p = _mpu_data_wrhdr(data->time,data->packetctr);
+	if(!p)
+		return 1;
+	_mpu_data_packch(data,p,mpu_data_layout);
+	return 0;
+}
+/******************************************************************************
+	function: _mpu_data_getlayout
+*******************************************************************************
+	Returns the buffer layout suitable for a sample mode.
+
+	Modes acquiring the magnetometer or computing the orientation use the full
+	MPUMOTIONDATA layout. Other modes only store the accelerometer and/or
+	gyroscope.
+
+	Parameters:
+		mode	-	Sample mode (MPU_MODE_xxx)
+
+	Returns:
+		0			-	Full MPUMOTIONDATA layout
+		otherwise	-	Bitmask of MPU_MODE_BM_A and MPU_MODE_BM_G indicating the channels stored
+*******************************************************************************/
+unsigned char _mpu_data_getlayout(unsigned char mode)
+{
+	if(mode&(MPU_MODE_BM_M|MPU_MODE_BM_Q|MPU_MODE_BM_E|MPU_MODE_BM_DBG|MPU_MODE_BM_QDBG))
+		return 0;
+	mode&=(MPU_MODE_BM_A|MPU_MODE_BM_G);
+	return mode;
+}
+/******************************************************************************
+	function: _mpu_data_getrecsize
+*******************************************************************************
+	Returns the size in bytes of a record with the given layout.
+*******************************************************************************/
+unsigned char _mpu_data_getrecsize(unsigned char layout)
+{
+	unsigned char size;
+
+	if(!layout)
+		return sizeof(MPUMOTIONDATA);
+	size=MPU_DATA_RECHDR;
+	if(layout&MPU_MODE_BM_A)
+		size+=6;
+	if(layout&MPU_MODE_BM_G)
+		size+=6;
+	return size;
+}
+/******************************************************************************
+	function: _mpu_data_setlayout
+*******************************************************************************
+	Selects the buffer layout for a sample mode and clears the buffer.
+	Must only be called when automatic read is disabled.
+
+	Parameters:
+		mode	-	Sample mode (MPU_MODE_xxx)
+*******************************************************************************/
+void _mpu_data_setlayout(unsigned char mode)
+{
+	unsigned short capacity;
+
+	mpu_data_layout = _mpu_data_getlayout(mode);
+	mpu_data_recsize = _mpu_data_getrecsize(mpu_data_layout);
+	// The read/write pointers are 8-bit and 255 marks free sync entries
+	capacity = MPU_MOTIONBUFFERBYTES/mpu_data_recsize;
+	if(capacity>255)
+		capacity=255;
+	mpu_data_capacity = capacity;
+	mpu_clearbuffer();
+}
+/******************************************************************************
+	function: _mpu_data_enchdr
+*******************************************************************************
+	Returns the header of a compacted record with the given time and packetctr,
+	and updates the reference to the record.
+
+	Parameters:
+		ref			-	Time and packetctr of the previous record
+		time		-	Time of the record
+		packetctr	-	Packet counter of the record
+
+	Returns:
+		0			-	The increments do not fit: the record needs a sync entry
+		nonzero		-	Header
+*******************************************************************************/
+unsigned short _mpu_data_enchdr(MPUDATAREF &ref,unsigned long time,unsigned long packetctr)
+{
+	unsigned long dt = time-ref.time;
+	unsigned long dc = packetctr-ref.packetctr;
+
+	ref.time=time;
+	ref.packetctr=packetctr;
+	if(dc==0 || dc>MPU_DATA_RECDCMAX || dt>MPU_DATA_RECDTMAX)
+		return 0;
+	return (unsigned short)(dt<<4)|(unsigned short)dc;
+}
+/******************************************************************************
+	function: _mpu_data_dechdr
+*******************************************************************************
+	Updates the reference with the header of a compacted record.
+
+	Parameters:
+		hdr			-	Header of the record
+		ref			-	Time and packetctr of the previous record, updated to the record
+		sync		-	Absolute time and packetctr used if the header is 0
+*******************************************************************************/
+void _mpu_data_dechdr(unsigned short hdr,MPUDATAREF &ref,const MPUDATAREF *sync)
+{
+	if(hdr)
+	{
+		ref.time+=hdr>>4;
+		ref.packetctr+=hdr&MPU_DATA_RECDCMAX;
+	}
+	else if(sync)
+		ref=*sync;
+}
+/******************************************************************************
+	function: _mpu_data_packch
+*******************************************************************************
+	Stores the accelerometer and/or gyroscope of a sample as indicated by layout.
+*******************************************************************************/
+void _mpu_data_packch(const MPUMOTIONDATA *data,unsigned char *p,unsigned char layout)
+{
+	if(layout&MPU_MODE_BM_A)
+	{
+		memcpy(p,(const void*)&data->ax,6);
+		p+=6;
+	}
+	if(layout&MPU_MODE_BM_G)
+		memcpy(p,(const void*)&data->gx,6);
+}
+/******************************************************************************
+	function: _mpu_data_pack
+*******************************************************************************
+	Stores a sample as a compacted record: header followed by the accelerometer
+	and/or gyroscope as indicated by layout.
+
+	Parameters:
+		data	-	Sample to compact
+		rec		-	Pointer to the record
+		layout	-	Layout of the record; must be non-zero
+		ref		-	Time and packetctr of the previous record, updated to the sample
+
+	Returns:
+		0		-	Success
+		1		-	The header is 0: the caller must keep the absolute time and packetctr (sync)
+*******************************************************************************/
+unsigned char _mpu_data_pack(const MPUMOTIONDATA *data,unsigned char *rec,unsigned char layout,MPUDATAREF &ref)
+{
+	unsigned short hdr = _mpu_data_enchdr(ref,data->time,data->packetctr);
+	*(unsigned short*)rec=hdr;
+	_mpu_data_packch(data,rec+MPU_DATA_RECHDR,layout);
+	return hdr?0:1;
+}
+/******************************************************************************
+	function: _mpu_data_unpack
+*******************************************************************************
+	Converts a record with the given layout into MPUMOTIONDATA.
+	Channels which are not stored in the layout are set to 0.
+
+	Parameters:
+		rec		-	Pointer to the record
+		data	-	Structure receiving the sample
+		layout	-	Layout of the record
+		ref		-	Time and packetctr of the previous record, updated to the record; unused with the full layout
+		sync	-	Absolute time and packetctr of the record if its header is 0
+*******************************************************************************/
+void _mpu_data_unpack(const unsigned char *rec,MPUMOTIONDATA &data,unsigned char layout,MPUDATAREF &ref,const MPUDATAREF *sync)
+{
+	if(!layout)
+	{
+		data = *(MPUMOTIONDATA*)rec;
+		return;
+	}
+	memset((void*)&data,0,sizeof(MPUMOTIONDATA));
+	_mpu_data_dechdr(*(const unsigned short*)rec,ref,sync);
+	data.time=ref.time;
+	data.packetctr=ref.packetctr;
+	rec+=MPU_DATA_RECHDR;
+	if(layout&MPU_MODE_BM_A)
+	{
+		memcpy((void*)&data.ax,rec,6);
+		rec+=6;
+	}
+	if(layout&MPU_MODE_BM_G)
+		memcpy((void*)&data.gx,rec,6);
+}
@@ -5,6 +5,7 @@
 #include "MadgwickAHRS.h"
 #include "wait.h"
 #include "main.h"
+#include "prof.h"
 
 #define MPU_GEOMETRY_BENCH	1
 
@@ -45,6 +46,7 @@ void mpu_quaternion_to_aerospace(float &yaw,float &pitch, float &roll)
 
 void mpu_compute_geometry(MPUMOTIONDATA &mpumotiondata,MPUMOTIONGEOMETRY &mpumotiongeometry)
 {
+	PROF_START(PROF_GEOM);
 	// Compute the quaternions if in a quaternion mode
 	
 	
@@ -206,7 +208,7 @@ void mpu_compute_geometry(MPUMOTIONDATA &mpumotiondata,MPUMOTIONGEOMETRY &mpumot
 		//fprintf(file_pri,"%f %f %f %f:  yaw: %f pitch %f roll: %f\n",_mpu_q0,_mpu_q1,_mpu_q2,_mpu_q3,yaw,pitch,t2);
 		//fprintf(file_pri,"alpha: %f x %f y %f z %f\n",mpumotiongeometry.alpha,mpumotiongeometry.x,mpumotiongeometry.y,mpumotiongeometry.z);
 	}
-	
+	PROF_STOP(PROF_GEOM);
 }
 
 unsigned long mpu_compute_geometry_time(void)
@@ -347,7 +347,7 @@ void packet_addchecksum_fletcher16_little(PACKET *packet)
 {
    // Round up to the next byte
    packet_end(packet);
-   unsigned short check = packet_fletcher16(packet->data,packet_size(packet));
+   unsigned short check = packet_fletcher16_asm(packet->data,packet_size(packet));
    packet_add16_little(packet,check);
 }
 /*
@@ -382,6 +382,9 @@ unsigned short packet_CheckSum(unsigned char *ptr,unsigned n)
 
 /*
   Fletcher's 16-bit checksum
+  
+  Reference implementation. packet_fletcher16_asm (helper_num.S) returns the same checksum with 
+  a loop unrolled 4 times; FLETCHER16 computes it incrementally as bytes are appended.
 */
 unsigned short packet_fletcher16(unsigned char *data, int len )
 {
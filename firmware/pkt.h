@@ -38,7 +38,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #define __PKT_NEWLITTLE
 
-#define __PKT_DATA_MAXSIZE 64
+// Large enough for DXZ blocks of several samples with magnetometer and quaternions (see stream_sample_z)
+#define __PKT_DATA_MAXSIZE 128
 
 typedef struct
 {
@@ -49,6 +50,34 @@ typedef struct
 
 } PACKET;
 
+/*
+	Incremental Fletcher-16: the checksum is folded in as bytes are appended, giving the
+	same result as packet_fletcher16 over the same bytes.
+	The sums are kept modulo 255 in the range 1..255 with an end-around carry.
+*/
+typedef struct
+{
+	unsigned char sum1,sum2;
+} FLETCHER16;
+
+inline void fletcher16_init(FLETCHER16 *f)
+{
+	f->sum1=0xff;
+	f->sum2=0xff;
+}
+inline void fletcher16_add8(FLETCHER16 *f,unsigned char data)
+{
+	unsigned short s;
+	s = f->sum1+data;
+	f->sum1 = s+(s>>8);
+	s = f->sum2+f->sum1;
+	f->sum2 = s+(s>>8);
+}
+inline unsigned short fletcher16_get(FLETCHER16 *f)
+{
+	return (f->sum1<<8)|f->sum2;
+}
+
 void packet_init(PACKET *packet,const char *hdr,unsigned char hdrsize);
 void packet_init_old(PACKET *packet);
 void packet_reset(PACKET *packet);
@@ -67,6 +96,7 @@ void packet_addchecksum_fletcher16_little(PACKET *packet);
 unsigned short packet_size(PACKET *packet);
 unsigned short packet_CheckSum(unsigned char *ptr,unsigned n);
 unsigned short packet_fletcher16(unsigned char *data, int len );
+extern "C" unsigned short packet_fletcher16_asm(unsigned char *data,unsigned short len);
 
 
 #endif // PKT_H
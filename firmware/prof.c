@@ -0,0 +1,262 @@
+#include "cpu.h"
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wait.h"
+#include "helper.h"
+#include "serial.h"
+#include "pkt.h"
+#include "prof.h"
+
+/*
+	File: prof
+
+	Profiling of the motion pipeline.
+
+	Probes measure the duration between a call to PROF_START and PROF_STOP in
+	timer ticks, i.e. CPU clock cycles, using the counter of the 1024Hz timer
+	(WAIT_TCNT) and the number of 1024Hz periods elapsed (_timer_time_1024hz_ctr).
+	For each probe the number of measurements, the minimum, maximum, mean and a
+	histogram of the durations are kept.
+
+	Probes in the main loop are interrupted by the ISRs, whose duration is included
+	in the measurement.
+
+	Each probe must only be started and stopped from the same context (either an
+	interrupt or the main loop), and must not be nested with itself.
+
+	The probes are only compiled with PROF_ENABLE=1; they are then disabled by
+	default, use prof_enable to enable them.
+	
+	The sums of the durations are 32-bit. When a sum would overflow, the sum and
+	the number of measurements it holds are halved, so that the mean remains that
+	of the recent measurements. At 11.0592MHz this happens after 388s of
+	cumulated duration.
+*/
+
+unsigned char prof_enabled=0;
+PROFTICK _prof_t0[PROF_NUM];
+PROFPROBE _prof_probe[PROF_NUM];
+unsigned short _prof_top;
+
+const char _prof_name_isr[] PROGMEM = "ISR";
+const char _prof_name_spi[] PROGMEM = "SPI read";
+const char _prof_name_mag[] PROGMEM = "Mag correction";
+const char _prof_name_geom[] PROGMEM = "Geometry";
+const char _prof_name_pkt[] PROGMEM = "Packet build";
+const char _prof_name_sdwrite[] PROGMEM = "SD write";
+const char _prof_name_sdwait[] PROGMEM = "SD wait";
+PGM_P const _prof_name[PROF_NUM] PROGMEM = {_prof_name_isr,_prof_name_spi,_prof_name_mag,_prof_name_geom,_prof_name_pkt,_prof_name_sdwrite,_prof_name_sdwait};
+
+// Width of the histogram bins in timer ticks
+const unsigned short _prof_histwidth[PROF_NUM] PROGMEM = {500,500,100,4000,250,4000,8000};
+
+/******************************************************************************
+	function: prof_enable
+*******************************************************************************
+	Enables or disables the profiling probes. Enabling clears the statistics.
+
+	Parameters:
+		en	-	1 to enable, 0 to disable
+******************************************************************************/
+void prof_enable(unsigned char en)
+{
+	if(en)
+		prof_clear();
+	prof_enabled=en?1:0;
+}
+/******************************************************************************
+	function: prof_clear
+*******************************************************************************
+	Clears the statistics of all the probes.
+******************************************************************************/
+void prof_clear(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		memset(_prof_probe,0,sizeof(_prof_probe));
+		for(unsigned char i=0;i<PROF_NUM;i++)
+			_prof_probe[i].min=0xffffffff;
+		_prof_top = OCR3A+1;
+	}
+}
+/******************************************************************************
+	function: _prof_gettick
+*******************************************************************************
+	Returns the current time in timer ticks.
+
+	When called with interrupts disabled the 1024Hz timer interrupt may be
+	pending; in this case the counter has wrapped but _timer_time_1024hz_ctr is
+	not yet incremented.
+******************************************************************************/
+void _prof_gettick(PROFTICK *t)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		t->t = WAIT_TCNT;
+		t->c = _timer_time_1024hz_ctr;
+		if((WAIT_TIFR&(1<<OCF3A)) && t->t<(_prof_top>>1))
+			t->c++;
+	}
+}
+/******************************************************************************
+	function: _prof_start
+*******************************************************************************
+	Starts a measurement. Use the macro PROF_START instead.
+******************************************************************************/
+void _prof_start(unsigned char p)
+{
+	_prof_gettick(&_prof_t0[p]);
+}
+/******************************************************************************
+	function: _prof_stop
+*******************************************************************************
+	Ends a measurement started by _prof_start and updates the statistics of the
+	probe. Use the macro PROF_STOP instead.
+******************************************************************************/
+void _prof_stop(unsigned char p)
+{
+	PROFTICK t1;
+	unsigned long d;
+	PROFPROBE *probe = &_prof_probe[p];
+
+	_prof_gettick(&t1);
+	d = (unsigned long)(unsigned short)(t1.c-_prof_t0[p].c)*_prof_top+t1.t-_prof_t0[p].t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		probe->n++;
+		if(probe->sum+d<probe->sum)
+		{
+			probe->sum>>=1;
+			probe->nsum>>=1;
+		}
+		probe->sum+=d;
+		probe->nsum++;
+		if(d<probe->min)
+			probe->min=d;
+		if(d>probe->max)
+			probe->max=d;
+		hist_insert(probe->hist,PROF_HISTNUM,pgm_read_word(&_prof_histwidth[p]),d>0xffff?0xffff:d);
+	}
+}
+/******************************************************************************
+	function: prof_getprobe
+*******************************************************************************
+	Returns a copy of the statistics of a probe.
+******************************************************************************/
+void prof_getprobe(unsigned char p,PROFPROBE *probe)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*probe = _prof_probe[p];
+	}
+}
+/******************************************************************************
+	function: _prof_tick2us
+*******************************************************************************
+	Converts timer ticks to microseconds.
+******************************************************************************/
+unsigned long _prof_tick2us(unsigned long t)
+{
+	return t/(F_CPU/1000000l);
+}
+/******************************************************************************
+	function: prof_print
+*******************************************************************************
+	Prints the statistics of all the probes.
+
+	Parameters:
+		f	-	Output stream
+******************************************************************************/
+void prof_print(FILE *f)
+{
+	PROFPROBE probe;
+	unsigned long mean;
+
+	#if PROF_ENABLE==0
+	fprintf_P(f,PSTR("Profiling probes not compiled (PROF_ENABLE=0)\n"));
+	#endif
+	fprintf_P(f,PSTR("Profiling %s. Durations in timer ticks (%lu ticks/ms); histogram bins of width w\n"),prof_enabled?"on":"off",F_CPU/1000l);
+	for(unsigned char p=0;p<PROF_NUM;p++)
+	{
+		prof_getprobe(p,&probe);
+		fprintf_P(f,PSTR(" %-14S: n=%lu"),(PGM_P)pgm_read_word(&_prof_name[p]),probe.n);
+		if(probe.n)
+		{
+			mean = probe.sum/probe.nsum;
+			fprintf_P(f,PSTR(" min=%lu mean=%lu max=%lu (%lu/%lu/%lu us)"),probe.min,mean,probe.max,_prof_tick2us(probe.min),_prof_tick2us(mean),_prof_tick2us(probe.max));
+		}
+		fprintf_P(f,PSTR("\n  w=%u:"),pgm_read_word(&_prof_histwidth[p]));
+		for(unsigned char i=0;i<PROF_HISTNUM;i++)
+			fprintf_P(f,PSTR(" %lu"),probe.hist[i]);
+		fputc('\n',f);
+	}
+}
+/******************************************************************************
+	function: prof_printbin
+*******************************************************************************
+	Sends the statistics of all the probes as binary packets, one per probe.
+
+	Packet format (little endian, byte aligned):
+		'D' 'P' 'P'
+		probe		-	8 bits
+		n			-	32 bits
+		min			-	32 bits (0 if n=0)
+		mean		-	32 bits
+		max			-	32 bits
+		histwidth	-	16 bits
+		hist		-	PROF_HISTNUM x 32 bits
+		checksum	-	16 bits, Fletcher-16 of all preceding bytes
+
+	Parameters:
+		f	-	Output stream
+******************************************************************************/
+void prof_printbin(FILE *f)
+{
+	PROFPROBE probe;
+	unsigned char buffer[3+1+4*4+2+PROF_HISTNUM*4+2];
+	unsigned char *p;
+	unsigned long v[4+PROF_HISTNUM];
+	FLETCHER16 c;
+	unsigned short check;
+
+	for(unsigned char pi=0;pi<PROF_NUM;pi++)
+	{
+		prof_getprobe(pi,&probe);
+		v[0]=probe.n;
+		v[1]=probe.n?probe.min:0;
+		v[2]=probe.n?probe.sum/probe.nsum:0;
+		v[3]=probe.max;
+		memcpy(&v[4],probe.hist,sizeof(probe.hist));
+
+		p=buffer;
+		*p++='D';
+		*p++='P';
+		*p++='P';
+		*p++=pi;
+		for(unsigned char i=0;i<4+PROF_HISTNUM;i++)
+		{
+			if(i==4)
+			{
+				unsigned short w = pgm_read_word(&_prof_histwidth[pi]);
+				*p++=w;
+				*p++=w>>8;
+			}
+			*p++=v[i];
+			*p++=v[i]>>8;
+			*p++=v[i]>>16;
+			*p++=v[i]>>24;
+		}
+		fletcher16_init(&c);
+		for(unsigned char *q=buffer;q<p;q++)
+			fletcher16_add8(&c,*q);
+		check = fletcher16_get(&c);
+		*p++=check;
+		*p++=check>>8;
+		fputbuf(f,(char*)buffer,p-buffer);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef __PROF_H
+#define __PROF_H
+
+#include <stdio.h>
+
+// Set to 1 (e.g. -DPROF_ENABLE=1) to compile the profiling probes in the firmware
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 0
+#endif
+
+// Probe points
+#define PROF_ISR		0			// mpu_isr, from entry to exit
+#define PROF_SPI		1			// MPU data read in mpu_isr
+#define PROF_MAG		2			// Magnetometer correction in mpu_isr
+#define PROF_GEOM		3			// mpu_compute_geometry
+#define PROF_PKT		4			// Binary packet build
+#define PROF_SDWRITE	5			// sd_streamcache_write, sd_streamcache_reserve and sd_streamcache_commit
+#define PROF_SDWAIT		6			// sd_streamcache_write or sd_streamcache_reserve blocked on a full staging ring
+#define PROF_NUM		7
+
+#define PROF_HISTNUM	8
+
+typedef struct
+{
+	unsigned short c;				// Value of _timer_time_1024hz_ctr
+	unsigned short t;				// Value of WAIT_TCNT
+} PROFTICK;
+
+typedef struct
+{
+	unsigned long n;				// Number of measurements
+	unsigned long sum;				// Sum of the durations in timer ticks of the last nsum measurements
+	unsigned long nsum;				// Number of measurements in sum; sum and nsum are halved when sum would overflow
+	unsigned long min,max;			// Minimum and maximum durations in timer ticks
+	unsigned long hist[PROF_HISTNUM];
+} PROFPROBE;
+
+extern unsigned char prof_enabled;
+
+#if PROF_ENABLE==1
+#define PROF_START(p) do { if(prof_enabled) _prof_start(p); } while(0)
+#define PROF_STOP(p) do { if(prof_enabled) _prof_stop(p); } while(0)
+#else
+#define PROF_START(p)
+#define PROF_STOP(p)
+#endif
+
+void prof_enable(unsigned char en);
+void prof_clear(void);
+void _prof_gettick(PROFTICK *t);
+void _prof_start(unsigned char p);
+void _prof_stop(unsigned char p);
+void prof_getprobe(unsigned char p,PROFPROBE *probe);
+void prof_print(FILE *f);
+void prof_printbin(FILE *f);
+
+#endif
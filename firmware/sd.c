@@ -1,9 +1,6 @@
 #include "cpu.h"
 #include <avr/io.h>
 #include <avr/pgmspace.h>
-#include <avr/sleep.h>
-#include <avr/power.h>
-#include <avr/eeprom.h>
 #include <util/delay.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,6 +8,7 @@
 #include "spi.h"
 #include "main.h"
 #include "sd.h"
+#include "prof.h"
 
 /*
 	File: sd
@@ -75,10 +73,32 @@
 	sd_streamcache_write returns only if the entire data has been written to the card or to the cache, or if there is an error.
 	Note that this behavior is different from sd_stream_write which returns when a block is completed or all the data is written.
 	
+	The cache is a staging ring of SD_STAGING_NUMSECTORS sectors. Data is staged while the card is busy and the ring is drained
+	one sector at a time each time the card reports ready, so that sd_streamcache_write only blocks when the entire ring is full.
+	The number of blocking calls and the worst blocking time are kept as statistics (sd_streamcache_printstat) 
+	to help choosing SD_STAGING_NUMSECTORS for a given data rate.
+	
+	For zero-copy writes sd_streamcache_reserve returns a pointer into the staging ring where a record can be 
+	serialised directly, and sd_streamcache_commit publishes it. This avoids building the record in an intermediate 
+	buffer and copying it into the staging ring.
+	
+	Erasing the area to write before a streaming write reduces the latency of the card, but erasing a large area 
+	takes seconds. With sd_streamcache_eraseahead only the first SD_ERASEAHEAD_MARGIN sectors are erased 
+	before the write starts; the following chunks of SD_ERASEAHEAD_CHUNK sectors are erased at block boundaries 
+	as the write address approaches the end of the erased area, preferably when the staging ring is nearly empty.
+	The erase is not waited for: the card is polled like after a block write and the data is staged meanwhile.
+	
 	
 	* sd_stream_open:				Start a stream write at the specified address (used both for caching and non-caching streaming writes).
 	* sd_streamcache_write:			Writes data in streaming multiblock write with caching.
 	* sd_streamcache_close			Finishes a multiblock write with caching.
+	* sd_streamcache_poll			Drains the staging ring to the card without blocking.
+	* sd_streamcache_reserve		Reserves space in the staging ring to serialise data in place (zero-copy).
+	* sd_streamcache_commit			Commits data serialised in place.
+	* sd_streamcache_suspend		Suspends the multiblock write at the next block boundary and calls a function.
+	* sd_streamcache_eraseahead		Erases the area ahead of the write address while streaming.
+	* sd_streamcache_clearstat		Clears the blocking statistics of streaming writes with caching.
+	* sd_streamcache_printstat		Prints the blocking statistics of streaming writes with caching.
 	
 	*Dependencies*
 	
@@ -86,6 +106,17 @@
 	* Card on SPI interface: this library assumes the card is interfaced on the SPI interface. The SPI interface must be 
 	initialised before using this library.
 	
+	*Hardware interface*
+	
+	sd, sd_int and ufat only access the hardware through the following functions. The host build (host/Makefile, 
+	make host-test) provides them with a simulated card backed by an image file (host/hostsd.c), to run and benchmark 
+	the storage stack without the hardware:
+	
+	* spi_rw_noselect, spi_rn_noselect, spi_wn_noselect:	SPI transfers
+	* sd_select_n:											Card chip select (the only register access of this library)
+	* timer_ms_get, timer_us_get:							Timeouts and statistics
+	* _delay_ms, _delay_us:									Delays during the card initialisation and busy waits
+	
 	
 	
 	
@@ -144,7 +175,8 @@ unsigned char sd_init(CID *cid,CSD *csd,SDSTAT *sdstat,unsigned long *capacity)
 	OCR ocr;
 	unsigned long t1;
 
-	
+	// Terminate a multiblock read left open (e.g. by ufat_format) before the card is reset
+	sd_stream_read_close();
 
 	// 0. Native initialization
 	// This was used for SD/MMC. Although it does not appear necessary with SDHC, 
@@ -359,6 +391,7 @@ BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOCK READ/WRITE   BLOC
 unsigned char sd_block_read(unsigned long addr,char *buffer)
 {
 	unsigned short checksum;
+	sd_stream_read_close();
 	unsigned char response = _sd_command_r1_datablock(MMC_READ_SINGLE_BLOCK,addr>>24,addr>>16,addr>>8,addr,0,buffer,512,&checksum);
 	return response;
 }
@@ -383,6 +416,7 @@ unsigned char sd_block_write(unsigned long addr,char *buffer)
 {
 	unsigned char response;
 
+	sd_stream_read_close();
 	response=_sd_block_open(addr);
 
 	#ifdef MMCDBG
@@ -431,8 +465,25 @@ unsigned char _sd_write_stream_mustpreerase;			// Indicates whether the pre-eras
 unsigned long _sd_write_stream_preerase;				// Indicates how many sectors must be pre-erased
 
 
-char _sdbuffer[SD_CACHE_SIZE];							// Cache memory for streaming writes with caching, also used for padding
-unsigned short _sdbuffer_n;								// Amount of memory used in cache
+char _sdbuffer[SD_CACHE_SIZE];							// Staging ring for streaming writes with caching, also used for padding by sd_stream_close
+unsigned short _sdbuffer_rd;							// Read offset in the staging ring
+unsigned short _sdbuffer_n;								// Amount of memory used in the staging ring
+unsigned short _sdbuffer_maxn;							// Maximum amount of memory used in the staging ring
+unsigned long _sd_streamcache_numblock;					// Number of sd_streamcache_write calls which blocked because the staging ring was full
+unsigned long _sd_streamcache_maxblocktime;				// Longest time (ms) sd_streamcache_write blocked because the staging ring was full
+char _sdrecord[SD_RECORD_MAXSIZE];						// Scratch area for zero-copy writes when the reserved space wraps around the staging ring
+unsigned char _sd_streamcache_scratch;					// Indicates whether the current reservation is in the scratch area
+unsigned char _sd_streamcache_suspendreq;				// Suspension of the multiblock write requested at the next block boundary
+void (*_sd_streamcache_suspendcb)(unsigned long);		// Function called when the multiblock write is suspended
+unsigned long _sd_streamcache_numsuspend;				// Number of suspensions of the multiblock write
+unsigned long _sd_streamcache_maxsuspendtime;			// Longest suspension (us), including the callback
+unsigned long _sd_streamcache_totsuspendtime;			// Total time spent in suspensions (us)
+unsigned long _sd_eraseahead_next;						// First sector not erased yet
+unsigned long _sd_eraseahead_end;						// Last sector to erase; erase-ahead is disabled if _sd_eraseahead_next>_sd_eraseahead_end
+unsigned long _sd_eraseahead_num;						// Number of chunks erased while streaming
+unsigned long _sd_eraseahead_maxtime;					// Longest erase while streaming (ms), including the termination of the multiblock write
+unsigned char _sd_eraseahead_busy;						// An erase is ongoing: the card is selected and busy until it answers 0xFF
+unsigned long _sd_eraseahead_t1;						// Start of the ongoing erase (ms)
 
 /******************************************************************************
 	function: sd_stream_open
@@ -449,18 +500,24 @@ unsigned short _sdbuffer_n;								// Amount of memory used in cache
 ******************************************************************************/
 void sd_stream_open(unsigned long addr,unsigned long preerase)
 {
+	sd_stream_read_close();
 	_sd_write_stream_open=0;						// Command write multiblock not sent yet
 	_sd_write_stream_address=addr;					// Write address
 	_sd_write_stream_mustwait=0;					// Must wait for answer from card
 	_sd_write_stream_block_started = 0;				// Start data token not sent yet
 	_sd_write_stream_numwritten = 0;				// No bytes written yet
 	_sdbuffer_n=0;									// Number of data into buffer	
+	_sdbuffer_rd=0;									// Read offset in buffer
 	_sd_write_stream_error=0;						// Number of errors
 	if(preerase)
 		_sd_write_stream_mustpreerase=1;			// The pre-erase command must be issued prior to multiblock write
 	else
 		_sd_write_stream_mustpreerase=0;			// The pre-erase command must not be issued.
 	_sd_write_stream_preerase=preerase;
+	_sd_streamcache_suspendreq=0;					// No suspension requested
+	_sd_eraseahead_next=1;							// No erase-ahead
+	_sd_eraseahead_end=0;
+	_sd_eraseahead_busy=0;
 }
 
 
@@ -651,118 +708,179 @@ STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   STREAM WRITE W/ CACHING   ST
 
 
 /******************************************************************************
-	function:	sd_streamcache_write
+	function:	_sd_streamcache_put
 *******************************************************************************
-	Writes data in streaming multiblock write with caching.
+	Appends data to the staging ring used by streaming writes with caching.
 
-	Rationale for caching: after completing a block the card needs some time to be ready for a new block. This time is
-	generally short but occasionnally may be longer when block reordering occurs.
-	If sd_streamcache_write is called while the card is still busy from a prior write the data is moved into the cache and the function returns immediately.
-	If the cache has no space for the data then the function will block until the cards is ready and will open a new block and write directly the data to the card.
-	Upon subsequent writes, or calling sd_streamcache_close, the cache content is written to the card.
-		
-	This function uses the cache buffer _sdbuffer and ensures it does not grow above SD_CACHE_SIZE.
+	The caller must ensure that size is not larger than the free space in the ring (SD_CACHE_SIZE-_sdbuffer_n).
+	The copy is done in at most two chunks if the data wraps around the end of the ring.
 
 	Parameters:
-		buffer			-	Buffer of data to write	
-		size			-	Number of bytes to write. Use size=0 to flush the buffer.
-		currentsect		-	Optionally a pointer to a variable holding the address (in sectors) of the block currently being used to store the data. 
-							If 0, the address will not be provided
+		buffer			-	Buffer of data to stage, or 0 to stage size times the byte c
+		c				-	Value to stage when buffer is 0 (used for padding)
+		size			-	Number of bytes to stage
+******************************************************************************/
+void _sd_streamcache_put(char *buffer,unsigned char c,unsigned short size)
+{
+	unsigned short wr,n1;
+
+	wr = _sdbuffer_rd+_sdbuffer_n;
+	if(wr>=SD_CACHE_SIZE)
+		wr-=SD_CACHE_SIZE;
+	// First chunk: up to the end of the ring
+	n1 = SD_CACHE_SIZE-wr;
+	if(n1>size)
+		n1=size;
+	if(buffer)
+	{
+		memcpy(_sdbuffer+wr,buffer,n1);
+		memcpy(_sdbuffer,buffer+n1,size-n1);
+	}
+	else
+	{
+		memset(_sdbuffer+wr,c,n1);
+		memset(_sdbuffer,c,size-n1);
+	}
+	_sdbuffer_n+=size;
+	if(_sdbuffer_n>_sdbuffer_maxn)
+		_sdbuffer_maxn=_sdbuffer_n;
+}
+/******************************************************************************
+	function:	_sd_streamcache_drain
+*******************************************************************************
+	Sends size bytes from the staging ring to the card.
+
+	The caller must ensure that a block is started and that size is not larger
+	than the amount of data in the ring nor than the space left in the block.
+
+	Parameters:
+		size			-	Number of bytes to send to the card
+******************************************************************************/
+void _sd_streamcache_drain(unsigned short size)
+{
+	unsigned short n1;
+
+	// First chunk: up to the end of the ring
+	n1 = SD_CACHE_SIZE-_sdbuffer_rd;
+	if(n1>size)
+		n1=size;
+	_sd_writebuffer(_sdbuffer+_sdbuffer_rd,n1);
+	_sd_writebuffer(_sdbuffer,size-n1);
+	_sdbuffer_rd+=size;
+	if(_sdbuffer_rd>=SD_CACHE_SIZE)
+		_sdbuffer_rd-=SD_CACHE_SIZE;
+	_sdbuffer_n-=size;
+}
+/******************************************************************************
+	function:	_sd_streamcache_blockstat
+*******************************************************************************
+	Updates the blocking statistics when sd_streamcache_write returns.
+
+	Parameters:
+		blocked			-	Nonzero if sd_streamcache_write had to wait for the card with a full staging ring
+		tblock			-	Time at which the blocking started
+******************************************************************************/
+void _sd_streamcache_blockstat(unsigned char blocked,unsigned long tblock)
+{
+	unsigned long dt;
+
+	if(!blocked)
+		return;
+	_sd_streamcache_numblock++;
+	dt = timer_ms_get()-tblock;
+	if(dt>_sd_streamcache_maxblocktime)
+		_sd_streamcache_maxblocktime=dt;
+}
+
+/******************************************************************************
+	function:	_sd_streamcache_ready
+*******************************************************************************
+	Checks whether the card is ready after the previous block write (_sd_write_stream_mustwait)
+	or after an erase-ahead (_sd_eraseahead_busy).
+
+	This function does not block: it clocks a few bytes to the card to obtain its status.
+	In case of timeout waiting for the card the multiblock write is closed and the card is
+	considered ready, so that the next write reopens the multiblock write.
+
+	Parameters:
+		error			-	Pointer to the error counter of the caller, incremented in case of timeout
 
 	Returns:
-		0				-	Success
-		other			-	Failure
+		0				-	Card busy
+		1				-	Card ready
 ******************************************************************************/
-unsigned char sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentsect)
+unsigned char _sd_streamcache_ready(unsigned char *error)
 {
-	// Find how many bytes can effectively be written until the sector is full.
-	unsigned long effw;
-	unsigned char rv,error;
+	unsigned char rv;
 
-	// Error indicates the number of errors that occurred during this function. Normally it should remain 0.
-	error=0;			
-	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: size: %u. incache: %u: strmopen: %d blkstr: %d wrinblk: %u addr: %lX\r"),size,_sdbuffer_n,_sd_write_stream_open,_sd_write_stream_block_started,_sd_write_stream_numwritten,_sd_write_stream_address);
-	#endif
+	if(_sd_eraseahead_busy)
+		return _sd_streamcache_eraseready(error);
+	if(!_sd_write_stream_mustwait)
+		return 1;
+
+	//fputc('w',file_pri);
+	// Get card status
+	rv = spi_rw_noselect(0xFF);
+	// To prevent timeout if streaming slowly. E.g. when sending one packet to the card every second only one FF is sent to the card per second, which timeouts MMC_TIMEOUT_READWRITE.
+	// Sending more FF is harmless at the cost of slightly slower maximum write speed (less than 0.5%).
+	rv = spi_rw_noselect(0xFF);
+	rv = spi_rw_noselect(0xFF);
+	rv = spi_rw_noselect(0xFF);
 
-	// This loop will be iterated to write size bytes to the card every time a block is completed
-sd_streamcache_write_loop:
-	//fputc('W',file_pri);
 	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write_loop: size: %u\n"),size);
+		printf_P(PSTR("sd_streamcache: wait <- %02X\n"),rv);
 	#endif
-	//fprintf(file_pri,"write2. size: %u. _sdbuffer_n: %u\n",size,_sdbuffer_n);
-
-	// Update current sector written to
-	if(currentsect)
-		*currentsect = _sd_write_stream_address;
 		
-	// Wait for card to become ready from previous block write (_sd_write_stream_mustwait)	
-	while(_sd_write_stream_mustwait)					// Enter wait loop if neeeded regardless of the amount of data to write
+	// DAN TOCHECK: add more clocks here
+	
+	if(rv==0xff)
 	{
-		//fputc('w',file_pri);
-		// Get card status
-		rv = spi_rw_noselect(0xFF);
-		// To prevent timeout if streaming slowly. E.g. when sending one packet to the card every second only one FF is sent to the card per second, which timeouts MMC_TIMEOUT_READWRITE.
-		// Sending more FF is harmless at the cost of slightly slower maximum write speed (less than 0.5%).
-		rv = spi_rw_noselect(0xFF);
-		rv = spi_rw_noselect(0xFF);
-		rv = spi_rw_noselect(0xFF);
-		
-		#ifdef MMCDBG
-			printf_P(PSTR("sd_streamcache: wait <- %02X\n"),rv);
-		#endif
-			
-		// DAN TOCHECK: add more clocks here
-		
-		if(rv==0xff)
-		{
-			// Card responds that it is ready: indicate wait not needed and exit from loop
-			_sd_write_stream_mustwait=0;
-			break;
-		}
-		// Check the time elapsed from _sd_block_stop_nowait for a timeout.
-		// ISSUE: with certain cards and slow streaming speed, the following timeouts. 
-		// This happens because multiple FF's must be sent above, and only one FF is sent per "putbuf" call. Options: send multiple FF's above, or increase the timeout. 
-		// Choice: issue multiple FF above
-		if(timer_ms_get()-_sd_write_stream_t1>=MMC_TIMEOUT_READWRITE)
-		{
-			//printf("Dan timeout\n");
-			// Timeout waiting for card. Close the block
-			//fputc('t',file_pri);			
-			_sd_write_stream_error++;
-			error++;
-			_sd_multiblock_close();
-			_sd_write_stream_open=0;							// Multiblock write not open
-			break;
-		}
-		// If size is nonzero (don't force writing buffer) and user data fits in cache buffer then store user data in cache and return immediately with success
-		// If the user data does not fit in the cache buffer then this while loop will block until the card is ready or a timeout occurs
-		// The size test ensures the cache buffer never holds more than SD_CACHE_SIZE bytes.
-		if(size && size<=SD_CACHE_SIZE-_sdbuffer_n)
-		{
-			//fputc('b',file_pri);
-			memcpy(_sdbuffer+_sdbuffer_n,buffer,size);
-			_sdbuffer_n+=size;
-			//return error|0x80;
-			#ifdef MMCDBG
-				printf_P(PSTR("sd_streamcache_write: cached, return ok\n"));
-			#endif
-			return error;		// Error is 0 (success)
-		}
-
+		// Card responds that it is ready: indicate wait not needed
+		_sd_write_stream_mustwait=0;
+		return 1;
 	}
-	// Here: card is ready (transaction/block may or may not be open/closed)
-		
-	// Nothing to write in the user-provided buffer nor in the cache buffer therefore returns successfully.
-	if(size==0 && _sdbuffer_n==0)
+	// Check the time elapsed from _sd_block_stop_nowait for a timeout.
+	// ISSUE: with certain cards and slow streaming speed, the following timeouts. 
+	// This happens because multiple FF's must be sent above, and only one FF is sent per "putbuf" call. Options: send multiple FF's above, or increase the timeout. 
+	// Choice: issue multiple FF above
+	if(timer_ms_get()-_sd_write_stream_t1>=MMC_TIMEOUT_READWRITE)
 	{
-		#ifdef MMCDBG
-			printf_P(PSTR("sd_streamcache_write: return ok\n"));
-		#endif
-		return error;			// Error is 0 (success)
+		//printf("Dan timeout\n");
+		// Timeout waiting for card. Close the block
+		//fputc('t',file_pri);			
+		_sd_write_stream_error++;
+		(*error)++;
+		_sd_multiblock_close();
+		_sd_write_stream_open=0;							// Multiblock write not open
+		_sd_write_stream_mustwait=0;
+		return 1;
 	}
-		
+	return 0;
+}
+/******************************************************************************
+	function:	_sd_streamcache_block
+*******************************************************************************
+	Writes data to the card until the current block is full or all data is written, 
+	whichever comes first. The card must be ready.
+
+	The multiblock write is opened and the block is started if needed.
+	The staging ring is drained first to preserve the order of the data; the user data 
+	is only written to the card once the staging ring is empty.
+	When the block is full it is terminated without waiting for the card.
+
+	Parameters:
+		buffer			-	Pointer to the pointer to the user data; updated by the number of bytes written
+		size			-	Pointer to the number of user bytes to write; updated by the number of bytes written
+		error			-	Pointer to the error counter of the caller
+
+	Returns:
+		0				-	Success
+		1				-	The multiblock write could not be opened
+******************************************************************************/
+unsigned char _sd_streamcache_block(char **buffer,unsigned short *size,unsigned char *error)
+{
+	unsigned short effw;
+	unsigned char rv;
 	
 	//	Write command not yet send.
 	if(!_sd_write_stream_open)
@@ -790,9 +908,9 @@ sd_streamcache_write_loop:
 				printf_P(PSTR("sd_streamcache_write. _sd_write_stream_address failed\r"));
 			#endif
 			_sd_write_stream_error++;
-			error++;
+			(*error)++;
 			//return error|0x20;					// Abort if the open failed
-			return error;
+			return 1;
 		}	
 		_sd_write_stream_open = 1;					// Block write is now open,...	
 		_sd_write_stream_block_started=0;			// Block has not started
@@ -811,38 +929,38 @@ sd_streamcache_write_loop:
 	}
 		
 	// Write the data until: either all data is written, or a block is completed (whichever comes first)
-	// First write data in cache buffer, if any. 
-	// It is always possible to write the entire cache buffer because the only time the buffer can 
-	// fill itself and become full is during the waiting for card ready; and the first time the card is ready 
-	// the buffer is emptied and stays empty.	
-	// _sdbuffer_n must be <=512, which means maximum buffer size is 512 bytes.
+	// First drain the staging ring, up to the end of the current block, to preserve the order of the data.
+	effw = 512-_sd_write_stream_numwritten;
+	if(_sdbuffer_n<effw)
+		effw=_sdbuffer_n;
 	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: write %u cache\n"),_sdbuffer_n);
+		printf_P(PSTR("sd_streamcache_write: write %u cache\n"),effw);
 	#endif
-	_sd_writebuffer(_sdbuffer,_sdbuffer_n);
-	_sd_write_stream_numwritten+=_sdbuffer_n;
-	_sdbuffer_n=0;
+	_sd_streamcache_drain(effw);
+	_sd_write_stream_numwritten+=effw;
 	
 	//printf("num: %u\n",_sd_write_stream_numwritten);
 	
-	// Write the user-provided buffer or a subset of it until card the block is full	
-	if(size<=512-_sd_write_stream_numwritten)
-		effw=size;
-	else
-		effw=512-_sd_write_stream_numwritten;
-		
-	// Send data and update counters
-	#ifdef MMCDBG
-		printf_P(PSTR("sd_streamcache_write: write %u data\n"),effw);
-	#endif
-	_sd_writebuffer(buffer,effw);
-	_sd_write_stream_numwritten+=effw;
-	// Update the buffer pointer and counter
-	buffer+=effw;
-	size-=effw;
+	// Write the user-provided buffer or a subset of it until card the block is full, only once the staging ring is empty
+	if(_sdbuffer_n==0)
+	{
+		if(*size<=512-_sd_write_stream_numwritten)
+			effw=*size;
+		else
+			effw=512-_sd_write_stream_numwritten;
 	
-	//printf("num: %u\n",_sd_write_stream_numwritten);
+		// Send data and update counters
+		#ifdef MMCDBG
+			printf_P(PSTR("sd_streamcache_write: write %u data\n"),effw);
+		#endif
+		_sd_writebuffer(*buffer,effw);
+		_sd_write_stream_numwritten+=effw;
+		// Update the buffer pointer and counter
+		*buffer+=effw;
+		*size-=effw;
+	}
 	
+	//printf("num: %u\n",_sd_write_stream_numwritten);
 	
 	// If a block is full, terminates it
 	if(_sd_write_stream_numwritten>=512)
@@ -868,21 +986,305 @@ sd_streamcache_write_loop:
 			//fputc('e',file_pri);
 			// Wait for the block to complete
 			_sd_write_stream_error++;
-			error++;
+			(*error)++;
 			_sd_block_stop_dowait();
 			_sd_multiblock_close();
 			_sd_write_stream_open=0;							// Multiblock write not open
 			_sd_write_stream_mustwait=0;
 		}
 	}
+	// Suspend the multiblock write if requested, now that a block boundary is reached
+	if(_sd_streamcache_suspendreq && !_sd_write_stream_block_started)
+		_sd_streamcache_dosuspend();
+	// Erase the next chunk ahead of the write address, preferably when there is little data staged.
+	// The erase does not block: when it is forced with more data staged, the data waits in the staging ring.
+	if(_sd_eraseahead_next<=_sd_eraseahead_end && !_sd_eraseahead_busy && !_sd_write_stream_block_started)
+	{
+		if(_sd_write_stream_address+SD_ERASEAHEAD_MIN>=_sd_eraseahead_next || 
+			(_sd_write_stream_address+SD_ERASEAHEAD_MARGIN>=_sd_eraseahead_next && _sdbuffer_n<512))
+			_sd_streamcache_doeraseahead();
+	}
+	return 0;
+}
+/******************************************************************************
+	function:	_sd_streamcache_dosuspend
+*******************************************************************************
+	Suspends the multiblock write at a block boundary: waits for the card to 
+	complete the last block, terminates the multiblock write and calls the 
+	callback provided to sd_streamcache_suspend.
+	
+	The data in the staging ring is kept; the next write reopens the multiblock
+	write at _sd_write_stream_address.
+******************************************************************************/
+void _sd_streamcache_dosuspend(void)
+{
+	unsigned long t1,dt;
+
+	t1=timer_us_get();
+	_sd_streamcache_suspendreq=0;
+	_sd_streamcache_stop();
+	_sd_streamcache_suspendcb(_sd_write_stream_address);
+	dt=timer_us_get()-t1;
+	_sd_streamcache_numsuspend++;
+	_sd_streamcache_totsuspendtime+=dt;
+	if(dt>_sd_streamcache_maxsuspendtime)
+		_sd_streamcache_maxsuspendtime=dt;
+}
+/******************************************************************************
+	function:	_sd_streamcache_stop
+*******************************************************************************
+	Internally used to terminate the multiblock write at a block boundary, 
+	after the card completes the last block or the ongoing erase-ahead. The next 
+	write reopens the multiblock write at _sd_write_stream_address.
+******************************************************************************/
+void _sd_streamcache_stop(void)
+{
+	unsigned char error=0;
+	
+	while(_sd_eraseahead_busy && !_sd_streamcache_eraseready(&error));
+	if(!_sd_write_stream_open)
+		return;
+	if(_sd_write_stream_mustwait)
+	{
+		if(_sd_block_stop_dowait())
+			_sd_write_stream_error++;
+		_sd_write_stream_mustwait=0;
+	}
+	if(_sd_multiblock_close())
+		_sd_write_stream_error++;
+	_sd_write_stream_open=0;							// Multiblock write not open
+}
+/******************************************************************************
+	function:	sd_streamcache_eraseahead
+*******************************************************************************
+	Erases the area ahead of the write address of a streaming write with caching.
+	
+	Must be called after sd_stream_open and before the first write. 
+	The sectors from the write address up to at least SD_ERASEAHEAD_MARGIN 
+	sectors ahead are erased immediately; the following sectors up to end are
+	erased by chunks of SD_ERASEAHEAD_CHUNK sectors while streaming.
+	
+	Each erase while streaming terminates the multiblock write at a block 
+	boundary, like a suspension, but does not wait for the erase to complete;
+	the number of erases and the longest erase are printed by 
+	sd_streamcache_printstat.
+
+	Parameters:
+		end			-	Last sector to erase
+	
+	Returns:
+		0			-	Success
+		Nonzero		-	Error
+******************************************************************************/
+unsigned char sd_streamcache_eraseahead(unsigned long end)
+{
+	_sd_eraseahead_next=_sd_write_stream_address;
+	_sd_eraseahead_end=end;
+	if(sd_erase_upto(&_sd_eraseahead_next,_sd_write_stream_address+SD_ERASEAHEAD_MARGIN,end))
+	{
+		_sd_eraseahead_next=1;
+		_sd_eraseahead_end=0;
+		return 1;
+	}
+	return 0;
+}
+/******************************************************************************
+	function:	_sd_streamcache_doeraseahead
+*******************************************************************************
+	Internally used to erase the next chunk ahead of the write address at a 
+	block boundary. In case of error erase-ahead is disabled and the streaming 
+	write continues without erase.
+	
+	The erase commands are issued without waiting for the card: the erase 
+	completes in _sd_streamcache_ready like a block write, while the data keeps 
+	being staged. The writer only blocks if the staging ring fills up.
+******************************************************************************/
+void _sd_streamcache_doeraseahead(void)
+{
+	unsigned long last;
 	
-	// If size is non null, loop to write the remaining data
-	if(size!=0)
+	_sd_eraseahead_t1=timer_ms_get();
+	_sd_streamcache_stop();
+	last=_sd_erase_chunklast(_sd_eraseahead_next,_sd_eraseahead_end);
+	if(_sd_cmd32(_sd_eraseahead_next) || _sd_cmd33(last) || _sd_cmd38_nowait())
+	{
+		_sd_write_stream_error++;
+		_sd_eraseahead_next=1;
+		_sd_eraseahead_end=0;
+		return;
+	}
+	_sd_eraseahead_next=last+1;
+	_sd_eraseahead_busy=1;
+}
+/******************************************************************************
+	function:	_sd_streamcache_eraseready
+*******************************************************************************
+	Checks whether the card completed the erase issued by 
+	_sd_streamcache_doeraseahead, without blocking. 
+	
+	Once the card is ready it is deselected and the erase time is accounted. 
+	In case of timeout erase-ahead is disabled and the card is considered ready.
+
+	Parameters:
+		error			-	Pointer to the error counter of the caller, incremented in case of timeout
+
+	Returns:
+		0				-	Card busy
+		1				-	Card ready
+******************************************************************************/
+unsigned char _sd_streamcache_eraseready(unsigned char *error)
+{
+	unsigned long dt;
+	
+	dt=timer_ms_get()-_sd_eraseahead_t1;
+	if(spi_rw_noselect(0xFF)!=0xff)
+	{
+		if(dt<SD_ERASE_TIMEOUT)
+			return 0;
+		// Timeout waiting for the erase
+		_sd_write_stream_error++;
+		(*error)++;
+		_sd_eraseahead_next=1;
+		_sd_eraseahead_end=0;
+	}
+	sd_select_n(1);
+	_sd_eraseahead_busy=0;
+	_sd_eraseahead_num++;
+	if(dt>_sd_eraseahead_maxtime)
+		_sd_eraseahead_maxtime=dt;
+	return 1;
+}
+
+/******************************************************************************
+	function:	sd_streamcache_write
+*******************************************************************************
+	Writes data in streaming multiblock write with caching.
+
+	Rationale for caching: after completing a block the card needs some time to be ready for a new block. This time is
+	generally short but occasionnally may be longer when block reordering occurs.
+	If sd_streamcache_write is called while the card is still busy from a prior write the data is moved into the staging ring and the function returns immediately.
+	If the staging ring has no space for the data then the function will block until the card is ready.
+	Each time the card is ready the staging ring is drained, one block at a time, before the user data is written directly to the card.
+	Upon subsequent writes, or calling sd_streamcache_close, the staged content is written to the card.
+
+	This function uses the staging ring _sdbuffer and ensures it does not grow above SD_CACHE_SIZE.
+
+	Use size=0 to flush: the function then blocks until the staging ring is entirely written to the card.
+
+	Parameters:
+		buffer			-	Buffer of data to write	
+		size			-	Number of bytes to write. Use size=0 to flush the buffer.
+		currentsect		-	Optionally a pointer to a variable holding the address (in sectors) of the block currently being used to store the data. 
+							If 0, the address will not be provided
+
+	Returns:
+		0				-	Success
+		other			-	Failure
+******************************************************************************/
+unsigned char sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentsect)
+{
+	unsigned char rv;
+	
+	PROF_START(PROF_SDWRITE);
+	rv = _sd_streamcache_write(buffer,size,currentsect);
+	PROF_STOP(PROF_SDWRITE);
+	return rv;
+}
+/******************************************************************************
+	function:	_sd_streamcache_write
+*******************************************************************************
+	Implementation of sd_streamcache_write.
+******************************************************************************/
+unsigned char _sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentsect)
+{
+	unsigned char error;
+	unsigned char blocked,waiting;
+	unsigned long tblock;
+
+	// Error indicates the number of errors that occurred during this function. Normally it should remain 0.
+	error=0;			
+	// Blocked indicates whether the call had to wait for the card with a full staging ring; used for statistics
+	blocked=0;
+	tblock=0;
+	// Waiting indicates whether a PROF_SDWAIT measurement is ongoing in the current pass of the loop
+	waiting=0;
+	#ifdef MMCDBG
+		printf_P(PSTR("sd_streamcache_write: size: %u. incache: %u: strmopen: %d blkstr: %d wrinblk: %u addr: %lX\r"),size,_sdbuffer_n,_sd_write_stream_open,_sd_write_stream_block_started,_sd_write_stream_numwritten,_sd_write_stream_address);
+	#endif
+
+	// This loop will be iterated to write size bytes to the card every time a block is completed
+sd_streamcache_write_loop:
+	//fputc('W',file_pri);
+	#ifdef MMCDBG
+		printf_P(PSTR("sd_streamcache_write_loop: size: %u\n"),size);
+	#endif
+	//fprintf(file_pri,"write2. size: %u. _sdbuffer_n: %u\n",size,_sdbuffer_n);
+
+	// Update current sector written to
+	if(currentsect)
+		*currentsect = _sd_write_stream_address;
+
+	// Wait for card to become ready from previous block write (_sd_write_stream_mustwait)	
+	while(!_sd_streamcache_ready(&error))
+	{
+		// If size is nonzero (don't force writing buffer) and user data fits in the staging ring then store user data in the ring and return immediately with success
+		// If the user data does not fit in the staging ring then this while loop will block until the card is ready or a timeout occurs
+		// The size test ensures the staging ring never holds more than SD_CACHE_SIZE bytes.
+		if(size && size<=SD_CACHE_SIZE-_sdbuffer_n)
+		{
+			//fputc('b',file_pri);
+			_sd_streamcache_put(buffer,0,size);
+			_sd_streamcache_blockstat(blocked,tblock);
+			//return error|0x80;
+			#ifdef MMCDBG
+				printf_P(PSTR("sd_streamcache_write: cached, return ok\n"));
+			#endif
+			return error;		// Error is 0 (success)
+		}
+		// Staging ring full: the caller is blocked until the card is ready
+		if(size && !blocked)
+		{
+			blocked=1;
+			tblock=timer_ms_get();
+		}
+		if(size && !waiting)
+		{
+			waiting=1;
+			PROF_START(PROF_SDWAIT);
+		}
+	}
+	if(waiting)
+	{
+		PROF_STOP(PROF_SDWAIT);
+		waiting=0;
+	}
+	// Here: card is ready (transaction/block may or may not be open/closed)
+
+	// Nothing to write in the user-provided buffer nor in the staging ring therefore returns successfully.
+	if(size==0 && _sdbuffer_n==0)
+	{
+		_sd_streamcache_blockstat(blocked,tblock);
+		#ifdef MMCDBG
+			printf_P(PSTR("sd_streamcache_write: return ok\n"));
+		#endif
+		return error;			// Error is 0 (success)
+	}
+
+	// Write the staging ring and user data up to the end of the block
+	if(_sd_streamcache_block(&buffer,&size,&error))
+	{
+		_sd_streamcache_blockstat(blocked,tblock);
+		return error;
+	}
+
+	// If size is non null, or if flushing and the staging ring is not empty, loop to write the remaining data
+	if(size!=0 || _sdbuffer_n!=0)
 	{
 		//printf("loop\n");
 		goto sd_streamcache_write_loop;
 	}
 
+	_sd_streamcache_blockstat(blocked,tblock);
 	#ifdef MMCDBG
 		printf_P(PSTR("sd_streamcache_write: return ok\n"));
 	#endif
@@ -890,6 +1292,169 @@ sd_streamcache_write_loop:
 	return error;
 }
 
+/******************************************************************************
+	function:	sd_streamcache_poll
+*******************************************************************************
+	Drains the staging ring to the card without blocking.
+
+	The staging ring is written to the card for as long as the card is ready. The function returns 
+	as soon as the card is busy or the staging ring is empty.
+	This may be called from the main loop when idle to keep the staging ring as empty as possible.
+
+	Returns:
+		0				-	Success
+		other			-	Failure
+******************************************************************************/
+unsigned char sd_streamcache_poll(void)
+{
+	unsigned char error=0;
+	unsigned short size=0;
+	char *buffer=0;
+
+	while(_sdbuffer_n && _sd_streamcache_ready(&error))
+	{
+		if(_sd_streamcache_block(&buffer,&size,&error))
+			break;
+	}
+	return error;
+}
+
+/******************************************************************************
+	function:	sd_streamcache_suspend
+*******************************************************************************
+	Requests to suspend the multiblock write of a streaming write with caching 
+	at the next block boundary, so that other sectors can be written (e.g. to 
+	update the size of a file) without padding the data stream.
+	
+	Once suspended, cb is called with the address of the next sector to write: 
+	all the sectors before it are on the card. The data in the staging ring is 
+	kept and the next write reopens the multiblock write where it was suspended.
+	
+	If no block is started the suspension is immediate. Otherwise it happens in 
+	the sd_streamcache_write, sd_streamcache_poll or sd_streamcache_reserve call 
+	that completes the current block.
+	
+	The cost of a suspension is the card busy time of the last block, the 
+	termination of the multiblock write, the time spent in cb and the reopening 
+	of the multiblock write.
+
+	Parameters:
+		cb				-	Function called when the multiblock write is suspended
+******************************************************************************/
+void sd_streamcache_suspend(void (*cb)(unsigned long))
+{
+	_sd_streamcache_suspendcb=cb;
+	_sd_streamcache_suspendreq=1;
+	if(!_sd_write_stream_block_started)
+		_sd_streamcache_dosuspend();
+}
+
+/******************************************************************************
+	function:	sd_streamcache_reserve
+*******************************************************************************
+	Reserves size bytes at the end of the staging ring, so that the caller can 
+	serialise data directly where it will be written to the card (zero-copy write).
+	
+	The reservation must be followed by a call to sd_streamcache_commit with the 
+	same size; no other streaming write with caching may happen in between.
+	
+	If the staging ring does not have enough free space this function blocks until 
+	the card has written enough data. 
+	If the free space wraps around the end of the staging ring, a pointer to a 
+	scratch area is returned instead and sd_streamcache_commit copies it into the ring;
+	this happens at most once per SD_CACHE_SIZE bytes.
+
+	Parameters:
+		size			-	Number of bytes to reserve, at most SD_RECORD_MAXSIZE
+
+	Returns:
+		0				-	Failure (size too large or card error)
+		nonzero			-	Pointer where to write size bytes
+******************************************************************************/
+char *sd_streamcache_reserve(unsigned short size)
+{
+	unsigned short wr;
+	unsigned char error=0;
+	unsigned char blocked=0;
+	unsigned long tblock=0;
+	unsigned short zero=0;
+	char *buffer=0;
+
+	if(size>SD_RECORD_MAXSIZE)
+		return 0;
+
+	PROF_START(PROF_SDWRITE);
+	// Make room in the staging ring
+	while(SD_CACHE_SIZE-_sdbuffer_n<size)
+	{
+		if(!blocked)
+		{
+			blocked=1;
+			tblock=timer_ms_get();
+			PROF_START(PROF_SDWAIT);
+		}
+		if(_sd_streamcache_ready(&error))
+		{
+			if(_sd_streamcache_block(&buffer,&zero,&error))
+			{
+				PROF_STOP(PROF_SDWAIT);
+				PROF_STOP(PROF_SDWRITE);
+				_sd_streamcache_blockstat(blocked,tblock);
+				return 0;
+			}
+		}
+	}
+	if(blocked)
+		PROF_STOP(PROF_SDWAIT);
+	_sd_streamcache_blockstat(blocked,tblock);
+
+	wr = _sdbuffer_rd+_sdbuffer_n;
+	if(wr>=SD_CACHE_SIZE)
+		wr-=SD_CACHE_SIZE;
+	// Serialise in place if contiguous, otherwise in the scratch area
+	if(SD_CACHE_SIZE-wr>=size)
+	{
+		_sd_streamcache_scratch=0;
+		PROF_STOP(PROF_SDWRITE);
+		return _sdbuffer+wr;
+	}
+	_sd_streamcache_scratch=1;
+	PROF_STOP(PROF_SDWRITE);
+	return _sdrecord;
+}
+/******************************************************************************
+	function:	sd_streamcache_commit
+*******************************************************************************
+	Commits the data serialised in the area returned by sd_streamcache_reserve
+	and drains the staging ring to the card if the card is ready.
+
+	Parameters:
+		size			-	Number of bytes to commit, identical to the reservation
+
+	Returns:
+		0				-	Success
+		other			-	Failure
+******************************************************************************/
+unsigned char sd_streamcache_commit(unsigned short size)
+{
+	unsigned char rv;
+	
+	PROF_START(PROF_SDWRITE);
+	if(_sd_streamcache_scratch)
+	{
+		_sd_streamcache_put(_sdrecord,0,size);
+	}
+	else
+	{
+		_sdbuffer_n+=size;
+		if(_sdbuffer_n>_sdbuffer_maxn)
+			_sdbuffer_maxn=_sdbuffer_n;
+	}
+	rv = sd_streamcache_poll();
+	PROF_STOP(PROF_SDWRITE);
+	return rv;
+}
+
 /******************************************************************************
 	sd_streamcache_close
 *******************************************************************************	
@@ -911,7 +1476,7 @@ unsigned char sd_streamcache_close(unsigned long *currentsect)
 		printf_P(PSTR("sd_streamcache_close: strmopen: %d blkstr: %d wrinblk: %u addr: %lX\r"),_sd_write_stream_open,_sd_write_stream_block_started,_sd_write_stream_numwritten,_sd_write_stream_address);
 	#endif
 	
-	// 1. Flush the cache. At this stage the block should be closed, but without waiting for ready
+	// 1. Flush the staging ring. At this stage the block should be closed, but without waiting for ready
 	response=sd_streamcache_write(0,0,0);
 	if(response)
 	{
@@ -929,17 +1494,10 @@ unsigned char sd_streamcache_close(unsigned long *currentsect)
 			printf("padding: %u topad: %u\n",_sd_write_stream_numwritten,topad);
 		#endif
 
-		// Write
-		memset(_sdbuffer,0x55,topad);
-		response = sd_streamcache_write(_sdbuffer,topad,0);
-		if(response)
-		{
-			printf_P(PSTR("sd_streamcache_close: error padding\n"));
-			_sd_multiblock_close();
-			_sd_write_stream_open=0;
-			return 1;
-		}
-		// 3. Flush cache again for the padding, if data was cached
+		// Stage the padding: the ring is empty after the flush and thus always has space for less than a block
+		_sd_streamcache_put(0,0x55,topad);
+
+		// 3. Flush the staging ring again for the padding
 		response=sd_streamcache_write(0,0,0);
 		if(response)
 		{
@@ -970,8 +1528,11 @@ unsigned char sd_streamcache_close(unsigned long *currentsect)
 		*currentsect = _sd_write_stream_address-1;
 	}
 	
-	// 5. Terminates the multiblock write
-	response = _sd_multiblock_close();
+	// 5. Terminates the multiblock write, unless it was terminated by an erase-ahead or a suspension
+	if(_sd_write_stream_open)
+		response = _sd_multiblock_close();
+	else
+		response = 0;
 	
 	#ifdef MMCDBG
 		printf_P(PSTR("_sd_multiblock_close: %02X\n"),response);
@@ -979,6 +1540,9 @@ unsigned char sd_streamcache_close(unsigned long *currentsect)
 	
 	// 5. Flag as closed
 	_sd_write_stream_open=0;
+	_sd_streamcache_suspendreq=0;
+	_sd_eraseahead_next=1;
+	_sd_eraseahead_end=0;
 	
 	if(response)
 	{
@@ -988,9 +1552,204 @@ unsigned char sd_streamcache_close(unsigned long *currentsect)
 
 	return 0;
 }
+/******************************************************************************
+	function: sd_streamcache_clearstat
+*******************************************************************************
+	Clears the blocking statistics of streaming writes with caching.
+******************************************************************************/
+void sd_streamcache_clearstat(void)
+{
+	_sdbuffer_maxn=0;
+	_sd_streamcache_numblock=0;
+	_sd_streamcache_maxblocktime=0;
+	_sd_streamcache_numsuspend=0;
+	_sd_streamcache_maxsuspendtime=0;
+	_sd_streamcache_totsuspendtime=0;
+	_sd_eraseahead_num=0;
+	_sd_eraseahead_maxtime=0;
+}
+/******************************************************************************
+	function: sd_streamcache_printstat
+*******************************************************************************
+	Prints the blocking statistics of streaming writes with caching:
+	size of the staging ring, maximum amount of data staged, number of calls
+	to sd_streamcache_write which blocked and the longest blocking time, 
+	and the number and duration of suspensions and erase-ahead of the multiblock write.
+
+	A non-zero number of blocking calls indicates that a larger SD_STAGING_NUMSECTORS
+	is needed to sustain the data rate without stalling the caller.
+
+	Parameters:
+		f			-	Stream on which to print the statistics
+******************************************************************************/
+void sd_streamcache_printstat(FILE *f)
+{
+	fprintf_P(f,PSTR("Staging: %u sectors. Max staged: %u bytes. Blocked: %lu. Max block time: %lu ms\n"),SD_STAGING_NUMSECTORS,_sdbuffer_maxn,_sd_streamcache_numblock,_sd_streamcache_maxblocktime);
+	if(_sd_streamcache_numsuspend)
+		fprintf_P(f,PSTR("Suspended: %lu. Total suspend time: %lu us. Mean: %lu us. Max: %lu us\n"),_sd_streamcache_numsuspend,_sd_streamcache_totsuspendtime,_sd_streamcache_totsuspendtime/_sd_streamcache_numsuspend,_sd_streamcache_maxsuspendtime);
+	if(_sd_eraseahead_num)
+		fprintf_P(f,PSTR("Erase-ahead: %lu chunks of %u sectors. Max erase time: %lu ms\n"),_sd_eraseahead_num,SD_ERASEAHEAD_CHUNK,_sd_eraseahead_maxtime);
+}
+
+/************************************************************************************************************************************************************
+*************************************************************************************************************************************************************
+STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   STREAM READ   
+*************************************************************************************************************************************************************
+************************************************************************************************************************************************************/
+
+unsigned char _sd_read_stream_open;						// Multiblock read open
+unsigned long _sd_read_stream_address;					// Address of the next sector to read
+unsigned long _sd_read_stream_left;						// Number of sectors left in the read-ahead window, 0 if unlimited
+
+/******************************************************************************
+	function: sd_stream_read_open
+*******************************************************************************
+	Starts a streaming read of consecutive sectors at the specified address.
+	
+	Internally a multiblock read (CMD18) is used: compared to sd_block_read 
+	there is no command overhead per sector.
+	
+	The read-ahead window indicates how many sectors the caller intends to read.
+	The multiblock read is terminated as soon as the last sector of the window 
+	is read, which releases the card without a call to sd_stream_read_close.
+	
+	The multiblock read is terminated early by sd_stream_read_close, or by 
+	any other card access (sd_block_read, sd_block_write, sd_stream_open, sd_erase).
+	
+	Parameters:
+		addr		-		Read start address in sectors
+		window		-		Number of sectors to read, or 0 if unknown
+	
+	Returns:
+		0			-		Success
+		other		-		Failure
+******************************************************************************/
+unsigned char sd_stream_read_open(unsigned long addr,unsigned long window)
+{
+	unsigned char rv;
+	
+	sd_stream_read_close();
+	rv = _sd_multiblock_read_open(addr);
+	if(rv)
+		return rv;
+	_sd_read_stream_open=1;
+	_sd_read_stream_address=addr;
+	_sd_read_stream_left=window;
+	return 0;
+}
+/******************************************************************************
+	function: sd_stream_read
+*******************************************************************************
+	Reads the next sector of a streaming read. 
+	
+	When the last sector of the read-ahead window is read the multiblock read 
+	is terminated.
+	
+	Parameters:
+		buffer		-		Buffer of 512 bytes which receives the data
+		checksum	-		Pointer receiving the CRC-16 (CCITT/XMODEM) of the data as sent by the card
+	
+	Returns:
+		0			-		Success
+		other		-		Failure; the streaming read is closed
+******************************************************************************/
+unsigned char sd_stream_read(char *buffer,unsigned short *checksum)
+{
+	if(!_sd_read_stream_open)
+		return 1;
+	if(_sd_readblock_ns(buffer,512,checksum))
+	{
+		sd_stream_read_close();
+		return 1;
+	}
+	_sd_read_stream_address++;
+	if(_sd_read_stream_left)
+	{
+		_sd_read_stream_left--;
+		if(_sd_read_stream_left==0)
+			return sd_stream_read_close();
+	}
+	return 0;
+}
+/******************************************************************************
+	function: sd_read
+*******************************************************************************
+	Reads a sector, using a multiblock read when consecutive sectors are read.
+	
+	If the sector follows the last sector read by an open streaming read, it 
+	is read from that streaming read. Otherwise the streaming read is terminated
+	and: if window is larger than 1 a new streaming read is started at addr with
+	the read-ahead window window; if window is 0 or 1 the sector is read with
+	sd_block_read, which is faster than a multiblock read for a single sector.
+	
+	Parameters:
+		addr		-		Address of the sector to read
+		buffer		-		Buffer of 512 bytes which receives the data
+		window		-		Number of consecutive sectors the caller intends to read from addr
+	
+	Returns:
+		0			-		Success
+		other		-		Failure
+******************************************************************************/
+unsigned char sd_read(unsigned long addr,char *buffer,unsigned long window)
+{
+	unsigned short checksum;
+	
+	if(!(_sd_read_stream_open && _sd_read_stream_address==addr))
+	{
+		if(window<=1)
+			return sd_block_read(addr,buffer);
+		if(sd_stream_read_open(addr,window))
+			return 1;
+	}
+	return sd_stream_read(buffer,&checksum);
+}
+/******************************************************************************
+	function: sd_read_clearstat
+*******************************************************************************
+	Clears the statistics of block reads.
+******************************************************************************/
+void sd_read_clearstat(void)
+{
+	_sd_read_clocked=0;
+	_sd_read_payload=0;
+}
+/******************************************************************************
+	function: sd_read_printstat
+*******************************************************************************
+	Prints the statistics of block reads: number of bytes clocked on SPI by 
+	commands, waits for the data token, data and checksums, per data byte.
+	
+	Parameters:
+		f			-	Stream on which to print the statistics
+******************************************************************************/
+void sd_read_printstat(FILE *f)
+{
+	fprintf_P(f,PSTR("Read: %lu data bytes, %lu bytes clocked"),_sd_read_payload,_sd_read_clocked);
+	if(_sd_read_payload)
+		fprintf_P(f,PSTR(" (%lu.%03lu per data byte)"),_sd_read_clocked/_sd_read_payload,(_sd_read_clocked%_sd_read_payload)*1000/_sd_read_payload);
+	fputc('\n',f);
+}
+/******************************************************************************
+	function: sd_stream_read_close
+*******************************************************************************
+	Terminates a streaming read.
+	
+	Returns:
+		0			-		Success
+		other		-		Failure
+******************************************************************************/
+unsigned char sd_stream_read_close(void)
+{
+	if(!_sd_read_stream_open)
+		return 0;
+	_sd_read_stream_open=0;
+	return _sd_multiblock_read_close();
+}
 
 unsigned char sd_erase(unsigned long addr1,unsigned long addr2)
 {
+	sd_stream_read_close();
 	
 	if(_sd_cmd32(addr1))
 		return 1;
@@ -1000,6 +1759,70 @@ unsigned char sd_erase(unsigned long addr1,unsigned long addr2)
 		return 1;
 	return 0;
 }
+/******************************************************************************
+	function: _sd_erase_chunklast
+*******************************************************************************
+	Returns the last sector of the chunk of SD_ERASEAHEAD_CHUNK sectors 
+	containing next, or end if it comes first.
+******************************************************************************/
+unsigned long _sd_erase_chunklast(unsigned long next,unsigned long end)
+{
+	unsigned long last;
+	
+	last=(next/SD_ERASEAHEAD_CHUNK+1)*SD_ERASEAHEAD_CHUNK-1;
+	if(last>end)
+		last=end;
+	return last;
+}
+/******************************************************************************
+	function: sd_erase_chunk
+*******************************************************************************
+	Erases the sectors from *next up to the end of its chunk of 
+	SD_ERASEAHEAD_CHUNK sectors, or up to end if it comes first, and updates 
+	*next to the first sector which is not erased.
+	
+	Parameters:
+		next		-		Pointer to the first sector to erase
+		end			-		Last sector which may be erased
+	Returns:
+		0			-		Success or nothing to erase
+		other		-		Failure
+******************************************************************************/
+unsigned char sd_erase_chunk(unsigned long *next,unsigned long end)
+{
+	unsigned long last;
+	
+	if(*next>end)
+		return 0;
+	last=_sd_erase_chunklast(*next,end);
+	if(sd_erase(*next,last))
+		return 1;
+	*next=last+1;
+	return 0;
+}
+/******************************************************************************
+	function: sd_erase_upto
+*******************************************************************************
+	Erases chunks from *next (see sd_erase_chunk) until the sector upto is 
+	erased, and updates *next to the first sector which is not erased.
+	
+	Parameters:
+		next		-		Pointer to the first sector to erase
+		upto		-		Sector which must be erased
+		end			-		Last sector which may be erased
+	Returns:
+		0			-		Success or nothing to erase
+		other		-		Failure
+******************************************************************************/
+unsigned char sd_erase_upto(unsigned long *next,unsigned long upto,unsigned long end)
+{
+	while(*next<=upto && *next<=end)
+	{
+		if(sd_erase_chunk(next,end))
+			return 1;
+	}
+	return 0;
+}
 
 /************************************************************************************************************************************************************
 *************************************************************************************************************************************************************
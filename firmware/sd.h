@@ -10,9 +10,11 @@
 #define SD_SEND_IF_COND							8
 #define MMC_SEND_CSD							9
 #define MMC_SEND_CID							10
+#define MMC_STOP_TRANSMISSION					12
 #define MMC_SEND_STATUS							13
 #define MMC_SET_BLOCKLEN						16
 #define MMC_READ_SINGLE_BLOCK					17
+#define MMC_READ_MULTIPLE_BLOCK					18
 #define MMC_WRITE_BLOCK							24
 #define MMC_WRITE_MULTIPLE_BLOCK				25
 #define MMC_PROGRAM_CSD							27
@@ -49,7 +51,28 @@
 
 #define SD_CHECK_BIT							0x80			// MSB set to 0 indicates R1 answer
 
-#define SD_CACHE_SIZE 512
+// Number of 512-byte sectors in the staging ring used by streaming writes with caching.
+// Each additional sector allows to hide a further ~1ms of card busy time at 512KB/s; override with -DSD_STAGING_NUMSECTORS=n.
+// RAM: the default ring and _sdrecord use about 1.1KB of the 16KB of the ATmega1284P.
+#ifndef SD_STAGING_NUMSECTORS
+#define SD_STAGING_NUMSECTORS	2
+#endif
+#define SD_CACHE_SIZE (SD_STAGING_NUMSECTORS*512)
+// Maximum size of a record serialised in place with sd_streamcache_reserve
+#define SD_RECORD_MAXSIZE		64
+
+// Erase-ahead of streaming writes. The area is erased by chunks of SD_ERASEAHEAD_CHUNK sectors aligned on multiples of the chunk size (4MB: a multiple of the allocation unit of most cards).
+#ifndef SD_ERASEAHEAD_CHUNK
+#define SD_ERASEAHEAD_CHUNK		8192
+#endif
+// The next chunk is erased when the write address is within SD_ERASEAHEAD_MARGIN sectors of the end of the erased area and the staging ring is nearly empty,
+// or in any case when the write address is within SD_ERASEAHEAD_MIN sectors of the end of the erased area.
+#ifndef SD_ERASEAHEAD_MARGIN
+#define SD_ERASEAHEAD_MARGIN	4096
+#endif
+#ifndef SD_ERASEAHEAD_MIN
+#define SD_ERASEAHEAD_MIN		1024
+#endif
 
 
 #define SD_CRC_CMD55							0x65
@@ -61,6 +84,9 @@
 //#define MMCCLOCKMORE
 
 extern unsigned short _sdbuffer_n;
+extern unsigned short _sdbuffer_maxn;
+extern unsigned long _sd_streamcache_numblock;
+extern unsigned long _sd_streamcache_maxblocktime;
 
 
 void sd_select_n(char ss);
@@ -84,11 +110,34 @@ void sd_stream_open(unsigned long addr,unsigned long preerase);
 unsigned char sd_stream_close(unsigned long *currentaddr);
 unsigned char sd_stream_write(char *buffer,unsigned short size,unsigned long *currentsect);
 unsigned char sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentaddr);
+unsigned char _sd_streamcache_write(char *buffer,unsigned short size,unsigned long *currentaddr);
 //unsigned char sd_write_stream_write_block(unsigned char *buffer,unsigned long *currentaddr);
 //unsigned char sd_write_stream_write_block2(unsigned char *buffer,unsigned long *currentaddr);
 unsigned char sd_streamcache_close(unsigned long *currentaddr);
+unsigned char sd_streamcache_poll(void);
+char *sd_streamcache_reserve(unsigned short size);
+void sd_streamcache_suspend(void (*cb)(unsigned long));
+void _sd_streamcache_dosuspend(void);
+void _sd_streamcache_stop(void);
+unsigned char sd_streamcache_eraseahead(unsigned long end);
+void _sd_streamcache_doeraseahead(void);
+unsigned char _sd_streamcache_eraseready(unsigned char *error);
+unsigned char sd_streamcache_commit(unsigned short size);
+void sd_streamcache_clearstat(void);
+void sd_streamcache_printstat(FILE *f);
+
+// Multiblock stream read
+unsigned char sd_stream_read_open(unsigned long addr,unsigned long window);
+unsigned char sd_stream_read(char *buffer,unsigned short *checksum);
+unsigned char sd_stream_read_close(void);
+unsigned char sd_read(unsigned long addr,char *buffer,unsigned long window);
+void sd_read_clearstat(void);
+void sd_read_printstat(FILE *f);
 
 unsigned char sd_erase(unsigned long addr1,unsigned long addr2);
+unsigned long _sd_erase_chunklast(unsigned long next,unsigned long end);
+unsigned char sd_erase_chunk(unsigned long *next,unsigned long end);
+unsigned char sd_erase_upto(unsigned long *next,unsigned long upto,unsigned long end);
 
 // Print functions
 void sd_print_csd(FILE *f,CSD *csd);
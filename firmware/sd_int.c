@@ -1,9 +1,6 @@
 #include "cpu.h"
 #include <avr/io.h>
 #include <avr/pgmspace.h>
-#include <avr/sleep.h>
-#include <avr/power.h>
-#include <avr/eeprom.h>
 #include <util/delay.h>
 #include <stdio.h>
 #include <string.h>
@@ -83,7 +80,11 @@
 	* _sd_multiblock_open:			Selects the card and starts a multiblock write by sending the MMC_WRITE_MULTIPLE_BLOCK command.
 	* _sd_multiblock_close: 		Terminates the multiblock write by sending MMC_STOPBLOCK and deselecting the card.
 	
+	* _sd_multiblock_read_open:		Selects the card and starts a multiblock read by sending the MMC_READ_MULTIPLE_BLOCK command.
+	* _sd_multiblock_read_close:	Terminates the multiblock read by sending MMC_STOP_TRANSMISSION and deselecting the card.
+	
 	Note that there is no internal "_sd_multiblock write" in this library; use _sd_writebuffer internally.
+	Blocks of a multiblock read are read with _sd_readblock_ns.
 
 	
 	
@@ -128,6 +129,9 @@
 	
 */
 
+unsigned long _sd_read_clocked;							// Number of bytes clocked on SPI by block reads (commands, waits, data, checksums)
+unsigned long _sd_read_payload;							// Number of data bytes read by block reads
+
 /************************************************************************************************************************************************************
 *************************************************************************************************************************************************************
 LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   LOW-LEVEL   
@@ -381,6 +385,7 @@ unsigned char _sd_waitblock_ns(void)
 {
 	unsigned long int t1;
 	unsigned char r1;
+	unsigned short n=0;
 	#ifdef MMCDBG
 	unsigned long nit=0;
 	#endif
@@ -388,6 +393,7 @@ unsigned char _sd_waitblock_ns(void)
 	do
 	{
 		r1 = spi_rw_noselect(0xFF);
+		n++;
 		
 		#ifdef MMCDBG
 		printf_P(PSTR("_sd_waitblock_ns: %X\n"),r1);
@@ -395,6 +401,7 @@ unsigned char _sd_waitblock_ns(void)
 		#endif
 	}
 	while(r1!= MMC_STARTBLOCK && (timer_ms_get()-t1<MMC_TIMEOUT_READWRITE));
+	_sd_read_clocked+=n;
 	#ifdef MMCDBG
 	printf("nit waiting start: %lu\n",nit);
 	#endif
@@ -423,8 +430,6 @@ unsigned char _sd_waitblock_ns(void)
 ******************************************************************************/
 unsigned char _sd_readblock_ns(char *buffer,unsigned short n,unsigned short *checksum)
 {
-	unsigned short i;
-
 	if(_sd_waitblock_ns())
 	{
 		// Waitblock timed out
@@ -432,10 +437,9 @@ unsigned char _sd_readblock_ns(char *buffer,unsigned short n,unsigned short *che
 	}
 
 	// read in data
-	for(i=0; i<n;i++)
-	{
-		*buffer++ = spi_rw_noselect(0xFF);
-	}	
+	spi_rn_noselect(buffer,n);
+	_sd_read_clocked+=n+2;
+	_sd_read_payload+=n;
 	
 	// Read 16-bit CRC
 	*checksum = spi_rw_noselect(0xFF);
@@ -500,9 +504,11 @@ unsigned char _sd_command_r1_datablock_ns(unsigned char cmd,unsigned char p1,uns
 
 	// Wait until an answer is received, or a timeout occurs	
 	t1 = timer_ms_get();
+	_sd_read_clocked+=7;
 	do
 	{
 		c = spi_rw_noselect(0xFF);
+		_sd_read_clocked++;
 		#ifdef MMCDBG
 			printf_P(PSTR("  <-%02Xh\n"),c);
 		#endif
@@ -781,6 +787,38 @@ unsigned char _sd_cmd38(void)
 	return 0;
 }
 
+/******************************************************************************
+	function: _sd_cmd38_nowait
+*******************************************************************************	
+	Issue CMD38 like _sd_cmd38 but returns without waiting for the erase to 
+	complete. 
+	
+	In case of success the card is left selected and busy: the caller must clock
+	0xFF with spi_rw_noselect until the card answers 0xFF, and deselect the card.
+				
+	Parameters:
+	
+	Returns:
+		0				-	Success
+		1				-	Error
+******************************************************************************/
+unsigned char _sd_cmd38_nowait(void)
+{
+	unsigned char crc = _sd_crc7command(MMC_ERASE,0,0,0,0);	
+	
+	sd_select_n(0);
+	unsigned char r1 = _sd_command_rn_ns(MMC_ERASE,0,0,0,0,crc,0,0);	
+	#ifdef MMCDBG
+		printf("R1b: %02X\n",r1);	
+	#endif
+	if(r1)
+	{
+		sd_select_n(1);
+		return 1;
+	}
+	return 0;
+}
+
 /******************************************************************************
 	function: _sd_acmd13
 *******************************************************************************	
@@ -1318,11 +1356,15 @@ unsigned char _sd_multiblock_close(void)
 	// Send Stop Tran token
 	response = spi_rw_noselect(MMC_STOPMULTIBLOCK);
 	
-	printf("resp stop mb: %02X\n",response);
+	#ifdef MMCDBG
+		printf("resp stop mb: %02X\n",response);
+	#endif
 	
 	response=_sd_block_stop_dowait();
 
-	printf("resp stop dowait: %02X\n",response);
+	#ifdef MMCDBG
+		printf("resp stop dowait: %02X\n",response);
+	#endif
 
 	//testfewmore();
 	
@@ -1332,6 +1374,109 @@ unsigned char _sd_multiblock_close(void)
 	return response;
 }
 
+/******************************************************************************
+	_sd_multiblock_read_open
+*******************************************************************************
+	Selects the card and starts a multiblock read by sending the MMC_READ_MULTIPLE_BLOCK command.
+	The blocks are then read with _sd_readblock_ns until _sd_multiblock_read_close 
+	is called. The card may be left selected without clocking between blocks.
+		
+	Parameters:
+		addr		-	Read start address in sectors
+			
+	Returns:
+		0			-	Ok
+		other		-	Error
+******************************************************************************/
+unsigned char _sd_multiblock_read_open(unsigned long addr)
+{
+	unsigned char r1;
+	unsigned long int t1;
+
+	#ifdef MMCDBG
+		printf_P(PSTR("_sd_multiblock_read_open\r"));
+	#endif	
+
+	sd_select_n(0);				//	Select card
+	spi_rw_noselect(0xFF);		// Preclock
+	spi_rw_noselect(MMC_READ_MULTIPLE_BLOCK|0x40);
+	spi_rw_noselect(addr>>24);
+	spi_rw_noselect(addr>>16);
+	spi_rw_noselect(addr>>8);
+	spi_rw_noselect(addr);
+	spi_rw_noselect(0x95);
+	_sd_read_clocked+=7;
+	
+	// Wait for R1
+	t1 = timer_ms_get();
+	do
+	{
+		r1 = spi_rw_noselect(0xFF);
+		_sd_read_clocked++;
+	}
+	while( (r1&SD_CHECK_BIT) && (timer_ms_get()-t1<MMC_TIMEOUT_ICOMMAND));
+	if (r1!=0)					// Command failed
+	{
+		sd_select_n(1);			// Deselect card
+		return r1|1;
+	}
+	return 0;
+}
+/******************************************************************************
+	_sd_multiblock_read_close
+*******************************************************************************
+	Terminates the multiblock read by sending MMC_STOP_TRANSMISSION and deselecting the card.
+	
+	The byte following the command is a stuff byte which is discarded before 
+	waiting for the R1 answer; the card is then busy until the read is stopped.
+
+	Returns:
+		0			-	Ok
+		other		-	Error
+******************************************************************************/
+unsigned char _sd_multiblock_read_close(void)
+{
+	unsigned char r1;
+	unsigned long int t1;
+
+	#ifdef MMCDBG
+		printf_P(PSTR("_sd_multiblock_read_close\r"));
+	#endif
+
+	spi_rw_noselect(MMC_STOP_TRANSMISSION|0x40);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0);
+	spi_rw_noselect(0x61);			// CRC of CMD12
+	spi_rw_noselect(0xFF);			// Stuff byte
+	_sd_read_clocked+=7;
+
+	// Wait for R1
+	t1 = timer_ms_get();
+	do
+	{
+		r1 = spi_rw_noselect(0xFF);
+		_sd_read_clocked++;
+	}
+	while( (r1&SD_CHECK_BIT) && (timer_ms_get()-t1<MMC_TIMEOUT_ICOMMAND));
+
+	// Wait until not busy
+	do
+	{
+		_sd_read_clocked++;
+		if(spi_rw_noselect(0xFF)==0xFF)
+			break;
+	}
+	while(timer_ms_get()-t1<MMC_TIMEOUT_READWRITE);
+	if(timer_ms_get()-t1>=MMC_TIMEOUT_READWRITE)
+		r1|=SD_CHECK_BIT;
+
+	sd_select_n(1);					// Deselect card
+
+	return r1;
+}
+
 /******************************************************************************
 	function: _sd_wait_notbusy
 *******************************************************************************	
@@ -84,6 +84,9 @@ typedef struct _SDSTAT {
 	
 } SDSTAT;
 
+extern unsigned long _sd_read_clocked;
+extern unsigned long _sd_read_payload;
+
 
 
 
@@ -114,6 +117,7 @@ unsigned char _sd_acmd23_ns(unsigned long num);
 unsigned char _sd_cmd32(unsigned long addr);
 unsigned char _sd_cmd33(unsigned long addr);
 unsigned char _sd_cmd38(void);
+unsigned char _sd_cmd38_nowait(void);
 unsigned char _sd_cmd58(OCR *ocr);
 
 
@@ -135,6 +139,10 @@ void _sd_writeconst(unsigned char b,unsigned short size);
 unsigned char _sd_multiblock_open(unsigned long addr,unsigned long preerase);
 unsigned char _sd_multiblock_close(void);
 
+// Internal multiblock reads
+unsigned char _sd_multiblock_read_open(unsigned long addr);
+unsigned char _sd_multiblock_read_close(void);
+
 // Helpers
 unsigned char __sd_wait_notbusy(unsigned long timeout);
 
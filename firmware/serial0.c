@@ -233,10 +233,8 @@ int uart0_fgetchar_int(FILE *stream)
 ******************************************************************************/
 unsigned char uart0_fputbuf_int(char *data,unsigned char n)
 {
-	if(uart0_txbufferfree()>=n)
+	if(buffer_write(&SerialData0Tx,data,n)==0)
 	{
-		for(unsigned short i=0;i<n;i++)
-			buffer_put(&SerialData0Tx,data[i]);
 		// Trigger an interrupt when UDR is empty
 		UCSR0B|=(1<<UDRIE0);		
 		return 0;
@@ -38,6 +38,7 @@ CIRCULARBUFFER SerialData1Rx;
 CIRCULARBUFFER SerialData1Tx;
 
 volatile unsigned long Serial1DOR=0;
+volatile unsigned long Serial1TxInt=0;			// Number of transmit interrupts, to compute the number of bytes per interrupt
 
 // Memory for the serial buffers
 unsigned char _serial1_rx_buffer[SERIAL1_RX_BUFFERSIZE_MAX];
@@ -265,10 +266,8 @@ int uart1_fgetchar_int(FILE *stream)
 ******************************************************************************/
 unsigned char uart1_fputbuf_int(char *data,unsigned char n)
 {
-	if(uart1_txbufferfree()>=n)
+	if(buffer_write(&SerialData1Tx,data,n)==0)
 	{
-		for(unsigned short i=0;i<n;i++)
-			buffer_put(&SerialData1Tx,data[i]);
 		// Trigger an interrupt when UDR is empty
 		UCSR1B|=(1<<UDRIE1);		
 		// XXX
@@ -285,23 +284,35 @@ unsigned char uart1_fputbuf_int(char *data,unsigned char n)
 */
 ISR(USART1_UDRE_vect)
 {
-	#ifdef ENABLE_BLUETOOTH_RTS
-	// If RTS is enabled, and RTS is set, clear the interrupt flag and return (i.e. do nothing because the receiver is busy)
-	//_delay_us(10);
-	if(PIND&0x10)
-	{
-		UCSR1B&=~(1<<UDRIE1);								// Deactivate interrupt otherwise we reenter continuously the loop
-		return;
-	}
-#endif
+	// The transmit buffer is accessed directly rather than with the circbuf functions: without function calls the 
+	// compiler saves much fewer registers in the interrupt prologue.
+	// The loop writes a second byte in the same interrupt when the first one moved to the shift register immediately
+	// (transmitter idle), and publishes the read pointer once.
+	unsigned short rdptr=SerialData1Tx.rdptr;
+	unsigned short wrptr=SerialData1Tx.wrptr;
 	
-	if(buffer_isempty(&SerialData1Tx))					// No data to transmit
+	Serial1TxInt++;
+	do
 	{
-		UCSR1B&=~(1<<UDRIE1);								// Deactivate interrupt otherwise we reenter continuously the loop
-		return;
+#ifdef ENABLE_BLUETOOTH_RTS
+		// If RTS is enabled, and RTS is set, clear the interrupt flag and return (i.e. do nothing because the receiver is busy)
+		if(PIND&0x10)
+		{
+			UCSR1B&=~(1<<UDRIE1);								// Deactivate interrupt otherwise we reenter continuously the loop
+			break;
+		}
+#endif
+		if(rdptr==wrptr)									// No data to transmit
+		{
+			UCSR1B&=~(1<<UDRIE1);								// Deactivate interrupt otherwise we reenter continuously the loop
+			break;
+		}
+		// Write data
+		UDR1 = _serial1_tx_buffer[rdptr];
+		rdptr=(rdptr+1)&(SERIAL1_TX_BUFFERSIZE_MAX-1);
 	}
-	// Write data
-	UDR1 = buffer_get(&SerialData1Tx);
+	while(UCSR1A&(1<<UDRE1));
+	SerialData1Tx.rdptr=rdptr;
 }
 /*ISR(USART1_TX_vect)
 {
@@ -42,6 +42,7 @@ void Serial1RTSToggle(unsigned char rts);
 void USART1_RX_vect_core(void);
 
 extern volatile unsigned long Serial1DOR;
+extern volatile unsigned long Serial1TxInt;
 
 // Callbacks for hooking into the interrupt routines.
 extern unsigned char  (*uart1_rx_callback)(unsigned char);
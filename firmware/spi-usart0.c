@@ -45,6 +45,7 @@
 	* spiusart0_rwn:		selects the peripheral and exchanges n byte. Waits for peripheral available before start, waits for completion. Do not use in interrupts.
 	* spiusart0_rwn_int:	selects the peripheral and exchanges n byte using interrupt-driven transfer.  Waits for peripheral available before start, waits for completion. Do not use in interrupts.
 	* spiusart0_rwn_int_cb:	selects the peripheral and exchanges n byte using interrupt-driven transfer. Returns if peripheral not available, calls a callback on transfer completion. Interrupt safe.
+	* spiusart0_rwn_int_cb_queue:	as spiusart0_rwn_int_cb, but if the peripheral is busy the transfer is queued and started as soon as the peripheral is released. Interrupt safe.
 	
 
 	The only function safe to call from an interrupt routing is spiusart0_rwn_int_cb. The other functions can cause deadlocks and must not be used in interrupts.
@@ -54,6 +55,9 @@
 	
 	The peripheral is selected with macros SPIUSART0_SELECT and SPIUSART0_DESELECT. When the assembly ISR is used, the file spi-usart0-isr.S must be modified to handle the select/deselect.
 	
+	A single transfer can be queued with spiusart0_rwn_int_cb_queue. The queued transfer is started when the peripheral is released, i.e. at the end of
+	a blocking transfer or in the ISR after the callback of an interrupt-driven transfer.
+	
 */
 
 
@@ -74,6 +78,10 @@ volatile unsigned short _spiusart0_n;
 volatile unsigned char _spiusart0_ongoing=0;
 void (*_spiusart0_callback)(void);
 volatile unsigned int _spiusart0_txint=0;
+// Queued transfer: _spiusart0_qn is non-zero when a transfer is queued
+volatile unsigned char _spiusart0_qn=0;
+unsigned char *_spiusart0_qptr;
+void (*_spiusart0_qcb)(void);
 
 
 extern void spiisr(void);
@@ -144,7 +152,9 @@ void vector22x(void)
 		if(_spiusart0_callback)
 			_spiusart0_callback();
 		
-		
+		// Start the queued transfer, if any
+		if(_spiusart0_qn)
+			_spiusart0_startqueued();
 		
 		return;
 	}
@@ -188,6 +198,7 @@ void spiusart0_init(void)
 	
 	
 	_spiusart0_ongoing=0;
+	_spiusart0_qn=0;
 	
 	printf_P(PSTR("SPI USART: A: %02X B: %02X C: %02X\n"),UCSR0A,UCSR0B,UCSR0C);
 }
@@ -226,6 +237,64 @@ void _spiusart0_waitavailandreserve(void)
 	return;
 	//while(_spiusart0_ongoing);
 }
+/******************************************************************************
+	function: _spiusart0_release
+*******************************************************************************	
+	Indicates the end of a transaction reserved with _spiusart0_waitavailandreserve
+	or _spiusart0_tryavailandreserve, and starts the queued transfer if any.
+******************************************************************************/
+void _spiusart0_release(void)
+{
+	_spiusart0_ongoing=0;
+	if(_spiusart0_qn)
+		_spiusart0_startqueued();
+}
+/******************************************************************************
+	function: _spiusart0_startqueued
+*******************************************************************************	
+	Starts the transfer queued by spiusart0_rwn_int_cb_queue, if any, and if
+	the peripheral is available. 
+	
+	Called when the peripheral is released, including from the SPI ISR.
+******************************************************************************/
+void _spiusart0_startqueued(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(_spiusart0_qn && !_spiusart0_ongoing)
+		{
+			unsigned char n = _spiusart0_qn;
+			_spiusart0_qn=0;
+			spiusart0_rwn_int_cb(_spiusart0_qptr,n,_spiusart0_qcb);
+		}
+	}
+}
+/******************************************************************************
+	function: spiusart0_setdivider
+*******************************************************************************	
+	Sets the SPI clock divider (UBRR0). The SPI clock is fclk/(2*(ubrr+1)).
+	
+	Waits until the SPI interface is available. Do not call in an interrupt 
+	routine.
+	
+	Parameters:
+		ubrr	-	Value for UBRR0
+******************************************************************************/
+void spiusart0_setdivider(unsigned char ubrr)
+{
+	_spiusart0_waitavailandreserve();
+	UBRR0=ubrr;
+	_spiusart0_release();
+}
+/******************************************************************************
+	function: spiusart0_getdivider
+*******************************************************************************	
+	Returns the SPI clock divider (UBRR0).
+******************************************************************************/
+unsigned char spiusart0_getdivider(void)
+{
+	return UBRR0;
+}
 /******************************************************************************
 	function: _spiusart0_tryavailandreserve
 *******************************************************************************	
@@ -291,7 +360,7 @@ unsigned char spiusart0_rw(unsigned char data)
 
 	// Get the data before indicating the peripheral is available
 	data = UDR0;
-	_spiusart0_ongoing=0;
+	_spiusart0_release();
 	return data;			
 }
 
@@ -334,7 +403,7 @@ void spiusart0_rwn(unsigned char *ptr,unsigned char n)
 	
 	SPIUSART0_DESELECT;
 	
-	_spiusart0_ongoing=0;
+	_spiusart0_release();
 
 	return;				// To avoid compiler complaining
 }
@@ -382,7 +451,7 @@ unsigned char spiusart0_rwn_try(unsigned char *ptr,unsigned char n)
 	
 	SPIUSART0_DESELECT;
 	
-	_spiusart0_ongoing=0;
+	_spiusart0_release();
 
 	return 0;
 }
@@ -549,6 +618,65 @@ unsigned char spiusart0_rwn_int_cb(unsigned char *ptr,unsigned char n,void (*cb)
 	return 0;
 }
 
+/******************************************************************************
+	function: spiusart0_rwn_int_cb_queue
+*******************************************************************************	
+	Read/write n bytes in the provided buffer using interrupts. 
+	
+	If the SPI interface is available the transfer starts immediately, 
+	otherwise it is queued and starts as soon as the interface is released.
+	A single transfer can be queued. A callback is called upon completion of 
+	the transfer.
+	
+	This function can be called in an interrupt safely.
+	
+	Parameters:
+		ptr					-	Pointer where the data to send and receive is stored.
+		n					-	Number of bytes to exchange; must be non-zero
+		cb					-	Callback called upon completion
+	
+	Return:
+			0:		Transaction initiated or queued
+			1:		Error: another transaction is already queued
+******************************************************************************/
+unsigned char spiusart0_rwn_int_cb_queue(unsigned char *ptr,unsigned char n,void (*cb)(void))
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(!_spiusart0_ongoing)
+		{
+			spiusart0_rwn_int_cb(ptr,n,cb);
+			return 0;
+		}
+		if(_spiusart0_qn)
+			return 1;
+		_spiusart0_qptr=ptr;
+		_spiusart0_qcb=cb;
+		_spiusart0_qn=n;
+	}
+	return 0;
+}
+
+/******************************************************************************
+	function: spiusart0_rwn_int_cb_unqueue
+*******************************************************************************	
+	Removes the transfer queued by spiusart0_rwn_int_cb_queue if it has the 
+	callback cb. A transfer which is already started is not affected.
+	
+	This function can be called in an interrupt safely.
+	
+	Parameters:
+		cb					-	Callback of the queued transfer to remove
+******************************************************************************/
+void spiusart0_rwn_int_cb_unqueue(void (*cb)(void))
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(_spiusart0_qn && _spiusart0_qcb==cb)
+			_spiusart0_qn=0;
+	}
+}
+
 /******************************************************************************
 	function: spiusart0_isbusy
 *******************************************************************************	
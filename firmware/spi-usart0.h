@@ -9,18 +9,25 @@ extern volatile unsigned char *_spiusart0_bufferptr;
 extern volatile unsigned short _spiusart0_n;
 extern volatile unsigned char _spiusart0_ongoing;
 extern void (*_spiusart0_callback)(void);
+extern volatile unsigned char _spiusart0_qn;
 
 
 void spiusart0_init(void);
 void spiusart0_deinit(void);
 void _spiusart0_waitavailandreserve(void);
 unsigned char _spiusart0_tryavailandreserve(void);
+void _spiusart0_release(void);
+extern "C" void _spiusart0_startqueued(void);
+void spiusart0_setdivider(unsigned char ubrr);
+unsigned char spiusart0_getdivider(void);
 unsigned char spiusart0_rw(unsigned char d);
 void spiusart0_rwn(unsigned char *ptr,unsigned char n);
 unsigned char spiusart0_rwn_try(unsigned char *ptr,unsigned char n);
 void spiusart0_rwn_int(unsigned char *ptr,unsigned char n);
 void spiusart0_rwn_int(unsigned char *ptr,unsigned char n);
 unsigned char spiusart0_rwn_int_cb(unsigned char *ptr,unsigned char n,void (*cb)(void));
+unsigned char spiusart0_rwn_int_cb_queue(unsigned char *ptr,unsigned char n,void (*cb)(void));
+void spiusart0_rwn_int_cb_unqueue(void (*cb)(void));
 unsigned char spiusart0_isbusy(void);
 
 // Callbacks for interrupt-driven read with user callback
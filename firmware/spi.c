@@ -40,6 +40,7 @@
 	* spi_rwn:						Exchanges n bytes with the SPI slave.
 	* spi_rwn_noselect: 			Exchanges n bytes with the SPI slave.
 	* spi_wn_noselect:				Writes n bytes to an SPI slave without storing the value returned by the slave.
+	* spi_rn_noselect:				Reads n bytes from an SPI slave, sending 0xFF.
 	
 	
 	
@@ -249,4 +250,35 @@ void spi_wn_noselect(char *ptr,unsigned short n)
 		n--;
 	}
 }
-
+/******************************************************************************
+	function: spi_rn_noselect
+*******************************************************************************	
+	Reads n bytes from an SPI slave, sending 0xFF for each byte (e.g. to read 
+	data blocks from SD cards).
+	
+	This function is faster than spi_rwn_noselect as the data to send needs not 
+	be loaded from the buffer.
+	
+	This function does not select/deselect the slave; this must be done by user
+	code.
+		
+	Parameters:
+		ptr		-	buffer where the data read from the slave will be stored
+		n		-	number of bytes to read from the slave
+		
+	Returns:
+		-
+******************************************************************************/
+void spi_rn_noselect(char *ptr,unsigned short n)
+{
+	while(n!=0)
+	{
+		SPDR = 0xFF;
+		
+		while(!(SPSR & (1<<SPIF))); 				//the SPIF Bit ist set when transfer complete...
+		
+		*ptr=SPDR;
+		ptr++;
+		n--;
+	}
+}
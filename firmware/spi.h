@@ -24,6 +24,7 @@ void spi_rwn(char *ptr,unsigned char n);
 void spi_rwn_noselect(char *ptr,unsigned short n);
 void spi_rwn_int(char *ptr,unsigned char n);
 void spi_wn_noselect(char *ptr,unsigned short n);
+void spi_rn_noselect(char *ptr,unsigned short n);
 
 
 #endif
\ No newline at end of file
@@ -37,6 +37,7 @@
 #include "spi.h"
 #include "sd.h"
 #include "ufat.h"
+#include "test_sd.h"
 
 
 
@@ -615,6 +616,7 @@ void sd_bench_streamcache_write2(unsigned long startsect,unsigned long size,unsi
 	
 	printf_P(PSTR("Benchmarking stream block write from %lu writing 512 bytes up to %lu with %lu pre-erased sectors\n"),startsect,size,preerase);
 	sd_stream_open(startsect,preerase);
+	sd_streamcache_clearstat();
 	
 	cursize=0;
 	pkt=0;
@@ -671,6 +673,7 @@ void sd_bench_streamcache_write2(unsigned long startsect,unsigned long size,unsi
 		startsect++;
 	}
 	printf("Done. Num fail: %lu. Wrote: %lu\n",numfail,cursize);
+	sd_streamcache_printstat(file_pri);
 	printhist(hist1,hist10,hist100);
 	printf("Worst times:\n");
 	for(int i=0;i<20;i++)
@@ -759,3 +762,222 @@ void sd_bench_streamcache_write2(unsigned long startsect,unsigned long size,unsi
 	}
 	
 }*/
+/******************************************************************************
+	Latency characterisation
+*******************************************************************************	
+	sd_bench_latency measures the latency of each sector write with the write 
+	methods used by the firmware and recommends the number of sectors of the 
+	staging ring (SD_STAGING_NUMSECTORS) for a given data rate.
+	
+	The latencies are kept in logarithmic histograms (SDLATENCY); p50 and p99 
+	are the upper bound of the histogram bin, max is exact.
+******************************************************************************/
+void sd_lat_clear(SDLATENCY *l)
+{
+	memset(l,0,sizeof(SDLATENCY));
+}
+void sd_lat_insert(SDLATENCY *l,unsigned long us)
+{
+	unsigned char b=0;
+	unsigned long v=us>>6;
+	
+	while(v && b<SD_LAT_NUMBIN-1)
+	{
+		v>>=1;
+		b++;
+	}
+	l->bin[b]++;
+	l->n++;
+	l->tot+=us;
+	if(us>l->max)
+		l->max=us;
+	if(us>=1000)
+	{
+		l->numbusy++;
+		l->totbusy+=us;
+	}
+}
+/******************************************************************************
+	function: sd_lat_percentile
+*******************************************************************************	
+	Returns the upper bound of the histogram bin which contains the given 
+	percentile, capped to the longest latency.
+	
+	Parameters:
+		l			-	Latency histogram
+		permil		-	Percentile in per mil (e.g. 990 for p99)
+	Returns:
+		Latency in us
+******************************************************************************/
+unsigned long sd_lat_percentile(SDLATENCY *l,unsigned short permil)
+{
+	unsigned long cum=0,ub;
+	
+	for(unsigned char b=0;b<SD_LAT_NUMBIN;b++)
+	{
+		cum+=l->bin[b];
+		if(cum*1000>=l->n*permil)
+		{
+			ub=64l<<b;
+			if(ub>l->max || b==SD_LAT_NUMBIN-1)
+				ub=l->max;
+			return ub;
+		}
+	}
+	return l->max;
+}
+void sd_lat_print(FILE *f,SDLATENCY *l)
+{
+	unsigned long mean=l->n?l->tot/l->n:0;
+	
+	fprintf_P(f,PSTR("\tn: %lu mean: %lu p50: %lu p99: %lu max: %lu us. Busy (>1ms): %lu writes, %lu ms\n"),l->n,mean,sd_lat_percentile(l,500),sd_lat_percentile(l,990),l->max,l->numbusy,l->totbusy/1000);
+	fprintf_P(f,PSTR("\t"));
+	for(unsigned char b=0;b<SD_LAT_NUMBIN;b++)
+		fprintf_P(f,PSTR("<%lu:%lu "),64l<<b,l->bin[b]);
+	fprintf_P(f,PSTR("\n"));
+}
+/******************************************************************************
+	function: sd_bench_latency_run
+*******************************************************************************	
+	Writes numsect sectors from startsect with one of the write methods and 
+	records the latency of each sector write.
+	
+	Parameters:
+		type		-	0: single block writes (sd_block_write)
+						1: multiblock write (sd_stream_write)
+						2: multiblock write with pre-erase of numsect sectors (ACMD23)
+						3: multiblock write after erasing the area (sd_erase)
+						4: multiblock write with caching (sd_streamcache_write)
+		startsect	-	First sector to write
+		numsect		-	Number of sectors to write
+		l			-	Latency histogram
+	Returns:
+		0			-	Success
+		Nonzero		-	Error
+******************************************************************************/
+unsigned char sd_bench_latency_run(unsigned char type,unsigned long startsect,unsigned long numsect,SDLATENCY *l)
+{
+	unsigned long t1,t2;
+	unsigned char rv=0;
+	
+	memset(ufatblock,'0',512);
+	sd_lat_clear(l);
+	
+	if(type==3)
+	{
+		if(sd_erase(startsect,startsect+numsect-1))
+			return 1;
+	}
+	if(type>=1)
+		sd_stream_open(startsect,type==2?numsect:0);
+	if(type==4)
+		sd_streamcache_clearstat();
+	
+	for(unsigned long i=0;i<numsect && !rv;i++)
+	{
+		format1u32(ufatblock,i);
+		t1=timer_us_get();
+		switch(type)
+		{
+			case 0:
+				rv=sd_block_write(startsect+i,ufatblock);
+				break;
+			case 4:
+				rv=sd_streamcache_write(ufatblock,512,0);
+				break;
+			default:
+				rv=sd_stream_write(ufatblock,512,0);
+		}
+		t2=timer_us_get();
+		sd_lat_insert(l,t2-t1);
+	}
+	
+	if(type==4)
+	{
+		if(sd_streamcache_close(0))
+			rv=1;
+	}
+	else if(type>=1)
+	{
+		if(sd_stream_close(0))
+			rv=1;
+	}
+	return rv;
+}
+/******************************************************************************
+	function: sd_bench_latency
+*******************************************************************************	
+	Characterises the write latency of the card with all the write methods of 
+	sd_bench_latency_run and recommends the size of the staging ring.
+	
+	Each method writes numsect sectors in its own area: 5*numsect sectors
+	from startsect are overwritten.
+	
+	The staging ring must hold the data produced while the card is busy. The 
+	recommendation is based on the multiblock write after erase, which is how 
+	logs are written (see sd_streamcache_eraseahead): one sector plus the data 
+	produced during the longest (resp. p99) write.
+	
+	Parameters:
+		startsect	-	First sector to write
+		numsect		-	Number of sectors to write with each method
+		samplerate	-	Sample rate in Hz of the data to log
+		samplesize	-	Size in bytes of a logged sample
+******************************************************************************/
+void sd_bench_latency(unsigned long startsect,unsigned long numsect,unsigned short samplerate,unsigned short samplesize)
+{
+	SDLATENCY l;
+	unsigned long rate,lat,bytes;
+	unsigned long maxlat=0,p99lat=0;
+	const char *name[5]={PSTR("single block"),PSTR("multiblock"),PSTR("multiblock, pre-erase"),PSTR("multiblock, erased"),PSTR("multiblock, cached")};
+	
+	for(unsigned char type=0;type<5;type++)
+	{
+		fprintf_P(file_pri,PSTR("%S: sectors %lu-%lu\n"),name[type],startsect+type*numsect,startsect+(type+1)*numsect-1);
+		if(sd_bench_latency_run(type,startsect+type*numsect,numsect,&l))
+			fprintf_P(file_pri,PSTR("\terror\n"));
+		sd_lat_print(file_pri,&l);
+		if(type==4)
+			sd_streamcache_printstat(file_pri);
+		if(type==3)
+		{
+			maxlat=l.max;
+			p99lat=sd_lat_percentile(&l,990);
+		}
+	}
+	
+	// Data rate in bytes per second
+	rate=(unsigned long)samplerate*samplesize;
+	fprintf_P(file_pri,PSTR("Data rate: %lu B/s\n"),rate);
+	for(unsigned char i=0;i<2;i++)
+	{
+		lat=i==0?p99lat:maxlat;
+		// Bytes produced during lat; lat in ms to avoid overflows
+		bytes=rate*((lat+999)/1000)/1000;
+		fprintf_P(file_pri,PSTR("Staging for %S latency (%lu us): %lu sectors\n"),i==0?PSTR("p99"):PSTR("max"),lat,1+(bytes+511)/512);
+	}
+	fprintf_P(file_pri,PSTR("Current staging: %u sectors\n"),SD_STAGING_NUMSECTORS);
+}
+/******************************************************************************
+	function: sd_bench_log
+*******************************************************************************	
+	Runs ufat_log_test and prints the distribution of the latency of the 
+	record writes.
+	
+	Parameters:
+		lognum			-	Log number to write to
+		size			-	Number of bytes to write
+		reportevery		-	Report average speed and status every reportevery bytes
+******************************************************************************/
+SDLATENCY _sd_bench_log_lat;
+void _sd_bench_log_insert(unsigned long us)
+{
+	sd_lat_insert(&_sd_bench_log_lat,us);
+}
+void sd_bench_log(unsigned char lognum,unsigned long size,unsigned long reportevery)
+{
+	sd_lat_clear(&_sd_bench_log_lat);
+	ufat_log_test(lognum,size,reportevery,_sd_bench_log_insert);
+	fprintf_P(file_pri,PSTR("Record write latency:\n"));
+	sd_lat_print(file_pri,&_sd_bench_log_lat);
+}
@@ -41,6 +41,17 @@
 #include "ufat.h"
 
 
+// Number of bins of the latency histograms of sd_bench_latency: bin 0 is below 64us, bin i is [2^(i+5);2^(i+6)) us, the last bin is above ~1s
+#define SD_LAT_NUMBIN 16
+
+typedef struct {
+	unsigned long bin[SD_LAT_NUMBIN];
+	unsigned long n;							// Number of writes
+	unsigned long max;							// Longest write (us)
+	unsigned long tot;							// Total time (us)
+	unsigned long numbusy;						// Number of writes longer than 1ms, i.e. where the card was busy
+	unsigned long totbusy;						// Total time of the writes longer than 1ms (us)
+} SDLATENCY;
 
 void test_sd_benchmarkwriteblock(unsigned long capacity_sectors);
 void test_sd_benchmarkwriteblockmulti(unsigned long capacity_sectors);
@@ -51,6 +62,13 @@ void sd_bench_write(unsigned long startsect,unsigned long size);
 void sd_bench_write2(unsigned long startsect,unsigned long size);
 void sd_bench_stream_write2(unsigned long startsect,unsigned long size,unsigned long preerase);
 void sd_bench_streamcache_write2(unsigned long startsect,unsigned long size,unsigned long preerase);
+void sd_lat_clear(SDLATENCY *l);
+void sd_lat_insert(SDLATENCY *l,unsigned long us);
+unsigned long sd_lat_percentile(SDLATENCY *l,unsigned short permil);
+void sd_lat_print(FILE *f,SDLATENCY *l);
+unsigned char sd_bench_latency_run(unsigned char type,unsigned long startsect,unsigned long numsect,SDLATENCY *l);
+void sd_bench_latency(unsigned long startsect,unsigned long numsect,unsigned short samplerate,unsigned short samplesize);
+void sd_bench_log(unsigned char lognum,unsigned long size,unsigned long reportevery);
 
 #endif
 
@@ -1,10 +1,8 @@
 #include "cpu.h"
 #include <avr/io.h>
 #include <avr/pgmspace.h>
-#include <avr/sleep.h>
-#include <avr/power.h>
-#include <avr/eeprom.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 #include <stdio.h>
 #include <string.h>
 #include "wait.h"
@@ -26,19 +24,21 @@
 	The tradeoff of this optimisation are the following:
 	
 	* Only file write is possible
-	* Only one file can be written to at any time
+	* Up to 1+UFAT_NUMLOG2 files can be written to at the same time; the first file opened is streamed to the card (primary log), the others are written by sectors (secondary logs).
+	  Secondary logs are disabled by default (UFAT_NUMLOG2=0).
 	* Seek/append operations are not implemented
-	* The maximum number of files in the file system is limited to 14
+	* The maximum number of files in the file system is limited to _UFAT_NUMLOGENTRY (14 with a one-sector ROOT, 16 more for each further ROOT sector)
 	* Only legacy 8.3 file names are supported
 	* Folders are not supported
 	* File names are pre-defined and cannot be changed
-	* The maximum size of files is the same for all files and pre-defined during formatting based on the total card capacity (i.e. MaxFileSize=CardCapacity/NumFiles)
+	* The maximum size of files is the same for all files and pre-defined during formatting based on the total card capacity (i.e. MaxFileSize=CardCapacity/NumFiles), up to the FAT32 limit of 4GB.
+	  On large cards more log files must be used to use the entire capacity (e.g. 16 log files of 4GB on a 64GB card).
 	* The filesystem must only be formatted by this library; formatting on a computer will not result in a card that this library can use
 	* Any file write, file rename or file move operation performed on a computer will lead to errors or data loss the next time that this library attempts to write to the card. 
 	  There is no issue if the card is only used on a computer after such an operation. However, if the card were used again with this library a formatting would be required.
 	* The first sector of the ROOT entry contains 16 directory entries. The entry 0 is the volume ID; entries 1 to n are the log files, entry n+1 to 14 are dummy files marked as erased to prevent the 
 	  OS from modifying this; entry 15 is uFAT metadata, stored as a file marked as erased. Upon checking the filesystem a checksum is run on this metadata to ensure no other operating system
-	  has tampered with them.
+	  has tampered with them. With more than 14 log files the following ROOT sectors hold 16 log files each, with dummy files in the unused entries.
 	* During formatting all the clusters that the log files will use when having the maximum size are marked as used (cluster linked, i.e. nonzero value). 
 	  This prevents another OS from using clusters that uFAT needs as the log file grows.
 	  Consequently the disk free space reported by a conventional OS will be constant and tiny (in the MB range), regardless of the size of the uFAT files.
@@ -48,11 +48,21 @@
 	
 	* There is only one FAT; uFAT does not create the secondary FAT commonly created by traditional OSes
 	* The size of the sectors is 512 bytes
-	* The size of the clusters is 64 sectors (64*512=32KB)
-	* The ROOT directory for the uFAT files is stored in exactly one sector; this limits the number of ROOT entries to a maximum of 16, and therefore the number of files to 14 (volumeID+14 log files+metadata stored as a fake file).
+	* The size of the clusters is selected when formatting, by default 64 sectors (64*512=32KB); 128 sectors (64KB) halves the size of the FAT on large cards
+	* The ROOT directory for the uFAT files is stored in up to _UFAT_ROOTSECTORS sectors, within the first cluster. The first sector has 16 ROOT entries: volumeID+14 log files+metadata stored as a fake file.
+	  Each further sector has 16 log files. Only the ROOT sector holding a log is written when the size of the log is updated.
 	* The first cluster of each files is allocated on a cluster that is the first cluster of a sector of the FAT (i.e. start location is a multiple of 128 clusters). This simplifies the FAT update.
 	* Upon formatting, files are pre-allocated on consecutive clusters which avoid fragmentation. The FAT is programmed accordingly. As data is written to the file, only the file length needs to be updated. This avoids slow FAT updates.
-	* The file size is updated only upon closing a file. This speeds-up streaming writes at the expense of lower reliability if the platform crashes before a file is closed.
+	* The file size is updated upon closing a file and, optionally, at periodic checkpoints while the file is written (see ufat_log_setcheckpoint). Without checkpoints the
+	  file has zero length if the platform crashes before the file is closed. With checkpoints the file size after a crash is that of the last checkpoint.
+	* The end of the area of each log is reserved for a time index (logindexsectors sectors, not part of the file). The index has one 32-bit 
+	  little endian entry per UFAT_INDEX_NUMSECT sectors of log data: entry k holds timer_ms_get when the first data of the sector 
+	  k*UFAT_INDEX_NUMSECT was written to the primary log. Unused entries are 0x00000000 or 0xFFFFFFFF (erased). The index sector of entry k is at 
+	  startsector+logsizebytes/512+k/128. The index of a log is written with one extra sector write every UFAT_INDEX_NUMSECT sectors 
+	  and allows to find the data of a given time with a binary search (ufat_log_findtime). Secondary logs are not indexed.
+	* Secondary logs have a staging ring of UFAT_LOG2_BUFSIZE bytes. Each time a sector of a secondary log is complete, the multiblock write of the primary log is
+	  suspended at its next sector boundary and the sector is written with a single block write. The multiblock write is therefore only interrupted on full
+	  sectors. Secondary logs are meant for lower data rates than the primary log: if the staging ring of a secondary log is full, writes to it fail.
 
 	It is recommended to ensure another operating system never writes to a uFAT formatted sd-card. 
 	Windows generally creates a "System Volume Information" and associated files when an SD-card is plugged in, without user intervention. 
@@ -69,11 +79,19 @@
 	* ufat_init:						Initialise the uFAT filesystem including low-level card initialisation and filesystem check.
 	* ufat_available:					Indicates whether the system successfully detected a disk with uFAT.
 	* ufat_log_open:					Opens the indicated log file for write operations using fprintf, fputc, fputbuf, etc
-	* ufat_log_close:					Close the previously opened log file
+	* ufat_log_close:					Close all the open log files
+	* ufat_log_closefile:				Close one log file
+	* ufat_log_reserve:					Reserves space in the log to serialise a record in place (zero-copy)
+	* ufat_log_commit:					Commits a record serialised in place
 	* ufat_log_test:					Test writing data to a log file
+	* ufat_log_test_multi:				Test writing data to several log files at the same time
 	* ufat_log_getmaxsize: 				Returns the maximum size of files in the given filesystem.
 	* ufat_log_getsize: 				Returns the size of the currently open file.
 	* ufat_log_getnumlogs:				Returns the number of logs available
+	* ufat_log_setcheckpoint:			Sets the interval at which the size of the open log is updated in the ROOT
+	* ufat_log_recover:					Finds the size of a log from the content of its sectors and updates the ROOT
+	* ufat_log_readout:					Sends the sectors of a log as binary frames
+	* ufat_log_findtime:				Finds the sector of a log which holds the data of a given time
 	
 
 
@@ -226,17 +244,34 @@ const char _str_ufat[] = "uFAT: ";
 
 unsigned long _log_current_sector,_log_current_size;
 unsigned char _log_current_log;
+unsigned char _log_current_open;							// Indicates whether the primary log is open
 FILE _log_file;
 SERIALPARAM _log_file_param;
 
+#if UFAT_NUMLOG2>0
+LOG2 _log2[UFAT_NUMLOG2];									// Secondary logs
+#endif
+unsigned char _log_suspend_pending;							// Suspension of the multiblock write requested
+
 
-#define _UFAT_NUMLOGENTRY 14								// Maximum number 14; 16 root entries=volid+logs+metadata
 char ufatblock[512];								// Multiuse buffer
 //unsigned char *ufatblock=_log_buffer[0];					// Multiuse buffer -> points to log buffer as no need for both at same time
 LOGENTRY _logentries[_UFAT_NUMLOGENTRY];					// Predefined number of log entries
 FSINFO _fsinfo;												// Summary of key info here
 unsigned long _logoffsetcluster=128;						// Offset of the logging area from the cluster start (in cluster). 128 ensures the first cluster of the first log file is the first cluster of the second FAT sector
 
+unsigned long _log_checkpoint_sectors=0;					// Checkpoint interval in sectors, 0 to disable
+unsigned long _log_checkpoint_ms=UFAT_CHECKPOINT_DEFAULT_S*1000l;	// Checkpoint interval in ms, 0 to disable
+unsigned long _log_checkpoint_sect;							// Sector following the data on the card at the last checkpoint
+unsigned long _log_checkpoint_time;							// Time of the last checkpoint
+unsigned char _log_checkpoint_pending;						// Checkpoint requested but not yet done
+unsigned long _log_checkpoint_num;							// Number of checkpoints of the current log
+unsigned long _log_checkpoint_err;							// Number of failed checkpoints of the current log
+unsigned long _log_index_num;								// Number of entries of the time index of the current log
+unsigned long _log_index_time;								// Time of the entry to write
+unsigned char _log_index_pending;							// Entry _log_index_num-1 must be written
+unsigned long _log_index_err;								// Number of failed writes of the index
+
 //unsigned long testfilesize=60000;
 //unsigned long testfilecluster=3;
 
@@ -267,12 +302,13 @@ PUBLIC FUNCTIONS   PUBLIC FUNCTIONS   PUBLIC FUNCTIONS   PUBLIC FUNCTIONS   PUBL
 	
 	Parameters:
 		numlogfile			-	Number of log files to create (between 1 and _UFAT_NUMLOGENTRY).
+		sectperclust		-	Cluster size in sectors: a power of 2 up to 128, or 0 for UFAT_SECTPERCLUST_DEFAULT
 				
 	Returns:
 		0					-	Success
 		1					-	Error
 ******************************************************************************/
-unsigned char ufat_format(unsigned char numlogfile)
+unsigned char ufat_format(unsigned char numlogfile,unsigned char sectperclust)
 {
 	unsigned char rv;
 	
@@ -281,6 +317,8 @@ unsigned char ufat_format(unsigned char numlogfile)
 		numlogfile=1;
 	if(numlogfile>_UFAT_NUMLOGENTRY)
 		numlogfile=_UFAT_NUMLOGENTRY;
+	if(sectperclust<_UFAT_ROOTSECTORS || sectperclust>128 || (sectperclust&(sectperclust-1)))
+		sectperclust=UFAT_SECTPERCLUST_DEFAULT;
 		
 	// Initialise the SD card; this initialises _fsinfo.card_capacity_sector
 	if(_ufat_init_sd())
@@ -317,7 +355,7 @@ unsigned char ufat_format(unsigned char numlogfile)
 	
 	
 	// Starts low level formatting: this creates the MBR (sector 0) with the partition table and the boot sector of the partition 0 (sector _UFAT_PARTITIONSTART)
-	if(_ufat_format_mbr_boot())
+	if(_ufat_format_mbr_boot(sectperclust))
 		return 1;
 		
 	// The ROOT and FAT should be entirely cleared prior to initialising the ROOT and FAT to the desired state in order to avoid leftover files and leftover used clusters
@@ -325,7 +363,7 @@ unsigned char ufat_format(unsigned char numlogfile)
 	// Erase the root in range [_fsinfo.cluster_begin; _fsinfo.cluster_begin+3*_fsinfo.sectors_per_cluster[ 
 	// The assumption is that the ROOT takes 3 clusters, as _ufat_format_fat_root initialises 3 clusters for the ROOT. This assumption has not been fully analysed.
 	fprintf_P(file_pri,PSTR("%sClearing ROOT and FAT\n"),_str_ufat);
-	for(unsigned char i=0;i<3*_fsinfo.sectors_per_cluster;i++)
+	for(unsigned short i=0;i<3*_fsinfo.sectors_per_cluster;i++)
 	{
 		rv = sd_block_write(_fsinfo.cluster_begin+i,ufatblock);
 		if(rv)
@@ -374,10 +412,16 @@ unsigned char ufat_format(unsigned char numlogfile)
 		printf_P("%sClusters for log files: %lu (total clusters: %lu, offset: %lu)\n",_str_ufat,availclust,_fsinfo.numclusters,_logoffsetcluster);
 	#endif
 	_fsinfo.logsizecluster = availclust/numlogfile;
+	// FAT32 files are limited to 4GB-1
+	if(_fsinfo.logsizecluster>0xffffffffUL/(_fsinfo.sectors_per_cluster*512UL))
+	{
+		_fsinfo.logsizecluster=0xffffffffUL/(_fsinfo.sectors_per_cluster*512UL);
+		fprintf_P(file_pri,PSTR("%sLog files limited to 4GB: %lu clusters unused, format with more log files to use them\n"),_str_ufat,availclust-_fsinfo.logsizecluster*numlogfile);
+	}
 	// Round down to multiple of 128 clusters to ensure each file first cluster starts on a new fat sector
 	_fsinfo.logsizecluster>>=7;
 	_fsinfo.logsizecluster<<=7;
-	_fsinfo.logsizebytes = _fsinfo.logsizecluster*_fsinfo.sectors_per_cluster*512;
+	_ufat_log_setsize();
 	#ifdef UFATDBG
 		printf_P("%sLog file size: %lu clusters, %lu bytes\n",_str_ufat,_fsinfo.logsizecluster,_fsinfo.logsizebytes);
 	#endif
@@ -484,7 +528,8 @@ unsigned char ufat_available(void)
 *******************************************************************************	
 	Opens the indicated log file for write operations using fprintf, fputc, fputbuf, etc.
 	
-	Only one log file can be open at any time.
+	The first log opened is the primary log. While the primary log is open, up 
+	to UFAT_NUMLOG2 secondary logs can be opened (see _ufat_log2_open).
 
 	Parameters:
 		n			-	Number of the log file to open; the maximum number available depends on how the card was formatted.
@@ -511,6 +556,16 @@ FILE *ufat_log_open(unsigned char n)
 		#endif
 		return 0;
 	}
+	if(_ufat_log_isopen(n))
+		return 0;
+	
+	// The primary log is open: open as a secondary log
+	if(_log_current_open)
+	#if UFAT_NUMLOG2>0
+		return _ufat_log2_open(n);
+	#else
+		return 0;
+	#endif
 	
 	// Initialise a FILE structure for writing using 
 	fdev_setup_stream(&_log_file,_ufat_log_fputchar,0,_FDEV_SETUP_WRITE);
@@ -526,27 +581,46 @@ FILE *ufat_log_open(unsigned char n)
 	_log_current_size=_logentries[n].size=0;
 	_log_current_sector=_logentries[n].startsector;
 	
+	// The first checkpoint happens after the checkpoint interval
+	_log_checkpoint_sect=_log_current_sector;
+	_log_checkpoint_time=timer_ms_get();
+	_log_checkpoint_pending=0;
+	_log_checkpoint_num=0;
+	_log_checkpoint_err=0;
+	
+	// Erase the index; the first entry is written with the first write
+	_log_index_num=0;
+	_log_index_pending=0;
+	_log_index_err=0;
+	if(sd_erase(_log_current_sector+(_fsinfo.logsizebytes>>9),_log_current_sector+(_fsinfo.logsizebytes>>9)+_fsinfo.logindexsectors-1))
+		return 0;
+	
+	
+	// Clear the size in the ROOT, so that after a power loss ufat_log_recover does not start from the size of the previous content of the log
+	if(_ufat_write_rootsector(_ufat_root_sector(n)))
+		return 0;
 	
-	// Erase file area; this seems more effective than the pre-erase command and helps reduce latency of writes
-	fprintf_P(file_pri,PSTR("%sErase sectors %lu-%lu\n"),_str_ufat,_log_current_sector,_log_current_sector+(_fsinfo.logsizebytes>>9)-1);
-	if(sd_erase(_log_current_sector,_log_current_sector+(_fsinfo.logsizebytes>>9)-1))
+	fprintf_P(file_pri,PSTR("%sStreaming write at sector %lu\n"),_str_ufat,_log_current_sector);
+	// Open stream specifying a pre-erase size
+	sd_stream_open(_log_current_sector,_fsinfo.logsizebytes>>9);
+	// Erase file area; this seems more effective than the pre-erase command and helps reduce latency of writes.
+	// Only the beginning is erased now; the rest is erased while writing.
+	if(sd_streamcache_eraseahead(_log_current_sector+(_fsinfo.logsizebytes>>9)-1))
 	{
 		#ifdef UFATDBG
 			printf("Error erasing file\n");
 		#endif
 		return 0;
 	}
-	
-	fprintf_P(file_pri,PSTR("%sStreaming write at sector %lu\n"),_str_ufat,_log_current_sector);
-	// Open stream specifying a pre-erase size
-	sd_stream_open(_log_current_sector,_fsinfo.logsizebytes>>9);
+	_log_current_open=1;
+	_log_suspend_pending=0;
 	
 	return &_log_file;
 }
 /******************************************************************************
 	function: ufat_log_close
 *******************************************************************************	
-	Close the previously opened log file
+	Close the primary log and all the secondary logs.
 
 	Returns:
 		0			-	always
@@ -563,6 +637,23 @@ unsigned char ufat_log_close(void)
 	{
 		printf_P(PSTR("%sFailed sd_write_stream_close\n"),_str_ufat);
 	}
+	_log_current_open=0;
+	_log_checkpoint_pending=0;
+	_log_suspend_pending=0;
+	if(_log_index_pending && _ufat_log_index_write())
+		_log_index_err++;
+	
+	// The multiblock write is terminated: write the remaining data of the secondary logs
+	#if UFAT_NUMLOG2>0
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+	{
+		if(!_log2[i].open)
+			continue;
+		if(_ufat_log2_flush(&_log2[i]))
+			printf_P(PSTR("%sError writing log %u\n"),_str_ufat,_log2[i].n);
+		printf_P(PSTR("%sLog %u size: %lu rejected writes: %lu erase errors: %lu\n"),_str_ufat,_log2[i].n,_log2[i].size,_log2[i].err,_log2[i].eraseerr);
+	}
+	#endif
 	
 	// Must write last sector if any
 	log_printstatus();
@@ -579,6 +670,41 @@ unsigned char ufat_log_close(void)
 	//if(_fsinfo.fat2_sector) _ufat_format_fat_log(_log_current_log,_fsinfo.fat2_sector);
 	return 0;
 }
+/******************************************************************************
+	function: ufat_log_closefile
+*******************************************************************************	
+	Close one log file.
+	
+	Closing the primary log closes all the logs (see ufat_log_close).
+	
+	Closing a secondary log while the primary log is open is deferred until
+	the multiblock write of the primary log reaches a sector boundary; the 
+	log cannot be written to anymore but remains open until then.
+
+	Parameters:
+		f			-	Log returned by ufat_log_open
+
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char ufat_log_closefile(FILE *f)
+{
+	if(f==&_log_file)
+		return ufat_log_close();
+	#if UFAT_NUMLOG2>0
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+	{
+		if(_log2[i].open && f==&_log2[i].file)
+		{
+			_log2[i].closing=1;
+			_ufat_log_suspend();
+			return 0;
+		}
+	}
+	#endif
+	return 1;
+}
 /******************************************************************************
 	function: ufat_log_test2
 *******************************************************************************	
@@ -646,7 +772,11 @@ unsigned char ufat_log_close(void)
 	unless there is a write error.
 	
 	The data file can be loaded for analysis of failures (should be zero) and 
-	time interval
+	time interval.
+	
+	The latency of each record write can be recorded with a callback (see 
+	sd_bench_log): its maximum is the longest time the caller is blocked, 
+	which must be shorter than the interval between samples when logging.
 	
 	Parameters:
 		lognum			-	Log number to write to
@@ -655,9 +785,10 @@ unsigned char ufat_log_close(void)
 							A lower value of reportevery (e.g. 4096) would allow to spot hiccups in write
 							speed due to SD card maintenance.
 							A larger value (32768) would report an 
+		latency			-	Called with the duration in us of each record write, or 0
 
 ******************************************************************************/
-void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reportevery)
+void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reportevery,UFAT_LATENCY_CB latency)
 {
 	FILE *log;
 	unsigned int szbuf=192;
@@ -673,6 +804,7 @@ void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reporte
 	unsigned long dtworst=0;
 	unsigned long dtworstspeed=0;
 	unsigned long tlast,tlastspeed;
+	unsigned long tus;
 	
 	memset(buf,'0',szbuf);
 	buf[szbuf-1]=0;
@@ -691,6 +823,7 @@ void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reporte
 		return;
 	}
 	log_printstatus();	
+	sd_streamcache_clearstat();
 	
 	cursize=0;
 	pkt=0;
@@ -736,6 +869,7 @@ void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reporte
 		strptr=format1u32(strptr,ufat_log_getsize());
 		strptr=format1u32(strptr,cursize);
 				
+		tus=timer_us_get();
 		if(fputbuf(log,buf,szbuf-1))
 		{
 			numfail++;
@@ -744,6 +878,8 @@ void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reporte
 		{
 			cursize+=szbuf-1;
 		}
+		if(latency)
+			latency(timer_us_get()-tus);
 		
 		pkt++;
 		
@@ -751,9 +887,80 @@ void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reporte
 	}
 	
 	ufat_log_close();
+	sd_streamcache_printstat(file_pri);
 	
 	
 		
+}
+/******************************************************************************
+	function: ufat_log_test_multi
+*******************************************************************************	
+	Writes test data to several logs at the same time to measure the aggregate 
+	write speed.
+	
+	The logs lognum to lognum+numlog-1 are opened (lognum is the primary log) 
+	and 191-byte records are written to each log in turn until size bytes are 
+	written in total. 
+	
+	Parameters:
+		lognum			-	First log number to write to
+		numlog			-	Number of logs, between 1 and 1+UFAT_NUMLOG2
+		size			-	Total number of bytes to write
+		
+	Returns:
+		Aggregate write speed in KB/s, or 0 in case of error.
+******************************************************************************/
+unsigned long ufat_log_test_multi(unsigned char lognum,unsigned char numlog,unsigned long size)
+{
+	FILE *log[1+UFAT_NUMLOG2];
+	char buf[192];
+	unsigned long cursize,numfail,pkt;
+	unsigned long t1,dt;
+	
+	if(numlog==0 || numlog>1+UFAT_NUMLOG2)
+		return 0;
+	
+	memset(buf,'0',192);
+	buf[190]='\n';
+	
+	for(unsigned char i=0;i<numlog;i++)
+	{
+		log[i] = ufat_log_open(lognum+i);
+		if(!log[i])
+		{
+			printf_P(PSTR("Error opening log %u\n"),lognum+i);
+			if(i)
+				ufat_log_close();
+			return 0;
+		}
+	}
+	sd_streamcache_clearstat();
+	
+	cursize=numfail=pkt=0;
+	t1=timer_ms_get();
+	while(cursize<size)
+	{
+		for(unsigned char i=0;i<numlog;i++)
+		{
+			char *strptr=buf;
+			strptr=format1u32(strptr,timer_ms_get());
+			strptr=format1u32(strptr,pkt);
+			strptr=format1u32(strptr,numfail);
+			if(fputbuf(log[i],buf,191))
+				numfail++;
+			else
+				cursize+=191;
+		}
+		pkt++;
+	}
+	dt=timer_ms_get()-t1;
+	if(dt==0)
+		dt=1;
+	
+	ufat_log_close();
+	printf_P(PSTR("%u logs: %lu bytes in %lu ms: %lu KB/s. Fail: %lu\n"),numlog,cursize,dt,cursize*1000/1024/dt,numfail);
+	sd_streamcache_printstat(file_pri);
+	return cursize*1000/1024/dt;
 }
 
 /******************************************************************************
@@ -825,6 +1032,268 @@ unsigned char ufat_log_getnumlogs(void)
 	}
 	return _fsinfo.lognum;
 }
+/******************************************************************************
+	function: ufat_log_setcheckpoint
+*******************************************************************************	
+	Sets the interval at which the size of the open log is updated in the ROOT
+	(checkpoint), so that the data written so far is readable if the platform 
+	crashes before the log is closed.
+	
+	A checkpoint is taken when either interval has elapsed since the previous one.
+	It suspends the multiblock write at the next sector boundary and rewrites
+	the ROOT sector with the size of the data on the card, rounded down to a 
+	sector. It typically costs a few ms of card time; the staging ring absorbs 
+	part of it. Checkpoints are only taken when data was written since the previous one.
+	
+	The interval applies to logs opened afterwards and to the currently open log.
+
+	Parameters:
+		sectors		-	Checkpoint every sectors sectors written, or 0 to disable
+		seconds		-	Checkpoint every seconds seconds, or 0 to disable
+******************************************************************************/
+void ufat_log_setcheckpoint(unsigned long sectors,unsigned short seconds)
+{
+	_log_checkpoint_sectors=sectors;
+	_log_checkpoint_ms=seconds*1000l;
+}
+/******************************************************************************
+	function: ufat_log_getcheckpoint
+*******************************************************************************	
+	Returns the checkpoint interval set by ufat_log_setcheckpoint.
+
+	Parameters:
+		sectors		-	Pointer to the checkpoint interval in sectors
+		seconds		-	Pointer to the checkpoint interval in seconds
+******************************************************************************/
+void ufat_log_getcheckpoint(unsigned long *sectors,unsigned short *seconds)
+{
+	*sectors=_log_checkpoint_sectors;
+	*seconds=_log_checkpoint_ms/1000;
+}
+/******************************************************************************
+	function: ufat_log_recover
+*******************************************************************************	
+	Finds the size of a log from the content of its sectors and writes it in 
+	the ROOT. Use this to recover a log that was not closed, e.g. after a 
+	power loss.
+	
+	The log is written sequentially from its first sector, and the area of the
+	log is erased at least SD_ERASEAHEAD_MIN sectors ahead of the write address 
+	(see sd_streamcache_eraseahead). The sectors further ahead may contain the 
+	previous content of the log. A sector is considered written unless all its
+	bytes are identical to 0x00 or 0xFF (the two possible erase states of SD 
+	cards).
+	
+	The search starts from the size in the ROOT, which is that of the last 
+	checkpoint (see ufat_log_setcheckpoint). The sectors are read with a 
+	stride of SD_ERASEAHEAD_MIN sectors until an erased sector is found, which 
+	is necessarily in the erased area ahead of the last written sector. The 
+	last written sector is then found with a binary search within the stride.
+	With checkpoints this needs a few tens of sector reads instead of reading 
+	the entire log.
+	
+	The stream only writes complete sectors until the log is closed, and 
+	ufat_log_close pads the last sector with 0x55 and writes the exact size in 
+	the ROOT, whereas checkpoints write sizes multiple of 512. Therefore, if the
+	size in the ROOT ends within the last written sector the log was closed and 
+	this size is kept. Otherwise the log was not closed and the size extends to 
+	the end of the last written sector, which contains only data: trailing 0x55 
+	bytes are not removed as they may be data. If a closed log could not update
+	its ROOT the recovered size includes the padding.
+	
+	The log must not be open.
+
+	Parameters:
+		n			-	Number of the log
+		size		-	Pointer to the recovered size in bytes
+		numread		-	Pointer to the number of sectors read in the search
+
+	Returns:
+		0			-	Success
+		1			-	Error
+******************************************************************************/
+unsigned char ufat_log_recover(unsigned char n,unsigned long *size,unsigned long *numread)
+{
+	unsigned long start,logsect,lo,hi,mid,rootsize;
+	unsigned char w;
+	
+	*numread=0;
+	if(_fsinfo.fs_available==0 || n>=_fsinfo.lognum)
+		return 1;
+	
+	start = _logentries[n].startsector;
+	
+	logsect=_fsinfo.logsizebytes>>9;
+	
+	// Invariant: the sector lo is written or lo=-1; the sector hi is not written or hi is past the end of the log.
+	// The sectors before the checkpoint size are written.
+	rootsize=_logentries[n].size;
+	lo=(rootsize>>9)-1;
+	if(lo>=logsect)
+		lo=0xffffffff;
+	// Find an erased sector with a stride smaller than the erased area ahead of the write address
+	while(1)
+	{
+		hi=lo+SD_ERASEAHEAD_MIN;
+		if(hi>=logsect)
+		{
+			hi=logsect;
+			break;
+		}
+		if(_ufat_log_recover_written(start+hi,&w))
+			return 1;
+		(*numread)++;
+		if(!w)
+			break;
+		lo=hi;
+	}
+	while(hi-lo>1)
+	{
+		mid=lo+(hi-lo)/2;
+		if(_ufat_log_recover_written(start+mid,&w))
+			return 1;
+		(*numread)++;
+		if(w)
+			lo=mid;
+		else
+			hi=mid;
+	}
+	if(lo==0xffffffff)
+	{
+		*size=0;
+	}
+	else
+	{
+		// Keep the exact size written by ufat_log_close if it ends in the last written sector
+		if(rootsize && ((rootsize+511)>>9)==lo+1)
+			*size=rootsize;
+		else
+			*size=(lo+1)<<9;
+	}
+	
+	_logentries[n].size = *size;
+	return _ufat_write_root(_fsinfo.lognum);
+}
+
+/******************************************************************************
+	function: ufat_log_readout
+*******************************************************************************	
+	Sends the sectors of a log as binary frames, e.g. to read out a log over
+	USB or Bluetooth without removing the card.
+	
+	The sectors are read with a multiblock read; a sector is read from the card
+	while the previous one is transmitted from the transmit buffer of the 
+	stream, so that the readout is limited by the link speed.
+	
+	Frame format (little endian):
+		'D' 'R' 'D'
+		sector		-	32 bits, offset of the sector from the start of the log
+		data		-	512 bytes
+		crc			-	16 bits, CRC-16/XMODEM (polynomial 0x1021, initial value 0) of the data followed by the 4 bytes of sector
+	
+	The CRC of the data is the one computed by the card, which is then extended 
+	with the sector offset: the data is checked end-to-end from the card.
+	A readout can be resumed from any sector offset, e.g. after a frame with an
+	invalid CRC.
+	
+	The readout is interrupted if a character is received on the stream or if 
+	the stream does not accept data for one second.
+	The last sector of the log is sent entirely; the size of the log is given by
+	ufat_log_getlogsize.
+	
+	Parameters:
+		f			-	Stream to send the frames to
+		n			-	Number of the log
+		sector		-	Offset of the first sector to send from the start of the log
+		numsector	-	Number of sectors to send, or 0 to send up to the end of the log
+		numsent		-	Pointer to the number of sectors sent
+
+	Returns:
+		0			-	Success
+		1			-	Error
+		2			-	Interrupted
+******************************************************************************/
+unsigned char ufat_log_readout(FILE *f,unsigned char n,unsigned long sector,unsigned long numsector,unsigned long *numsent)
+{
+	unsigned long logsect;
+	unsigned short crc;
+	unsigned char hdr[7];
+	unsigned char chk[2];
+	unsigned char rv=0;
+	
+	*numsent=0;
+	if(_fsinfo.fs_available==0 || n>=_fsinfo.lognum)
+		return 1;
+	
+	// Number of sectors of the log holding data
+	logsect=(_logentries[n].size+511)>>9;
+	if(sector>=logsect)
+		return 0;
+	if(numsector==0 || numsector>logsect-sector)
+		numsector=logsect-sector;
+		
+	if(sd_stream_read_open(_logentries[n].startsector+sector,numsector))
+		return 1;
+	
+	hdr[0]='D';
+	hdr[1]='R';
+	hdr[2]='D';
+	while(*numsent<numsector)
+	{
+		if(sd_stream_read(ufatblock,&crc))
+			return 1;
+		hdr[3]=sector;
+		hdr[4]=sector>>8;
+		hdr[5]=sector>>16;
+		hdr[6]=sector>>24;
+		for(unsigned char i=3;i<7;i++)
+			crc=_crc_xmodem_update(crc,hdr[i]);
+		
+		// Transmit in chunks as space becomes available in the transmit buffer
+		if((rv=_ufat_log_readout_put(f,(char*)hdr,7)))
+			break;
+		for(unsigned short i=0;i<512;i+=128)
+			if((rv=_ufat_log_readout_put(f,ufatblock+i,128)))
+				break;
+		if(rv)
+			break;
+		chk[0]=crc;
+		chk[1]=crc>>8;
+		if((rv=_ufat_log_readout_put(f,(char*)chk,2)))
+			break;
+		
+		sector++;
+		(*numsent)++;
+		
+		// Interrupt if the host sends something
+		if(fgetrxbuflevel(f))
+		{
+			rv=2;
+			break;
+		}
+	}
+	// The multiblock read terminates by itself at the end of the window, otherwise terminate it early
+	if(sd_stream_read_close() && rv==0)
+		rv=1;
+	return rv;
+}
+/******************************************************************************
+	function: ufat_log_getlogsize
+*******************************************************************************	
+	Returns the size of a log as recorded in the ROOT.
+	
+	Parameters:
+		n			-	Number of the log
+
+	Returns:
+		Size of the log, or 0 if the filesystem is not available or the log does not exist.
+******************************************************************************/
+unsigned long ufat_log_getlogsize(unsigned char n)
+{
+	if(_fsinfo.fs_available==0 || n>=_fsinfo.lognum)
+		return 0;
+	return _logentries[n].size;
+}
 
 /************************************************************************************************************************************************************
 *************************************************************************************************************************************************************
@@ -894,6 +1363,7 @@ unsigned char _ufat_init_sd(void)
 	_fsinfo.logstartcluster
 	_fsinfo.logsizecluster
 	_fsinfo.logsizebytes
+	_fsinfo.logindexsectors
 	_fsinfo.lognum
 	
 	Parameters:
@@ -923,7 +1393,7 @@ unsigned char _ufat_init_fs(void)
 	// This formula "_fsinfo.cluster_begin+(_fsinfo.root_cluster-2)*_fsinfo.sectors_per_cluster" could be simplified
 	// as the root directory is in the first cluster anyways; we could simply read the block at "_fsinfo.cluster_begin", 
 	// which is what we do when we write the root
-	sd_block_read(_fsinfo.cluster_begin+(_fsinfo.root_cluster-2)*_fsinfo.sectors_per_cluster,ufatblock);	
+	sd_read(_fsinfo.cluster_begin+(_fsinfo.root_cluster-2)*_fsinfo.sectors_per_cluster,ufatblock,_UFAT_ROOTSECTORS);	
 		
 	// 5. Interpret root
 	/*for(unsigned i=0;i<16;i++)
@@ -948,14 +1418,21 @@ unsigned char _ufat_init_fs(void)
 	_fsinfo.logstartcluster = *(unsigned long*)(fe->name+1);
 	_fsinfo.logsizecluster = *(unsigned long*)(fe->name+5);		
 	_fsinfo.lognum=fe->ext[1];
-	_fsinfo.logsizebytes=_fsinfo.logsizecluster*_fsinfo.sectors_per_cluster*512;	
+	if(_fsinfo.lognum>_UFAT_NUMLOGENTRY)
+	{
+		fprintf_P(file_pri,PSTR("%serror: %u logs, at most %u supported (_UFAT_ROOTSECTORS)\n"),_str_ufat,_fsinfo.lognum,_UFAT_NUMLOGENTRY);
+		return 1;
+	}
+	_ufat_log_setsize();
 	
-	fprintf_P(file_pri,PSTR("%snumlogs: %d startcluster: %lu sizecluster: %lu sizebytes: %lu\n"),_str_ufat,_fsinfo.lognum,_fsinfo.logstartcluster,_fsinfo.logsizecluster,_fsinfo.logsizebytes);
+	fprintf_P(file_pri,PSTR("%snumlogs: %d startcluster: %lu sizecluster: %lu sizebytes: %lu index: %lu sectors\n"),_str_ufat,_fsinfo.lognum,_fsinfo.logstartcluster,_fsinfo.logsizecluster,_fsinfo.logsizebytes,_fsinfo.logindexsectors);
 	
-	// 7. Convert root to _logentries
+	// 7. Convert root to _logentries, reading the following ROOT sectors if needed
 	for(unsigned l=0;l<_fsinfo.lognum;l++)
 	{
-		FILEENTRYRAW *fer = (FILEENTRYRAW*)(ufatblock+32+32*l);
+		if(l>=14 && _ufat_root_offset(l)==0)
+			sd_read(_fsinfo.cluster_begin+(_fsinfo.root_cluster-2)*_fsinfo.sectors_per_cluster+_ufat_root_sector(l),ufatblock,_UFAT_ROOTSECTORS-_ufat_root_sector(l));
+		FILEENTRYRAW *fer = (FILEENTRYRAW*)(ufatblock+_ufat_root_offset(l));
 		ufat_fileentryraw2logentry(fer,&_logentries[l]);
 	}
 	
@@ -1003,13 +1480,13 @@ void _ufat_getpart(char *block,unsigned char pn,PARTITION *p)
 	
 	
 	Parameters:
-		capacity_sector		-	Card capacity in sectors
+		sectperclust		-	Cluster size in sectors
 				
 	Returns:
 		0					-	Success
 		1					-	Error
 ******************************************************************************/
-unsigned char _ufat_format_mbr_boot(void)
+unsigned char _ufat_format_mbr_boot(unsigned char sectperclust)
 {
 	unsigned char rv;
 	
@@ -1020,7 +1497,7 @@ unsigned char _ufat_format_mbr_boot(void)
 	// Access the first partition entry
 	PARTITION *p;
 	p = (PARTITION*)(ufatblock+446);
-	p->type = 0x0b;							// Type FAT32. 
+	p->type = 0x0c;							// Type FAT32 with LBA addressing; the partition of SDHC/SDXC cards is beyond the CHS limit
 	p->lbabegin = _UFAT_PARTITIONSTART;		// Start location
 	p->numsec = _fsinfo.card_capacity_sector;	// Card capacity reported by the SD interface
 	p->numsec-=p->lbabegin;					// Define the partition size as spanning the entire card from lbabegin to the end.
@@ -1046,7 +1523,7 @@ unsigned char _ufat_format_mbr_boot(void)
 	bs->jump[2] = 0x90;
 	strcpy(bs->oem,"BLUESENS");
 	bs->sectorsize=512;
-	bs->sectperclust=64;								// Number of sector per cluster is 64: 64*512=32KB clusters
+	bs->sectperclust=sectperclust;						// Number of sector per cluster, e.g. 64: 64*512=32KB clusters
 	bs->numfat = 1;										// One fat only
 	//bs->totsectors_short=0;							// This must be zero for totsectors_long to be used; zeroed by memset
 	bs->mediadescriptor=248;							// Found by reverse engineering
@@ -1098,6 +1575,23 @@ unsigned char _ufat_format_mbr_boot(void)
 	
 	// Initialise the fsinfo structure from the boot sector
 	_ufat_bs2keyinfo(bs,&_fsinfo);
+	
+	// Write the FSInfo sector referenced by the boot sector, and its copy after the backup boot sector
+	// ------------------------------------------
+	// Only the signatures are set: the free cluster count and the next free cluster are marked as unknown (0xFFFFFFFF)
+	memset(ufatblock,0,512);
+	*(unsigned long*)(ufatblock+0) = 0x41615252;		// Lead signature "RRaA"
+	*(unsigned long*)(ufatblock+484) = 0x61417272;		// Structure signature "rrAa"
+	*(unsigned long*)(ufatblock+488) = 0xFFFFFFFF;		// Free cluster count
+	*(unsigned long*)(ufatblock+492) = 0xFFFFFFFF;		// Next free cluster
+	*(unsigned long*)(ufatblock+508) = 0xAA550000;		// Trail signature
+	fprintf_P(file_pri,PSTR("%sWriting FSInfo... "),_str_ufat);
+	if(sd_block_write(_UFAT_PARTITIONSTART+1,ufatblock) || sd_block_write(_UFAT_PARTITIONSTART+7,ufatblock))
+	{
+		fprintf_P(file_pri,PSTR("error\n"));
+		return 1;
+	}
+	fprintf_P(file_pri,PSTR("\n"));
 		
 	return 0;
 }
@@ -1149,6 +1643,7 @@ unsigned char _ufat_format_mbr_boot(void)
 	This is used internally by ufat_format and ufat_log_close.
 	The variables _logentries and _fsinfo must be initialised before calling this function.
 	
+	All the ROOT sectors needed for numlogfile log files are written.
 	
 	Parameters:
 		numlogfile		-	Number of log files
@@ -1158,18 +1653,111 @@ unsigned char _ufat_format_mbr_boot(void)
 		1					-	Error
 ******************************************************************************/
 unsigned char _ufat_write_root(unsigned char numlogfile)
+{
+	unsigned char rv;
+	unsigned char ns = _ufat_root_numsectors(numlogfile);
+
+	// Write root sectors
+	fprintf_P(file_pri,PSTR("%sWriting root... "),_str_ufat);
+	for(unsigned char i=0;i<ns;i++)
+	{
+		_ufat_build_root(i,numlogfile);
+		rv = sd_block_write(_fsinfo.cluster_begin+i,ufatblock);
+		if(rv!=0)
+		{
+			fprintf_P(file_pri,PSTR("error\n"));
+			return 1;
+		}
+	}
+	// Write the sector afterwards as all zeroes
+	memset(ufatblock,0,512);
+	rv = sd_block_write(_fsinfo.cluster_begin+ns,ufatblock);
+	if(rv!=0)
+	{
+		fprintf_P(file_pri,PSTR("error\n"));
+		return 1;
+	}
+	fprintf_P(file_pri,PSTR("\n"));
+	return 0;	
+}
+/******************************************************************************
+	function: _ufat_write_rootsector
+*******************************************************************************	
+	Writes one ROOT sector, without messages. Used to update the size of logs.
+	
+	Parameters:
+		sector			-	ROOT sector, from 0
+	Returns:
+		0					-	Success
+		1					-	Error
+******************************************************************************/
+unsigned char _ufat_write_rootsector(unsigned char sector)
+{
+	_ufat_build_root(sector,_fsinfo.lognum);
+	return sd_block_write(_fsinfo.cluster_begin+sector,ufatblock);
+}
+/******************************************************************************
+	function: _ufat_root_numsectors
+*******************************************************************************	
+	Returns the number of ROOT sectors holding numlogfile log files.
+******************************************************************************/
+unsigned char _ufat_root_numsectors(unsigned char numlogfile)
+{
+	if(numlogfile<=14)
+		return 1;
+	return 1+(numlogfile-14+15)/16;
+}
+/******************************************************************************
+	function: _ufat_root_sector, _ufat_root_offset
+*******************************************************************************	
+	Return the ROOT sector holding the entry of log n, and the offset in bytes 
+	of the entry within the sector.
+	
+	Logs 0 to 13 are in entries 1 to 14 of sector 0; the following logs are in
+	entries 0 to 15 of the next sectors.
+******************************************************************************/
+unsigned char _ufat_root_sector(unsigned char n)
+{
+	if(n<14)
+		return 0;
+	return 1+(n-14)/16;
+}
+unsigned short _ufat_root_offset(unsigned char n)
+{
+	if(n<14)
+		return 32+n*32;
+	return ((n-14)&15)*32;
+}
+/******************************************************************************
+	function: _ufat_build_root
+*******************************************************************************	
+	Builds a ROOT sector in ufatblock from _logentries and _fsinfo.
+	
+	Parameters:
+		sector				-	ROOT sector to build, from 0
+		numlogfile			-	Number of log files
+******************************************************************************/
+void _ufat_build_root(unsigned char sector,unsigned char numlogfile)
 {
 	FILEENTRYRAW *fe;
+	unsigned first,last;
+	
 	memset(ufatblock,0,512);
-	// ROOT entry 0: Volume ID
-	fe=(FILEENTRYRAW*)ufatblock;
-	strcpy(fe->name,"BLUESENS");
-	strcpy(fe->ext,"LOG");
-	fe->attrib = 0x08;
+	// Logs in this sector
+	if(sector==0)
+	{
+		first=0;
+		last=14;
+	}
+	else
+	{
+		first=14+(sector-1)*16;
+		last=first+16;
+	}
 	// ROOT entry 1 to n: log files
-	for(unsigned i=0;i<numlogfile;i++)
+	for(unsigned i=first;i<numlogfile && i<last;i++)
 	{
-		fe=(FILEENTRYRAW*)(ufatblock+32+i*32);
+		fe=(FILEENTRYRAW*)(ufatblock+_ufat_root_offset(i));
 		strcpy(fe->name,_logentries[i].name);
 		strcpy(fe->ext,_logentries[i].name);
 		fe->attrib = 0x20;	// Read-only and archive
@@ -1183,12 +1771,14 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 		fe->clusterhi = _logentries[i].startcluster>>16;
 		fe->clusterlo = _logentries[i].startcluster&0xffff;
 	}
-	// ROOT entry numlogfiles to_UFAT_NUMLOGENTRY: "dummy" files appearing as erased to reserve space in the ROOT and avoid Windows to create e.g. "System Volume Information" and overwriting our metadata
-	for(unsigned i=numlogfile;i<_UFAT_NUMLOGENTRY;i++)
+	// ROOT entry numlogfiles to the end of the sector: "dummy" files appearing as erased to reserve space in the ROOT and avoid Windows to create e.g. "System Volume Information" and overwriting our metadata
+	for(unsigned i=numlogfile>first?numlogfile:first;i<last;i++)
 	{
-		fe=(FILEENTRYRAW*)(ufatblock+32+i*32);
+		fe=(FILEENTRYRAW*)(ufatblock+_ufat_root_offset(i));
 		memset(fe,0,sizeof(FILEENTRYRAW));
-		sprintf(fe->name,"DUMMY%d",i);
+		char name[16]={0};
+		sprintf(name,"DUMMY%u",i);
+		memcpy(fe->name,name,8);
 		fe->name[0]=0xE5;		// Mark of an erased file
 		//printf("file %s\n",fe->name);
 		strcpy(fe->ext,"DUM");
@@ -1206,6 +1796,14 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 		fe->clusterlo = _fsinfo.logstartcluster;
 		//fe->clusterlo = 0;
 	}
+	if(sector!=0)
+		return;
+	
+	// ROOT entry 0: Volume ID
+	fe=(FILEENTRYRAW*)ufatblock;
+	strcpy(fe->name,"BLUESENS");
+	strcpy(fe->ext,"LOG");
+	fe->attrib = 0x08;
 	
 	// ROOT entry 15 (last root entry): this entry is hacked to store metadata about the logging system
 	fe=(FILEENTRYRAW*)(ufatblock+480);
@@ -1233,26 +1831,6 @@ unsigned char _ufat_write_root(unsigned char numlogfile)
 	fe->size = 0;
 	fe->clusterhi = 0;
 	fe->clusterlo = _logoffsetcluster;
-	
-
-	// Write root sector
-	fprintf_P(file_pri,PSTR("%sWriting root... "),_str_ufat);
-	unsigned char rv = sd_block_write(_fsinfo.cluster_begin,ufatblock);
-	if(rv!=0)
-	{
-		fprintf_P(file_pri,PSTR("error\n"));
-		return 1;
-	}
-	// Write the sector afterwards as all zeroes
-	memset(ufatblock,0,512);
-	rv = sd_block_write(_fsinfo.cluster_begin+1,ufatblock);
-	if(rv!=0)
-	{
-		fprintf_P(file_pri,PSTR("error\n"));
-		return 1;
-	}
-	fprintf_P(file_pri,PSTR("\n"));
-	return 0;	
 }
 
 /*unsigned char ufat_format_alllinkedfat(unsigned long fat_sector,unsigned long firstcluster,unsigned long totclusters)
@@ -1479,7 +2057,7 @@ unsigned char _ufat_mbr_boot_read(void)
 	fprintf_P(file_pri,PSTR("%sReading MBR... "),_str_ufat);
 	
 	// 1. Read MBR and partition table	
-	sd_block_read(0,ufatblock);	
+	sd_read(0,ufatblock,1);	
 	// Sanity check
 	if(ufatblock[510]!=0x55 || ufatblock[511]!=0xAA)
 	{
@@ -1495,7 +2073,7 @@ unsigned char _ufat_mbr_boot_read(void)
 			printf_P(PSTR("Part %d: Boot: %d Type: %02X: LBA begin: %lu Num sector: %lu\n"),i,p[i].boot,p[i].type,p[i].lbabegin,p[i].numsec);
 		#endif
 	}
-	if(p[0].type!=0x0b)
+	if(p[0].type!=0x0b && p[0].type!=0x0c)
 	{
 		fprintf_P(file_pri,PSTR("%sInvalid partition table\n"),_str_ufat);
 		return 1;
@@ -1504,7 +2082,7 @@ unsigned char _ufat_mbr_boot_read(void)
 	
 	// 2. Read first partition
 	fprintf_P(file_pri,PSTR("%sReading bootsect... "),_str_ufat);
-	sd_block_read(p[0].lbabegin,ufatblock);	
+	sd_read(p[0].lbabegin,ufatblock,1);	
 	BOOTSECT_FAT32 *bs;	
 	bs = (BOOTSECT_FAT32*)ufatblock;		// cast to bootsector to simplify checking	
 	// Sanity checks:
@@ -1656,6 +2234,7 @@ unsigned char _ufat_log_fputbuf(char *buffer,unsigned char size)
 		printf("Writing block to sector %lu failed\n",_log_current_sector);
 		return EOF;
 	}
+	_ufat_log_checkpoint();
 
 	return 0;	
 	
@@ -1688,16 +2267,619 @@ int _ufat_log_fputchar(char c,FILE *f)
 		printf("Writing block to sector %lu failed\n",_log_current_sector);
 		return EOF;
 	}
+	_ufat_log_checkpoint();
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log_readout_put
+*******************************************************************************	
+	Internally used by ufat_log_readout to write data to a stream, waiting 
+	until the transmit buffer has space.
+	
+	Parameters:
+		f			-		Stream
+		buffer		-		Data to write
+		size		-		Number of bytes to write, at most 128 
+	Returns:
+		0			-		Success
+		1			-		Timeout
+******************************************************************************/
+unsigned char _ufat_log_readout_put(FILE *f,char *buffer,unsigned char size)
+{
+	unsigned long t1;
+	
+	t1=timer_ms_get();
+	while(fputbuf(f,buffer,size))
+	{
+		if(timer_ms_get()-t1>1000)
+			return 1;
+	}
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log_recover_written
+*******************************************************************************	
+	Internally used by ufat_log_recover to check whether a sector has been 
+	written since it was erased.
+	
+	Parameters:
+		sect		-	Sector to check
+		w			-	Pointer receiving 1 if the sector is written, 0 if it is erased
+	Returns:
+		0			-		Success
+		1			-		Error
+******************************************************************************/
+unsigned char _ufat_log_recover_written(unsigned long sect,unsigned char *w)
+{
+	char c;
+	
+	if(sd_block_read(sect,ufatblock))
+		return 1;
+	c=ufatblock[0];
+	*w=1;
+	if(c!=0x00 && c!=(char)0xff)
+		return 0;
+	for(unsigned short i=1;i<512;i++)
+		if(ufatblock[i]!=c)
+			return 0;
+	*w=0;
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log_checkpoint
+*******************************************************************************	
+	Internally used after each write to the log to request a checkpoint when
+	a checkpoint interval has elapsed (see ufat_log_setcheckpoint).
+	
+	The checkpoint is done by _ufat_log_suspend_cb once the multiblock write
+	is suspended at a sector boundary.
+******************************************************************************/
+void _ufat_log_checkpoint(void)
+{
+	_ufat_log_index();
+	if(_log_checkpoint_pending || _sd_write_stream_address==_log_checkpoint_sect)
+		return;
+	if( (_log_checkpoint_sectors && _sd_write_stream_address-_log_checkpoint_sect>=_log_checkpoint_sectors) ||
+		(_log_checkpoint_ms && timer_ms_get()-_log_checkpoint_time>=_log_checkpoint_ms) )
+	{
+		_log_checkpoint_pending=1;
+		_ufat_log_suspend();
+	}
+}
+/******************************************************************************
+	function: _ufat_log_suspend
+*******************************************************************************	
+	Internally used to request a suspension of the multiblock write of the 
+	primary log, in order to write sectors of secondary logs or to take a 
+	checkpoint in _ufat_log_suspend_cb.
+******************************************************************************/
+void _ufat_log_suspend(void)
+{
+	if(_log_suspend_pending)
+		return;
+	_log_suspend_pending=1;
+	sd_streamcache_suspend(_ufat_log_suspend_cb);
+}
+/******************************************************************************
+	function: _ufat_log_suspend_cb
+*******************************************************************************	
+	Called by the SD streaming layer once the multiblock write of the primary
+	log is suspended.
+	
+	Writes the complete sectors of the secondary logs, and the last sector of 
+	the secondary logs being closed. 
+	Then, if a checkpoint is requested or a secondary log is closed, writes the
+	size of the data on the card in the ROOT.
+	
+	Only the ROOT sectors holding the logs are written, without messages, to 
+	keep the suspension short.
+	
+	Parameters:
+		sect		-	Next sector to be written: the sectors of the primary log before it are on the card
+******************************************************************************/
+void _ufat_log_suspend_cb(unsigned long sect)
+{
+	unsigned long size;
+	unsigned short rootsect;
+	
+	_log_suspend_pending=0;
+	
+	#if UFAT_NUMLOG2>0
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+	{
+		LOG2 *l=&_log2[i];
+		if(!l->open)
+			continue;
+		if(l->closing)
+		{
+			_ufat_log2_flush(l);
+			_log_checkpoint_pending=1;
+		}
+		else
+		{
+			while(l->level>=512)
+				if(_ufat_log2_writesector(l))
+					break;
+			_logentries[l->n].size = (l->sector-_logentries[l->n].startsector)<<9;
+		}
+	}
+	#endif
+	
+	if(_log_index_pending && _ufat_log_index_write())
+		_log_index_err++;
+	
+	if(!_log_checkpoint_pending)
+		return;
+	
+	size = (sect-_logentries[_log_current_log].startsector)<<9;
+	if(size>_log_current_size)
+		size=_log_current_size;
+	_logentries[_log_current_log].size = size;
+	// Write the ROOT sectors holding the primary and secondary logs
+	rootsect = 1<<_ufat_root_sector(_log_current_log);
+	#if UFAT_NUMLOG2>0
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+		if(_log2[i].open)
+			rootsect |= 1<<_ufat_root_sector(_log2[i].n);
+	#endif
+	for(unsigned char i=0;i<_UFAT_ROOTSECTORS;i++)
+	{
+		if((rootsect&(1<<i)) && _ufat_write_rootsector(i))
+		{
+			_log_checkpoint_err++;
+			rootsect=0;
+		}
+	}
+	if(rootsect)
+		_log_checkpoint_num++;
+	_log_checkpoint_sect=sect;
+	_log_checkpoint_time=timer_ms_get();
+	_log_checkpoint_pending=0;
+}
+/******************************************************************************
+	function: _ufat_log_setsize
+*******************************************************************************	
+	Internally used to compute the size of the data area and of the time index
+	of the logs from the number of clusters of the logs.
+******************************************************************************/
+void _ufat_log_setsize(void)
+{
+	unsigned long sect = _fsinfo.logsizecluster*_fsinfo.sectors_per_cluster;
+	
+	// One 4-byte entry per UFAT_INDEX_NUMSECT sectors, 128 entries per sector
+	_fsinfo.logindexsectors = (sect/UFAT_INDEX_NUMSECT+1+127)/128;
+	_fsinfo.logsizebytes = (sect-_fsinfo.logindexsectors)*512;
+}
+/******************************************************************************
+	function: _ufat_log_index
+*******************************************************************************	
+	Internally used after each write to the primary log to add an entry to the
+	time index when the data written reaches a new group of UFAT_INDEX_NUMSECT
+	sectors. The entry is written by _ufat_log_suspend_cb once the multiblock 
+	write is suspended at a sector boundary.
+	
+	The group is that of the data written, not of the write address of the 
+	card, which lags behind by the staging ring: the data of the first sector 
+	of the group is therefore never later than the time of the entry.
+******************************************************************************/
+void _ufat_log_index(void)
+{
+	unsigned long g;
+	
+	if(_log_index_pending || _log_current_size==0)
+		return;
+	g=((_log_current_size-1)>>9)/UFAT_INDEX_NUMSECT;
+	if(g<_log_index_num || g>=_fsinfo.logindexsectors*128)
+		return;
+	// Groups skipped since the last entry get the same time
+	_log_index_num=g+1;
+	_log_index_time=timer_ms_get();
+	_log_index_pending=1;
+	_ufat_log_suspend();
+}
+/******************************************************************************
+	function: _ufat_log_index_write
+*******************************************************************************	
+	Internally used to write the pending entries of the time index. The card 
+	must not be in a multiblock write. Uses ufatblock.
+	
+	Entries of groups skipped since the previous write (e.g. with large writes)
+	are written with the same time.
+	
+	Returns:
+		0			-	Success
+		nonzero		-	Error
+******************************************************************************/
+unsigned char _ufat_log_index_write(void)
+{
+	unsigned long idx = _logentries[_log_current_log].startsector+(_fsinfo.logsizebytes>>9);
+	unsigned long e = _log_index_num-1;
+	unsigned long *entry = (unsigned long*)ufatblock;
+	
+	_log_index_pending=0;
+	if(sd_block_read(idx+e/128,ufatblock))
+		return 1;
+	// Fill the entries of the groups without entry in this sector
+	do
+	{
+		entry[e&127]=_log_index_time;
+		if((e&127)==0)
+			break;
+		e--;
+	}
+	while(entry[e&127]==0 || entry[e&127]==0xffffffff);
+	return sd_block_write(idx+(_log_index_num-1)/128,ufatblock);
+}
+/******************************************************************************
+	function: ufat_log_findtime
+*******************************************************************************	
+	Finds the sector of a log which holds the data written at a given time, 
+	using a binary search in the time index of the log. 
+	
+	The returned sector is the first sector of the last group of 
+	UFAT_INDEX_NUMSECT sectors which was reached at or before time: its data is
+	not later than time, and the data of time is at most UFAT_INDEX_NUMSECT 
+	sectors further.
+	
+	The search reads about log2(number of entries/128)+1 sectors.
+	
+	Parameters:
+		n			-	Number of the log
+		time		-	Time in ms (timer_ms_get)
+		sector		-	Pointer to the sector offset from the start of the log
+		entrytime	-	Pointer to the time of the index entry of the sector
+	Returns:
+		0			-	Success
+		1			-	Error
+		2			-	The log has no index or all the entries are after time
+******************************************************************************/
+unsigned char ufat_log_findtime(unsigned char n,unsigned long time,unsigned long *sector,unsigned long *entrytime)
+{
+	unsigned long idx,lo,hi,mid,cur=0xffffffff,v;
+	unsigned long *entry = (unsigned long*)ufatblock;
+	
+	if(_fsinfo.fs_available==0 || n>=_fsinfo.lognum)
+		return 1;
+	idx=_logentries[n].startsector+(_fsinfo.logsizebytes>>9);
+	
+	// Invariant: entry lo is valid and not after time, or lo=-1; entry hi is invalid, after time, or past the end of the index.
+	lo=0xffffffff;
+	hi=_fsinfo.logindexsectors*128;
+	while(hi-lo>1)
+	{
+		mid=lo+(hi-lo)/2;
+		if(mid/128!=cur)
+		{
+			cur=mid/128;
+			if(sd_block_read(idx+cur,ufatblock))
+				return 1;
+		}
+		v=entry[mid&127];
+		if(v!=0 && v!=0xffffffff && v<=time)
+		{
+			lo=mid;
+			*entrytime=v;
+		}
+		else
+			hi=mid;
+	}
+	if(lo==0xffffffff)
+		return 2;
+	*sector=lo*UFAT_INDEX_NUMSECT;
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log_isopen
+*******************************************************************************	
+	Returns whether a log is open, either as primary or secondary log.
+	
+	Parameters:
+		n			-	Number of the log
+******************************************************************************/
+unsigned char _ufat_log_isopen(unsigned char n)
+{
+	if(_log_current_open && _log_current_log==n)
+		return 1;
+	#if UFAT_NUMLOG2>0
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+		if(_log2[i].open && _log2[i].n==n)
+			return 1;
+	#endif
+	return 0;
+}
+#if UFAT_NUMLOG2>0
+/******************************************************************************
+	function: _ufat_log2_open
+*******************************************************************************	
+	Opens a secondary log while the primary log is open.
+	
+	Like the primary log, the log area is erased ahead of the sectors written 
+	(see _ufat_log2_writesector). The beginning of the log area is erased 
+	immediately if the card is not in a multiblock write, which is the case if
+	the logs are opened before writing to the primary log.
+	
+	Parameters:
+		n			-	Number of the log
+	Returns:
+		0			-	Error
+		nonzero		-	FILE* for write operations
+******************************************************************************/
+FILE *_ufat_log2_open(unsigned char n)
+{
+	LOG2 *l=0;
+	unsigned char i;
+	
+	for(i=0;i<UFAT_NUMLOG2;i++)
+	{
+		if(!_log2[i].open)
+		{
+			l=&_log2[i];
+			break;
+		}
+	}
+	if(!l)
+	{
+		#ifdef UFATDBG
+			printf("no secondary log available\n");
+		#endif
+		return 0;
+	}
+	
+	l->n=n;
+	l->sector=_logentries[n].startsector;
+	l->size=_logentries[n].size=0;
+	l->err=l->eraseerr=0;
+	l->rd=l->level=0;
+	l->closing=0;
+	
+	l->erased=l->sector;
+	if(!_sd_write_stream_open)
+	{
+		if(sd_erase_upto(&l->erased,l->sector+SD_ERASEAHEAD_MARGIN,l->sector+(_fsinfo.logsizebytes>>9)-1))
+			return 0;
+	}
+	
+	fdev_setup_stream(&l->file,_ufat_log2_fputchar,0,_FDEV_SETUP_WRITE);
+	l->param.putbuf = _ufat_log2_getfputbuf<0>(i);
+	l->param.txbuf = 0;
+	l->param.rxbuf = 0;
+	l->param.blocking = 0;
+	fdev_set_udata(&l->file,(void*)&l->param);
+	l->open=1;
+	
+	// Clear the size in the ROOT at the next suspension, as for the primary log
+	_log_checkpoint_pending=1;
+	_ufat_log_suspend();
+	
+	fprintf_P(file_pri,PSTR("%sSecondary log %u at sector %lu\n"),_str_ufat,n,l->sector);
+	return &l->file;
+}
+/******************************************************************************
+	function: _ufat_log2_write
+*******************************************************************************	
+	Internally used to write data to a secondary log. The data is stored in the
+	staging ring of the log; when a sector is complete a suspension of the 
+	primary log is requested to write it.
+	
+	Parameters:
+		l			-		Secondary log
+		buffer		-		Data to write
+		size		-		Number of bytes to write
+	Returns:
+		0			-		Success
+		EOF			-		Error
+******************************************************************************/
+unsigned char _ufat_log2_write(LOG2 *l,char *buffer,unsigned char size)
+{
+	unsigned short wr,n1;
+	
+	if(!l->open || l->closing || l->size+size>_fsinfo.logsizebytes)
+		return EOF;
+	if(size>UFAT_LOG2_BUFSIZE-l->level)
+	{
+		l->err++;
+		return EOF;
+	}
+	wr=l->rd+l->level;
+	if(wr>=UFAT_LOG2_BUFSIZE)
+		wr-=UFAT_LOG2_BUFSIZE;
+	n1=UFAT_LOG2_BUFSIZE-wr;
+	if(n1>size)
+		n1=size;
+	memcpy(l->buffer+wr,buffer,n1);
+	memcpy(l->buffer,buffer+n1,size-n1);
+	l->level+=size;
+	l->size+=size;
+	if(l->level>=512)
+		_ufat_log_suspend();
+	return 0;
+}
+/******************************************************************************
+	function: _ufat_log2_writesector
+*******************************************************************************	
+	Internally used to write the first sector of the staging ring of a secondary
+	log to the card. The card must not be in a multiblock write.
+	
+	The next chunks of the log area are erased once the sector to write is 
+	within SD_ERASEAHEAD_MIN sectors of the end of the erased area. If the erase 
+	fails it is counted and erase-ahead is disabled for this log, which is then
+	written without erase.
+	
+	Parameters:
+		l			-		Secondary log
+	Returns:
+		0			-		Success
+		nonzero		-		Error
+******************************************************************************/
+unsigned char _ufat_log2_writesector(LOG2 *l)
+{
+	unsigned short n1;
+	unsigned char rv;
+	
+	if(l->sector+SD_ERASEAHEAD_MIN>=l->erased)
+	{
+		if(sd_erase_upto(&l->erased,l->sector+SD_ERASEAHEAD_MARGIN,_logentries[l->n].startsector+(_fsinfo.logsizebytes>>9)-1))
+		{
+			l->eraseerr++;
+			l->erased=0xFFFFFFFF;								// Disable erase-ahead for this log
+		}
+	}
+	rv=_sd_block_open(l->sector);
+	if(rv)
+		return rv;
+	n1=UFAT_LOG2_BUFSIZE-l->rd;
+	if(n1>512)
+		n1=512;
+	_sd_writebuffer(l->buffer+l->rd,n1);
+	_sd_writebuffer(l->buffer,512-n1);
+	rv=_sd_block_close();
+	l->rd+=512;
+	if(l->rd>=UFAT_LOG2_BUFSIZE)
+		l->rd-=UFAT_LOG2_BUFSIZE;
+	l->level-=512;
+	l->sector++;
+	return rv;
+}
+/******************************************************************************
+	function: _ufat_log2_flush
+*******************************************************************************	
+	Internally used to write all the data of a secondary log to the card, 
+	padding the last sector with 0x55, and close the log. The card must not be 
+	in a multiblock write.
+	
+	Parameters:
+		l			-		Secondary log
+	Returns:
+		0			-		Success
+		nonzero		-		Error
+******************************************************************************/
+unsigned char _ufat_log2_flush(LOG2 *l)
+{
+	unsigned char rv=0;
+	unsigned short topad;
+	
+	if(l->level&511)
+	{
+		// Pad to a full sector; the padding is written directly and not accounted in the size
+		topad=512-(l->level&511);
+		l->level+=topad;
+		while(topad--)
+		{
+			unsigned short wr=l->rd+l->level-1-topad;
+			if(wr>=UFAT_LOG2_BUFSIZE)
+				wr-=UFAT_LOG2_BUFSIZE;
+			l->buffer[wr]=0x55;
+		}
+	}
+	while(l->level && rv==0)
+		rv=_ufat_log2_writesector(l);
+	_logentries[l->n].size = l->size;
+	l->open=0;
+	return rv;
+}
+/******************************************************************************
+	function: _ufat_log2_fputchar
+*******************************************************************************	
+	Internally used to write one byte to secondary logs when fprintf/fputs/fputc are called.
+******************************************************************************/
+int _ufat_log2_fputchar(char c,FILE *f)
+{
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+		if(f==&_log2[i].file)
+			return _ufat_log2_write(&_log2[i],&c,1);
+	return EOF;
+}
+/******************************************************************************
+	function: _ufat_log2_fputbuf
+*******************************************************************************	
+	Internally used to write to the secondary log I when fputbuf is called, 
+	which does not indicate the FILE to the putbuf function.
+******************************************************************************/
+template<unsigned char I> unsigned char _ufat_log2_fputbuf(char *buffer,unsigned char size)
+{
+	return _ufat_log2_write(&_log2[I],buffer,size);
+}
+/******************************************************************************
+	function: _ufat_log2_getfputbuf
+*******************************************************************************	
+	Returns _ufat_log2_fputbuf for the secondary log i, instantiated for 
+	I to UFAT_NUMLOG2-1. Call with I=0.
+******************************************************************************/
+template<unsigned char I> unsigned char (*_ufat_log2_getfputbuf(unsigned char i))(char *,unsigned char)
+{
+	if(i==I)
+		return _ufat_log2_fputbuf<I>;
+	return _ufat_log2_getfputbuf<I+1>(i);
+}
+template<> unsigned char (*_ufat_log2_getfputbuf<UFAT_NUMLOG2>(unsigned char i))(char *,unsigned char)
+{
 	return 0;
 }
+#endif
 
 
 
+/******************************************************************************
+	function: ufat_log_reserve
+*******************************************************************************	
+	Reserves size bytes in the currently open log to serialise a record in place.
+	
+	The returned pointer is located in the sector staging buffer of the SD card 
+	stream: the record is written to the card without intermediate copies.
+	The reservation must be followed by ufat_log_commit with the same size, 
+	without other writes to the log in between.
+	
+	Parameters:
+		size		-		Size of the record, at most SD_RECORD_MAXSIZE
+	Returns:
+		0			-		Error (log full or card error)
+		nonzero		-		Pointer where to serialise the record
+******************************************************************************/
+char *ufat_log_reserve(unsigned short size)
+{
+	// Check if space to write to file
+	if(_log_current_size+size>_fsinfo.logsizebytes)
+	{
+		return 0;
+	}
+	return sd_streamcache_reserve(size);
+}
+/******************************************************************************
+	function: ufat_log_commit
+*******************************************************************************	
+	Commits a record serialised in the area returned by ufat_log_reserve.
+	
+	Parameters:
+		size		-		Size of the record, identical to the reservation
+	Returns:
+		0			-		Success
+		1			-		Error
+******************************************************************************/
+unsigned char ufat_log_commit(unsigned short size)
+{
+	unsigned char rv = sd_streamcache_commit(size);
+	_log_current_size+=size;
+	if(rv!=0)
+	{
+		printf_P(PSTR("Writing block to sector %lu failed\n"),_sd_write_stream_address);
+		return 1;
+	}
+	_ufat_log_checkpoint();
+	return 0;
+}
+
 void log_printstatus(void)
 {
 	printf_P(PSTR("%sCurrent log: %u\n"),_str_ufat,_log_current_log);
 	printf_P(PSTR("\tsize: %lu\n"),_log_current_size);
 	printf_P(PSTR("\tsector: %lu\n"),_log_current_sector);
+	printf_P(PSTR("\tcheckpoints: %lu (errors: %lu) every %lu sectors/%lu ms\n"),_log_checkpoint_num,_log_checkpoint_err,_log_checkpoint_sectors,_log_checkpoint_ms);
+	printf_P(PSTR("\tindex: %lu entries (errors: %lu)\n"),_log_index_num,_log_index_err);
+	#if UFAT_NUMLOG2>0
+	for(unsigned char i=0;i<UFAT_NUMLOG2;i++)
+		if(_log2[i].open)
+			printf_P(PSTR("\tsecondary log %u: size %lu sector %lu staged %u rejected writes %lu erase errors %lu\n"),_log2[i].n,_log2[i].size,_log2[i].sector,_log2[i].level,_log2[i].err,_log2[i].eraseerr);
+	#endif
 }
 
 
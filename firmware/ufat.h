@@ -1,6 +1,9 @@
 #ifndef __UFAT_H
 #define __UFAT_H
 
+#include <stdio.h>
+#include "serial.h"
+
 typedef struct {
 	unsigned char boot;
 	unsigned char chsbegin[3];
@@ -56,7 +59,8 @@ typedef struct {
 	unsigned char lognum;
 	unsigned long logstartcluster;
 	unsigned long logsizecluster;
-	unsigned long logsizebytes;
+	unsigned long logsizebytes;							// Size of the data area of the logs, without the index (see logindexsectors)
+	unsigned long logindexsectors;						// Number of sectors of the time index at the end of the area of each log
 	// Availability
 	unsigned char fs_available;							// Indicates that the card is formatted with the uFAT and therefore files can be written
 	unsigned char card_available;						// Indicates that low-level card initialisation is successful: an sd-card is available
@@ -94,25 +98,76 @@ typedef struct {
 	//unsigned char used;
 } LOGENTRY;
 
+// Number of secondary logs which can be open at the same time as the primary log. Each costs its staging ring and about 60 bytes
+// of RAM: disabled by default, enable with e.g. -DUFAT_NUMLOG2=2.
+#ifndef UFAT_NUMLOG2
+#define UFAT_NUMLOG2 0
+#endif
+// Size of the staging ring of each secondary log; must be a multiple of 512
+#ifndef UFAT_LOG2_BUFSIZE
+#define UFAT_LOG2_BUFSIZE 1024
+#endif
+
+typedef struct
+{
+	unsigned char open;										// Log open
+	unsigned char closing;									// Close requested: the last sector is written at the next suspension
+	unsigned char n;										// Log number
+	unsigned long sector;									// Next sector to write
+	unsigned long size;										// Number of bytes written to the log
+	unsigned long erased;									// First sector of the log area which is not erased
+	unsigned long err;										// Number of writes rejected because the staging ring was full
+	unsigned long eraseerr;									// Number of failed erases; erase-ahead is disabled after a failure
+	unsigned short rd,level;								// Read offset and level of the staging ring
+	char buffer[UFAT_LOG2_BUFSIZE];							// Staging ring
+	FILE file;
+	SERIALPARAM param;
+} LOG2;
+
 // Start location of the partition; there is no fixed rule defining where it should start except after the MBR. 
 #define _UFAT_PARTITIONSTART 8192											
 
+// Number of sectors of the ROOT holding log entries. The first sector holds the volume ID, 14 logs and the uFAT metadata; each further 
+// sector holds 16 logs and costs 16*sizeof(LOGENTRY) bytes of RAM. Cards formatted with fewer logs can be used with a larger value.
+#ifndef _UFAT_ROOTSECTORS
+#define _UFAT_ROOTSECTORS 1
+#endif
+#define _UFAT_NUMLOGENTRY (14+16*(_UFAT_ROOTSECTORS-1))
+
+// Default cluster size in sectors used by ufat_format; FAT32 allows up to 128 sectors (64KB)
+#define UFAT_SECTPERCLUST_DEFAULT 64
+
+// Number of sectors of log data per entry of the time index
+#ifndef UFAT_INDEX_NUMSECT
+#define UFAT_INDEX_NUMSECT 2048
+#endif
+
+// Default interval in seconds at which the size of the open log is updated in the ROOT, 0 to disable
+#ifndef UFAT_CHECKPOINT_DEFAULT_S
+#define UFAT_CHECKPOINT_DEFAULT_S 10
+#endif
+
 extern FSINFO _fsinfo;														// Summary of key info here
 extern char ufatblock[];
 
 unsigned long _ufat_getfilentrycluster(FILEENTRYRAW *fer);
 
 void _ufat_getpart(char *block,unsigned char pn,PARTITION *p);
-unsigned char _ufat_format_mbr_boot(void);
+unsigned char _ufat_format_mbr_boot(unsigned char sectperclust);
 
 //unsigned char ufat_format_alllinkedfat(unsigned long fat_sector,unsigned long firstcluster,unsigned long totclusters);
 unsigned char _ufat_format_fat_log(unsigned char i,unsigned long fat_sector);
 unsigned char _ufat_write_root(unsigned char numlogfile);
+void _ufat_build_root(unsigned char sector,unsigned char numlogfile);
+unsigned char _ufat_write_rootsector(unsigned char sector);
+unsigned char _ufat_root_numsectors(unsigned char numlogfile);
+unsigned char _ufat_root_sector(unsigned char n);
+unsigned short _ufat_root_offset(unsigned char n);
 
 unsigned char _ufat_format_fat_root(unsigned long fat_sector);
 unsigned char _ufat_mbr_boot_read(void);
 
-unsigned char ufat_format(unsigned char numlogfile);
+unsigned char ufat_format(unsigned char numlogfile,unsigned char sectperclust);
 unsigned char ufat_mbr_boot_init(void);
 unsigned char _ufat_init_sd(void);
 unsigned char _ufat_init_fs(void);
@@ -130,11 +185,38 @@ FILE *ufat_log_open(unsigned char n);
 int _ufat_log_fputchar(char c,FILE *f);
 unsigned char _ufat_log_fputbuf(char *buffer,unsigned char size);
 unsigned char ufat_log_close(void);
-void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reportevery);
+unsigned char ufat_log_closefile(FILE *f);
+char *ufat_log_reserve(unsigned short size);
+unsigned char ufat_log_commit(unsigned short size);
+typedef void (*UFAT_LATENCY_CB)(unsigned long us);
+void ufat_log_test(unsigned char lognum,unsigned long size,unsigned long reportevery,UFAT_LATENCY_CB latency);
+unsigned long ufat_log_test_multi(unsigned char lognum,unsigned char numlog,unsigned long size);
 //void ufat_log_test22(unsigned char lognum,unsigned long size,unsigned char ch,unsigned bsize);
 void log_printstatus(void);
 unsigned long ufat_log_getmaxsize(void);
 unsigned long ufat_log_getsize(void);
 unsigned char ufat_log_getnumlogs(void);
+void ufat_log_setcheckpoint(unsigned long sectors,unsigned short seconds);
+void ufat_log_getcheckpoint(unsigned long *sectors,unsigned short *seconds);
+unsigned char ufat_log_recover(unsigned char n,unsigned long *size,unsigned long *numread);
+unsigned char _ufat_log_recover_written(unsigned long sect,unsigned char *w);
+unsigned char ufat_log_readout(FILE *f,unsigned char n,unsigned long sector,unsigned long numsector,unsigned long *numsent);
+unsigned char _ufat_log_readout_put(FILE *f,char *buffer,unsigned char size);
+unsigned long ufat_log_getlogsize(unsigned char n);
+void _ufat_log_checkpoint(void);
+void _ufat_log_suspend(void);
+void _ufat_log_setsize(void);
+void _ufat_log_index(void);
+unsigned char _ufat_log_index_write(void);
+unsigned char ufat_log_findtime(unsigned char n,unsigned long time,unsigned long *sector,unsigned long *entrytime);
+void _ufat_log_suspend_cb(unsigned long sect);
+unsigned char _ufat_log_isopen(unsigned char n);
+FILE *_ufat_log2_open(unsigned char n);
+unsigned char _ufat_log2_write(LOG2 *l,char *buffer,unsigned char size);
+unsigned char _ufat_log2_writesector(LOG2 *l);
+unsigned char _ufat_log2_flush(LOG2 *l);
+int _ufat_log2_fputchar(char c,FILE *f);
+template<unsigned char I> unsigned char _ufat_log2_fputbuf(char *buffer,unsigned char size);
+template<unsigned char I> unsigned char (*_ufat_log2_getfputbuf(unsigned char i))(char *,unsigned char);
 
 #endif
\ No newline at end of file
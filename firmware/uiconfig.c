@@ -39,13 +39,15 @@ unsigned char ConfigLoadStreamBattery(void)
 {
 	return eeprom_read_byte((uint8_t*)CONFIG_ADDR_ENABLE_BATTERY) ? 1:0;
 }
+// Binary format: 0=text, 1=binary, 2=compressed binary (only for motion data; other modes use binary)
 void ConfigSaveStreamBinary(unsigned char binary)
 {
-	eeprom_write_byte((uint8_t*)CONFIG_ADDR_STREAM_BINARY, binary?1:0);
+	eeprom_write_byte((uint8_t*)CONFIG_ADDR_STREAM_BINARY, binary>2?1:binary);
 }
 unsigned char ConfigLoadStreamBinary(void)
 {
-	return eeprom_read_byte((uint8_t*)CONFIG_ADDR_STREAM_BINARY) ? 1:0;
+	unsigned char binary = eeprom_read_byte((uint8_t*)CONFIG_ADDR_STREAM_BINARY);
+	return binary>2?1:binary;
 }
 void ConfigSaveStreamPktCtr(unsigned char pktctr)
 {